@@ -0,0 +1,113 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "AnalysisManager.h"
+
+#include "Trace.h"
+
+AnalysisManager::AnalysisManager() {}
+
+AnalysisManager::~AnalysisManager() {}
+
+void AnalysisManager::set_scope(const Scope& scope) {
+  if (scope != m_scope) {
+    if (cached() != NO_ANALYSES) {
+      TRACE(PM, 2, "Scope changed, dropping cached analyses\n");
+    }
+    invalidate(ALL_ANALYSES);
+    m_scope = scope;
+  }
+}
+
+/*
+ * Only the requests callers make are counted: building the signature map
+ * from a cached hierarchy is one build, not a hit and a build.
+ */
+void AnalysisManager::count(AnalysisSet analysis) {
+  if (cached() & analysis) {
+    ++m_stats.hits;
+  } else {
+    ++m_stats.builds;
+  }
+}
+
+const ClassHierarchy& AnalysisManager::get_class_hierarchy(
+    const Scope& scope) {
+  set_scope(scope);
+  count(ANALYSIS_CLASS_HIERARCHY);
+  return class_hierarchy();
+}
+
+const SignatureMap& AnalysisManager::get_signature_map(const Scope& scope) {
+  set_scope(scope);
+  count(ANALYSIS_SIGNATURE_MAP);
+  return signature_map();
+}
+
+const ClassScopes& AnalysisManager::get_class_scopes(const Scope& scope) {
+  set_scope(scope);
+  count(ANALYSIS_CLASS_SCOPES);
+  if (!m_class_scopes) {
+    m_class_scopes = std::make_unique<ClassScopes>(m_scope);
+  }
+  return *m_class_scopes;
+}
+
+const ClassHierarchy& AnalysisManager::class_hierarchy() {
+  if (m_class_scopes) {
+    return m_class_scopes->get_class_hierarchy();
+  }
+  if (!m_class_hierarchy) {
+    m_class_hierarchy =
+        std::make_unique<ClassHierarchy>(build_type_hierarchy(m_scope));
+  }
+  return *m_class_hierarchy;
+}
+
+const SignatureMap& AnalysisManager::signature_map() {
+  if (m_class_scopes) {
+    return m_class_scopes->get_signature_map();
+  }
+  if (!m_signature_map) {
+    m_signature_map =
+        std::make_unique<SignatureMap>(build_signature_map(class_hierarchy()));
+  }
+  return *m_signature_map;
+}
+
+void AnalysisManager::invalidate(AnalysisSet analyses) {
+  // The signature map is built from the hierarchy, and the class scopes from
+  // both.
+  if (analyses & ANALYSIS_CLASS_HIERARCHY) {
+    m_class_hierarchy.reset();
+    analyses |= ANALYSIS_SIGNATURE_MAP;
+  }
+  if (analyses & ANALYSIS_SIGNATURE_MAP) {
+    m_signature_map.reset();
+    analyses |= ANALYSIS_CLASS_SCOPES;
+  }
+  if (analyses & ANALYSIS_CLASS_SCOPES) {
+    m_class_scopes.reset();
+  }
+}
+
+AnalysisSet AnalysisManager::cached() const {
+  AnalysisSet analyses = NO_ANALYSES;
+  if (m_class_hierarchy) {
+    analyses |= ANALYSIS_CLASS_HIERARCHY;
+  }
+  if (m_signature_map) {
+    analyses |= ANALYSIS_SIGNATURE_MAP;
+  }
+  if (m_class_scopes) {
+    // They come with their own hierarchy and signature map.
+    analyses |= ALL_ANALYSES;
+  }
+  return analyses;
+}
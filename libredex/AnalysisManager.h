@@ -0,0 +1,70 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "ClassHierarchy.h"
+#include "DexClass.h"
+#include "Pass.h"
+#include "VirtualScope.h"
+
+/*
+ * Computes the class hierarchy, signature map and class scopes of a scope
+ * once and hands them out until they are invalidated, instead of every pass
+ * building its own.
+ *
+ * The PassManager owns one; after each pass, it drops whatever the pass does
+ * not list in Pass::preserved_analyses(). A pass that changes the hierarchy or
+ * the virtual methods partway through its run, and needs an analysis again
+ * afterwards, calls invalidate() itself.
+ *
+ * The analyses are built for a given scope; asking for them with a scope
+ * that has different classes rebuilds them. The references returned are
+ * valid until the analysis is invalidated or rebuilt.
+ */
+class AnalysisManager {
+ public:
+  struct Stats {
+    size_t hits{0};
+    size_t builds{0};
+  };
+
+  AnalysisManager();
+  ~AnalysisManager();
+
+  const ClassHierarchy& get_class_hierarchy(const Scope& scope);
+  const SignatureMap& get_signature_map(const Scope& scope);
+  const ClassScopes& get_class_scopes(const Scope& scope);
+
+  /*
+   * Drop the given analyses, and the ones built from them.
+   */
+  void invalidate(AnalysisSet analyses);
+
+  AnalysisSet cached() const;
+
+  // Over all the analyses, counting the requests made by callers.
+  const Stats& stats() const { return m_stats; }
+
+ private:
+  void set_scope(const Scope& scope);
+  void count(AnalysisSet analysis);
+  const ClassHierarchy& class_hierarchy();
+  const SignatureMap& signature_map();
+
+  Scope m_scope;
+  std::unique_ptr<ClassHierarchy> m_class_hierarchy;
+  std::unique_ptr<SignatureMap> m_signature_map;
+  std::unique_ptr<ClassScopes> m_class_scopes;
+  Stats m_stats;
+};
@@ -0,0 +1,231 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "BinaryTrace.h"
+
+#include <cstdio>
+#include <cstring>
+
+namespace binary_trace {
+
+namespace {
+
+template <class T>
+void put(std::vector<char>& out, T v) {
+  out.insert(out.end(), (char*)&v, (char*)&v + sizeof(v));
+}
+
+/*
+ * Bounds-checked reads of the encoded arguments. Running past the end clears
+ * ok() and reads zeros.
+ */
+class ArgReader {
+ public:
+  ArgReader(const char* begin, const char* end) : m_ptr(begin), m_end(end) {}
+
+  template <class T>
+  T read() {
+    T v{};
+    if (static_cast<size_t>(m_end - m_ptr) < sizeof(T)) {
+      m_ok = false;
+      m_ptr = m_end;
+      return v;
+    }
+    memcpy(&v, m_ptr, sizeof(T));
+    m_ptr += sizeof(T);
+    return v;
+  }
+
+  std::string read_string(size_t len) {
+    if (static_cast<size_t>(m_end - m_ptr) < len) {
+      m_ok = false;
+      m_ptr = m_end;
+      return std::string();
+    }
+    std::string s(m_ptr, len);
+    m_ptr += len;
+    return s;
+  }
+
+  bool at_end() const { return m_ptr == m_end; }
+  bool ok() const { return m_ok; }
+
+ private:
+  const char* m_ptr;
+  const char* m_end;
+  bool m_ok{true};
+};
+
+/*
+ * printf a single conversion, with its length modifier replaced by the one
+ * matching how the argument was stored.
+ */
+template <class... Args>
+void print_conversion(std::string& out,
+                      const std::string& spec,
+                      const char* length,
+                      Args... args) {
+  auto fmt = spec;
+  fmt.insert(fmt.size() - 1, length);
+  auto n = snprintf(nullptr, 0, fmt.c_str(), args...);
+  if (n <= 0) {
+    return;
+  }
+  std::vector<char> buf(n + 1);
+  snprintf(buf.data(), buf.size(), fmt.c_str(), args...);
+  out.append(buf.data(), n);
+}
+
+/*
+ * print_conversion() with the width and precision the conversion takes from
+ * its arguments.
+ */
+template <class T>
+void print_with_stars(std::string& out,
+                      const std::string& spec,
+                      const char* length,
+                      unsigned num_stars,
+                      const int (&stars)[2],
+                      T v) {
+  if (num_stars == 2) {
+    print_conversion(out, spec, length, stars[0], stars[1], v);
+  } else if (num_stars == 1) {
+    print_conversion(out, spec, length, stars[0], v);
+  } else {
+    print_conversion(out, spec, length, v);
+  }
+}
+
+} // namespace
+
+void encode_args(std::vector<char>& out, const char* fmt, va_list ap) {
+  Conversion conv;
+  for (size_t pos = 0; next_conversion(fmt, pos, &conv); pos = conv.end) {
+    for (unsigned i = 0; i < conv.stars; ++i) {
+      out.push_back(kInt32);
+      put<uint32_t>(out, va_arg(ap, int));
+    }
+    if (is_integer_conversion(conv.specifier)) {
+      if (conv.wide) {
+        out.push_back(kInt64);
+        put<uint64_t>(out, va_arg(ap, long long));
+      } else {
+        out.push_back(kInt32);
+        put<uint32_t>(out, va_arg(ap, int));
+      }
+    } else if (is_double_conversion(conv.specifier)) {
+      out.push_back(kDouble);
+      if (memchr(fmt + conv.length_begin, 'L', conv.length_size)) {
+        put<double>(out, static_cast<double>(va_arg(ap, long double)));
+      } else {
+        put<double>(out, va_arg(ap, double));
+      }
+    } else if (conv.specifier == 'p') {
+      out.push_back(kPointer);
+      put<uint64_t>(out, reinterpret_cast<uintptr_t>(va_arg(ap, void*)));
+    } else if (conv.specifier == 's') {
+      auto str = va_arg(ap, const char*);
+      if (str == nullptr) {
+        out.push_back(kNullString);
+      } else {
+        auto len = strlen(str);
+        out.push_back(kString);
+        put<uint32_t>(out, len);
+        out.insert(out.end(), str, str + len);
+      }
+    } else if (conv.specifier == 'n') {
+      va_arg(ap, void*);
+    } else {
+      // We can't tell what the argument is; render() prints the rest of the
+      // format as it is.
+      return;
+    }
+  }
+}
+
+bool render(const std::string& fmt,
+            const char* args,
+            size_t args_size,
+            std::string* out) {
+  ArgReader reader(args, args + args_size);
+  auto literal = [&](size_t from, size_t to) {
+    // Outside conversions, "%%" stands for '%'.
+    for (size_t i = from; i < to; ++i) {
+      out->push_back(fmt[i]);
+      if (fmt[i] == '%' && i + 1 < to && fmt[i + 1] == '%') {
+        ++i;
+      }
+    }
+  };
+  size_t pos = 0;
+  Conversion conv;
+  while (next_conversion(fmt.c_str(), pos, &conv)) {
+    literal(pos, conv.begin);
+    // The conversion, without its length modifier.
+    auto spec = fmt.substr(conv.begin, conv.length_begin - conv.begin) +
+                conv.specifier;
+    int stars[2] = {0, 0};
+    for (unsigned i = 0; i < conv.stars && i < 2; ++i) {
+      if (reader.at_end() || reader.read<uint8_t>() != kInt32) {
+        return false;
+      }
+      stars[i] = reader.read<int32_t>();
+    }
+    if (reader.at_end()) {
+      // The tracer could not encode this argument; give up on the rest.
+      if (conv.specifier != 'n') {
+        *out += fmt.substr(conv.begin);
+        return reader.ok();
+      }
+      pos = conv.end;
+      continue;
+    }
+    auto tag = reader.read<uint8_t>();
+    switch (tag) {
+    case kInt32:
+      print_with_stars(
+          *out, spec, "", conv.stars, stars, reader.read<int32_t>());
+      break;
+    case kInt64:
+      print_with_stars(
+          *out, spec, "ll", conv.stars, stars, reader.read<long long>());
+      break;
+    case kDouble:
+      print_with_stars(*out, spec, "", conv.stars, stars, reader.read<double>());
+      break;
+    case kPointer:
+      print_with_stars(*out,
+                       spec,
+                       "",
+                       conv.stars,
+                       stars,
+                       reinterpret_cast<void*>(reader.read<uint64_t>()));
+      break;
+    case kString:
+    case kNullString: {
+      std::string s = "(null)";
+      if (tag == kString) {
+        s = reader.read_string(reader.read<uint32_t>());
+      }
+      print_with_stars(*out, spec, "", conv.stars, stars, s.c_str());
+      break;
+    }
+    default:
+      return false;
+    }
+    if (!reader.ok()) {
+      return false;
+    }
+    pos = conv.end;
+  }
+  literal(pos, fmt.size());
+  return reader.ok();
+}
+
+} // namespace binary_trace
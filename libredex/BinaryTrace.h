@@ -0,0 +1,197 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+ * The file format of the binary TRACE backend (see Trace.cpp), shared with
+ * the decoder in tools/trace-decode.
+ *
+ * Instead of formatting each message, a tracing thread appends a record with
+ * the module, level, a timestamp, the address of the format string and the
+ * raw arguments to a ring buffer of its own. A background thread copies the
+ * rings to the file as they fill up, so tracing threads never wait on each
+ * other. The text is only produced by the decoder.
+ *
+ * Layout (all integers in host byte order):
+ *
+ *   char     magic[8]      "RDXTRACE"
+ *   uint32_t version       kBinaryTraceVersion
+ *   uint32_t num_modules
+ *   { uint32_t length; char name[length]; } modules[num_modules]
+ *   chunks, until the end of the file:
+ *     uint32_t thread      small integer, in order of each thread's first trace
+ *     uint32_t length
+ *     char     records[length]
+ *
+ * A record is
+ *
+ *   uint32_t size          of the whole record
+ *   uint8_t  kind          'F' or 'E'
+ *
+ * followed, for 'F' (the first use of a format string by a thread), by
+ *
+ *   uint64_t id            the address of the format string
+ *   char     text[]        the rest of the record, without the terminator
+ *
+ * and for 'E' (a trace event) by
+ *
+ *   uint8_t  module
+ *   uint8_t  level
+ *   uint8_t  unused
+ *   uint64_t time          nanoseconds since tracing started
+ *   uint64_t id            the format string
+ *   args                   one per conversion, in order, as below
+ *
+ * An argument starts with its ArgTag: kInt32 and kInt64 are followed by the
+ * value in 4 or 8 bytes, kDouble by a double, kPointer by 8 bytes and kString
+ * by a uint32_t length and the characters. kNullString has no payload.
+ */
+
+namespace binary_trace {
+
+constexpr char kMagic[8] = {'R', 'D', 'X', 'T', 'R', 'A', 'C', 'E'};
+constexpr uint32_t kBinaryTraceVersion = 1;
+
+constexpr uint8_t kFormatRecord = 'F';
+constexpr uint8_t kEventRecord = 'E';
+
+constexpr size_t kRecordHeaderSize = 5;
+constexpr size_t kFormatHeaderSize = kRecordHeaderSize + 8;
+constexpr size_t kEventHeaderSize = kRecordHeaderSize + 3 + 8 + 8;
+
+enum ArgTag : uint8_t {
+  kInt32 = 1,
+  kInt64,
+  kDouble,
+  kPointer,
+  kString,
+  kNullString,
+};
+
+/*
+ * One conversion of a printf format string, fmt[begin, end).
+ */
+struct Conversion {
+  size_t begin;
+  size_t end;
+  char specifier;
+  // Whether a length modifier makes an integer conversion take 64 bits.
+  bool wide;
+  // Where the length modifier sits in the conversion, and how long it is.
+  size_t length_begin;
+  size_t length_size;
+  // The number of '*' (an int argument each) for width and precision.
+  unsigned stars;
+};
+
+/*
+ * Find the next conversion that takes an argument in fmt, starting at pos.
+ * "%%" is skipped. Returns false at the end of the string.
+ */
+inline bool next_conversion(const char* fmt, size_t pos, Conversion* conv) {
+  for (;;) {
+    while (fmt[pos] != '\0' && fmt[pos] != '%') {
+      ++pos;
+    }
+    if (fmt[pos] == '\0') {
+      return false;
+    }
+    auto begin = pos++;
+    if (fmt[pos] == '%') {
+      ++pos;
+      continue;
+    }
+    conv->begin = begin;
+    conv->stars = 0;
+    // Flags, width and precision.
+    while (fmt[pos] != '\0') {
+      char c = fmt[pos];
+      if (c == '*') {
+        ++conv->stars;
+      } else if (!(c == '-' || c == '+' || c == ' ' || c == '#' || c == '.' ||
+                   c == '\'' || (c >= '0' && c <= '9'))) {
+        break;
+      }
+      ++pos;
+    }
+    conv->length_begin = pos;
+    conv->wide = false;
+    while (fmt[pos] != '\0') {
+      char c = fmt[pos];
+      if (c == 'l' || c == 'j' || c == 'z' || c == 't' || c == 'q') {
+        conv->wide = true;
+      } else if (!(c == 'h' || c == 'L')) {
+        break;
+      }
+      ++pos;
+    }
+    conv->length_size = pos - conv->length_begin;
+    if (fmt[pos] == '\0') {
+      return false;
+    }
+    conv->specifier = fmt[pos++];
+    conv->end = pos;
+    return true;
+  }
+}
+
+inline bool is_integer_conversion(char specifier) {
+  switch (specifier) {
+  case 'd':
+  case 'i':
+  case 'o':
+  case 'u':
+  case 'x':
+  case 'X':
+  case 'c':
+    return true;
+  default:
+    return false;
+  }
+}
+
+inline bool is_double_conversion(char specifier) {
+  switch (specifier) {
+  case 'e':
+  case 'E':
+  case 'f':
+  case 'F':
+  case 'g':
+  case 'G':
+  case 'a':
+  case 'A':
+    return true;
+  default:
+    return false;
+  }
+}
+
+/*
+ * Append the arguments in ap to out, guided by the conversions in fmt.
+ * Strings are copied, since they are often temporaries like SHOW()'s.
+ */
+void encode_args(std::vector<char>& out, const char* fmt, va_list ap);
+
+/*
+ * Format fmt with the arguments encode_args() stored in [args, args +
+ * args_size), as printf would have. Returns false if they don't match fmt.
+ */
+bool render(const std::string& fmt,
+            const char* args,
+            size_t args_size,
+            std::string* out);
+
+} // namespace binary_trace
@@ -0,0 +1,738 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "DexCache.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <unordered_map>
+#include <vector>
+#include <unistd.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+
+#include "DexDebugInstruction.h"
+#include "IRCode.h"
+#include "Sha1.h"
+#include "Trace.h"
+#include "WorkQueue.h"
+
+namespace {
+
+const char kMagic[8] = {'r', 'd', 'x', 'i', 'r', 'c', 'c', 'h'};
+
+struct CacheHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t num_methods;
+  char sha1[40];
+};
+
+/*
+ * Maps the refs of one dex back to their indices.
+ */
+struct RefIndices {
+  std::unordered_map<const DexString*, uint32_t> strings;
+  std::unordered_map<const DexType*, uint32_t> types;
+  std::unordered_map<const DexFieldRef*, uint32_t> fields;
+  std::unordered_map<const DexMethodRef*, uint32_t> methods;
+
+  RefIndices(const dex_header* dh, DexIdx* idx) {
+    for (uint32_t i = 0; i < dh->string_ids_size; ++i) {
+      strings.emplace(idx->get_stringidx(i), i);
+    }
+    for (uint32_t i = 0; i < dh->type_ids_size; ++i) {
+      types.emplace(idx->get_typeidx(i), i);
+    }
+    for (uint32_t i = 0; i < dh->field_ids_size; ++i) {
+      fields.emplace(idx->get_fieldidx(i), i);
+    }
+    for (uint32_t i = 0; i < dh->method_ids_size; ++i) {
+      methods.emplace(idx->get_methodidx(i), i);
+    }
+  }
+};
+
+class Writer {
+ public:
+  explicit Writer(const RefIndices& refs) : m_refs(refs) {}
+
+  void write_method(const CodeItemRef& ref) {
+    const auto& code = *ref.method->get_code();
+    uleb(ref.dex_insns);
+    // Ballooning leaves the debug item with just the parameter names.
+    auto dbg = const_cast<DexDebugItem*>(code.get_debug_item());
+    if (dbg == nullptr) {
+      uleb(0);
+    } else {
+      if (!dbg->get_entries().empty()) {
+        m_ok = false;
+      }
+      auto& names = dbg->get_param_names();
+      uleb(names.size() + 1);
+      for (auto name : names) {
+        nullable_ref(m_refs.strings, name);
+      }
+    }
+
+    std::unordered_map<const MethodItemEntry*, uint32_t> entry_ids;
+    std::unordered_map<const DexPosition*, uint32_t> position_ids;
+    uint32_t num_entries = 0;
+    for (auto& mie : code) {
+      if (mie.type == MFLOW_POSITION) {
+        position_ids.emplace(mie.pos.get(), num_entries);
+      }
+      entry_ids.emplace(&mie, num_entries++);
+    }
+    auto entry = [&](const MethodItemEntry* mie) {
+      auto it = entry_ids.find(mie);
+      if (it == entry_ids.end()) {
+        m_ok = false;
+        return uint32_t(0);
+      }
+      return it->second;
+    };
+
+    uleb(code.get_registers_size());
+    uleb(num_entries);
+    for (auto& mie : code) {
+      u8(mie.type);
+      switch (mie.type) {
+      case MFLOW_TRY:
+        u8(mie.tentry->type);
+        uleb(entry(mie.tentry->catch_start));
+        break;
+      case MFLOW_CATCH:
+        nullable_ref(m_refs.types, mie.centry->catch_type);
+        uleb(mie.centry->next ? entry(mie.centry->next) + 1 : 0);
+        break;
+      case MFLOW_OPCODE:
+        write_insn(mie.insn);
+        break;
+      case MFLOW_TARGET:
+        u8(mie.target->type);
+        uleb(entry(mie.target->src));
+        uleb(static_cast<uint32_t>(mie.target->index));
+        break;
+      case MFLOW_DEBUG:
+        write_debug(mie.dbgop.get());
+        break;
+      case MFLOW_POSITION: {
+        auto pos = mie.pos.get();
+        uleb(pos->line);
+        nullable_ref(m_refs.strings, pos->file);
+        nullable_ref(m_refs.methods, pos->method);
+        auto parent = position_ids.find(pos->parent);
+        uleb(parent != position_ids.end() ? parent->second + 1 : 0);
+        break;
+      }
+      case MFLOW_FALLTHROUGH:
+        break;
+      case MFLOW_DEX_OPCODE:
+        // Only seen after lowering, never right after ballooning.
+        m_ok = false;
+        break;
+      }
+    }
+  }
+
+  bool ok() const { return m_ok; }
+  std::vector<uint8_t>& bytes() { return m_out; }
+
+ private:
+  void u8(uint8_t v) { m_out.push_back(v); }
+
+  void uleb(uint32_t v) {
+    uint8_t buf[5];
+    auto end = write_uleb128(buf, v);
+    m_out.insert(m_out.end(), buf, end);
+  }
+
+  void u64(uint64_t v) {
+    for (int i = 0; i < 8; ++i) {
+      m_out.push_back(static_cast<uint8_t>(v >> (i * 8)));
+    }
+  }
+
+  template <typename Map, typename Ref>
+  void ref(const Map& map, Ref* r) {
+    auto it = map.find(r);
+    if (it == map.end()) {
+      m_ok = false;
+      uleb(0);
+      return;
+    }
+    uleb(it->second);
+  }
+
+  template <typename Map, typename Ref>
+  void nullable_ref(const Map& map, Ref* r) {
+    if (r == nullptr) {
+      uleb(0);
+      return;
+    }
+    auto it = map.find(r);
+    if (it == map.end()) {
+      m_ok = false;
+      uleb(0);
+      return;
+    }
+    uleb(it->second + 1);
+  }
+
+  void write_insn(const IRInstruction* insn) {
+    uleb(insn->opcode());
+    if (insn->dests_size()) {
+      uleb(insn->dest());
+    }
+    uleb(insn->srcs_size());
+    for (auto reg : insn->srcs()) {
+      uleb(reg);
+    }
+    if (insn->has_literal()) {
+      u64(static_cast<uint64_t>(insn->get_literal()));
+    } else if (insn->has_string()) {
+      ref(m_refs.strings, insn->get_string());
+    } else if (insn->has_type()) {
+      ref(m_refs.types, insn->get_type());
+    } else if (insn->has_field()) {
+      ref(m_refs.fields, insn->get_field());
+    } else if (insn->has_method()) {
+      ref(m_refs.methods, insn->get_method());
+    } else if (insn->has_data()) {
+      auto data = insn->get_data();
+      uleb(data->opcode());
+      uleb(data->data_size());
+      for (size_t i = 0; i < data->data_size(); ++i) {
+        uleb(data->data()[i]);
+      }
+    }
+  }
+
+  void write_debug(const DexDebugInstruction* dbgop) {
+    auto op = dbgop->opcode();
+    u8(op);
+    switch (op) {
+    case DBG_SET_FILE:
+      nullable_ref(m_refs.strings,
+                   static_cast<const DexDebugOpcodeSetFile*>(dbgop)->file());
+      break;
+    case DBG_START_LOCAL:
+    case DBG_START_LOCAL_EXTENDED: {
+      auto start_local = static_cast<const DexDebugOpcodeStartLocal*>(dbgop);
+      uleb(start_local->uvalue());
+      nullable_ref(m_refs.strings, start_local->name());
+      nullable_ref(m_refs.types, start_local->type());
+      if (op == DBG_START_LOCAL_EXTENDED) {
+        nullable_ref(m_refs.strings, start_local->sig());
+      }
+      break;
+    }
+    default:
+      // DBG_ADVANCE_LINE is signed, but the raw bits round-trip.
+      uleb(dbgop->uvalue());
+      break;
+    }
+  }
+
+  const RefIndices& m_refs;
+  std::vector<uint8_t> m_out;
+  bool m_ok{true};
+};
+
+/*
+ * Bounds-checked decoding. Any malformed input clears ok(), and the caller
+ * then discards the whole entry.
+ */
+class Reader {
+ public:
+  Reader(const dex_header* dh,
+         DexIdx* idx,
+         const uint8_t* begin,
+         const uint8_t* end)
+      : m_dh(dh), m_idx(idx), m_ptr(begin), m_end(end) {}
+
+  bool read_method(CachedCode* cached) {
+    cached->dex_insns = uleb();
+    auto num_names_p1 = uleb();
+    if (!m_ok || num_names_p1 > size_t(m_end - m_ptr)) {
+      return false;
+    }
+    std::unique_ptr<DexDebugItem> dbg;
+    if (num_names_p1 != 0) {
+      dbg = std::make_unique<DexDebugItem>();
+      auto& names = dbg->get_param_names();
+      names.reserve(num_names_p1 - 1);
+      for (uint32_t i = 1; i < num_names_p1; ++i) {
+        names.push_back(nullable_string());
+      }
+    }
+    cached->code = read_code();
+    if (cached->code == nullptr) {
+      return false;
+    }
+    cached->code->set_debug_item(std::move(dbg));
+    return true;
+  }
+
+ private:
+  std::unique_ptr<IRCode> read_code() {
+    auto code = std::make_unique<IRCode>();
+    code->set_registers_size(uleb());
+    auto num_entries = uleb();
+    // Every entry takes at least one byte.
+    if (!m_ok || num_entries > size_t(m_end - m_ptr)) {
+      return nullptr;
+    }
+    std::vector<MethodItemEntry*> entries;
+    entries.reserve(num_entries);
+    for (uint32_t i = 0; i < num_entries; ++i) {
+      entries.push_back(new MethodItemEntry());
+      code->push_back(*entries.back());
+    }
+    auto entry = [&](uint32_t id) -> MethodItemEntry* {
+      if (id >= entries.size()) {
+        m_ok = false;
+        return nullptr;
+      }
+      return entries[id];
+    };
+    auto nullable_entry = [&](uint32_t id_p1) -> MethodItemEntry* {
+      return id_p1 == 0 ? nullptr : entry(id_p1 - 1);
+    };
+
+    std::vector<std::pair<DexPosition*, uint32_t>> parents;
+    for (auto mie : entries) {
+      auto type = u8();
+      switch (type) {
+      case MFLOW_TRY: {
+        auto try_type = u8();
+        auto catch_start = entry(uleb());
+        if (!m_ok || catch_start == nullptr || try_type > TRY_END) {
+          return nullptr;
+        }
+        mie->type = MFLOW_TRY;
+        mie->tentry =
+            new TryEntry(static_cast<TryEntryType>(try_type), catch_start);
+        break;
+      }
+      case MFLOW_CATCH: {
+        auto catch_type = nullable_type();
+        auto next = nullable_entry(uleb());
+        if (!m_ok) {
+          return nullptr;
+        }
+        mie->type = MFLOW_CATCH;
+        mie->centry = new CatchEntry(catch_type);
+        mie->centry->next = next;
+        break;
+      }
+      case MFLOW_OPCODE: {
+        auto insn = read_insn();
+        if (insn == nullptr) {
+          return nullptr;
+        }
+        mie->type = MFLOW_OPCODE;
+        mie->insn = insn;
+        break;
+      }
+      case MFLOW_TARGET: {
+        auto target_type = u8();
+        auto src = entry(uleb());
+        auto index = static_cast<int32_t>(uleb());
+        if (!m_ok || target_type > BRANCH_MULTI) {
+          return nullptr;
+        }
+        auto bt = new BranchTarget();
+        bt->type = static_cast<BranchTargetType>(target_type);
+        bt->src = src;
+        bt->index = index;
+        mie->type = MFLOW_TARGET;
+        mie->target = bt;
+        break;
+      }
+      case MFLOW_DEBUG: {
+        auto dbgop = read_debug();
+        if (dbgop == nullptr) {
+          return nullptr;
+        }
+        mie->type = MFLOW_DEBUG;
+        new (&mie->dbgop) std::unique_ptr<DexDebugInstruction>(std::move(dbgop));
+        break;
+      }
+      case MFLOW_POSITION: {
+        auto pos = std::make_unique<DexPosition>(uleb());
+        pos->file = nullable_string();
+        // Every method ref of a loaded dex is a DexMethod, even before the
+        // class defining it is loaded.
+        pos->method = static_cast<DexMethod*>(nullable_method());
+        auto parent = uleb();
+        if (!m_ok) {
+          return nullptr;
+        }
+        pos->parent = nullptr;
+        if (parent != 0) {
+          parents.emplace_back(pos.get(), parent - 1);
+        }
+        mie->type = MFLOW_POSITION;
+        new (&mie->pos) std::unique_ptr<DexPosition>(std::move(pos));
+        break;
+      }
+      case MFLOW_FALLTHROUGH:
+        break;
+      default:
+        return nullptr;
+      }
+      if (!m_ok) {
+        return nullptr;
+      }
+    }
+    for (auto& pair : parents) {
+      auto parent = entry(pair.second);
+      if (parent == nullptr || parent->type != MFLOW_POSITION) {
+        return nullptr;
+      }
+      pair.first->parent = parent->pos.get();
+    }
+    if (!m_ok || m_ptr != m_end) {
+      return nullptr;
+    }
+    return code;
+  }
+
+  uint8_t u8() {
+    if (m_ptr >= m_end) {
+      m_ok = false;
+      return 0;
+    }
+    return *m_ptr++;
+  }
+
+  uint32_t uleb() {
+    uint32_t result = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+      auto byte = u8();
+      result |= uint32_t(byte & 0x7f) << shift;
+      if (!(byte & 0x80)) {
+        return result;
+      }
+    }
+    m_ok = false;
+    return 0;
+  }
+
+  uint64_t u64() {
+    uint64_t result = 0;
+    for (int i = 0; i < 8; ++i) {
+      result |= uint64_t(u8()) << (i * 8);
+    }
+    return result;
+  }
+
+  uint32_t index(uint32_t limit) {
+    auto i = uleb();
+    if (i >= limit) {
+      m_ok = false;
+    }
+    return i;
+  }
+
+  DexString* nullable_string() {
+    auto i = uleb();
+    if (i == 0) return nullptr;
+    if (i > m_dh->string_ids_size) {
+      m_ok = false;
+      return nullptr;
+    }
+    return m_idx->get_stringidx(i - 1);
+  }
+
+  DexType* nullable_type() {
+    auto i = uleb();
+    if (i == 0) return nullptr;
+    if (i > m_dh->type_ids_size) {
+      m_ok = false;
+      return nullptr;
+    }
+    return m_idx->get_typeidx(i - 1);
+  }
+
+  DexMethodRef* nullable_method() {
+    auto i = uleb();
+    if (i == 0) return nullptr;
+    if (i > m_dh->method_ids_size) {
+      m_ok = false;
+      return nullptr;
+    }
+    return m_idx->get_methodidx(i - 1);
+  }
+
+  IRInstruction* read_insn() {
+    auto op = static_cast<DexOpcode>(uleb());
+    if (!m_ok || is_fopcode(op) || opcode::has_range(op)) {
+      return nullptr;
+    }
+    std::unique_ptr<IRInstruction> insn(new IRInstruction(op));
+    if (insn->dests_size()) {
+      insn->set_dest(uleb());
+    }
+    auto num_srcs = uleb();
+    if (!m_ok || num_srcs > 0xffff) {
+      return nullptr;
+    }
+    insn->set_arg_word_count(num_srcs);
+    for (uint32_t i = 0; i < num_srcs; ++i) {
+      insn->set_src(i, uleb());
+    }
+    if (insn->has_literal()) {
+      insn->set_literal(static_cast<int64_t>(u64()));
+    } else if (insn->has_string()) {
+      auto i = index(m_dh->string_ids_size);
+      if (m_ok) insn->set_string(m_idx->get_stringidx(i));
+    } else if (insn->has_type()) {
+      auto i = index(m_dh->type_ids_size);
+      if (m_ok) insn->set_type(m_idx->get_typeidx(i));
+    } else if (insn->has_field()) {
+      auto i = index(m_dh->field_ids_size);
+      if (m_ok) insn->set_field(m_idx->get_fieldidx(i));
+    } else if (insn->has_method()) {
+      auto i = index(m_dh->method_ids_size);
+      if (m_ok) insn->set_method(m_idx->get_methodidx(i));
+    } else if (insn->has_data()) {
+      auto fopcode = uleb();
+      auto count = uleb();
+      if (!m_ok || count > size_t(m_end - m_ptr)) {
+        return nullptr;
+      }
+      std::vector<uint16_t> words;
+      words.reserve(count + 1);
+      words.push_back(fopcode);
+      for (uint32_t i = 0; i < count; ++i) {
+        words.push_back(uleb());
+      }
+      if (m_ok) insn->set_data(new DexOpcodeData(words.data(), count));
+    }
+    return m_ok ? insn.release() : nullptr;
+  }
+
+  std::unique_ptr<DexDebugInstruction> read_debug() {
+    auto op = u8();
+    switch (op) {
+    case DBG_SET_FILE: {
+      auto file = nullable_string();
+      return m_ok ? std::make_unique<DexDebugOpcodeSetFile>(file) : nullptr;
+    }
+    case DBG_START_LOCAL:
+    case DBG_START_LOCAL_EXTENDED: {
+      auto reg = uleb();
+      auto name = nullable_string();
+      auto type = nullable_type();
+      auto sig = op == DBG_START_LOCAL_EXTENDED ? nullable_string() : nullptr;
+      if (!m_ok) return nullptr;
+      return std::make_unique<DexDebugOpcodeStartLocal>(reg, name, type, sig);
+    }
+    case DBG_ADVANCE_LINE: {
+      auto value = static_cast<int32_t>(uleb());
+      if (!m_ok) return nullptr;
+      return std::make_unique<DexDebugInstruction>(op, value);
+    }
+    default: {
+      uint32_t value = uleb();
+      if (!m_ok) return nullptr;
+      return std::make_unique<DexDebugInstruction>(op, value);
+    }
+    }
+  }
+
+  const dex_header* m_dh;
+  DexIdx* m_idx;
+  const uint8_t* m_ptr;
+  const uint8_t* m_end;
+  bool m_ok{true};
+};
+
+} // namespace
+
+std::string DexCache::hash(const uint8_t* data, size_t size) {
+  Sha1Context context;
+  sha1_init(&context);
+  // sha1_update takes an unsigned int length.
+  constexpr size_t kChunk = 1 << 30;
+  for (size_t off = 0; off < size; off += kChunk) {
+    sha1_update(&context,
+                data + off,
+                static_cast<unsigned int>(std::min(kChunk, size - off)));
+  }
+  unsigned char digest[20];
+  sha1_final(digest, &context);
+  char hex[41];
+  for (int i = 0; i < 20; ++i) {
+    snprintf(hex + 2 * i, 3, "%02x", digest[i]);
+  }
+  return std::string(hex, 40);
+}
+
+std::string DexCache::path_for(const std::string& key) const {
+  return m_dir + "/" + key + ".irc";
+}
+
+std::unique_ptr<offset_to_cached_code> DexCache::load(const std::string& key,
+                                                      const dex_header* dh,
+                                                      DexIdx* idx) const {
+  auto path = path_for(key);
+  boost::system::error_code ec;
+  if (!boost::filesystem::is_regular_file(path, ec)) {
+    return nullptr;
+  }
+  boost::iostreams::mapped_file_source file;
+  try {
+    file.open(path);
+  } catch (const std::exception& e) {
+    TRACE(MAIN, 1, "Cannot map IR cache %s: %s\n", path.c_str(), e.what());
+    return nullptr;
+  }
+  auto base = reinterpret_cast<const uint8_t*>(file.data());
+  auto size = file.size();
+
+  if (size < sizeof(CacheHeader)) {
+    return nullptr;
+  }
+  auto header = reinterpret_cast<const CacheHeader*>(base);
+  if (memcmp(header->magic, kMagic, sizeof(kMagic)) != 0 ||
+      header->version != kDexCacheVersion ||
+      key.compare(0, std::string::npos, header->sha1, sizeof(header->sha1)) !=
+          0) {
+    TRACE(MAIN, 1, "Ignoring stale IR cache %s\n", path.c_str());
+    return nullptr;
+  }
+  auto num_methods = header->num_methods;
+  if (size < sizeof(CacheHeader) +
+                 (2 * uint64_t(num_methods) + 1) * sizeof(uint32_t)) {
+    return nullptr;
+  }
+  auto code_offs = reinterpret_cast<const uint32_t*>(base + sizeof(CacheHeader));
+  auto offsets = code_offs + num_methods;
+  auto data = reinterpret_cast<const uint8_t*>(offsets + num_methods + 1);
+  auto data_size = size - (data - base);
+  for (size_t i = 0; i < num_methods; ++i) {
+    if (offsets[i] > offsets[i + 1] || offsets[i + 1] > data_size) {
+      return nullptr;
+    }
+  }
+
+  std::vector<CachedCode> codes(num_methods);
+  std::atomic<bool> ok{true};
+  auto wq = workqueue_foreach<size_t>([&](size_t i) {
+    Reader reader(dh, idx, data + offsets[i], data + offsets[i + 1]);
+    if (!reader.read_method(&codes[i])) {
+      ok = false;
+    }
+  });
+  for (size_t i = 0; i < num_methods; ++i) {
+    wq.add_item(i);
+  }
+  wq.run_all();
+  if (!ok) {
+    TRACE(MAIN, 1, "Ignoring corrupt IR cache %s\n", path.c_str());
+    return nullptr;
+  }
+
+  auto cached = std::make_unique<offset_to_cached_code>();
+  cached->reserve(num_methods);
+  for (size_t i = 0; i < num_methods; ++i) {
+    if (!cached->emplace(code_offs[i], std::move(codes[i])).second) {
+      TRACE(MAIN, 1, "Ignoring corrupt IR cache %s\n", path.c_str());
+      return nullptr;
+    }
+  }
+  return cached;
+}
+
+bool DexCache::store(const std::string& key,
+                     const dex_header* dh,
+                     DexIdx* idx,
+                     const std::vector<CodeItemRef>& methods) const {
+  RefIndices refs(dh, idx);
+  std::vector<std::vector<uint8_t>> blobs(methods.size());
+  std::atomic<bool> ok{true};
+  auto wq = workqueue_foreach<size_t>([&](size_t i) {
+    Writer writer(refs);
+    writer.write_method(methods[i]);
+    if (!writer.ok()) {
+      ok = false;
+    }
+    blobs[i] = std::move(writer.bytes());
+  });
+  for (size_t i = 0; i < methods.size(); ++i) {
+    wq.add_item(i);
+  }
+  wq.run_all();
+  if (!ok) {
+    TRACE(MAIN, 1, "Cannot express IR of dex %s in its own indices\n",
+          key.c_str());
+    return false;
+  }
+
+  CacheHeader header;
+  memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kDexCacheVersion;
+  header.num_methods = methods.size();
+  always_assert(key.size() == sizeof(header.sha1));
+  memcpy(header.sha1, key.data(), sizeof(header.sha1));
+  std::vector<uint32_t> code_offs;
+  code_offs.reserve(methods.size());
+  for (const auto& ref : methods) {
+    code_offs.push_back(ref.code_off);
+  }
+  std::vector<uint32_t> offsets;
+  offsets.reserve(blobs.size() + 1);
+  uint64_t offset = 0;
+  for (const auto& blob : blobs) {
+    offsets.push_back(offset);
+    offset += blob.size();
+  }
+  offsets.push_back(offset);
+  if (offset > std::numeric_limits<uint32_t>::max()) {
+    return false;
+  }
+
+  // Write to a temporary file and rename it into place, so that concurrent
+  // runs never map a partially written entry.
+  boost::system::error_code ec;
+  boost::filesystem::create_directories(m_dir, ec);
+  auto path = path_for(key);
+  auto tmp_path = path + ".tmp" + std::to_string(getpid());
+  {
+    std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(code_offs.data()),
+              code_offs.size() * sizeof(uint32_t));
+    out.write(reinterpret_cast<const char*>(offsets.data()),
+              offsets.size() * sizeof(uint32_t));
+    for (const auto& blob : blobs) {
+      out.write(reinterpret_cast<const char*>(blob.data()), blob.size());
+    }
+    if (!out) {
+      TRACE(MAIN, 1, "Cannot write IR cache %s\n", tmp_path.c_str());
+      boost::filesystem::remove(tmp_path, ec);
+      return false;
+    }
+  }
+  boost::filesystem::rename(tmp_path, path, ec);
+  if (ec) {
+    boost::filesystem::remove(tmp_path, ec);
+    return false;
+  }
+  return true;
+}
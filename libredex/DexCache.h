@@ -0,0 +1,93 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "DexClass.h"
+#include "DexDefs.h"
+#include "DexIdx.h"
+
+/*
+ * An on-disk cache of ballooned IR for input dexes, keyed by the SHA-1 of the
+ * dex file. Builds often feed redex secondary dexes that are byte-identical
+ * to the previous run's; for those, the loader takes each method's IR from the
+ * cache instead of parsing and ballooning its code_item.
+ *
+ * Because an entry is only ever used with a byte-identical dex, it identifies
+ * methods by the offset of their code_item and refers to strings, types,
+ * fields and methods by their index in that dex, resolved through the dex's
+ * own DexIdx.
+ *
+ * Layout of a cache file (all integers little-endian):
+ *
+ *   char     magic[8]       "rdxircch"
+ *   uint32_t version        kDexCacheVersion
+ *   uint32_t num_methods
+ *   char     sha1[40]       hex SHA-1 of the dex
+ *   uint32_t code_offs[num_methods]
+ *   uint32_t offsets[num_methods + 1]
+ *   uint8_t  data[]         one encoded method per offset range
+ *
+ * The offset table lets the methods be decoded in parallel straight out of
+ * the mapped file.
+ */
+
+/*
+ * Entries of any other version are ignored and replaced. Bump it whenever
+ * the encoding, the decoder, or the IR that ballooning a code_item produces
+ * changes.
+ */
+constexpr uint32_t kDexCacheVersion = 1;
+
+/*
+ * A method to store, with the code_item it was ballooned from.
+ */
+struct CodeItemRef {
+  uint32_t code_off;
+  uint32_t dex_insns;
+  DexMethod* method;
+};
+
+class DexCache {
+ public:
+  explicit DexCache(std::string dir) : m_dir(std::move(dir)) {}
+
+  /*
+   * Hex SHA-1 of the given bytes, used as the cache key.
+   */
+  static std::string hash(const uint8_t* data, size_t size);
+
+  /*
+   * Decode the entry for `key`, the dex with the given header and index.
+   * Returns null if there is no entry or it is damaged.
+   */
+  std::unique_ptr<offset_to_cached_code> load(const std::string& key,
+                                              const dex_header* dh,
+                                              DexIdx* idx) const;
+
+  /*
+   * Write an entry for `methods`, which must have just been ballooned from
+   * the dex with the given header and index. Returns false (and writes
+   * nothing) if the IR cannot be expressed in terms of that dex's indices.
+   */
+  bool store(const std::string& key,
+             const dex_header* dh,
+             DexIdx* idx,
+             const std::vector<CodeItemRef>& methods) const;
+
+  std::string path_for(const std::string& key) const;
+
+ private:
+  std::string m_dir;
+};
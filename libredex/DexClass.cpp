@@ -181,28 +181,29 @@ std::unique_ptr<DexDebugItem> DexDebugItem::get_dex_debug(DexIdx* idx,
 namespace {
 
 /*
- * Convert DexDebugEntries into debug opcodes.
+ * Convert DexDebugEntries into debug opcodes, given the lines that
+ * map_positions() assigned to the emitted positions.
  */
 std::vector<std::unique_ptr<DexDebugInstruction>> generate_debug_instructions(
     DexDebugItem* debugitem,
-    DexOutputIdx* dodx,
-    PositionMapper* pos_mapper,
+    const std::vector<uint32_t>& lines,
     uint32_t* line_start) {
   std::vector<std::unique_ptr<DexDebugInstruction>> dbgops;
   uint32_t prev_addr = 0;
   boost::optional<uint32_t> prev_line;
   auto& entries = debugitem->get_entries();
+  auto next_line = lines.begin();
 
   for (auto it = entries.begin(); it != entries.end(); ++it) {
     // find all entries that belong to the same address, and group them by type
     auto addr = it->addr;
-    std::vector<DexPosition*> positions;
+    bool has_position = false;
     std::vector<DexDebugInstruction*> insns;
     for (; it != entries.end() && it->addr == addr; ++it) {
       switch (it->type) {
         case DexDebugEntryType::Position:
           if (it->pos->file != nullptr) {
-            positions.push_back(it->pos.get());
+            has_position = true;
           }
           break;
         case DexDebugEntryType::Instruction:
@@ -214,12 +215,10 @@ std::vector<std::unique_ptr<DexDebugInstruction>> generate_debug_instructions(
     auto addr_delta = addr - prev_addr;
     prev_addr = addr;
 
-    for (auto pos : positions) {
-      pos_mapper->register_position(pos);
-    }
     // only emit the last position entry for a given address
-    if (!positions.empty()) {
-      auto line = pos_mapper->position_to_line(positions.back());
+    if (has_position) {
+      always_assert(next_line != lines.end());
+      auto line = *next_line++;
       int32_t line_delta;
       if (prev_line) {
         line_delta = line - *prev_line;
@@ -261,27 +260,53 @@ std::vector<std::unique_ptr<DexDebugInstruction>> generate_debug_instructions(
 
 }
 
-int DexDebugItem::encode(DexOutputIdx* dodx, PositionMapper* pos_mapper,
-    uint8_t* output) {
-  uint8_t* encdata = output;
+std::vector<uint32_t> DexDebugItem::map_positions(PositionMapper* pos_mapper) {
+  std::vector<uint32_t> lines;
+  for (auto it = m_dbg_entries.begin(); it != m_dbg_entries.end();) {
+    auto addr = it->addr;
+    DexPosition* last = nullptr;
+    for (; it != m_dbg_entries.end() && it->addr == addr; ++it) {
+      if (it->type == DexDebugEntryType::Position &&
+          it->pos->file != nullptr) {
+        pos_mapper->register_position(it->pos.get());
+        last = it->pos.get();
+      }
+    }
+    // only the last position entry for a given address is emitted
+    if (last != nullptr) {
+      lines.push_back(pos_mapper->position_to_line(last));
+    }
+  }
+  return lines;
+}
+
+void DexDebugItem::vencode(DexOutputIdx* dodx,
+                           const std::vector<uint32_t>& lines,
+                           std::vector<uint8_t>& bytes) {
   uint32_t line_start{0};
-  auto dbgops =
-      generate_debug_instructions(this, dodx, pos_mapper, &line_start);
-  encdata = write_uleb128(encdata, line_start);
-  encdata = write_uleb128(encdata, (uint32_t) m_param_names.size());
+  auto dbgops = generate_debug_instructions(this, lines, &line_start);
+  // Room for the longest debug opcode: the opcode itself followed by up to
+  // four uleb128s.
+  uint8_t buf[1 + 4 * 5];
+  auto append = [&](uint8_t* end) {
+    bytes.insert(bytes.end(), buf, end);
+  };
+  append(write_uleb128(buf, line_start));
+  append(write_uleb128(buf, (uint32_t) m_param_names.size()));
   for (auto s : m_param_names) {
     if (s == nullptr) {
-      encdata = write_uleb128p1(encdata, DEX_NO_INDEX);
+      append(write_uleb128p1(buf, DEX_NO_INDEX));
       continue;
     }
     uint32_t idx = dodx->stringidx(s);
-    encdata = write_uleb128p1(encdata, idx);
+    append(write_uleb128p1(buf, idx));
   }
   for (auto& dbgop : dbgops) {
+    uint8_t* encdata = buf;
     dbgop->encode(dodx, encdata);
+    append(encdata);
   }
-  encdata = write_uleb128(encdata, DBG_END_SEQUENCE);
-  return (int) (encdata - output);
+  append(write_uleb128(buf, DBG_END_SEQUENCE));
 }
 
 void DexDebugItem::bind_positions(DexMethod* method, DexString* file) {
@@ -440,6 +465,40 @@ int DexCode::encode(DexOutputIdx* dodx, uint32_t* output) {
   return (int) (hemit - ((uint8_t*)output));
 }
 
+uint32_t DexCode::encoded_size(DexOutputIdx* dodx) const {
+  // Mirrors encode() above, including the fill-array-data and switch
+  // payloads that size() leaves out.
+  uint32_t insns_size = 0;
+  for (auto const& opc : get_instructions()) {
+    insns_size += opc->size();
+  }
+  uint32_t size = sizeof(dex_code_item) + insns_size * sizeof(uint16_t);
+  if (m_tries.size() == 0) return size;
+  if (insns_size & 1) size += sizeof(uint16_t);
+  size += m_tries.size() * sizeof(dex_tries_item);
+  std::unordered_set<DexCatches, boost::hash<DexCatches>> catches_set;
+  for (auto& dextry : m_tries) {
+    catches_set.insert(dextry->m_catches);
+  }
+  size += uleb128_encoding_size(catches_set.size());
+  for (auto const& catches : catches_set) {
+    size_t catchcount = catches.size();
+    bool has_catchall = catches.back().first == nullptr;
+    if (has_catchall) {
+      catchcount = -(catchcount - 1);
+    }
+    size += sleb128_encoding_size((int32_t) catchcount);
+    for (auto const& cit : catches) {
+      auto type = cit.first;
+      if (type != nullptr) {
+        size += uleb128_encoding_size(dodx->typeidx(type));
+      }
+      size += uleb128_encoding_size(cit.second);
+    }
+  }
+  return size;
+}
+
 DexMethod::DexMethod(DexType* type, DexString* name, DexProto* proto)
     : DexMethodRef(type, name, proto) {
   m_virtual = false;
@@ -581,7 +640,8 @@ void DexMethod::make_non_concrete() {
  */
 void DexClass::load_class_data_item(DexIdx* idx,
                                     uint32_t cdi_off,
-                                    DexEncodedValueArray* svalues) {
+                                    DexEncodedValueArray* svalues,
+                                    offset_to_cached_code* cached_code) {
   if (cdi_off == 0) return;
   m_has_class_data = true;
   const uint8_t* encd = idx->get_uleb_data(cdi_off);
@@ -616,12 +676,27 @@ void DexClass::load_class_data_item(DexIdx* idx,
     df->make_concrete(access_flags);
     m_ifields.push_back(df);
   }
+  auto take_cached_code = [&](uint32_t code_off) -> std::unique_ptr<IRCode> {
+    if (cached_code == nullptr || code_off == 0) {
+      return nullptr;
+    }
+    auto it = cached_code->find(code_off);
+    if (it == cached_code->end()) {
+      return nullptr;
+    }
+    return it->second.take();
+  };
   ndex = 0;
   for (uint32_t i = 0; i < dmethod_count; i++) {
     ndex += read_uleb128(&encd);
     auto access_flags = (DexAccessFlags)read_uleb128(&encd);
     uint32_t code_off = read_uleb128(&encd);
     DexMethod* dm = static_cast<DexMethod*>(idx->get_methodidx(ndex));
+    if (auto code = take_cached_code(code_off)) {
+      dm->make_concrete(access_flags, std::move(code), false);
+      m_dmethods.push_back(dm);
+      continue;
+    }
     std::unique_ptr<DexCode> dc = DexCode::get_dex_code(idx, code_off);
     if (dc && dc->get_debug_item()) {
       dc->get_debug_item()->bind_positions(dm, m_source_file);
@@ -635,6 +710,11 @@ void DexClass::load_class_data_item(DexIdx* idx,
     auto access_flags = (DexAccessFlags)read_uleb128(&encd);
     uint32_t code_off = read_uleb128(&encd);
     DexMethod* dm = static_cast<DexMethod*>(idx->get_methodidx(ndex));
+    if (auto code = take_cached_code(code_off)) {
+      dm->make_concrete(access_flags, std::move(code), true);
+      m_vmethods.push_back(dm);
+      continue;
+    }
     auto dc = DexCode::get_dex_code(idx, code_off);
     if (dc && dc->get_debug_item()) {
       dc->get_debug_item()->bind_positions(dm, m_source_file);
@@ -644,6 +724,18 @@ void DexClass::load_class_data_item(DexIdx* idx,
   }
 }
 
+CachedCode::CachedCode(CachedCode&& other)
+    : code(std::move(other.code)),
+      dex_insns(other.dex_insns),
+      taken(other.taken.load()) {}
+
+std::unique_ptr<IRCode> CachedCode::take() {
+  if (taken.exchange(true)) {
+    return nullptr;
+  }
+  return std::move(code);
+}
+
 std::unique_ptr<IRCode> DexMethod::release_code() { return std::move(m_code); }
 
 void DexClass::add_method(DexMethod* m) {
@@ -904,7 +996,8 @@ DexAnnotationDirectory* DexClass::get_annotation_directory() {
 
 DexClass::DexClass(DexIdx* idx,
                    const dex_class_def* cdef,
-                   const std::string& dex_location)
+                   const std::string& dex_location,
+                   offset_to_cached_code* cached_code)
     : m_access_flags((DexAccessFlags)cdef->access_flags),
       m_super_class(idx->get_typeidx(cdef->super_idx)),
       m_self(idx->get_typeidx(cdef->typeidx)),
@@ -917,7 +1010,7 @@ DexClass::DexClass(DexIdx* idx,
   load_class_annotations(idx, cdef->annotations_off);
   auto deva = std::unique_ptr<DexEncodedValueArray>(
       load_static_values(idx, cdef->static_values_off));
-  load_class_data_item(idx, cdef->class_data_offset, deva.get());
+  load_class_data_item(idx, cdef->class_data_offset, deva.get(), cached_code);
   g_redex->publish_class(this);
 }
 
@@ -9,6 +9,7 @@
 
 #pragma once
 
+#include <atomic>
 #include <cstdlib>
 #include <cstring>
 #include <functional>
@@ -573,6 +574,7 @@ class DexDebugItem {
   DexDebugItem(DexIdx* idx, uint32_t offset);
 
  public:
+  DexDebugItem() = default;
   DexDebugItem(const DexDebugItem&);
   static std::unique_ptr<DexDebugItem> get_dex_debug(DexIdx* idx,
                                                      uint32_t offset);
@@ -586,8 +588,18 @@ class DexDebugItem {
   void remove_parameter_names() { m_param_names.clear(); };
   void bind_positions(DexMethod* method, DexString* file);
 
-  /* Returns number of bytes encoded, *output has no alignment requirements */
-  int encode(DexOutputIdx* dodx, PositionMapper* pos_mapper, uint8_t* output);
+  /*
+   * Registers the positions with the PositionMapper, and returns the lines it
+   * maps the emitted ones to, in order. The mapper numbers lines in the order
+   * it sees positions, so this must be called in emit order; vencode() can
+   * then run concurrently for different items.
+   */
+  std::vector<uint32_t> map_positions(PositionMapper* pos_mapper);
+
+  /* Appends the encoding, given the lines from map_positions(), to bytes */
+  void vencode(DexOutputIdx* dodx,
+               const std::vector<uint32_t>& lines,
+               std::vector<uint8_t>& bytes);
 
   void gather_types(std::vector<DexType*>& ltype) const;
   void gather_strings(std::vector<DexString*>& lstring) const;
@@ -682,6 +694,12 @@ class DexCode {
    */
   int encode(DexOutputIdx* dodx, uint32_t* output);
 
+  /*
+   * Returns the number of bytes encode() will write, so that code items can
+   * be laid out before they are encoded.
+   */
+  uint32_t encoded_size(DexOutputIdx* dodx) const;
+
   /*
    * Returns the number of 2-byte code units needed to encode all the
    * instructions.
@@ -922,6 +940,29 @@ class DexMethod : public DexMethodRef {
 
 using dexcode_to_offset = std::unordered_map<DexCode*, uint32_t>;
 
+/*
+ * IR read back from a DexCache entry, to be used in place of the code_item it
+ * was ballooned from. `dex_insns` is the number of instructions of that
+ * code_item, which the input stats still report.
+ */
+struct CachedCode {
+  std::unique_ptr<IRCode> code;
+  uint32_t dex_insns{0};
+  std::atomic<bool> taken{false};
+
+  CachedCode() = default;
+  CachedCode(CachedCode&& other);
+
+  /*
+   * Methods sharing a code_item share its entry, and may be loaded by
+   * different threads. Only the first to ask gets the IR; the others parse
+   * the code_item as if it had not been cached.
+   */
+  std::unique_ptr<IRCode> take();
+};
+
+using offset_to_cached_code = std::unordered_map<uint32_t, CachedCode>;
+
 class DexClass {
  private:
   DexAccessFlags m_access_flags;
@@ -943,15 +984,21 @@ class DexClass {
   void load_class_annotations(DexIdx* idx, uint32_t anno_off);
   void load_class_data_item(DexIdx* idx,
                             uint32_t cdi_off,
-                            DexEncodedValueArray* svalues);
+                            DexEncodedValueArray* svalues,
+                            offset_to_cached_code* cached_code);
 
   friend struct ClassCreator;
 
  public:
   ReferencedState rstate;
+  /*
+   * Methods whose code_item offset has an entry in `cached_code` take that
+   * IR instead of parsing their code_item.
+   */
   DexClass(DexIdx* idx,
            const dex_class_def* cdef,
-           const std::string& dex_location);
+           const std::string& dex_location,
+           offset_to_cached_code* cached_code = nullptr);
 
  public:
   const std::vector<DexMethod*>& get_dmethods() const { return m_dmethods; }
@@ -189,6 +189,14 @@ inline uint8_t* write_sleb128(uint8_t* ptr, int32_t val) {
   }
 }
 
+/*
+ * Number of bytes write_sleb128 takes to encode a particular integer.
+ */
+inline uint8_t sleb128_encoding_size(int32_t v) {
+  uint8_t buf[5];
+  return write_sleb128(buf, v) - buf;
+}
+
 inline uint32_t mutf8_next_code_point(const char*& s) {
   uint8_t v = *s++;
   /* Simple common case first, a utf8 char... */
@@ -12,17 +12,19 @@
 #include "DexLoader.h"
 #include "DexDefs.h"
 #include "DexAccess.h"
+#include "DexCache.h"
 #include "IRCode.h"
 #include "Trace.h"
 #include "Walkers.h"
 #include "WorkQueue.h"
 
 class DexLoader {
-  DexIdx* m_idx;
+  DexIdx* m_idx{nullptr};
   const dex_class_def* m_class_defs;
   DexClasses* m_classes;
   boost::iostreams::mapped_file m_file;
   std::string m_dex_location;
+  std::unique_ptr<offset_to_cached_code> m_cached_code;
 
  public:
   explicit DexLoader(const char* location) : m_dex_location(location) {}
@@ -31,7 +33,20 @@ class DexLoader {
     if (m_file.is_open()) m_file.close();
   }
   DexClasses load_dex(const char* location, dex_stats_t* stats);
+  uint32_t open_dex(const char* location, DexClasses* classes);
   void load_dex_class(int num);
+  const dex_header* get_header() const {
+    return reinterpret_cast<const dex_header*>(m_file.const_data());
+  }
+  DexIdx* get_idx() const { return m_idx; }
+  std::string content_hash() const {
+    return DexCache::hash(reinterpret_cast<const uint8_t*>(m_file.const_data()),
+                          m_file.size());
+  }
+  void set_cached_code(std::unique_ptr<offset_to_cached_code> cached_code) {
+    m_cached_code = std::move(cached_code);
+  }
+  std::vector<CodeItemRef> code_items() const;
   void gather_input_stats(dex_stats_t* stats, const dex_header* dh);
 };
 
@@ -132,6 +147,14 @@ void DexLoader::gather_input_stats(dex_stats_t* stats, const dex_header* dh) {
       }
     }
   }
+  if (m_cached_code) {
+    for (const auto& entry : *m_cached_code) {
+      // Taken by the method in place of parsing its code_item.
+      if (entry.second.taken) {
+        stats->num_instructions += entry.second.dex_insns;
+      }
+    }
+  }
   for (uint32_t meth_idx = 0; meth_idx < dh->method_ids_size; ++meth_idx) {
     auto* meth = m_idx->get_methodidx(meth_idx);
     DexProto* proto = meth->get_proto();
@@ -143,20 +166,72 @@ void DexLoader::gather_input_stats(dex_stats_t* stats, const dex_header* dh) {
 
 void DexLoader::load_dex_class(int num) {
   const dex_class_def* cdef = m_class_defs + num;
-  DexClass* dc = new DexClass(m_idx, cdef, m_dex_location);
+  DexClass* dc =
+      new DexClass(m_idx, cdef, m_dex_location, m_cached_code.get());
   m_classes->at(num) = dc;
 }
 
-DexClasses DexLoader::load_dex(const char* location, dex_stats_t* stats) {
+/*
+ * The methods of this dex with a code_item, before any of them is ballooned.
+ */
+std::vector<CodeItemRef> DexLoader::code_items() const {
+  std::vector<CodeItemRef> items;
+  std::unordered_set<uint32_t> seen;
+  auto dh = get_header();
+  for (uint32_t cidx = 0; cidx < dh->class_defs_size; ++cidx) {
+    auto cdi_off = m_class_defs[cidx].class_data_offset;
+    if (cdi_off == 0) {
+      continue;
+    }
+    const uint8_t* encd = m_idx->get_uleb_data(cdi_off);
+    uint32_t sfield_count = read_uleb128(&encd);
+    uint32_t ifield_count = read_uleb128(&encd);
+    uint32_t dmethod_count = read_uleb128(&encd);
+    uint32_t vmethod_count = read_uleb128(&encd);
+    for (uint32_t i = 0; i < 2 * (sfield_count + ifield_count); ++i) {
+      read_uleb128(&encd);
+    }
+    for (auto count : {dmethod_count, vmethod_count}) {
+      uint32_t ndex = 0;
+      for (uint32_t i = 0; i < count; ++i) {
+        ndex += read_uleb128(&encd);
+        read_uleb128(&encd); // access_flags
+        uint32_t code_off = read_uleb128(&encd);
+        // Shared code_items are ballooned once per method; keep the first.
+        if (code_off == 0 || !seen.insert(code_off).second) {
+          continue;
+        }
+        auto method = static_cast<DexMethod*>(m_idx->get_methodidx(ndex));
+        if (auto code = method->get_dex_code()) {
+          items.push_back(CodeItemRef{
+              code_off,
+              static_cast<uint32_t>(code->get_instructions().size()),
+              method});
+        } else if (m_cached_code && m_cached_code->count(code_off)) {
+          items.push_back(CodeItemRef{
+              code_off, m_cached_code->at(code_off).dex_insns, method});
+        }
+      }
+    }
+  }
+  return items;
+}
+
+/*
+ * Map the dex at `location`, validate its header and size `classes` to hold
+ * one entry per class_def. Returns the number of classes left to load with
+ * load_dex_class().
+ */
+uint32_t DexLoader::open_dex(const char* location, DexClasses* classes) {
   m_file.open(location, boost::iostreams::mapped_file::readonly);
   if (!m_file.is_open()) {
     fprintf(stderr, "error: cannot create memory-mapped file: %s\n", location);
     exit(EXIT_FAILURE);
   }
-  auto dh = reinterpret_cast<const dex_header*>(m_file.const_data());
+  auto dh = get_header();
   validate_dex_header(dh, m_file.size());
   if (dh->class_defs_size == 0) {
-    return DexClasses(0);
+    return 0;
   }
   m_idx = new DexIdx(dh);
   auto off = (uint64_t)dh->class_defs_off;
@@ -165,12 +240,21 @@ DexClasses DexLoader::load_dex(const char* location, dex_stats_t* stats) {
   always_assert_log(limit <= m_file.size(), "invalid class_defs_size");
   m_class_defs =
       reinterpret_cast<const dex_class_def*>(m_file.const_data() + off);
-  DexClasses classes(dh->class_defs_size);
-  m_classes = &classes;
+  classes->resize(dh->class_defs_size);
+  m_classes = classes;
+  return dh->class_defs_size;
+}
 
-  auto lwork = new class_load_work[dh->class_defs_size];
+DexClasses DexLoader::load_dex(const char* location, dex_stats_t* stats) {
+  DexClasses classes;
+  auto num_classes = open_dex(location, &classes);
+  if (num_classes == 0) {
+    return classes;
+  }
+
+  auto lwork = new class_load_work[num_classes];
   auto wq = workqueue_foreach<class_load_work*>(class_work);
-  for (uint32_t i = 0; i < dh->class_defs_size; i++) {
+  for (uint32_t i = 0; i < num_classes; i++) {
     lwork[i].dl = this;
     lwork[i].num = i;
     wq.add_item(&lwork[i]);
@@ -178,23 +262,103 @@ DexClasses DexLoader::load_dex(const char* location, dex_stats_t* stats) {
   wq.run_all();
   delete[] lwork;
 
-  gather_input_stats(stats, dh);
+  gather_input_stats(stats, get_header());
 
   return classes;
 }
 
 static void mt_balloon(DexMethod* method) { method->balloon(); }
 
-static void balloon_all(const Scope& scope) {
-  auto wq = workqueue_foreach<DexMethod*>(mt_balloon);
+template <class WorkQueue>
+static void add_balloon_work(WorkQueue& wq, const Scope& scope) {
   walk_methods(scope, [&](DexMethod* m) {
     if (m->get_dex_code()) {
       wq.add_item(m);
     }
   });
+}
+
+static void balloon_all(const Scope& scope) {
+  auto wq = workqueue_foreach<DexMethod*>(mt_balloon);
+  add_balloon_work(wq, scope);
+  wq.run_all();
+}
+
+static void balloon_all(const std::vector<DexClasses>& dexen) {
+  auto wq = workqueue_foreach<DexMethod*>(mt_balloon);
+  for (const auto& classes : dexen) {
+    add_balloon_work(wq, classes);
+  }
   wq.run_all();
 }
 
+/*
+ * Give every dex that the IR cache has an entry for the IR to use when its
+ * classes are loaded. Returns the cache keys of all dexes.
+ */
+static std::vector<std::string> load_cached_code(
+    const std::vector<std::unique_ptr<DexLoader>>& loaders,
+    const std::vector<DexClasses>& dexen,
+    const std::string& cache_dir) {
+  DexCache cache(cache_dir);
+  std::vector<std::string> keys(dexen.size());
+  auto hash_wq = workqueue_foreach<size_t>(
+      [&](size_t i) { keys[i] = loaders[i]->content_hash(); });
+  for (size_t i = 0; i < dexen.size(); ++i) {
+    if (!dexen[i].empty()) {
+      hash_wq.add_item(i);
+    }
+  }
+  hash_wq.run_all();
+
+  for (size_t i = 0; i < dexen.size(); ++i) {
+    if (dexen[i].empty()) {
+      continue;
+    }
+    auto& dl = loaders[i];
+    auto cached_code = cache.load(keys[i], dl->get_header(), dl->get_idx());
+    if (cached_code) {
+      TRACE(MAIN, 1, "IR cache hit for %s (%zu methods)\n", keys[i].c_str(),
+            cached_code->size());
+      dl->set_cached_code(std::move(cached_code));
+    } else {
+      TRACE(MAIN, 1, "IR cache miss for %s\n", keys[i].c_str());
+    }
+  }
+  return keys;
+}
+
+/*
+ * Like balloon_all(), after load_cached_code(): balloons the methods that did
+ * not get their IR from the cache, and writes entries for their dexes.
+ */
+static void balloon_all_cached(
+    const std::vector<std::unique_ptr<DexLoader>>& loaders,
+    const std::vector<DexClasses>& dexen,
+    const std::string& cache_dir,
+    const std::vector<std::string>& keys) {
+  std::vector<std::pair<size_t, std::vector<CodeItemRef>>> to_store;
+  for (size_t i = 0; i < dexen.size(); ++i) {
+    bool complete = true;
+    walk_methods(dexen[i], [&](DexMethod* m) {
+      if (m->get_dex_code()) {
+        complete = false;
+      }
+    });
+    if (!complete) {
+      to_store.emplace_back(i, loaders[i]->code_items());
+    }
+  }
+
+  balloon_all(dexen);
+
+  DexCache cache(cache_dir);
+  for (const auto& pair : to_store) {
+    auto& dl = loaders[pair.first];
+    cache.store(keys[pair.first], dl->get_header(), dl->get_idx(), pair.second);
+  }
+}
+
 DexClasses load_classes_from_dex(const char* location, bool balloon) {
   dex_stats_t stats;
   return load_classes_from_dex(location, &stats, balloon);
@@ -211,3 +375,55 @@ DexClasses load_classes_from_dex(const char* location, dex_stats_t* stats, bool
 }
 
 void balloon_for_test(const Scope& scope) { balloon_all(scope); }
+
+std::vector<DexClasses> load_classes_from_dexes(
+    const std::vector<std::string>& locations,
+    std::vector<dex_stats_t>* stats,
+    bool balloon,
+    const std::string& ir_cache_dir) {
+  bool use_cache = balloon && !ir_cache_dir.empty();
+  std::vector<std::unique_ptr<DexLoader>> loaders;
+  std::vector<DexClasses> dexen(locations.size());
+  stats->assign(locations.size(), dex_stats_t());
+  std::vector<class_load_work> lwork;
+  for (size_t i = 0; i < locations.size(); ++i) {
+    const char* location = locations[i].c_str();
+    TRACE(MAIN, 1, "Loading classes from dex from %s\n", location);
+    loaders.emplace_back(std::make_unique<DexLoader>(location));
+    auto* dl = loaders.back().get();
+    auto num_classes = dl->open_dex(location, &dexen[i]);
+    for (uint32_t j = 0; j < num_classes; ++j) {
+      lwork.push_back(class_load_work{dl, static_cast<int>(j)});
+    }
+  }
+
+  std::vector<std::string> cache_keys;
+  if (use_cache) {
+    cache_keys = load_cached_code(loaders, dexen, ir_cache_dir);
+  }
+
+  // Every class_def of every dex goes through the same queue, so small dexes
+  // no longer leave the pool idle while they wait for their turn.
+  auto wq = workqueue_foreach<class_load_work*>(class_work);
+  for (auto& work : lwork) {
+    wq.add_item(&work);
+  }
+  wq.run_all();
+
+  auto stats_wq = workqueue_foreach<size_t>([&](size_t i) {
+    if (!dexen[i].empty()) {
+      loaders[i]->gather_input_stats(&stats->at(i), loaders[i]->get_header());
+    }
+  });
+  for (size_t i = 0; i < locations.size(); ++i) {
+    stats_wq.add_item(i);
+  }
+  stats_wq.run_all();
+
+  if (use_cache) {
+    balloon_all_cached(loaders, dexen, ir_cache_dir, cache_keys);
+  } else if (balloon) {
+    balloon_all(dexen);
+  }
+  return dexen;
+}
@@ -17,4 +17,19 @@
 DexClasses load_classes_from_dex(const char* location, bool balloon = true);
 DexClasses load_classes_from_dex(const char* location, dex_stats_t* stats, bool balloon = true);
 
+/**
+ * Load several dexes as a single batch: all files are mapped up front, and
+ * their classes are parsed and ballooned on one shared work queue. The result
+ * and `stats` are in the order of `locations`, and each DexClasses keeps the
+ * class_def order of its file, so the outcome does not depend on scheduling.
+ *
+ * A non-empty `ir_cache_dir` keeps the ballooned IR of each dex there (see
+ * DexCache.h), and reuses it when the same dex is loaded again.
+ */
+std::vector<DexClasses> load_classes_from_dexes(
+    const std::vector<std::string>& locations,
+    std::vector<dex_stats_t>* stats,
+    bool balloon = true,
+    const std::string& ir_cache_dir = "");
+
 void balloon_for_test(const Scope& scope);
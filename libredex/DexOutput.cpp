@@ -8,6 +8,7 @@
  */
 
 #include <algorithm>
+#include <chrono>
 #include <memory>
 #include <fcntl.h>
 #include <sys/stat.h>
@@ -34,6 +35,7 @@
 #include "Debug.h"
 #include "DexClass.h"
 #include "DexOutput.h"
+#include "DexOutputBuffer.h"
 #include "DexUtil.h"
 #include "IRCode.h"
 #include "Pass.h"
@@ -344,7 +346,6 @@ void GatheredTypes::gather_components() {
   sort_unique(m_lstring);
 }
 
-constexpr uint32_t k_max_dex_size = 16 * 1024 * 1024;
 typedef std::map<DexAnnotation*, uint32_t> annomap_t;
 typedef std::map<DexAnnotationSet*, uint32_t> asetmap_t;
 typedef std::map<ParamAnnotations*, uint32_t> xrefmap_t;
@@ -357,6 +358,7 @@ public:
   DexClasses* m_classes;
   DexOutputIdx* dodx;
   GatheredTypes* m_gtypes;
+  DexOutputBuffer m_buffer;
   uint8_t* m_output;
   uint32_t m_offset;
   const char* m_filename;
@@ -404,12 +406,10 @@ public:
                     adirmap_t& adirmap,
                     std::vector<DexAnnotationDirectory*>& adirlist);
   void generate_annotations();
-  void generate_debug_items();
   void generate_typelist_data();
   void generate_map();
   void finalize_header();
   void init_header_offsets();
-  void write_symbol_files();
   void align_output() { m_offset = (m_offset + 3) & ~3; }
   void emit_locator(Locator locator);
   std::unique_ptr<Locator> locator_for_descriptor(
@@ -431,6 +431,19 @@ public:
   ~DexOutput();
   void prepare(SortMode string_mode, const std::vector<SortMode>& code_mode);
   void write();
+
+  /*
+   * prepare() and write() split into their steps. Only the debug items and
+   * the symbol files touch state shared between dexes (the PositionMapper and
+   * the appended mapping files); everything else may run concurrently with
+   * other DexOutputs.
+   */
+  void prepare_sections(SortMode string_mode,
+                        const std::vector<SortMode>& code_mode);
+  void generate_debug_items();
+  void finalize_output();
+  void write_dex_file();
+  void write_symbol_files();
 };
 
 DexOutput::DexOutput(
@@ -447,8 +460,7 @@ DexOutput::DexOutput(
     : m_config_files(config_files)
 {
   m_classes = classes;
-  m_output = (uint8_t*)malloc(k_max_dex_size);
-  memset(m_output, 0, k_max_dex_size);
+  m_output = m_buffer.data();
   m_offset = 0;
   m_gtypes = new GatheredTypes(classes);
   dodx = m_gtypes->get_dodx(m_output);
@@ -465,7 +477,6 @@ DexOutput::DexOutput(
 DexOutput::~DexOutput() {
   delete m_gtypes;
   delete dodx;
-  free(m_output);
 }
 
 void DexOutput::insert_map_item(uint16_t maptype,
@@ -482,9 +493,10 @@ void DexOutput::insert_map_item(uint16_t maptype,
 void DexOutput::emit_locator(Locator locator) {
   char buf[Locator::encoded_max];
   size_t locator_length = locator.encode(buf);
-  write_uleb128(m_output + m_offset, (uint32_t) locator_length);
-  m_offset += uleb128_encoding_size((uint32_t) locator_length);
-  memcpy(m_output + m_offset, buf, locator_length + 1);
+  size_t uleb_size = uleb128_encoding_size((uint32_t) locator_length);
+  write_uleb128(m_buffer.at(m_offset, uleb_size), (uint32_t) locator_length);
+  m_offset += uleb_size;
+  memcpy(m_buffer.at(m_offset, locator_length + 1), buf, locator_length + 1);
   m_offset += locator_length + 1;
 }
 
@@ -575,7 +587,7 @@ void DexOutput::generate_string_data(SortMode mode) {
     uint32_t idx = dodx->stringidx(str);
     TRACE(CUSTOMSORT, 3, "str emit %s\n", SHOW(str));
     stringids[idx].offset = m_offset;
-    str->encode(m_output + m_offset);
+    str->encode(m_buffer.at(m_offset, str->get_entry_size()));
     m_offset += str->get_entry_size();
     m_stats.num_strings++;
   }
@@ -617,7 +629,9 @@ void DexOutput::generate_typelist_data() {
     ++num_tls;
     align_output();
     m_tl_emit_offsets[tl] = m_offset;
-    int size = tl->encode(dodx, (uint32_t*)(m_output + m_offset));
+    size_t max_size = sizeof(uint32_t) +
+                      tl->get_type_list().size() * sizeof(uint16_t);
+    int size = tl->encode(dodx, (uint32_t*)m_buffer.at(m_offset, max_size));
     m_offset += size;
     m_stats.num_type_lists++;
   }
@@ -715,6 +729,16 @@ void DexOutput::generate_class_data() {
   }
 }
 
+/*
+ * The class_data_item is all ulebs: four counts, then an index delta and
+ * access flags per field, plus a code offset per method.
+ */
+static size_t class_data_max_size(const DexClass* clz) {
+  size_t fields = clz->get_sfields().size() + clz->get_ifields().size();
+  size_t methods = clz->get_dmethods().size() + clz->get_vmethods().size();
+  return (4 + 2 * fields + 3 * methods) * 5;
+}
+
 void DexOutput::generate_class_data_items() {
   /*
    * First generate a dexcode_to_offset needed for the encoding
@@ -730,7 +754,8 @@ void DexOutput::generate_class_data_items() {
     DexClass* clz = m_classes->at(i);
     if (!clz->has_class_data()) continue;
     /* No alignment constraints for this data */
-    int size = clz->encode(dodx, dco, m_output + m_offset);
+    int size =
+        clz->encode(dodx, dco, m_buffer.at(m_offset, class_data_max_size(clz)));
     m_cdi_offsets[clz] = m_offset;
     m_offset += size;
   }
@@ -787,6 +812,8 @@ void DexOutput::generate_code_items(const std::vector<SortMode>& mode) {
         break;
     }
   }
+  std::vector<DexMethod*> methods;
+  std::vector<DexCode*> codes;
   for (DexMethod* meth : lmeth) {
     if (meth->get_access() & (DEX_ACCESS_ABSTRACT | DEX_ACCESS_NATIVE)) {
       // There is no code item for ABSTRACT or NATIVE methods.
@@ -797,14 +824,31 @@ void DexOutput::generate_code_items(const std::vector<SortMode>& mode) {
     always_assert_log(
         meth->is_concrete() && code != nullptr,
         "Undefined method in generate_code_items()\n\t prototype: %s\n", SHOW(meth));
+    methods.push_back(meth);
+    codes.push_back(code);
+  }
+
+  // Now that everything is synced, the size of each code item is known, so
+  // we lay them all out first and then encode each one into its slot
+  // concurrently.
+  std::vector<uint32_t> sizes(codes.size());
+  workqueue_parallel_for(codes.size(), [&](size_t i) {
+    sizes[i] = codes[i]->encoded_size(dodx);
+  });
+  for (size_t i = 0; i < codes.size(); ++i) {
     align_output();
-    int size = code->encode(dodx, (uint32_t*)(m_output + m_offset));
-    m_method_bytecode_offsets.emplace_back(meth->get_name()->c_str(), m_offset);
-    m_code_item_emits.emplace_back(code,
-                                   (dex_code_item*)(m_output + m_offset));
-    m_offset += size;
-    m_stats.num_instructions += code->get_instructions().size();
+    m_method_bytecode_offsets.emplace_back(methods[i]->get_name()->c_str(),
+                                           m_offset);
+    m_code_item_emits.emplace_back(
+        codes[i], (dex_code_item*)m_buffer.at(m_offset, sizes[i]));
+    m_offset += sizes[i];
+    m_stats.num_instructions += codes[i]->get_instructions().size();
   }
+  workqueue_parallel_for(codes.size(), [&](size_t i) {
+    auto& emit = m_code_item_emits[i];
+    int size = emit.first->encode(dodx, (uint32_t*)emit.second);
+    always_assert(size == (int) sizes[i]);
+  });
   insert_map_item(TYPE_CODE_ITEM, (uint32_t) m_code_item_emits.size(), ci_start);
 }
 
@@ -821,13 +865,13 @@ void DexOutput::generate_static_values() {
     if (enc_arrays.count(*deva)) {
       m_static_values[clz] = enc_arrays.at(*deva);
     } else {
-      uint8_t* output = m_output + m_offset;
-      uint8_t* outputsv = output;
+      std::vector<uint8_t> bytes;
       /* No alignment requirements */
-      deva->encode(dodx, output);
+      deva->vencode(dodx, bytes);
+      memcpy(m_buffer.at(m_offset, bytes.size()), bytes.data(), bytes.size());
       enc_arrays.emplace(std::move(*deva.release()), m_offset);
       m_static_values[clz] = m_offset;
-      m_offset += output - outputsv;
+      m_offset += bytes.size();
       m_stats.num_static_values++;
     }
   }
@@ -841,15 +885,42 @@ static bool annotation_cmp(const DexAnnotationDirectory* a,
   return (a->viz_score() < b->viz_score());
 }
 
+/*
+ * Encodes each distinct item of the list concurrently, returning them with
+ * their encodings in the order they first appear. Deduplicating the
+ * encodings and copying them out decides the offsets, so that is left to the
+ * (serial) caller.
+ */
+template <class T, class Bytes>
+static std::vector<std::pair<T*, Bytes>> encode_unique(
+    const std::vector<T*>& list,
+    const std::function<void(T*, Bytes&)>& encode) {
+  std::vector<std::pair<T*, Bytes>> encoded;
+  std::unordered_set<T*> seen;
+  for (auto item : list) {
+    if (seen.insert(item).second) {
+      encoded.emplace_back(item, Bytes());
+    }
+  }
+  workqueue_parallel_for(encoded.size(), [&](size_t i) {
+    encode(encoded[i].first, encoded[i].second);
+  });
+  return encoded;
+}
+
 void DexOutput::unique_annotations(annomap_t& annomap,
                                    std::vector<DexAnnotation*>& annolist) {
   int annocnt = 0;
   uint32_t mentry_offset = m_offset;
   std::map<std::vector<uint8_t>, uint32_t> annotation_byte_offsets;
-  for (auto anno : annolist) {
+  auto encoded = encode_unique<DexAnnotation, std::vector<uint8_t>>(
+      annolist, [&](DexAnnotation* anno, std::vector<uint8_t>& bytes) {
+        anno->vencode(dodx, bytes);
+      });
+  for (auto& it : encoded) {
+    auto anno = it.first;
+    auto& annotation_bytes = it.second;
     if (annomap.count(anno)) continue;
-    std::vector<uint8_t> annotation_bytes;
-    anno->vencode(dodx, annotation_bytes);
     if (annotation_byte_offsets.count(annotation_bytes)) {
       annomap[anno] = annotation_byte_offsets[annotation_bytes];
       continue;
@@ -858,7 +929,7 @@ void DexOutput::unique_annotations(annomap_t& annomap,
     annotation_byte_offsets[annotation_bytes] = m_offset;
     annomap[anno] = m_offset;
     /* Not a dupe, encode... */
-    uint8_t* annoout = (uint8_t*)(m_output + m_offset);
+    uint8_t* annoout = m_buffer.at(m_offset, annotation_bytes.size());
     memcpy(annoout, &annotation_bytes[0], annotation_bytes.size());
     m_offset += annotation_bytes.size();
     annocnt++;
@@ -875,10 +946,14 @@ void DexOutput::unique_asets(annomap_t& annomap,
   int asetcnt = 0;
   uint32_t mentry_offset = m_offset;
   std::map<std::vector<uint32_t>, uint32_t> aset_offsets;
-  for (auto aset : asetlist) {
+  auto encoded = encode_unique<DexAnnotationSet, std::vector<uint32_t>>(
+      asetlist, [&](DexAnnotationSet* aset, std::vector<uint32_t>& bytes) {
+        aset->vencode(dodx, bytes, annomap);
+      });
+  for (auto& it : encoded) {
+    auto aset = it.first;
+    auto& aset_bytes = it.second;
     if (asetmap.count(aset)) continue;
-    std::vector<uint32_t> aset_bytes;
-    aset->vencode(dodx, aset_bytes, annomap);
     if (aset_offsets.count(aset_bytes)) {
       asetmap[aset] = aset_offsets[aset_bytes];
       continue;
@@ -887,7 +962,8 @@ void DexOutput::unique_asets(annomap_t& annomap,
     aset_offsets[aset_bytes] = m_offset;
     asetmap[aset] = m_offset;
     /* Not a dupe, encode... */
-    uint8_t* asetout = (uint8_t*)(m_output + m_offset);
+    uint8_t* asetout =
+        m_buffer.at(m_offset, aset_bytes.size() * sizeof(uint32_t));
     memcpy(asetout, &aset_bytes[0], aset_bytes.size() * sizeof(uint32_t));
     m_offset += aset_bytes.size() * sizeof(uint32_t);
     asetcnt++;
@@ -921,7 +997,8 @@ void DexOutput::unique_xrefs(asetmap_t& asetmap,
     xref_offsets[xref_bytes] = m_offset;
     xrefmap[xref] = m_offset;
     /* Not a dupe, encode... */
-    uint8_t* xrefout = (uint8_t*)(m_output + m_offset);
+    uint8_t* xrefout =
+        m_buffer.at(m_offset, xref_bytes.size() * sizeof(uint32_t));
     memcpy(xrefout, &xref_bytes[0], xref_bytes.size() * sizeof(uint32_t));
     m_offset += xref_bytes.size() * sizeof(uint32_t);
     xrefcnt++;
@@ -938,10 +1015,15 @@ void DexOutput::unique_adirs(asetmap_t& asetmap,
   int adircnt = 0;
   uint32_t mentry_offset = m_offset;
   std::map<std::vector<uint32_t>, uint32_t> adir_offsets;
-  for (auto adir : adirlist) {
+  auto encoded = encode_unique<DexAnnotationDirectory, std::vector<uint32_t>>(
+      adirlist,
+      [&](DexAnnotationDirectory* adir, std::vector<uint32_t>& bytes) {
+        adir->vencode(dodx, bytes, xrefmap, asetmap);
+      });
+  for (auto& it : encoded) {
+    auto adir = it.first;
+    auto& adir_bytes = it.second;
     if (adirmap.count(adir)) continue;
-    std::vector<uint32_t> adir_bytes;
-    adir->vencode(dodx, adir_bytes, xrefmap, asetmap);
     if (adir_offsets.count(adir_bytes)) {
       adirmap[adir] = adir_offsets[adir_bytes];
       continue;
@@ -950,7 +1032,8 @@ void DexOutput::unique_adirs(asetmap_t& asetmap,
     adir_offsets[adir_bytes] = m_offset;
     adirmap[adir] = m_offset;
     /* Not a dupe, encode... */
-    uint8_t* adirout = (uint8_t*)(m_output + m_offset);
+    uint8_t* adirout =
+        m_buffer.at(m_offset, adir_bytes.size() * sizeof(uint32_t));
     memcpy(adirout, &adir_bytes[0], adir_bytes.size() * sizeof(uint32_t));
     m_offset += adir_bytes.size() * sizeof(uint32_t);
     adircnt++;
@@ -1013,25 +1096,39 @@ void DexOutput::generate_annotations() {
 }
 
 void DexOutput::generate_debug_items() {
-  uint32_t dbg_start = m_offset;
-  int dbgcount = 0;
+  // The PositionMapper is shared with the other dexes and numbers lines in
+  // the order it sees positions, so that part runs in emit order. The items
+  // are then encoded concurrently and copied into place.
+  std::vector<std::pair<DexDebugItem*, dex_code_item*>> dbgs;
+  std::vector<std::vector<uint32_t>> lines;
   for (auto& it : m_code_item_emits) {
     DexCode* dc = it.first;
     dex_code_item* dci = it.second;
     auto dbg = dc->get_debug_item();
     if (dbg == nullptr) continue;
-    dbgcount++;
+    dbgs.emplace_back(dbg, dci);
+    lines.push_back(dbg->map_positions(m_pos_mapper));
+  }
+  std::vector<std::vector<uint8_t>> encoded(dbgs.size());
+  workqueue_parallel_for(dbgs.size(), [&](size_t i) {
+    dbgs[i].first->vencode(dodx, lines[i], encoded[i]);
+  });
+  uint32_t dbg_start = m_offset;
+  for (size_t i = 0; i < dbgs.size(); ++i) {
     // No align requirement for debug items.
-    int size = dbg->encode(dodx, m_pos_mapper, m_output + m_offset);
-    dci->debug_info_off = m_offset;
-    m_offset += size;
+    auto& bytes = encoded[i];
+    memcpy(m_buffer.at(m_offset, bytes.size()), bytes.data(), bytes.size());
+    dbgs[i].second->debug_info_off = m_offset;
+    m_offset += bytes.size();
   }
-  insert_map_item(TYPE_DEBUG_INFO_ITEM, dbgcount, dbg_start);
+  insert_map_item(TYPE_DEBUG_INFO_ITEM, (uint32_t) dbgs.size(), dbg_start);
 }
 
 void DexOutput::generate_map() {
   align_output();
-  uint32_t* mapout = (uint32_t*)(m_output + m_offset);
+  uint32_t* mapout = (uint32_t*)m_buffer.at(
+      m_offset,
+      sizeof(uint32_t) + (m_map_items.size() + 1) * sizeof(dex_map_item));
   hdr.map_off = m_offset;
   insert_map_item(TYPE_MAP_LIST, 1, m_offset);
   *mapout = (uint32_t) m_map_items.size();
@@ -1114,6 +1211,8 @@ void DexOutput::init_header_offsets() {
   insert_map_item(TYPE_CLASS_DEF_ITEM, (uint32_t) m_classes->size(), m_offset);
 
   m_offset += m_classes->size() * sizeof(dex_class_def);
+  // The id sections are filled in by index later on.
+  m_buffer.ensure(m_offset);
   hdr.data_off = m_offset;
   /* Todo... */
   hdr.map_off = 0;
@@ -1312,7 +1411,8 @@ void DexOutput::write_symbol_files() {
   );
 }
 
-void DexOutput::prepare(SortMode string_mode, const std::vector<SortMode>& code_mode) {
+void DexOutput::prepare_sections(SortMode string_mode,
+                                 const std::vector<SortMode>& code_mode) {
   fix_jumbos(m_classes, dodx);
   init_header_offsets();
   generate_static_values();
@@ -1326,13 +1426,22 @@ void DexOutput::prepare(SortMode string_mode, const std::vector<SortMode>& code_
   generate_method_data();
   generate_class_data();
   generate_annotations();
-  generate_debug_items();
+}
+
+void DexOutput::finalize_output() {
   generate_map();
   align_output();
   finalize_header();
 }
 
-void DexOutput::write() {
+void DexOutput::prepare(SortMode string_mode, const std::vector<SortMode>& code_mode) {
+  prepare_sections(string_mode, code_mode);
+  generate_debug_items();
+  finalize_output();
+}
+
+void DexOutput::write_dex_file() {
+  auto start = std::chrono::steady_clock::now();
   struct stat st;
   int fd = open(m_filename, O_CREAT | O_TRUNC | O_WRONLY, 0660);
   if (fd == -1) {
@@ -1344,7 +1453,14 @@ void DexOutput::write() {
     m_stats.num_bytes = st.st_size;
   }
   close(fd);
+  m_stats.max_buffer_bytes = m_buffer.committed_size(m_offset);
+  m_stats.write_time_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                              std::chrono::steady_clock::now() - start)
+                              .count();
+}
 
+void DexOutput::write() {
+  write_dex_file();
   write_symbol_files();
 }
 
@@ -1358,36 +1474,38 @@ static SortMode make_sort_bytecode(const std::string& sort_bytecode) {
   }
 }
 
-dex_stats_t
-write_classes_to_dex(
-  std::string filename,
-  DexClasses* classes,
-  LocatorIndex* locator_index,
-  size_t dex_number,
-  ConfigFiles& cfg,
-  const Json::Value& json_cfg,
-  PositionMapper* pos_mapper)
-{
-  auto method_mapping_filename = cfg.metafile(
+namespace {
+
+struct DexOutputConfig {
+  std::string method_mapping_filename;
+  std::string class_mapping_filename;
+  std::string pg_mapping_filename;
+  std::string bytecode_offset_filename;
+  SortMode string_sort_mode{SortMode::DEFAULT};
+  std::vector<SortMode> code_sort_mode;
+};
+
+DexOutputConfig parse_output_config(ConfigFiles& cfg,
+                                    const Json::Value& json_cfg) {
+  DexOutputConfig out_cfg;
+  out_cfg.method_mapping_filename = cfg.metafile(
     json_cfg.get("method_mapping", "").asString());
-  auto class_mapping_filename = cfg.metafile(
+  out_cfg.class_mapping_filename = cfg.metafile(
     json_cfg.get("class_mapping", "").asString());
-  auto pg_mapping_filename = cfg.metafile(
+  out_cfg.pg_mapping_filename = cfg.metafile(
     json_cfg.get("proguard_map_output", "").asString());
-  auto bytecode_offset_filename = cfg.metafile(
+  out_cfg.bytecode_offset_filename = cfg.metafile(
     json_cfg.get("bytecode_offset_map", "").asString());
 
   auto sort_strings = json_cfg.get("string_sort_mode", "").asString();
-  SortMode string_sort_mode = SortMode::DEFAULT;
   if (sort_strings == "class_strings") {
-    string_sort_mode = SortMode::CLASS_STRINGS;
+    out_cfg.string_sort_mode = SortMode::CLASS_STRINGS;
   } else if (sort_strings == "class_order") {
-    string_sort_mode = SortMode::CLASS_ORDER;
+    out_cfg.string_sort_mode = SortMode::CLASS_ORDER;
   }
 
   auto sort_bytecode_cfg = json_cfg.get("bytecode_sort_mode", Json::Value());
-  std::vector<SortMode> code_sort_mode;
-
+  auto& code_sort_mode = out_cfg.code_sort_mode;
   if (sort_bytecode_cfg.isString()) {
     code_sort_mode.push_back(make_sort_bytecode(sort_bytecode_cfg.asString()));
   } else if (sort_bytecode_cfg.isArray()) {
@@ -1398,24 +1516,105 @@ write_classes_to_dex(
   if (code_sort_mode.empty()) {
     code_sort_mode.push_back(SortMode::DEFAULT);
   }
+  return out_cfg;
+}
+
+} // namespace
+
+dex_stats_t
+write_classes_to_dex(
+  std::string filename,
+  DexClasses* classes,
+  LocatorIndex* locator_index,
+  size_t dex_number,
+  ConfigFiles& cfg,
+  const Json::Value& json_cfg,
+  PositionMapper* pos_mapper)
+{
+  auto out_cfg = parse_output_config(cfg, json_cfg);
 
-  DexOutput dout = DexOutput(
+  DexOutput dout(
     filename.c_str(),
     classes,
     locator_index,
     dex_number,
     cfg,
     pos_mapper,
-    method_mapping_filename,
-    class_mapping_filename,
-    pg_mapping_filename,
-    bytecode_offset_filename);
+    out_cfg.method_mapping_filename,
+    out_cfg.class_mapping_filename,
+    out_cfg.pg_mapping_filename,
+    out_cfg.bytecode_offset_filename);
 
-  dout.prepare(string_sort_mode, code_sort_mode);
+  dout.prepare(out_cfg.string_sort_mode, out_cfg.code_sort_mode);
   dout.write();
   return dout.m_stats;
 }
 
+std::vector<dex_stats_t>
+write_classes_to_dexes(
+  const std::vector<DexOutputJob>& jobs,
+  LocatorIndex* locator_index,
+  ConfigFiles& cfg,
+  const Json::Value& json_cfg,
+  PositionMapper* pos_mapper,
+  size_t num_threads)
+{
+  always_assert(num_threads >= 1);
+  auto out_cfg = parse_output_config(cfg, json_cfg);
+  std::vector<dex_stats_t> stats;
+  stats.reserve(jobs.size());
+
+  // Dexes are processed in windows of num_threads so that only that many
+  // output buffers are alive at once.
+  for (size_t start = 0; start < jobs.size(); start += num_threads) {
+    size_t end = std::min(jobs.size(), start + num_threads);
+    std::vector<std::unique_ptr<DexOutput>> outputs(end - start);
+
+    auto prepare_wq = workqueue_foreach<size_t>([&](size_t i) {
+      const auto& job = jobs[start + i];
+      outputs[i] = std::make_unique<DexOutput>(
+        job.filename.c_str(),
+        job.classes,
+        locator_index,
+        job.dex_number,
+        cfg,
+        pos_mapper,
+        out_cfg.method_mapping_filename,
+        out_cfg.class_mapping_filename,
+        out_cfg.pg_mapping_filename,
+        out_cfg.bytecode_offset_filename);
+      outputs[i]->prepare_sections(out_cfg.string_sort_mode,
+                                   out_cfg.code_sort_mode);
+    }, num_threads);
+    for (size_t i = 0; i < outputs.size(); ++i) {
+      prepare_wq.add_item(i);
+    }
+    prepare_wq.run_all();
+
+    // The PositionMapper hands out line numbers in registration order, so
+    // debug items are encoded one dex at a time, in dex order.
+    for (auto& dout : outputs) {
+      dout->generate_debug_items();
+    }
+
+    auto write_wq = workqueue_foreach<DexOutput*>([](DexOutput* dout) {
+      dout->finalize_output();
+      dout->write_dex_file();
+    }, num_threads);
+    for (auto& dout : outputs) {
+      write_wq.add_item(dout.get());
+    }
+    write_wq.run_all();
+
+    // Symbol files are appended to, so keep them in dex order as well.
+    for (auto& dout : outputs) {
+      dout->write_symbol_files();
+      stats.push_back(dout->m_stats);
+    }
+  }
+  return stats;
+}
+
 LocatorIndex
 make_locator_index(DexStoresVector& stores)
 {
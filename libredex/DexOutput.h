@@ -100,6 +100,26 @@ dex_stats_t write_classes_to_dex(
   const Json::Value& json_cfg,
   PositionMapper* line_mapper);
 
+struct DexOutputJob {
+  std::string filename;
+  DexClasses* classes;
+  size_t dex_number;
+};
+
+/*
+ * Write several dexes, preparing and writing up to num_threads of them
+ * concurrently. Debug items (and hence PositionMapper line numbers) and the
+ * symbol files are still produced in job order, so the output is the same as
+ * calling write_classes_to_dex() on each job in turn.
+ */
+std::vector<dex_stats_t> write_classes_to_dexes(
+  const std::vector<DexOutputJob>& jobs,
+  LocatorIndex* locator_index /* nullable */,
+  ConfigFiles& cfg,
+  const Json::Value& json_cfg,
+  PositionMapper* line_mapper,
+  size_t num_threads);
+
 typedef bool (*cmp_dstring)(const DexString*, const DexString*);
 typedef bool (*cmp_dtype)(const DexType*, const DexType*);
 typedef bool (*cmp_dproto)(const DexProto*, const DexProto*);
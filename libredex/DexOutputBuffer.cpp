@@ -0,0 +1,114 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "DexOutputBuffer.h"
+
+#include <algorithm>
+
+#ifdef _MSC_VER
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "Debug.h"
+
+namespace {
+
+// Every offset in a dex file is a uint32_t.
+constexpr uint64_t k_max_reservation = uint64_t(1) << 32;
+// If the OS refuses to overcommit that much, settle for no less than this.
+constexpr uint64_t k_min_reservation = 16 * 1024 * 1024;
+
+#ifdef _MSC_VER
+/*
+ * Windows has no overcommit: committing the whole reservation would charge
+ * all of it against the commit limit up front. We reserve address space
+ * only, and ensure() commits it a chunk at a time as the writer advances.
+ */
+constexpr size_t k_commit_chunk = 1024 * 1024;
+#endif
+
+uint8_t* reserve(size_t size) {
+#ifdef _MSC_VER
+  return (uint8_t*)VirtualAlloc(nullptr, size, MEM_RESERVE, PAGE_NOACCESS);
+#else
+  void* p = mmap(nullptr,
+                 size,
+                 PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                 -1,
+                 0);
+  return p == MAP_FAILED ? nullptr : (uint8_t*)p;
+#endif
+}
+
+// The granularity at which the buffer is backed by memory.
+size_t commit_size() {
+#ifdef _MSC_VER
+  return k_commit_chunk;
+#else
+  return sysconf(_SC_PAGESIZE);
+#endif
+}
+
+}
+
+DexOutputBuffer::DexOutputBuffer()
+    : m_data(nullptr), m_capacity(0), m_committed(0) {
+  uint64_t size = k_max_reservation;
+  if (size > SIZE_MAX / 2) {
+    size = SIZE_MAX / 2 + 1;
+  }
+  for (; size >= k_min_reservation; size /= 2) {
+    m_data = reserve(size);
+    if (m_data != nullptr) {
+      m_capacity = size;
+#ifndef _MSC_VER
+      // The mapping is already writable; pages are supplied on first touch.
+      m_committed = size;
+#endif
+      return;
+    }
+  }
+  always_assert_log(false, "Unable to reserve a dex output buffer\n");
+}
+
+DexOutputBuffer::~DexOutputBuffer() {
+#ifdef _MSC_VER
+  VirtualFree(m_data, 0, MEM_RELEASE);
+#else
+  munmap(m_data, m_capacity);
+#endif
+}
+
+void DexOutputBuffer::ensure(size_t end) {
+  if (end <= m_committed) {
+    return;
+  }
+  always_assert_log(end <= m_capacity,
+                    "Dex output of %zu bytes overflows the %zu byte buffer\n",
+                    end,
+                    m_capacity);
+#ifdef _MSC_VER
+  size_t target = std::min(
+      m_capacity, (end + k_commit_chunk - 1) / k_commit_chunk * k_commit_chunk);
+  void* p = VirtualAlloc(
+      m_data + m_committed, target - m_committed, MEM_COMMIT, PAGE_READWRITE);
+  always_assert_log(p != nullptr, "Unable to commit dex output buffer memory\n");
+  m_committed = target;
+#endif
+}
+
+size_t DexOutputBuffer::committed_size(size_t used) const {
+  static const size_t granule = commit_size();
+  return std::min(m_capacity, (used + granule - 1) / granule * granule);
+}
@@ -0,0 +1,66 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * Backing store for a dex file while it is being emitted.
+ *
+ * DexOutput hands out raw pointers into the buffer and patches earlier
+ * sections (the header, class defs, debug info offsets) after later ones have
+ * been written, so the storage must never move. Rather than allocating and
+ * zeroing a fixed-size block up front, we reserve address space for the
+ * largest dex the format can describe and back it with zero-filled memory
+ * only as far as it has been written.
+ *
+ * Every write must go through at() (or be covered by an earlier ensure()),
+ * which checks it against the reservation and, on Windows, commits the
+ * memory underneath it.
+ */
+class DexOutputBuffer {
+ public:
+  DexOutputBuffer();
+  ~DexOutputBuffer();
+
+  DexOutputBuffer(const DexOutputBuffer&) = delete;
+  DexOutputBuffer& operator=(const DexOutputBuffer&) = delete;
+
+  uint8_t* data() const { return m_data; }
+  size_t capacity() const { return m_capacity; }
+
+  /*
+   * Make the first `end` bytes of the buffer writable. Fails if the
+   * reservation is too small to hold them.
+   */
+  void ensure(size_t end);
+
+  /*
+   * Pointer to `size` writable bytes at `offset`.
+   */
+  uint8_t* at(size_t offset, size_t size) {
+    ensure(offset + size);
+    return m_data + offset;
+  }
+
+  /*
+   * Memory backing the buffer once `used` bytes of it have been written,
+   * i.e. the high-water mark rounded up to a page (a commit chunk on
+   * Windows).
+   */
+  size_t committed_size(size_t used) const;
+
+ private:
+  uint8_t* m_data;
+  size_t m_capacity;
+  // How much of the buffer is known to be writable.
+  size_t m_committed;
+};
@@ -9,6 +9,7 @@
 
 #include "DexUtil.h"
 
+#include <algorithm>
 #include <boost/filesystem.hpp>
 #include <boost/regex.hpp>
 #include <unordered_set>
@@ -409,6 +410,8 @@ dex_stats_t&
   lhs.num_type_lists += rhs.num_type_lists;
   lhs.num_bytes += rhs.num_bytes;
   lhs.num_instructions += rhs.num_instructions;
+  lhs.max_buffer_bytes = std::max(lhs.max_buffer_bytes, rhs.max_buffer_bytes);
+  lhs.write_time_us += rhs.write_time_us;
   return lhs;
 }
 
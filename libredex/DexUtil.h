@@ -346,6 +346,11 @@ struct dex_stats_t {
   int num_type_lists = 0;
   int num_bytes = 0;
   int num_instructions = 0;
+  // The memory backing the largest output buffer, and the time spent writing
+  // to disk. Dexes are written concurrently, so several buffers can be live
+  // at once; summing stats keeps the largest one rather than their total.
+  uint64_t max_buffer_bytes = 0;
+  uint64_t write_time_us = 0;
 };
 
 dex_stats_t&
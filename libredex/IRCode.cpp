@@ -351,6 +351,7 @@ bool encode_offset(FatMethod* fm,
     if (goto_op != bop) {
       auto insn = branch_op_mie->dex_insn;
       branch_op_mie->dex_insn = new DexInstruction(goto_op);
+      branch_op_mie->dex_insn->set_offset(offset);
       delete insn;
       return false;
     }
@@ -395,15 +396,18 @@ bool encode_offset(FatMethod* fm,
   return true;
 }
 
-static bool multi_target_compare_index(const BranchTarget* a,
-                                       const BranchTarget* b) {
-  return (a->index < b->index);
+// A case of a switch, and the index of the entry it branches to.
+using MultiTarget = std::pair<BranchTarget*, uint32_t>;
+
+static bool multi_target_compare_index(const MultiTarget& a,
+                                       const MultiTarget& b) {
+  return (a.first->index < b.first->index);
 }
 
-static bool multi_contains_gaps(const std::vector<BranchTarget*>& targets) {
-  int32_t key = targets.front()->index;
-  for (auto target : targets) {
-    if (target->index != key) return true;
+static bool multi_contains_gaps(const std::vector<MultiTarget>& targets) {
+  int32_t key = targets.front().first->index;
+  for (const auto& target : targets) {
+    if (target.first->index != key) return true;
     key++;
   }
   return false;
@@ -827,6 +831,7 @@ void IRCode::remove_branch_targets(IRInstruction *branch_inst) {
 void IRCode::replace_branch(IRInstruction* from, IRInstruction* to) {
   always_assert(is_branch(from->opcode()));
   always_assert(is_branch(to->opcode()));
+  ++m_generation;
   for (auto& mentry : *m_fmethod) {
     if (mentry.type == MFLOW_OPCODE && mentry.insn == from) {
       mentry.insn = to;
@@ -842,6 +847,7 @@ void IRCode::replace_branch(IRInstruction* from, IRInstruction* to) {
 }
 
 void IRCode::remove_debug_line_info(Block* block) {
+  ++m_generation;
   for (MethodItemEntry& mie : *block) {
     if (mie.type == MFLOW_POSITION) {
       mie.pos.release();
@@ -852,6 +858,7 @@ void IRCode::remove_debug_line_info(Block* block) {
 
 void IRCode::replace_opcode_with_infinite_loop(IRInstruction* from) {
   IRInstruction* to = new IRInstruction(OPCODE_GOTO_32);
+  ++m_generation;
   auto miter = m_fmethod->begin();
   for (; miter != m_fmethod->end(); miter++) {
     MethodItemEntry* mentry = &*miter;
@@ -908,6 +915,7 @@ void IRCode::insert_after(IRInstruction* position,
    * MEI's probably.
    *
    */
+  ++m_generation;
   for (auto const& mei : *m_fmethod) {
     if (mei.type == MFLOW_OPCODE &&
         (position == nullptr || mei.insn == position)) {
@@ -930,12 +938,14 @@ void IRCode::insert_after(IRInstruction* position,
 
 FatMethod::iterator IRCode::insert_before(
     const FatMethod::iterator& position, MethodItemEntry& mie) {
+  ++m_generation;
   return m_fmethod->insert(position, mie);
 }
 
 FatMethod::iterator IRCode::insert_after(
     const FatMethod::iterator& position, MethodItemEntry& mie) {
   always_assert(position != m_fmethod->end());
+  ++m_generation;
   return m_fmethod->insert(std::next(position), mie);
 }
 
@@ -952,6 +962,7 @@ FatMethod::iterator IRCode::insert_after(
  * block boundaries.)
  */
 void IRCode::remove_switch_case(IRInstruction* insn) {
+  ++m_generation;
 
   TRACE(MTRANS, 3, "Removing switch case from: %s\n", SHOW(m_fmethod));
   // Check if we are inside switch method.
@@ -1035,6 +1046,7 @@ size_t IRCode::sum_opcode_sizes() const {
 
 void IRCode::remove_opcode(const FatMethod::iterator& it) {
   always_assert(it->type == MFLOW_OPCODE);
+  ++m_generation;
   auto insn = it->insn;
   always_assert(!opcode::is_move_result_pseudo(insn->opcode()));
   if (insn->has_move_result_pseudo()) {
@@ -1075,6 +1087,7 @@ FatMethod::iterator IRCode::main_block() {
 
 FatMethod::iterator IRCode::insert(FatMethod::iterator cur,
                                    IRInstruction* insn) {
+  ++m_generation;
   MethodItemEntry* mentry = new MethodItemEntry(insn);
   return m_fmethod->insert(cur, *mentry);
 }
@@ -1083,6 +1096,7 @@ FatMethod::iterator IRCode::make_if_block(
     FatMethod::iterator cur,
     IRInstruction* insn,
     FatMethod::iterator* false_block) {
+  ++m_generation;
   auto if_entry = new MethodItemEntry(insn);
   *false_block = m_fmethod->insert(cur, *if_entry);
   auto bt = new BranchTarget();
@@ -1097,6 +1111,7 @@ FatMethod::iterator IRCode::make_if_else_block(
     IRInstruction* insn,
     FatMethod::iterator* false_block,
     FatMethod::iterator* true_block) {
+  ++m_generation;
   // if block
   auto if_entry = new MethodItemEntry(insn);
   *false_block = m_fmethod->insert(cur, *if_entry);
@@ -1127,6 +1142,7 @@ FatMethod::iterator IRCode::make_switch_block(
     IRInstruction* insn,
     FatMethod::iterator* default_block,
     std::map<SwitchIndices, FatMethod::iterator>& cases) {
+  ++m_generation;
   auto switch_entry = new MethodItemEntry(insn);
   *default_block = m_fmethod->insert(cur, *switch_entry);
   FatMethod::iterator main_block = *default_block;
@@ -1170,11 +1186,16 @@ const char* DEBUG_ONLY show_reg_map(RegMap& map) {
 
 void IRCode::build_cfg(bool editable) {
   clear_cfg();
+  if (editable) {
+    // The blocks of an editable CFG are edited without our knowledge.
+    ++m_generation;
+  }
   m_cfg = std::make_unique<ControlFlowGraph>(m_fmethod, editable);
 }
 
 void IRCode::clear_cfg() {
   if (m_cfg && m_cfg->editable()) {
+    ++m_generation;
     m_fmethod = m_cfg->linearize();
   }
 
@@ -1245,94 +1266,202 @@ std::unique_ptr<DexCode> IRCode::sync(const DexMethod* method) {
   return dex_code;
 }
 
-bool IRCode::try_sync(DexCode* code) {
-  std::unordered_map<MethodItemEntry*, uint32_t> entry_to_addr;
+namespace {
+
+/*
+ * A simple branch to relax: the indices of its source opcode and of its
+ * target in the entries of a method.
+ */
+struct SimpleBranch {
+  uint32_t src;
+  uint32_t target;
+};
+
+uint32_t goto_size(int32_t offset) {
+  switch (goto_for_offset(offset)) {
+  case OPCODE_GOTO:
+    return 1;
+  case OPCODE_GOTO_16:
+    return 2;
+  default:
+    return 3;
+  }
+}
+
+/*
+ * Sets addrs[i] to the address of entries[i], and addrs[entries.size()] to
+ * the size of the code.
+ */
+void layout(const std::vector<uint32_t>& sizes, std::vector<uint32_t>* addrs) {
   uint32_t addr = 0;
-  // Step 1, regenerate opcode list for the method, and
-  // and calculate the opcode entries address offsets.
+  for (size_t i = 0; i < sizes.size(); ++i) {
+    (*addrs)[i] = addr;
+    addr += sizes[i];
+  }
+  addrs->back() = addr;
+}
+
+} // namespace
+
+bool IRCode::try_sync(DexCode* code) {
+  // Step 1, number the entries densely so that everything below can keep
+  // their sizes and addresses in flat arrays. Only the entries that others
+  // point to -- branch sources and catch handlers -- need a reverse lookup.
   TRACE(MTRANS, 5, "Emitting opcodes\n");
-  for (auto miter = m_fmethod->begin(); miter != m_fmethod->end(); miter++) {
-    MethodItemEntry* mentry = &*miter;
-    TRACE(MTRANS, 5, "Analyzing mentry %p\n", mentry);
-    entry_to_addr[mentry] = addr;
-    if (mentry->type == MFLOW_DEX_OPCODE) {
-      TRACE(MTRANS, 5, "Emitting mentry %p at %08x\n", mentry, addr);
-      addr += mentry->dex_insn->size();
+  std::vector<MethodItemEntry*> entries;
+  std::unordered_map<const MethodItemEntry*, uint32_t> referenced;
+  for (auto& mie : *m_fmethod) {
+    if ((mie.type == MFLOW_DEX_OPCODE &&
+         (is_branch(mie.dex_insn->opcode()) ||
+          mie.dex_insn->opcode() == OPCODE_FILL_ARRAY_DATA)) ||
+        mie.type == MFLOW_CATCH) {
+      referenced.emplace(&mie, entries.size());
     }
+    entries.push_back(&mie);
   }
+  auto index_of = [&](const MethodItemEntry* mie) {
+    auto it = referenced.find(mie);
+    always_assert_log(it != referenced.end(),
+                      "%s refers to nonexistent entry",
+                      SHOW(*mie));
+    return it->second;
+  };
+
   // Step 2, Branch relaxation: calculate branch offsets for if-* and goto
-  // opcodes, resizing them where necessary. Since resizing opcodes affects
-  // address offsets, we need to iterate this to a fixed point.
+  // opcodes, resizing them where necessary.
+  //
+  // Gotos start out at their smallest size and only ever grow, so a few
+  // linear passes over the flat arrays reach the fixed point, and the
+  // instructions are only rewritten once it is found. The one change that
+  // needs a new layout is an if-* whose offset doesn't fit in 16 bits, which
+  // is rewritten into an if-* around a goto/32; it is rare enough that we
+  // just start over after it.
   //
   // For instructions that use address offsets but never need resizing (i.e.
   // switch and fill-array-data opcodes), we calculate their offsets after
   // we have reached the fixed point.
   TRACE(MTRANS, 5, "Recalculating branches\n");
-  std::vector<MethodItemEntry*> multi_branches;
-  std::unordered_map<MethodItemEntry*, std::vector<BranchTarget*>> multis;
-  std::unordered_map<BranchTarget*, uint32_t> multi_targets;
-  bool needs_resync = false;
-  for (auto miter = m_fmethod->begin(); miter != m_fmethod->end(); miter++) {
-    MethodItemEntry* mentry = &*miter;
-    if (entry_to_addr.find(mentry) == entry_to_addr.end()) {
-      continue;
-    }
+  const auto num_entries = entries.size();
+  std::vector<uint32_t> sizes(num_entries, 0);
+  std::vector<SimpleBranch> branches;
+  std::vector<uint32_t> multi_branches;
+  std::unordered_map<uint32_t, std::vector<MultiTarget>> multis;
+  for (uint32_t i = 0; i < num_entries; ++i) {
+    auto mentry = entries[i];
     if (mentry->type == MFLOW_DEX_OPCODE) {
       auto opcode = mentry->dex_insn->opcode();
+      sizes[i] = mentry->dex_insn->size();
       if (is_multi_branch(opcode)) {
-        multi_branches.push_back(mentry);
+        multi_branches.push_back(i);
       }
-    }
-    if (mentry->type == MFLOW_TARGET) {
+    } else if (mentry->type == MFLOW_TARGET) {
       BranchTarget* bt = mentry->target;
       if (bt->type == BRANCH_MULTI) {
-        multis[bt->src].push_back(bt);
-        multi_targets[bt] = entry_to_addr.at(mentry);
         // We can't fix the primary switch opcodes address until we emit
-        // the fopcode, which comes later.
+        // the fopcode, which comes later. Targets of anything but a dex
+        // switch opcode are never emitted.
+        auto src = referenced.find(bt->src);
+        if (src != referenced.end()) {
+          multis[src->second].emplace_back(bt, i);
+        }
       } else if (bt->type == BRANCH_SIMPLE &&
                  is_branch(bt->src->dex_insn->opcode())) {
-        MethodItemEntry* branch_op_mie = bt->src;
-        auto branch_addr = entry_to_addr.find(branch_op_mie);
-        always_assert_log(branch_addr != entry_to_addr.end(),
-                          "%s refers to nonexistent branch instruction",
-                          SHOW(*mentry));
-        int32_t branch_offset = entry_to_addr.at(mentry) - branch_addr->second;
-        if (branch_offset == 1) {
-          needs_resync = true;
-          branch_op_mie->type = MFLOW_FALLTHROUGH;
-          mentry->type = MFLOW_FALLTHROUGH;
-        } else {
-          needs_resync |=
-              !encode_offset(m_fmethod, branch_op_mie, branch_offset);
+        branches.push_back({index_of(bt->src), i});
+      }
+    }
+  }
+
+  for (const auto& branch : branches) {
+    if (is_goto(entries[branch.src]->dex_insn->opcode())) {
+      sizes[branch.src] = 1;
+    }
+  }
+
+  // A goto to the very next opcode is dropped. Whether that is the case only
+  // depends on which entries in between are dropped too, all of which come
+  // later, so this is a single backwards sweep.
+  std::stable_sort(branches.begin(),
+                   branches.end(),
+                   [](const SimpleBranch& a, const SimpleBranch& b) {
+                     return a.src > b.src;
+                   });
+  std::vector<bool> dropped(branches.size(), false);
+  {
+    auto next_sized = static_cast<uint32_t>(num_entries);
+    size_t b = 0;
+    for (auto i = num_entries; i-- > 0;) {
+      for (; b < branches.size() && branches[b].src == i; ++b) {
+        const auto& branch = branches[b];
+        if (sizes[i] == 1 && branch.target > i &&
+            next_sized > branch.target) {
+          entries[branch.src]->type = MFLOW_FALLTHROUGH;
+          entries[branch.target]->type = MFLOW_FALLTHROUGH;
+          sizes[i] = 0;
+          dropped[b] = true;
         }
       }
+      if (sizes[i] != 0) {
+        next_sized = i;
+      }
     }
   }
-  if (needs_resync) {
-    return false;
+
+  std::vector<uint32_t> addrs(num_entries + 1);
+  bool grew;
+  do {
+    grew = false;
+    layout(sizes, &addrs);
+    for (size_t b = 0; b < branches.size(); ++b) {
+      if (dropped[b]) {
+        continue;
+      }
+      const auto& branch = branches[b];
+      int32_t offset = addrs[branch.target] - addrs[branch.src];
+      auto branch_op_mie = entries[branch.src];
+      auto opcode = branch_op_mie->dex_insn->opcode();
+      if (is_goto(opcode)) {
+        auto size = goto_size(offset);
+        if (size > sizes[branch.src]) {
+          sizes[branch.src] = size;
+          grew = true;
+        }
+      } else if (is_conditional_branch(opcode) && bytecount(offset) > 2) {
+        encode_offset(m_fmethod, branch_op_mie, offset);
+        return false;
+      }
+    }
+  } while (grew);
+
+  for (size_t b = 0; b < branches.size(); ++b) {
+    if (!dropped[b]) {
+      const auto& branch = branches[b];
+      encode_offset(m_fmethod,
+                    entries[branch.src],
+                    addrs[branch.target] - addrs[branch.src]);
+    }
   }
 
   size_t num_align_nops{0};
   auto& opout = code->reset_instructions();
-  for (auto& mie : *m_fmethod) {
+  for (uint32_t i = 0; i < num_entries; ++i) {
+    auto& mie = *entries[i];
     // We are assuming that fill-array-data-payload opcodes are always at
     // the end of the opcode stream (we enforce that during instruction
     // lowering). I.e. they are only followed by other fill-array-data-payload
     // opcodes. So adjusting their addresses here does not require re-running
     // branch relaxation.
-    entry_to_addr.at(&mie) += num_align_nops;
+    addrs[i] += num_align_nops;
     if (mie.type == MFLOW_TARGET &&
         mie.target->src->dex_insn->opcode() == OPCODE_FILL_ARRAY_DATA) {
       // This MFLOW_TARGET is right before a fill-array-data-payload opcode,
       // so we should make sure its address is aligned
-      if (entry_to_addr.at(&mie) & 1) {
+      if (addrs[i] & 1) {
         opout.push_back(new DexInstruction(OPCODE_NOP));
-        ++entry_to_addr.at(&mie);
+        ++addrs[i];
         ++num_align_nops;
       }
-      mie.target->src->dex_insn->set_offset(entry_to_addr.at(&mie) -
-                                            entry_to_addr.at(mie.target->src));
+      mie.target->src->dex_insn->set_offset(addrs[i] -
+                                            addrs[index_of(mie.target->src)]);
       continue;
     }
     if (mie.type != MFLOW_DEX_OPCODE) {
@@ -1341,13 +1470,14 @@ bool IRCode::try_sync(DexCode* code) {
     TRACE(MTRANS, 6, "Emitting insn %s\n", SHOW(mie.dex_insn));
     opout.push_back(mie.dex_insn);
   }
-  addr += num_align_nops;
+  uint32_t addr = addrs.back() + num_align_nops;
 
   TRACE(MTRANS, 5, "Emitting multi-branches\n");
   // Step 3, generate multi-branch fopcodes
-  for (auto multiopcode : multi_branches) {
-    auto& targets = multis[multiopcode];
-    auto multi_insn = multiopcode->dex_insn;
+  for (auto multi_index : multi_branches) {
+    auto& targets = multis[multi_index];
+    auto multi_insn = entries[multi_index]->dex_insn;
+    auto multi_addr = addrs[multi_index];
     std::sort(targets.begin(), targets.end(), multi_target_compare_index);
     always_assert_log(!targets.empty(), "need to have targets");
     if (multi_contains_gaps(targets)) {
@@ -1359,9 +1489,9 @@ bool IRCode::try_sync(DexCode* code) {
       uint32_t* spkeys = (uint32_t*)&sparse_payload[2];
       uint32_t* sptargets =
           (uint32_t*)&sparse_payload[2 + (targets.size() * 2)];
-      for (BranchTarget* target : targets) {
-        *spkeys++ = target->index;
-        *sptargets++ = multi_targets[target] - entry_to_addr.at(multiopcode);
+      for (const auto& target : targets) {
+        *spkeys++ = target.first->index;
+        *sptargets++ = addrs[target.second] - multi_addr;
       }
       // Emit align nop
       if (addr & 1) {
@@ -1375,7 +1505,7 @@ bool IRCode::try_sync(DexCode* code) {
       opout.push_back(fop);
       // re-write the source opcode with the address of the
       // fopcode, increment the address of the fopcode.
-      multi_insn->set_offset(addr - entry_to_addr.at(multiopcode));
+      multi_insn->set_offset(addr - multi_addr);
       multi_insn->set_opcode(OPCODE_SPARSE_SWITCH);
       addr += count;
     } else {
@@ -1385,9 +1515,9 @@ bool IRCode::try_sync(DexCode* code) {
       packed_payload[0] = FOPCODE_PACKED_SWITCH;
       packed_payload[1] = targets.size();
       uint32_t* psdata = (uint32_t*)&packed_payload[2];
-      *psdata++ = targets.front()->index;
-      for (BranchTarget* target : targets) {
-        *psdata++ = multi_targets[target] - entry_to_addr.at(multiopcode);
+      *psdata++ = targets.front().first->index;
+      for (const auto& target : targets) {
+        *psdata++ = addrs[target.second] - multi_addr;
       }
       // Emit align nop
       if (addr & 1) {
@@ -1401,7 +1531,7 @@ bool IRCode::try_sync(DexCode* code) {
       opout.push_back(fop);
       // re-write the source opcode with the address of the
       // fopcode, increment the address of the fopcode.
-      multi_insn->set_offset(addr - entry_to_addr.at(multiopcode));
+      multi_insn->set_offset(addr - multi_addr);
       multi_insn->set_opcode(OPCODE_PACKED_SWITCH);
       addr += count;
     }
@@ -1411,12 +1541,13 @@ bool IRCode::try_sync(DexCode* code) {
   TRACE(MTRANS, 5, "Emitting debug opcodes\n");
   auto debugitem = code->get_debug_item();
   if (debugitem) {
-    auto& entries = debugitem->get_entries();
-    for (auto& mentry : *m_fmethod) {
+    auto& dbg_entries = debugitem->get_entries();
+    for (uint32_t i = 0; i < num_entries; ++i) {
+      auto& mentry = *entries[i];
       if (mentry.type == MFLOW_DEBUG) {
-        entries.emplace_back(entry_to_addr.at(&mentry), std::move(mentry.dbgop));
+        dbg_entries.emplace_back(addrs[i], std::move(mentry.dbgop));
       } else if (mentry.type == MFLOW_POSITION) {
-        entries.emplace_back(entry_to_addr.at(&mentry), std::move(mentry.pos));
+        dbg_entries.emplace_back(addrs[i], std::move(mentry.pos));
       }
     }
   }
@@ -1425,7 +1556,9 @@ bool IRCode::try_sync(DexCode* code) {
   auto& tries = code->get_tries();
   tries.clear();
   MethodItemEntry* active_try = nullptr;
-  for (auto& mentry : *m_fmethod) {
+  uint32_t active_try_addr = 0;
+  for (uint32_t i = 0; i < num_entries; ++i) {
+    auto& mentry = *entries[i];
     if (mentry.type != MFLOW_TRY) {
       continue;
     }
@@ -1433,6 +1566,7 @@ bool IRCode::try_sync(DexCode* code) {
     if (tentry->type == TRY_START) {
       always_assert(active_try == nullptr);
       active_try = &mentry;
+      active_try_addr = addrs[i];
       continue;
     }
     assert(tentry->type == TRY_END);
@@ -1447,16 +1581,16 @@ bool IRCode::try_sync(DexCode* code) {
                       "mismatched try start (%s) and end (%s)",
                       SHOW(*try_start),
                       SHOW(*try_end));
-    auto insn_count = entry_to_addr.at(try_end) - entry_to_addr.at(try_start);
+    auto insn_count = addrs[i] - active_try_addr;
     if (insn_count == 0) {
       continue;
     }
-    auto try_item = new DexTryItem(entry_to_addr.at(try_start), insn_count);
+    auto try_item = new DexTryItem(active_try_addr, insn_count);
     for (auto mei = try_end->tentry->catch_start;
         mei != nullptr;
         mei = mei->centry->next) {
       try_item->m_catches.emplace_back(mei->centry->catch_type,
-                                       entry_to_addr.at(mei));
+                                       addrs[index_of(mei)]);
     }
     tries.emplace_back(try_item);
   }
@@ -144,6 +144,8 @@ struct MethodItemEntry {
   MethodItemEntry(): type(MFLOW_FALLTHROUGH) {}
   ~MethodItemEntry();
 
+  REDEX_POOL_ALLOCATED(MethodItemEntry)
+
   /*
    * This should only ever be used by the instruction lowering step. Do NOT use
    * it in passes!
@@ -185,9 +187,9 @@ class Block;
 class IRCode {
  private:
   /* try_sync() is the work-horse of sync.  It's intended such that it can fail
-   * in the event that an opcode needs to be resized.  In that instance, it
-   * changes the opcode in question, and returns false.  It's intended to be
-   * called multiple times until it returns true.
+   * in the event that an if-* opcode's offset doesn't fit, and it has to be
+   * rewritten into new opcodes.  In that instance, it returns false.  It's
+   * intended to be called multiple times until it returns true.
    */
   bool try_sync(DexCode*);
 
@@ -205,6 +207,13 @@ class IRCode {
   // exposing the param names should be enough
   std::unique_ptr<DexDebugItem> m_dbg;
 
+  uint64_t m_generation{0};
+  // The generation and fingerprint at which the code last passed
+  // IRTypeChecker::run_if_changed().
+  bool m_checked{false};
+  uint64_t m_checked_generation{0};
+  uint64_t m_checked_fingerprint{0};
+
  private:
   FatMethod::iterator main_block();
   FatMethod::iterator insert(FatMethod::iterator cur, IRInstruction* insn);
@@ -250,9 +259,28 @@ class IRCode {
 
   uint16_t get_registers_size() const { return m_registers_size; }
 
-  void set_registers_size(uint16_t sz) { m_registers_size = sz; }
+  void set_registers_size(uint16_t sz) {
+    ++m_generation;
+    m_registers_size = sz;
+  }
 
-  uint16_t allocate_temp() { return m_registers_size++; }
+  uint16_t allocate_temp() {
+    ++m_generation;
+    return m_registers_size++;
+  }
+
+  /*
+   * Incremented by the members of IRCode that edit the code. It does not see
+   * edits made through IRInstruction's setters or directly on the entries;
+   * IRTypeChecker::run_if_changed() makes up for that with a fingerprint of
+   * the code.
+   */
+  uint64_t generation() const { return m_generation; }
+
+  /*
+   * For code that edits the entries behind IRCode's back.
+   */
+  void mark_changed() { ++m_generation; }
 
   /*
    * Find the subrange of load-param instructions. These instructions should
@@ -262,6 +290,9 @@ class IRCode {
 
   const DexDebugItem* get_debug_item() const { return m_dbg.get(); }
   DexDebugItem* get_debug_item() { return m_dbg.get(); }
+  void set_debug_item(std::unique_ptr<DexDebugItem> dbg) {
+    m_dbg = std::move(dbg);
+  }
   std::unique_ptr<DexDebugItem> release_debug_item() {
     return std::move(m_dbg);
   }
@@ -312,11 +343,13 @@ class IRCode {
 
   template <class... Args>
   void push_back(Args&&... args) {
+    ++m_generation;
     m_fmethod->push_back(*(new MethodItemEntry(std::forward<Args>(args)...)));
   }
 
   /* Passes memory ownership of "mie" to callee. */
   void push_back(MethodItemEntry& mie) {
+    ++m_generation;
     m_fmethod->push_back(mie);
   }
 
@@ -339,6 +372,7 @@ class IRCode {
   template <class... Args>
   FatMethod::iterator insert_before(const FatMethod::iterator& position,
                                     Args&&... args) {
+    ++m_generation;
     return m_fmethod->insert(
         position, *(new MethodItemEntry(std::forward<Args>(args)...)));
   }
@@ -347,6 +381,7 @@ class IRCode {
   FatMethod::iterator insert_after(const FatMethod::iterator& position,
                                    Args&&... args) {
     always_assert(position != m_fmethod->end());
+    ++m_generation;
     return m_fmethod->insert(
         std::next(position),
         *(new MethodItemEntry(std::forward<Args>(args)...)));
@@ -389,9 +424,11 @@ class IRCode {
   FatMethod::reverse_iterator rend() { return m_fmethod->rend(); }
 
   FatMethod::iterator erase(FatMethod::iterator it) {
+    ++m_generation;
     return m_fmethod->erase(it);
   }
   FatMethod::iterator erase_and_dispose(FatMethod::iterator it) {
+    ++m_generation;
     return m_fmethod->erase_and_dispose(it, FatMethodDisposer());
   }
 
@@ -402,6 +439,7 @@ class IRCode {
   friend std::string show(const IRCode*);
 
   friend class MethodSplicer;
+  friend class IRTypeChecker;
 };
 
 class InstructionIterator {
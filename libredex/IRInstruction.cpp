@@ -216,7 +216,7 @@ void IRInstruction::denormalize_registers() {
   always_assert(!opcode::has_range(m_opcode));
   if (is_invoke(m_opcode)) {
     auto& args = get_method()->get_proto()->get_args()->get_type_list();
-    std::vector<uint16_t> srcs;
+    SrcRegs srcs;
     size_t args_idx {0};
     size_t srcs_idx {0};
     if (m_opcode != OPCODE_INVOKE_STATIC) {
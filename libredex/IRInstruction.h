@@ -9,7 +9,10 @@
 
 #pragma once
 
+#include <boost/container/small_vector.hpp>
+
 #include "DexInstruction.h"
+#include "ObjectPool.h"
 
 /*
  * IRInstruction is very similar to the Dalvik instruction set, but with a few
@@ -98,9 +101,17 @@
  *     return-void
  *   B2: <catches exceptions from B1>
  *     invoke-static {v0} LQux;.a(LFoo;)V
+ *
+ * Source registers are stored inline for up to five operands (the most a
+ * non-range invoke can have), so most instructions need no allocation
+ * besides the instruction itself, which comes from an ObjectPool.
  */
 class IRInstruction final {
  public:
+  using SrcRegs = boost::container::small_vector<uint16_t, 5>;
+
+  REDEX_POOL_ALLOCATED(IRInstruction)
+
   explicit IRInstruction(DexOpcode op);
 
   /*
@@ -182,7 +193,7 @@ class IRInstruction final {
     return m_dest;
   }
   uint16_t src(size_t i) const { return m_srcs.at(i); }
-  const std::vector<uint16_t>& srcs() const { return m_srcs; }
+  const SrcRegs& srcs() const { return m_srcs; }
   uint16_t arg_word_count() const { return m_srcs.size(); }
 
   /*
@@ -306,7 +317,7 @@ class IRInstruction final {
 
  private:
   DexOpcode m_opcode;
-  std::vector<uint16_t> m_srcs;
+  SrcRegs m_srcs;
   uint16_t m_dest {0};
   union {
     // Zero-initialize this union with the uint64_t member instead of a
@@ -1422,8 +1422,115 @@ void IRTypeChecker::run() {
   m_complete = true;
 }
 
+namespace {
+
+inline void mix(uint64_t* h, uint64_t v) {
+  // boost::hash_combine, widened to 64 bits.
+  *h ^= v + 0x9e3779b97f4a7c15ULL + (*h << 6) + (*h >> 2);
+}
+
+inline void mix(uint64_t* h, const void* p) {
+  mix(h, reinterpret_cast<uintptr_t>(p));
+}
+
+} // namespace
+
+/*
+ * Covers everything the check depends on: the entries in order, identified by
+ * their address since branch targets and catch entries refer to each other
+ * that way, the instructions' operands, and the parts of the method, fields
+ * and callees that the type inference reads.
+ */
+uint64_t IRTypeChecker::fingerprint(const IRCode* code) const {
+  uint64_t h = 0;
+  mix(&h, m_enable_polymorphic_constants);
+  mix(&h, m_verify_moves);
+  mix(&h, m_dex_method->get_proto());
+  mix(&h, is_static(m_dex_method));
+  mix(&h, code->get_registers_size());
+  for (const auto& mie : *code) {
+    if (mie.type == MFLOW_FALLTHROUGH) {
+      // Dropped by build_cfg().
+      continue;
+    }
+    mix(&h, mie.type);
+    mix(&h, &mie);
+    switch (mie.type) {
+    case MFLOW_OPCODE: {
+      auto insn = mie.insn;
+      mix(&h, insn);
+      mix(&h, insn->opcode());
+      if (insn->dests_size()) {
+        mix(&h, insn->dest());
+      }
+      mix(&h, insn->srcs_size());
+      for (auto src : insn->srcs()) {
+        mix(&h, src);
+      }
+      if (insn->has_literal()) {
+        mix(&h, insn->get_literal());
+      } else if (insn->has_string()) {
+        mix(&h, insn->get_string());
+      } else if (insn->has_type()) {
+        mix(&h, insn->get_type());
+      } else if (insn->has_field()) {
+        mix(&h, insn->get_field());
+        mix(&h, insn->get_field()->get_type());
+      } else if (insn->has_method()) {
+        mix(&h, insn->get_method());
+        mix(&h, insn->get_method()->get_proto());
+      } else if (insn->has_data()) {
+        mix(&h, insn->get_data());
+      }
+      break;
+    }
+    case MFLOW_TRY:
+      mix(&h, mie.tentry->type);
+      mix(&h, mie.tentry->catch_start);
+      break;
+    case MFLOW_CATCH:
+      mix(&h, mie.centry->catch_type);
+      mix(&h, mie.centry->next);
+      break;
+    case MFLOW_TARGET:
+      mix(&h, mie.target->type);
+      mix(&h, mie.target->src);
+      mix(&h, mie.target->index);
+      break;
+    default:
+      break;
+    }
+  }
+  return h;
+}
+
+bool IRTypeChecker::run_if_changed() {
+  IRCode* code = m_dex_method->get_code();
+  if (code == nullptr || m_complete) {
+    run();
+    return false;
+  }
+  // Any change through IRCode's own members shows in the generation, so
+  // only code that looks unchanged needs fingerprinting.
+  if (code->m_checked && code->m_checked_generation == code->generation() &&
+      code->m_checked_fingerprint == fingerprint(code)) {
+    m_complete = true;
+    return false;
+  }
+  run();
+  if (m_good) {
+    code->m_checked = true;
+    code->m_checked_generation = code->generation();
+    code->m_checked_fingerprint = fingerprint(code);
+  }
+  return true;
+}
+
 IRType IRTypeChecker::get_type(IRInstruction* insn, uint16_t reg) const {
   check_completion();
+  always_assert_log(m_type_inference != nullptr,
+                    "No types inferred for method %s.\n",
+                    m_dex_method->get_deobfuscated_name().c_str());
   auto& type_envs = m_type_inference->m_type_envs;
   auto it = type_envs.find(insn);
   if (it == type_envs.end()) {
@@ -197,6 +197,13 @@ class IRTypeChecker final {
 
   void run();
 
+  /*
+   * Like run(), but skips methods whose code has not changed since it last
+   * passed this way, and reports them as good. Returns whether the method was
+   * actually checked. get_type() is not available after a skipped check.
+   */
+  bool run_if_changed();
+
   bool good() const {
     check_completion();
     return m_good;
@@ -235,6 +242,8 @@ class IRTypeChecker final {
                       m_dex_method->get_deobfuscated_name().c_str());
   }
 
+  uint64_t fingerprint(const IRCode* code) const;
+
   DexMethod* m_dex_method;
   bool m_complete;
   bool m_enable_polymorphic_constants;
@@ -8,12 +8,16 @@
  */
 
 #include "Inliner.h"
+
+#include <boost/functional/hash.hpp>
+
 #include "IRInstruction.h"
 #include "DexUtil.h"
 #include "Mutators.h"
 #include "Resolver.h"
 #include "Transform.h"
 #include "Walkers.h"
+#include "WorkQueue.h"
 
 namespace {
 
@@ -143,6 +147,49 @@ bool method_ok(DexType* type, DexMethodRef* meth) {
   return false;
 }
 
+/**
+ * Resolvers handed to the inliner typically fill a MethodRefCache, which is
+ * not safe to use from several threads. This puts a lock-striped cache in
+ * front of such a resolver and only calls it, under a lock, on a miss.
+ */
+class ConcurrentResolver {
+  using Key = std::pair<DexMethodRef*, MethodSearch>;
+  struct Shard {
+    std::mutex mtx;
+    std::unordered_map<Key, DexMethod*, boost::hash<Key>> cache;
+  };
+  static constexpr size_t kShards = 32;
+
+  std::function<DexMethod*(DexMethodRef*, MethodSearch)> m_resolver;
+  std::mutex m_resolver_mtx;
+  Shard m_shards[kShards];
+
+ public:
+  explicit ConcurrentResolver(
+      std::function<DexMethod*(DexMethodRef*, MethodSearch)> resolver)
+      : m_resolver(resolver) {}
+
+  DexMethod* resolve(DexMethodRef* ref, MethodSearch search) {
+    Key key(ref, search);
+    auto& shard = m_shards[boost::hash<Key>()(key) % kShards];
+    {
+      std::lock_guard<std::mutex> guard(shard.mtx);
+      auto it = shard.cache.find(key);
+      if (it != shard.cache.end()) {
+        return it->second;
+      }
+    }
+    DexMethod* method;
+    {
+      std::lock_guard<std::mutex> guard(m_resolver_mtx);
+      method = m_resolver(ref, search);
+    }
+    std::lock_guard<std::mutex> guard(shard.mtx);
+    shard.cache.emplace(key, method);
+    return method;
+  }
+};
+
 }
 
 MultiMethodInliner::MultiMethodInliner(
@@ -174,22 +221,55 @@ void MultiMethodInliner::inline_methods() {
   // we want to inline bottom up, so as a first step we identify all the
   // top level callers, then we recurse into all inlinable callees until we
   // hit a leaf and we start inlining from there
+  std::vector<InlineStep> steps;
   for (auto it : caller_callee) {
     auto caller = it.first;
-    TraceContext context(caller->get_deobfuscated_name());
     // if the caller is not a top level keep going, it will be traversed
     // when inlining a top level caller
     if (callee_caller.find(caller) != callee_caller.end()) continue;
     std::unordered_set<DexMethod*> visited;
     visited.insert(caller);
-    caller_inline(caller, it.second, visited);
+    caller_inline(caller, it.second, visited, steps);
+  }
+
+  if (!m_config.parallel) {
+    for (const auto& step : steps) {
+      TraceContext context(step.caller);
+      inline_callees(step.caller, step.callees);
+    }
+    return;
   }
+
+  auto serial_resolver = resolver;
+  auto concurrent_resolver =
+      std::make_shared<ConcurrentResolver>(serial_resolver);
+  resolver = [concurrent_resolver](DexMethodRef* ref, MethodSearch search) {
+    return concurrent_resolver->resolve(ref, search);
+  };
+  m_defer_visibility = true;
+  run_steps_in_waves(steps);
+  m_defer_visibility = false;
+  resolver = serial_resolver;
+
+  for (auto cls : m_public_classes) {
+    set_public(cls);
+  }
+  for (auto method : m_public_methods) {
+    set_public(method);
+  }
+  for (auto field : m_public_fields) {
+    set_public(field);
+  }
+  m_public_classes.clear();
+  m_public_methods.clear();
+  m_public_fields.clear();
 }
 
 void MultiMethodInliner::caller_inline(
     DexMethod* caller,
     const std::vector<DexMethod*>& callees,
-    std::unordered_set<DexMethod*>& visited) {
+    std::unordered_set<DexMethod*>& visited,
+    std::vector<InlineStep>& steps) {
   std::vector<DexMethod*> nonrecursive_callees;
   nonrecursive_callees.reserve(callees.size());
   // recurse into the callees in case they have something to inline on
@@ -206,11 +286,79 @@ void MultiMethodInliner::caller_inline(
     auto maybe_caller = caller_callee.find(callee);
     if (maybe_caller != caller_callee.end()) {
       visited.insert(callee);
-      caller_inline(callee, maybe_caller->second, visited);
+      caller_inline(callee, maybe_caller->second, visited, steps);
       visited.erase(callee);
     }
   }
-  inline_callees(caller, nonrecursive_callees);
+  steps.push_back(InlineStep{caller, std::move(nonrecursive_callees)});
+}
+
+void MultiMethodInliner::run_steps_in_waves(
+    const std::vector<InlineStep>& steps) {
+  // A step reads the code of its callees and rewrites the code of its caller
+  // (and, via change_visibility, of the callees it inlines). Give each step
+  // the wave right after the latest earlier step touching any of those
+  // methods. Steps in the same wave then touch disjoint methods, and every
+  // method sees the same sequence of steps as in the serial walk.
+  std::unordered_map<DexMethod*, size_t> last_wave;
+  std::vector<std::vector<size_t>> waves;
+  for (size_t i = 0; i < steps.size(); ++i) {
+    const auto& step = steps[i];
+    size_t wave = 0;
+    auto bump = [&](DexMethod* method) {
+      auto it = last_wave.find(method);
+      if (it != last_wave.end()) {
+        wave = std::max(wave, it->second + 1);
+      }
+    };
+    bump(step.caller);
+    for (auto callee : step.callees) {
+      bump(callee);
+    }
+    last_wave[step.caller] = wave;
+    for (auto callee : step.callees) {
+      last_wave[callee] = wave;
+    }
+    if (wave == waves.size()) {
+      waves.emplace_back();
+    }
+    waves[wave].push_back(i);
+  }
+  TRACE(MMINL, 2, "%ld inlining steps in %ld waves\n",
+      steps.size(), waves.size());
+
+  for (const auto& wave : waves) {
+    auto wq = workqueue_foreach<size_t>([&](size_t i) {
+      const auto& step = steps[i];
+      TraceContext context(step.caller);
+      inline_callees(step.caller, step.callees);
+    });
+    for (auto i : wave) {
+      wq.add_item(i);
+    }
+    wq.run_all();
+  }
+}
+
+MultiMethodInliner::InliningInfo MultiMethodInliner::get_info() const {
+  InliningInfo snapshot;
+  snapshot.calls_inlined = info.calls_inlined;
+  snapshot.recursive = info.recursive;
+  snapshot.not_found = info.not_found;
+  snapshot.blacklisted = info.blacklisted;
+  snapshot.throws = info.throws;
+  snapshot.multi_ret = info.multi_ret;
+  snapshot.need_vmethod = info.need_vmethod;
+  snapshot.invoke_super = info.invoke_super;
+  snapshot.write_over_ins = info.write_over_ins;
+  snapshot.escaped_virtual = info.escaped_virtual;
+  snapshot.non_pub_virtual = info.non_pub_virtual;
+  snapshot.escaped_field = info.escaped_field;
+  snapshot.non_pub_field = info.non_pub_field;
+  snapshot.non_pub_ctor = info.non_pub_ctor;
+  snapshot.cross_store = info.cross_store;
+  snapshot.caller_too_large = info.caller_too_large;
+  return snapshot;
 }
 
 void MultiMethodInliner::inline_callees(
@@ -259,6 +407,7 @@ void MultiMethodInliner::inline_callees(
     estimated_insn_size += callee->get_code()->sum_opcode_sizes();
     change_visibility(callee);
     info.calls_inlined++;
+    std::lock_guard<std::mutex> guard(m_mutex);
     inlined.insert(callee);
   }
 }
@@ -405,6 +554,7 @@ bool MultiMethodInliner::create_vmethod(IRInstruction* insn) {
       return false;
     }
     if (!is_native(method)) {
+      std::lock_guard<std::mutex> guard(m_mutex);
       m_make_static.insert(method);
     } else {
       info.need_vmethod++;
@@ -567,7 +717,7 @@ void MultiMethodInliner::change_visibility(DexMethod* callee) {
     if (insn->has_field()) {
       auto cls = type_class(insn->get_field()->get_class());
       if (cls != nullptr && !cls->is_external()) {
-        set_public(cls);
+        make_public(cls);
       }
       auto field =
           resolve_field(insn->get_field(), is_sfield_op(insn->opcode())
@@ -576,8 +726,8 @@ void MultiMethodInliner::change_visibility(DexMethod* callee) {
         TRACE(MMINL, 6, "changing visibility of %s.%s %s\n",
             SHOW(field->get_class()), SHOW(field->get_name()),
             SHOW(field->get_type()));
-        set_public(field);
-        set_public(type_class(field->get_class()));
+        make_public(field);
+        make_public(type_class(field->get_class()));
         // FIXME no point in rewriting opcodes in the callee
         insn->set_field(field);
       }
@@ -586,15 +736,15 @@ void MultiMethodInliner::change_visibility(DexMethod* callee) {
     if (insn->has_method()) {
       auto cls = type_class(insn->get_method()->get_class());
       if (cls != nullptr && !cls->is_external()) {
-        set_public(cls);
+        make_public(cls);
       }
       auto method = resolver(insn->get_method(), opcode_to_search(insn));
       if (method != nullptr && method->is_concrete()) {
         TRACE(MMINL, 6, "changing visibility of %s.%s: %s\n",
             SHOW(method->get_class()), SHOW(method->get_name()),
             SHOW(method->get_proto()));
-        set_public(method);
-        set_public(type_class(method->get_class()));
+        make_public(method);
+        make_public(type_class(method->get_class()));
         // FIXME no point in rewriting opcodes in the callee
         insn->set_method(method);
       }
@@ -605,7 +755,7 @@ void MultiMethodInliner::change_visibility(DexMethod* callee) {
       auto cls = type_class(type);
       if (cls != nullptr && !cls->is_external()) {
         TRACE(MMINL, 6, "changing visibility of %s\n", SHOW(type));
-        set_public(cls);
+        make_public(cls);
       }
       continue;
     }
@@ -617,11 +767,38 @@ void MultiMethodInliner::change_visibility(DexMethod* callee) {
     auto cls = type_class(type);
     if (cls != nullptr && !cls->is_external()) {
       TRACE(MMINL, 6, "changing visibility of %s\n", SHOW(type));
-      set_public(cls);
+      make_public(cls);
     }
   }
 }
 
+void MultiMethodInliner::make_public(DexClass* cls) {
+  if (!m_defer_visibility) {
+    set_public(cls);
+    return;
+  }
+  std::lock_guard<std::mutex> guard(m_mutex);
+  m_public_classes.push_back(cls);
+}
+
+void MultiMethodInliner::make_public(DexMethod* method) {
+  if (!m_defer_visibility) {
+    set_public(method);
+    return;
+  }
+  std::lock_guard<std::mutex> guard(m_mutex);
+  m_public_methods.push_back(method);
+}
+
+void MultiMethodInliner::make_public(DexField* field) {
+  if (!m_defer_visibility) {
+    set_public(field);
+    return;
+  }
+  std::lock_guard<std::mutex> guard(m_mutex);
+  m_public_fields.push_back(field);
+}
+
 void MultiMethodInliner::invoke_direct_to_static() {
   // We sort the methods here because make_static renames methods on collision,
   // and which collisions occur is order-dependent. E.g. if we have the
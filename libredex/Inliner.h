@@ -9,8 +9,10 @@
 
 #pragma once
 
+#include <atomic>
 #include <functional>
 #include <map>
+#include <mutex>
 #include <set>
 #include <vector>
 
@@ -58,6 +60,11 @@ void inline_method(IRCode* caller,
  * Not all methods may be inlined both for restriction on the caller or the
  * callee.
  * Perform inlining bottom up.
+ *
+ * With Config::parallel set, inlining steps that touch disjoint sets of
+ * methods are run concurrently, in waves that respect the order in which the
+ * serial walk would have touched each method. The result is identical to the
+ * serial mode.
  */
 class MultiMethodInliner {
  public:
@@ -66,6 +73,7 @@ class MultiMethodInliner {
     std::unordered_set<DexType*> black_list;
     std::unordered_set<DexType*> caller_black_list;
     std::unordered_set<DexType*> whitelist_no_method_limit;
+    bool parallel{false};
   };
 
   MultiMethodInliner(
@@ -99,14 +107,31 @@ class MultiMethodInliner {
 
  private:
   /**
-   * Inline all callees into caller.
+   * One call to inline_callees() in the bottom up walk.
+   */
+  struct InlineStep {
+    DexMethod* caller;
+    std::vector<DexMethod*> callees;
+  };
+
+  /**
+   * Schedule the inlining of all callees into caller.
    * Recurse in a callee if that has inlinable candidates of its own.
-   * Inlining is bottom up.
+   * Inlining is bottom up, so callees' steps come before the caller's.
+   * The walk only depends on the call graph, never on what gets inlined.
    */
   void caller_inline(
       DexMethod* caller,
       const std::vector<DexMethod*>& callees,
-      std::unordered_set<DexMethod*>& visited);
+      std::unordered_set<DexMethod*>& visited,
+      std::vector<InlineStep>& steps);
+
+  /**
+   * Run the steps concurrently. A step reads and writes the code of its
+   * caller and callees only, so it waits for the last earlier step that
+   * touched any of them; steps whose dependencies are done form a wave.
+   */
+  void run_steps_in_waves(const std::vector<InlineStep>& steps);
 
   /**
    * Return true if the callee is inlinable into the caller.
@@ -204,6 +229,16 @@ class MultiMethodInliner {
    */
   void change_visibility(DexMethod* callee);
 
+  /**
+   * set_public(), deferred to the end of inlining in parallel mode so that
+   * no access flags change while other threads are checking them. Deferring
+   * does not change any decision: the inlinability checks only look at the
+   * visibility of external or non-concrete members, which we never touch.
+   */
+  void make_public(DexClass* cls);
+  void make_public(DexMethod* method);
+  void make_public(DexField* field);
+
   /**
    * Staticize required methods (stored in `m_make_static`) and update
    * opcodes accordingly.
@@ -229,6 +264,16 @@ class MultiMethodInliner {
    */
   std::unordered_set<DexMethod*> inlined;
 
+  /**
+   * Guards `inlined`, `m_make_static` and the deferred visibility changes
+   * while steps run in parallel.
+   */
+  std::mutex m_mutex;
+  bool m_defer_visibility{false};
+  std::vector<DexClass*> m_public_classes;
+  std::vector<DexMethod*> m_public_methods;
+  std::vector<DexField*> m_public_fields;
+
   //
   // Maps from callee to callers and reverse map from caller to callees.
   // Those are used to perform bottom up inlining.
@@ -243,25 +288,32 @@ class MultiMethodInliner {
   /**
    * Info about inlining.
    */
-  struct InliningInfo {
-    size_t calls_inlined{0};
-    size_t recursive{0};
-    size_t not_found{0};
-    size_t blacklisted{0};
-    size_t throws{0};
-    size_t multi_ret{0};
-    size_t need_vmethod{0};
-    size_t invoke_super{0};
-    size_t write_over_ins{0};
-    size_t escaped_virtual{0};
-    size_t non_pub_virtual{0};
-    size_t escaped_field{0};
-    size_t non_pub_field{0};
-    size_t non_pub_ctor{0};
-    size_t cross_store{0};
-    size_t caller_too_large{0};
+  template <typename Counter>
+  struct InliningInfoT {
+    Counter calls_inlined{0};
+    Counter recursive{0};
+    Counter not_found{0};
+    Counter blacklisted{0};
+    Counter throws{0};
+    Counter multi_ret{0};
+    Counter need_vmethod{0};
+    Counter invoke_super{0};
+    Counter write_over_ins{0};
+    Counter escaped_virtual{0};
+    Counter non_pub_virtual{0};
+    Counter escaped_field{0};
+    Counter non_pub_field{0};
+    Counter non_pub_ctor{0};
+    Counter cross_store{0};
+    Counter caller_too_large{0};
   };
-  InliningInfo info;
+
+ public:
+  using InliningInfo = InliningInfoT<size_t>;
+
+ private:
+  // Atomic, as steps running in parallel all update the same counters.
+  InliningInfoT<std::atomic<size_t>> info;
 
   const std::vector<DexClass*>& m_scope;
 
@@ -270,9 +322,7 @@ class MultiMethodInliner {
   std::unordered_set<DexMethod*> m_make_static;
 
  public:
-  const InliningInfo& get_info() {
-    return info;
-  }
+  InliningInfo get_info() const;
 };
 
 /**
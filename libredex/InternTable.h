@@ -0,0 +1,337 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+/*
+ * A concurrent hash map for RedexContext's interning tables.
+ *
+ * The table is split into shards, each with its own mutex and its own array
+ * of bucket chains. Lookups take no lock at all: they read the bucket array
+ * and walk the chain through atomic pointers. Writers lock only the shard
+ * they touch.
+ *
+ * To keep lock-free readers safe, memory is never reclaimed while the table
+ * is alive: erased nodes are unlinked but kept, and growing a shard copies
+ * its nodes into a new bucket array while the old one is retired. Erasing is
+ * rare (renaming members), and retired arrays add up to at most the size of
+ * the live one, so this costs little.
+ *
+ * Values should be cheap to copy (pointers); a default-constructed Value is
+ * returned for missing keys.
+ */
+template <typename Key,
+          typename Value,
+          typename Hash = std::hash<Key>,
+          typename Equal = std::equal_to<Key>>
+class InternTable {
+  static constexpr size_t kShardBits = 6;
+  static constexpr size_t kShards = size_t(1) << kShardBits;
+  static constexpr size_t kInitialBuckets = 16;
+
+  struct Node {
+    Node(const Key& k, const Value& v, size_t h, Node* n)
+        : key(k), value(v), hash(h), next(n) {}
+    const Key key;
+    const Value value;
+    const size_t hash;
+    std::atomic<Node*> next;
+  };
+
+  struct Buckets {
+    explicit Buckets(size_t n)
+        : mask(n - 1), heads(new std::atomic<Node*>[n]) {
+      for (size_t i = 0; i < n; ++i) {
+        heads[i].store(nullptr, std::memory_order_relaxed);
+      }
+    }
+    const size_t mask;
+    std::unique_ptr<std::atomic<Node*>[]> heads;
+  };
+
+  struct Shard {
+    mutable std::mutex mtx;
+    std::atomic<Buckets*> buckets{nullptr};
+    size_t size{0};
+    std::vector<Buckets*> retired_buckets;
+    std::vector<Node*> retired_nodes;
+  };
+
+  Shard m_shards[kShards];
+
+  static size_t hash_of(const Key& key) {
+    // Mix the bits: std::hash of a pointer is the pointer itself.
+    uint64_t h = Hash()(key);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+  }
+
+  Shard& shard_for(size_t h) {
+    return m_shards[h >> (sizeof(size_t) * 8 - kShardBits)];
+  }
+  const Shard& shard_for(size_t h) const {
+    return m_shards[h >> (sizeof(size_t) * 8 - kShardBits)];
+  }
+
+  static Node* find_in(const Buckets* buckets, const Key& key, size_t h) {
+    if (buckets == nullptr) {
+      return nullptr;
+    }
+    auto node = buckets->heads[h & buckets->mask].load(
+        std::memory_order_acquire);
+    for (; node != nullptr; node = node->next.load(std::memory_order_acquire)) {
+      if (node->hash == h && Equal()(node->key, key)) {
+        return node;
+      }
+    }
+    return nullptr;
+  }
+
+  // Requires the shard lock.
+  void link(Shard& shard, const Key& key, const Value& value, size_t h) {
+    auto buckets = shard.buckets.load(std::memory_order_relaxed);
+    if (buckets == nullptr) {
+      buckets = new Buckets(kInitialBuckets);
+      shard.buckets.store(buckets, std::memory_order_release);
+    } else if (shard.size >= 2 * (buckets->mask + 1)) {
+      buckets = grow(shard, buckets);
+    }
+    auto& head = buckets->heads[h & buckets->mask];
+    auto node = new Node(key, value, h, head.load(std::memory_order_relaxed));
+    head.store(node, std::memory_order_release);
+    ++shard.size;
+  }
+
+  // Requires the shard lock.
+  bool unlink(Shard& shard, const Key& key, size_t h) {
+    auto buckets = shard.buckets.load(std::memory_order_relaxed);
+    if (buckets == nullptr) {
+      return false;
+    }
+    auto prev = &buckets->heads[h & buckets->mask];
+    for (auto node = prev->load(std::memory_order_relaxed); node != nullptr;
+         node = prev->load(std::memory_order_relaxed)) {
+      if (node->hash == h && Equal()(node->key, key)) {
+        // Readers standing on `node` can still follow its next pointer.
+        prev->store(node->next.load(std::memory_order_relaxed),
+                    std::memory_order_release);
+        shard.retired_nodes.push_back(node);
+        --shard.size;
+        return true;
+      }
+      prev = &node->next;
+    }
+    return false;
+  }
+
+  // See rekey() and rekey_or_drop().
+  bool move_entry(const Key& from,
+                  const Key& to,
+                  const Value& value,
+                  bool drop_on_collision) {
+    auto from_h = hash_of(from);
+    auto to_h = hash_of(to);
+    auto& from_shard = shard_for(from_h);
+    auto& to_shard = shard_for(to_h);
+    std::unique_lock<std::mutex> from_lock(from_shard.mtx, std::defer_lock);
+    std::unique_lock<std::mutex> to_lock(to_shard.mtx, std::defer_lock);
+    if (&from_shard == &to_shard) {
+      from_lock.lock();
+    } else {
+      std::lock(from_lock, to_lock);
+    }
+    auto node =
+        find_in(to_shard.buckets.load(std::memory_order_relaxed), to, to_h);
+    if (node != nullptr) {
+      if (from_h == to_h && Equal()(from, to) && node->value == value) {
+        return true;
+      }
+      if (drop_on_collision) {
+        unlink(from_shard, from, from_h);
+      }
+      return false;
+    }
+    // Link first, so that lock-free readers find at least one of the two.
+    link(to_shard, to, value, to_h);
+    unlink(from_shard, from, from_h);
+    return true;
+  }
+
+
+  // Requires the shard lock.
+  Buckets* grow(Shard& shard, Buckets* old_buckets) {
+    auto n = (old_buckets->mask + 1) * 4;
+    auto buckets = new Buckets(n);
+    for (size_t i = 0; i <= old_buckets->mask; ++i) {
+      auto node = old_buckets->heads[i].load(std::memory_order_relaxed);
+      while (node != nullptr) {
+        auto& head = buckets->heads[node->hash & buckets->mask];
+        head.store(new Node(node->key,
+                            node->value,
+                            node->hash,
+                            head.load(std::memory_order_relaxed)),
+                   std::memory_order_relaxed);
+        shard.retired_nodes.push_back(node);
+        node = node->next.load(std::memory_order_relaxed);
+      }
+    }
+    shard.buckets.store(buckets, std::memory_order_release);
+    shard.retired_buckets.push_back(old_buckets);
+    return buckets;
+  }
+
+ public:
+  InternTable() = default;
+  InternTable(const InternTable&) = delete;
+  InternTable& operator=(const InternTable&) = delete;
+
+  ~InternTable() {
+    for (auto& shard : m_shards) {
+      auto buckets = shard.buckets.load();
+      if (buckets != nullptr) {
+        for (size_t i = 0; i <= buckets->mask; ++i) {
+          auto node = buckets->heads[i].load();
+          while (node != nullptr) {
+            auto next = node->next.load();
+            delete node;
+            node = next;
+          }
+        }
+        delete buckets;
+      }
+      for (auto node : shard.retired_nodes) {
+        delete node;
+      }
+      for (auto retired : shard.retired_buckets) {
+        delete retired;
+      }
+    }
+  }
+
+  /*
+   * Lock-free lookup.
+   */
+  Value get(const Key& key) const {
+    auto h = hash_of(key);
+    auto& shard = shard_for(h);
+    auto node =
+        find_in(shard.buckets.load(std::memory_order_acquire), key, h);
+    return node != nullptr ? node->value : Value();
+  }
+
+  /*
+   * Return the value for `key`, creating it if missing. `create` runs under
+   * the shard lock, at most once, and returns the key to store (which must
+   * compare equal to `key`, but may point into the new value) along with the
+   * value.
+   */
+  template <typename Create>
+  Value get_or_create(const Key& key, Create create) {
+    auto h = hash_of(key);
+    auto& shard = shard_for(h);
+    auto node =
+        find_in(shard.buckets.load(std::memory_order_acquire), key, h);
+    if (node != nullptr) {
+      return node->value;
+    }
+    std::lock_guard<std::mutex> guard(shard.mtx);
+    node = find_in(shard.buckets.load(std::memory_order_relaxed), key, h);
+    if (node != nullptr) {
+      return node->value;
+    }
+    std::pair<Key, Value> entry = create();
+    link(shard, entry.first, entry.second, h);
+    return entry.second;
+  }
+
+  /*
+   * Insert unless the key is already present. Returns whether it inserted.
+   */
+  bool insert(const Key& key, const Value& value) {
+    auto h = hash_of(key);
+    auto& shard = shard_for(h);
+    std::lock_guard<std::mutex> guard(shard.mtx);
+    if (find_in(shard.buckets.load(std::memory_order_relaxed), key, h)) {
+      return false;
+    }
+    link(shard, key, value, h);
+    return true;
+  }
+
+  /*
+   * Remove the key if present. Returns whether it was present.
+   */
+  bool erase(const Key& key) {
+    auto h = hash_of(key);
+    auto& shard = shard_for(h);
+    std::lock_guard<std::mutex> guard(shard.mtx);
+    return unlink(shard, key, h);
+  }
+
+  /*
+   * Move the entry for `from` to `to`, storing `value` there, while holding
+   * the locks of both shards, so that no writer of either key sees the entry
+   * missing or present twice. Fails without changing anything if `to` is
+   * already taken by another entry.
+   */
+  bool rekey(const Key& from, const Key& to, const Value& value) {
+    return move_entry(from, to, value, /* drop_on_collision */ false);
+  }
+
+  /*
+   * Like rekey(), except that if `to` is already taken by another entry, the
+   * entry for `from` is removed and the other one kept. Returns whether
+   * `value` ended up under `to`.
+   */
+  bool rekey_or_drop(const Key& from, const Key& to, const Value& value) {
+    return move_entry(from, to, value, /* drop_on_collision */ true);
+  }
+
+  bool contains(const Key& key) const { return get(key) != Value(); }
+
+  /*
+   * Visit all entries. Not safe to run concurrently with writers.
+   */
+  template <typename Fn>
+  void for_each(Fn fn) const {
+    for (auto& shard : m_shards) {
+      auto buckets = shard.buckets.load(std::memory_order_acquire);
+      if (buckets == nullptr) {
+        continue;
+      }
+      for (size_t i = 0; i <= buckets->mask; ++i) {
+        for (auto node = buckets->heads[i].load(std::memory_order_acquire);
+             node != nullptr;
+             node = node->next.load(std::memory_order_acquire)) {
+          fn(node->key, node->value);
+        }
+      }
+    }
+  }
+
+  size_t size() const {
+    size_t result = 0;
+    for (auto& shard : m_shards) {
+      std::lock_guard<std::mutex> guard(shard.mtx);
+      result += shard.size;
+    }
+    return result;
+  }
+};
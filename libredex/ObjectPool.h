@@ -0,0 +1,361 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <vector>
+
+/*
+ * A pool of fixed-size blocks for the small objects that make up IRCode
+ * (MethodItemEntry, IRInstruction). There are millions of these once all
+ * methods are ballooned, and going through malloc for each of them costs
+ * both time and per-block bookkeeping.
+ *
+ * Blocks are carved out of large slabs, each owned by the thread that
+ * obtained it. A thread keeps the blocks of its own slabs on a private free
+ * list, so allocating and freeing them never takes a lock. A block freed on
+ * any other thread (entries move between methods when inlining) goes to a
+ * shared lock-free overflow list instead, which the next thread to run out
+ * adopts wholesale. Either way, freed blocks get reused by whoever allocates
+ * next rather than being stranded on a thread that no longer allocates.
+ *
+ * Slabs are returned to the system by clear(), once no object is alive.
+ *
+ * Classes opt in with REDEX_POOL_ALLOCATED(ClassName).
+ */
+namespace object_pool {
+
+struct Stats {
+  // Bytes obtained from the system for slabs.
+  size_t slab_bytes{0};
+  // Blocks ever carved out of the slabs. Freed blocks are reused before new
+  // ones are carved, so this bounds the peak number of live objects, but may
+  // exceed it when threads hold on to free blocks of their own.
+  size_t carved_blocks{0};
+  // Objects currently allocated.
+  size_t live_objects{0};
+  // Size of one block.
+  size_t block_size{0};
+
+  // What as many objects as were carved out would have cost in malloc
+  // bookkeeping (glibc: 8-byte header, 16-byte granularity, 32-byte minimum).
+  size_t malloc_overhead_saved() const {
+    size_t chunk = std::max<size_t>(32, (block_size + 8 + 15) & ~size_t(15));
+    return carved_blocks * (chunk - block_size);
+  }
+};
+
+// Slabs are aligned to their size, so that the header of a block's slab is
+// found by masking the block's address.
+constexpr size_t kSlabSize = 256 * 1024;
+
+inline void* allocate_slab() {
+#ifdef _MSC_VER
+  void* slab = _aligned_malloc(kSlabSize, kSlabSize);
+#else
+  void* slab = nullptr;
+  if (posix_memalign(&slab, kSlabSize, kSlabSize) != 0) {
+    slab = nullptr;
+  }
+#endif
+  if (slab == nullptr) {
+    throw std::bad_alloc();
+  }
+  return slab;
+}
+
+inline void free_slab(void* slab) {
+#ifdef _MSC_VER
+  _aligned_free(slab);
+#else
+  std::free(slab);
+#endif
+}
+
+template <size_t kBlockSize, size_t kAlign>
+class FixedSizePool {
+  struct FreeBlock {
+    FreeBlock* next;
+  };
+
+  struct Local;
+
+  struct SlabHeader {
+    const Local* owner;
+  };
+
+  static constexpr size_t kSize =
+      (std::max(kBlockSize, sizeof(FreeBlock)) + kAlign - 1) & ~(kAlign - 1);
+  // The header takes up the first block(s) of each slab.
+  static constexpr size_t kHeaderBlocks =
+      (sizeof(SlabHeader) + kSize - 1) / kSize;
+  static constexpr size_t kBlocksPerSlab = kSlabSize / kSize;
+  static_assert(kBlocksPerSlab >= 64 + kHeaderBlocks,
+                "Objects this large should not be pool-allocated");
+
+  struct Global {
+    std::mutex mtx;
+    std::vector<void*> slabs;
+    // Threads that may hold blocks, and what is left of the live count of
+    // those that exited.
+    std::vector<const Local*> locals;
+    std::atomic<ptrdiff_t> exited_live{0};
+    // Blocks freed away from their owning thread, and those handed back by
+    // threads that exited.
+    std::atomic<FreeBlock*> overflow{nullptr};
+    std::atomic<size_t> carved_blocks{0};
+  };
+
+  // Trivially destructible so that it stays usable while other thread_local
+  // and static destructors free objects.
+  struct Local {
+    FreeBlock* free_list;
+    char* bump;
+    char* bump_end;
+    // Objects allocated minus objects freed by this thread. Only this thread
+    // writes it; get_stats() reads it.
+    std::atomic<ptrdiff_t> live;
+    // The clear() this thread's lists date from.
+    unsigned generation;
+    bool registered;
+    bool exited;
+  };
+
+  struct LocalFlusher {
+    ~LocalFlusher() { flush_local(); }
+  };
+
+  static std::atomic<unsigned> s_generation;
+
+  static Global& global() {
+    // Never destroyed, objects can outlive static destruction.
+    static Global* g = new Global();
+    return *g;
+  }
+
+  static Local& local() {
+    static thread_local Local l{
+        nullptr, nullptr, nullptr, {0}, 0, false, false};
+    auto generation = s_generation.load(std::memory_order_acquire);
+    if (l.generation != generation) {
+      // Our lists point into slabs that clear() released.
+      l.free_list = nullptr;
+      l.bump = l.bump_end = nullptr;
+      l.generation = generation;
+    }
+    return l;
+  }
+
+  static const SlabHeader* header_of(const void* block) {
+    return reinterpret_cast<const SlabHeader*>(
+        reinterpret_cast<uintptr_t>(block) & ~(uintptr_t)(kSlabSize - 1));
+  }
+
+  static void count(Local& l, ptrdiff_t delta) {
+    if (l.exited) {
+      global().exited_live.fetch_add(delta, std::memory_order_relaxed);
+    } else {
+      l.live.store(l.live.load(std::memory_order_relaxed) + delta,
+                   std::memory_order_relaxed);
+    }
+  }
+
+  static void push_overflow(FreeBlock* first, FreeBlock* last) {
+    auto& overflow = global().overflow;
+    auto head = overflow.load(std::memory_order_relaxed);
+    do {
+      last->next = head;
+    } while (!overflow.compare_exchange_weak(
+        head, first, std::memory_order_release, std::memory_order_relaxed));
+  }
+
+  static void flush_local() {
+    auto& l = local();
+    auto& g = global();
+    if (l.free_list != nullptr) {
+      auto last = l.free_list;
+      while (last->next != nullptr) {
+        last = last->next;
+      }
+      push_overflow(l.free_list, last);
+      l.free_list = nullptr;
+    }
+    // The rest of the bump region is lost, at most one slab per thread.
+    l.bump = l.bump_end = nullptr;
+    std::lock_guard<std::mutex> guard(g.mtx);
+    g.exited_live.fetch_add(l.live.load(std::memory_order_relaxed),
+                            std::memory_order_relaxed);
+    g.locals.erase(std::find(g.locals.begin(), g.locals.end(), &l));
+    l.exited = true;
+  }
+
+  // Make sure this thread is counted, and its free list handed back on exit.
+  static void register_local(Local& l) {
+    if (l.registered) {
+      return;
+    }
+    l.registered = true;
+    {
+      auto& g = global();
+      std::lock_guard<std::mutex> guard(g.mtx);
+      g.locals.push_back(&l);
+    }
+    static thread_local LocalFlusher flusher;
+    (void)flusher;
+  }
+
+  static void* refill(Local& l) {
+    auto& g = global();
+    auto blocks = g.overflow.exchange(nullptr, std::memory_order_acquire);
+    if (blocks != nullptr) {
+      if (l.exited) {
+        // Hand back all but one, as nothing would flush them again.
+        if (blocks->next != nullptr) {
+          auto last = blocks->next;
+          while (last->next != nullptr) {
+            last = last->next;
+          }
+          push_overflow(blocks->next, last);
+        }
+      } else {
+        l.free_list = blocks->next;
+      }
+      return blocks;
+    }
+    auto slab = static_cast<char*>(allocate_slab());
+    new (slab) SlabHeader{&l};
+    {
+      std::lock_guard<std::mutex> guard(g.mtx);
+      g.slabs.push_back(slab);
+    }
+    auto block = slab + kHeaderBlocks * kSize;
+    l.bump = block + kSize;
+    l.bump_end = slab + kBlocksPerSlab * kSize;
+    g.carved_blocks.fetch_add(1, std::memory_order_relaxed);
+    return block;
+  }
+
+ public:
+  static void* allocate() {
+    auto& l = local();
+    void* block;
+    if (l.free_list != nullptr) {
+      block = l.free_list;
+      l.free_list = l.free_list->next;
+    } else if (l.bump != l.bump_end) {
+      block = l.bump;
+      l.bump += kSize;
+      global().carved_blocks.fetch_add(1, std::memory_order_relaxed);
+    } else {
+      if (!l.exited) {
+        register_local(l);
+      }
+      block = refill(l);
+    }
+    count(l, 1);
+    return block;
+  }
+
+  static void deallocate(void* p) {
+    if (p == nullptr) {
+      return;
+    }
+    auto block = static_cast<FreeBlock*>(p);
+    auto& l = local();
+    if (!l.exited) {
+      register_local(l);
+    }
+    count(l, -1);
+    if (!l.exited && header_of(p)->owner == &l) {
+      block->next = l.free_list;
+      l.free_list = block;
+    } else {
+      push_overflow(block, block);
+    }
+  }
+
+  static Stats get_stats() {
+    auto& g = global();
+    Stats stats;
+    ptrdiff_t live;
+    {
+      std::lock_guard<std::mutex> guard(g.mtx);
+      stats.slab_bytes = g.slabs.size() * kSlabSize;
+      live = g.exited_live.load(std::memory_order_relaxed);
+      for (auto l : g.locals) {
+        live += l->live.load(std::memory_order_relaxed);
+      }
+    }
+    stats.carved_blocks = g.carved_blocks.load(std::memory_order_relaxed);
+    stats.live_objects = std::max<ptrdiff_t>(0, live);
+    stats.block_size = kSize;
+    return stats;
+  }
+
+  /*
+   * Returns every slab to the system, provided that no object is alive.
+   * Other threads must not use the pool meanwhile; the free lists they hold
+   * are dropped the next time they do.
+   */
+  static bool clear() {
+    if (get_stats().live_objects != 0) {
+      return false;
+    }
+    auto& g = global();
+    std::lock_guard<std::mutex> guard(g.mtx);
+    for (auto slab : g.slabs) {
+      free_slab(slab);
+    }
+    g.slabs.clear();
+    g.overflow.store(nullptr, std::memory_order_relaxed);
+    g.carved_blocks.store(0, std::memory_order_relaxed);
+    s_generation.fetch_add(1, std::memory_order_release);
+    return true;
+  }
+};
+
+template <size_t kBlockSize, size_t kAlign>
+std::atomic<unsigned> FixedSizePool<kBlockSize, kAlign>::s_generation{0};
+
+template <typename T>
+using PoolFor = FixedSizePool<sizeof(T), alignof(T)>;
+
+} // namespace object_pool
+
+/*
+ * Route operator new/delete of a class through its FixedSizePool. Only
+ * single-object allocation is pooled; arrays still go through malloc.
+ */
+#define REDEX_POOL_ALLOCATED(T)                                     \
+  static void* operator new(size_t size) {                          \
+    if (size != sizeof(T)) {                                        \
+      return ::operator new(size);                                  \
+    }                                                               \
+    return object_pool::PoolFor<T>::allocate();                     \
+  }                                                                 \
+  static void operator delete(void* p, size_t size) {               \
+    if (size != sizeof(T)) {                                        \
+      ::operator delete(p);                                         \
+      return;                                                       \
+    }                                                               \
+    object_pool::PoolFor<T>::deallocate(p);                         \
+  }                                                                 \
+  static object_pool::Stats pool_stats() {                          \
+    return object_pool::PoolFor<T>::get_stats();                    \
+  }                                                                 \
+  static bool pool_clear() {                                        \
+    return object_pool::PoolFor<T>::clear();                        \
+  }
@@ -0,0 +1,64 @@
+/**
+ * Copyright (c) 2017-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "ParallelWalkers.h"
+
+#include <mutex>
+
+namespace parallel_walkers {
+
+namespace {
+
+std::mutex s_stats_lock;
+Stats s_stats;
+
+} // namespace
+
+void record_tasks(const std::vector<TaskTime>& times) {
+  if (times.empty()) {
+    return;
+  }
+  // Keep just the slowest of this walk before taking the lock.
+  std::vector<TaskTime> slowest(times);
+  auto keep = std::min(kSlowestKept, slowest.size());
+  auto by_time = [](const TaskTime& a, const TaskTime& b) {
+    return a.seconds > b.seconds;
+  };
+  std::partial_sort(
+      slowest.begin(), slowest.begin() + keep, slowest.end(), by_time);
+  slowest.resize(keep);
+  double total = 0;
+  for (const auto& t : times) {
+    total += t.seconds;
+  }
+
+  std::lock_guard<std::mutex> lock(s_stats_lock);
+  s_stats.tasks += times.size();
+  s_stats.total_seconds += total;
+  s_stats.slowest.insert(
+      s_stats.slowest.end(), slowest.begin(), slowest.end());
+  std::stable_sort(s_stats.slowest.begin(), s_stats.slowest.end(), by_time);
+  if (s_stats.slowest.size() > kSlowestKept) {
+    s_stats.slowest.resize(kSlowestKept);
+  }
+}
+
+Stats take_stats() {
+  std::lock_guard<std::mutex> lock(s_stats_lock);
+  Stats stats;
+  std::swap(stats, s_stats);
+  return stats;
+}
+
+size_t method_size(const DexMethod* method) {
+  auto code = method->get_code();
+  return code == nullptr ? 0 : code->sum_opcode_sizes();
+}
+
+} // namespace parallel_walkers
@@ -9,7 +9,10 @@
 
 #pragma once
 
+#include <algorithm>
+#include <chrono>
 #include <functional>
+#include <numeric>
 #include <thread>
 #include <vector>
 
@@ -20,14 +23,67 @@
 #include "Match.h"
 #include "WorkQueue.h"
 
+/**
+ * How walk_methods_parallel() splits and orders its work.
+ */
+enum class WalkOrder {
+  // One task per class, in scope order.
+  ByClass,
+  // One task per method, the largest methods first, so that a few huge
+  // methods do not end up running alone once every other task is done. The
+  // time each method takes is recorded in the parallel_walkers stats.
+  LargestMethodFirst,
+};
+
+namespace parallel_walkers {
+
+struct TaskTime {
+  const DexMethod* method;
+  double seconds;
+};
+
+/*
+ * What the LargestMethodFirst walks since the last take_stats() spent on
+ * their tasks.
+ */
+struct Stats {
+  size_t tasks{0};
+  double total_seconds{0};
+  // The slowest tasks, slowest first; at most kSlowestKept of them.
+  std::vector<TaskTime> slowest;
+};
+
+constexpr size_t kSlowestKept = 10;
+
+void record_tasks(const std::vector<TaskTime>& times);
+
+Stats take_stats();
+
+/*
+ * The number of code units of the method, without ballooning it.
+ */
+size_t method_size(const DexMethod* method);
+
+/*
+ * The number of threads the walkers use unless told otherwise. This code
+ * usually runs on a processor with Hyperthreading, where the number of
+ * physical cores is half the number of logical cores. The walkers spend most
+ * of their time chasing pointers through the IR, and the two hyperthreads of
+ * a core share its caches, so one thread per physical core often gets us as
+ * good results as one per logical core. At least one, since a WorkQueue
+ * needs one.
+ */
+inline size_t default_num_threads() {
+  return std::max(1u, std::thread::hardware_concurrency() / 2);
+}
+
+} // namespace parallel_walkers
+
 /**
  * Walk all methods of all classes defined in 'scope' calling back
  * the walker function in parallel.  Make sure all global
  * information needed is copied locally per thread using DataInitializerFn.
- *
- * This code usually runs on a processor with Hyperthreading, where the number
- * of physical cores is half the number of logical cores. Setting num_threads
- * to that number often gets us good results, so that's the default.
+ * See parallel_walkers::default_num_threads() for the default num_threads.
  */
 template <class Data,
           class Output,
@@ -41,16 +97,64 @@ Output walk_methods_parallel(
     OutputReducerFn reducer,
     DataInitializerFn data_initializer,
     const Output& init = Output(),
-    size_t num_threads = std::thread::hardware_concurrency() / 2) {
+    size_t num_threads = parallel_walkers::default_num_threads(),
+    WalkOrder order = WalkOrder::ByClass) {
+  if (order == WalkOrder::LargestMethodFirst) {
+    std::vector<std::pair<size_t, DexMethod*>> methods;
+    for (const auto& cls : scope) {
+      for (auto dmethod : cls->get_dmethods()) {
+        methods.emplace_back(0, dmethod);
+      }
+      for (auto vmethod : cls->get_vmethods()) {
+        methods.emplace_back(0, vmethod);
+      }
+    }
+    auto size_wq = workqueue_foreach<size_t>(
+        [&](size_t i) {
+          methods[i].first = parallel_walkers::method_size(methods[i].second);
+        },
+        num_threads);
+    for (size_t i = 0; i < methods.size(); ++i) {
+      size_wq.add_item(i);
+    }
+    size_wq.run_all();
+    std::stable_sort(
+        methods.begin(), methods.end(), [](const auto& a, const auto& b) {
+          return a.first > b.first;
+        });
+    std::vector<parallel_walkers::TaskTime> times(methods.size());
+    auto wq = WorkQueue<size_t, Data, Output>(
+        [&](Data& data, size_t i) {
+          auto method = methods[i].second;
+          TraceContext context(method);
+          auto start = std::chrono::steady_clock::now();
+          Output out = walker(data, method);
+          times[i] = {method,
+                      std::chrono::duration<double>(
+                          std::chrono::steady_clock::now() - start)
+                          .count()};
+          return out;
+        },
+        reducer,
+        data_initializer,
+        num_threads);
+    std::vector<size_t> order(methods.size());
+    std::iota(order.begin(), order.end(), 0);
+    wq.add_ordered_items(std::move(order));
+    auto out = wq.run_all(init);
+    parallel_walkers::record_tasks(times);
+    return out;
+  }
+
   auto wq = WorkQueue<DexClass*, Data, Output>(
       [&](Data& data, DexClass* cls) {
         Output out = init;
         for (auto dmethod : cls->get_dmethods()) {
-          TraceContext context(dmethod->get_deobfuscated_name());
+          TraceContext context(dmethod);
           out = reducer(out, walker(data, dmethod));
         }
         for (auto vmethod : cls->get_vmethods()) {
-          TraceContext context(vmethod->get_deobfuscated_name());
+          TraceContext context(vmethod);
           out = reducer(out, walker(data, vmethod));
         }
         return out;
@@ -68,7 +172,9 @@ Output walk_methods_parallel(
 // The simple version. Call `walker` on all methods in `scope` in parallel.
 template <class Scope>
 void walk_methods_parallel_simple(
-    const Scope& scope, const std::function<void(DexMethod*)>& walker) {
+    const Scope& scope,
+    const std::function<void(DexMethod*)>& walker,
+    WalkOrder order = WalkOrder::ByClass) {
   walk_methods_parallel<std::nullptr_t, std::nullptr_t, Scope>(
       scope,
       [&walker](std::nullptr_t, DexMethod* m) {
@@ -76,5 +182,8 @@ void walk_methods_parallel_simple(
         return nullptr;
       },
       [](std::nullptr_t, std::nullptr_t) { return nullptr; },
-      [](int) { return nullptr; });
+      [](int) { return nullptr; },
+      nullptr,
+      parallel_walkers::default_num_threads(),
+      order);
 }
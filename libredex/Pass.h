@@ -21,6 +21,22 @@
 
 class PassManager;
 
+/*
+ * The whole-program analyses that the PassManager caches between passes (see
+ * AnalysisManager.h).
+ */
+enum Analysis : uint32_t {
+  ANALYSIS_CLASS_HIERARCHY = 1 << 0,
+  ANALYSIS_SIGNATURE_MAP = 1 << 1,
+  ANALYSIS_CLASS_SCOPES = 1 << 2,
+};
+
+using AnalysisSet = uint32_t;
+
+constexpr AnalysisSet NO_ANALYSES = 0;
+constexpr AnalysisSet ALL_ANALYSES =
+    ANALYSIS_CLASS_HIERARCHY | ANALYSIS_SIGNATURE_MAP | ANALYSIS_CLASS_SCOPES;
+
 class PassConfig {
  public:
   explicit PassConfig(const Json::Value& cfg)
@@ -134,6 +150,13 @@ class Pass {
   virtual void eval_pass(DexStoresVector& stores, ConfigFiles& cfg, PassManager& mgr) {};
   virtual void run_pass(DexStoresVector& stores, ConfigFiles& cfg, PassManager& mgr) = 0;
 
+  /**
+   * The analyses cached by the PassManager (see AnalysisManager.h) that are
+   * still valid after run_pass. Passes that only rewrite method bodies
+   * preserve them all.
+   */
+  virtual AnalysisSet preserved_analyses() const { return NO_ANALYSES; }
+
  private:
   std::string m_name;
 };
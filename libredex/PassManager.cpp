@@ -9,9 +9,11 @@
 
 #include "PassManager.h"
 
+#include <atomic>
 #include <cstdio>
 #include <unordered_set>
 
+#include "AnalysisManager.h"
 #include "ConfigFiles.h"
 #include "Debug.h"
 #include "DexClass.h"
@@ -23,6 +25,7 @@
 #include "IRCode.h"
 #include "IRTypeChecker.h"
 #include "ParallelWalkers.h"
+#include "PassProfiler.h"
 #include "PrintSeeds.h"
 #include "ProguardMatcher.h"
 #include "ProguardPrintConfiguration.h"
@@ -41,6 +44,7 @@ PassManager::PassManager(const std::vector<Pass*>& passes,
     : m_config(config),
       m_registered_passes(passes),
       m_current_pass_info(nullptr),
+      m_analyses(new AnalysisManager()),
       m_pg_config(empty_pg_config()),
       m_testing_mode(false),
       m_verify_none_mode(verify_none_mode) {
@@ -54,12 +58,15 @@ PassManager::PassManager(const std::vector<Pass*>& passes,
     : m_config(config),
       m_registered_passes(passes),
       m_current_pass_info(nullptr),
+      m_analyses(new AnalysisManager()),
       m_pg_config(pg_config),
       m_testing_mode(false),
       m_verify_none_mode(verify_none_mode) {
   init(config);
 }
 
+PassManager::~PassManager() {}
+
 void PassManager::init(const Json::Value& config) {
   if (config["redex"].isMember("passes")) {
     auto passes_from_config = config["redex"]["passes"];
@@ -72,12 +79,13 @@ void PassManager::init(const Json::Value& config) {
   }
 }
 
-void PassManager::run_type_checker(const Scope& scope,
-                                   bool polymorphic_constants,
-                                   bool verify_moves) {
+size_t PassManager::run_type_checker(const Scope& scope,
+                                     bool polymorphic_constants,
+                                     bool verify_moves) {
   TRACE(PM, 1, "Running IRTypeChecker...\n");
   Timer t("IRTypeChecker");
-  walk_methods_parallel_simple(scope, [=](DexMethod* dex_method) {
+  std::atomic<size_t> checked{0};
+  walk_methods_parallel_simple(scope, [&](DexMethod* dex_method) {
     IRTypeChecker checker(dex_method);
     if (polymorphic_constants) {
       checker.enable_polymorphic_constants();
@@ -85,7 +93,11 @@ void PassManager::run_type_checker(const Scope& scope,
     if (verify_moves) {
       checker.verify_moves();
     }
-    checker.run();
+    // Methods that passed an earlier run and have not changed since are
+    // skipped.
+    if (checker.run_if_changed()) {
+      checked.fetch_add(1, std::memory_order_relaxed);
+    }
     if (checker.fail()) {
       std::string msg = checker.what();
       fprintf(
@@ -93,7 +105,9 @@ void PassManager::run_type_checker(const Scope& scope,
       fprintf(stderr, "Code:\n%s\n", SHOW(dex_method->get_code()));
       exit(EXIT_FAILURE);
     }
-  });
+  }, WalkOrder::LargestMethodFirst);
+  TRACE(PM, 1, "IRTypeChecker checked %lu methods\n", checked.load());
+  return checked.load();
 }
 
 const std::string PASS_ORDER_KEY = "pass_order";
@@ -178,23 +192,64 @@ void PassManager::run_passes(DexStoresVector& stores,
     trigger_passes.insert(trigger_pass.asString());
   }
 
+  // Profiling mode: see PassProfiler.h.
+  auto profile_output =
+      cfg.metafile(m_config.get("pass_profile_output", "").asString());
+  auto profile_trace_output =
+      cfg.metafile(m_config.get("pass_profile_trace_output", "").asString());
+  std::unique_ptr<PassProfiler> profiler;
+  if (!profile_output.empty() || !profile_trace_output.empty()) {
+    profiler = std::make_unique<PassProfiler>();
+  }
+
   for (size_t i = 0; i < m_activated_passes.size(); ++i) {
     Pass* pass = m_activated_passes[i];
     TRACE(PM, 1, "Running %s...\n", pass->name().c_str());
-    Timer t(pass->name() + " (run)");
-    m_current_pass_info = &m_pass_info[i];
-    pass->run_pass(stores, cfg, *this);
+    if (profiler) {
+      scope = build_class_scope(it);
+      profiler->begin(m_pass_info[i].name, scope);
+    }
+    {
+      Timer t(pass->name() + " (run)");
+      m_current_pass_info = &m_pass_info[i];
+      parallel_walkers::take_stats();
+      auto analysis_stats = m_analyses->stats();
+      pass->run_pass(stores, cfg, *this);
+      record_parallel_walk_stats(parallel_walkers::take_stats());
+      record_analysis_stats(analysis_stats.hits, analysis_stats.builds);
+      m_analyses->invalidate(~pass->preserved_analyses());
+    }
+    if (profiler) {
+      scope = build_class_scope(it);
+      profiler->end(scope);
+    }
     if (run_after_each_pass || trigger_passes.count(pass->name()) > 0) {
       scope = build_class_scope(it);
-      run_type_checker(scope, polymorphic_constants, verify_moves);
+      set_metric("type_checker_methods_checked",
+                 run_type_checker(scope, polymorphic_constants, verify_moves));
     }
     m_current_pass_info = nullptr;
   }
 
+  TRACE(PM, 1, "Analyses: %lu built, %lu reused\n",
+        m_analyses->stats().builds, m_analyses->stats().hits);
+
   // Always run the type checker before generating the optimized dex code.
   scope = build_class_scope(it);
   run_type_checker(scope, polymorphic_constants, verify_moves);
 
+  if (profiler) {
+    Json::StyledStreamWriter writer;
+    if (!profile_output.empty()) {
+      std::ofstream out(profile_output);
+      writer.write(out, profiler->to_json());
+    }
+    if (!profile_trace_output.empty()) {
+      std::ofstream out(profile_trace_output);
+      writer.write(out, profiler->to_chrome_trace());
+    }
+  }
+
   if (!cfg.get_printseeds().empty()) {
     Timer t("Writing outgoing classes to file " + cfg.get_printseeds() +
             ".outgoing");
@@ -225,6 +280,33 @@ void PassManager::activate_pass(const char* name, const Json::Value& cfg) {
   always_assert_log(false, "No pass named %s!", name);
 }
 
+void PassManager::record_parallel_walk_stats(
+    const parallel_walkers::Stats& stats) {
+  if (stats.tasks == 0) {
+    return;
+  }
+  auto ms = [](double seconds) { return static_cast<int>(seconds * 1000); };
+  set_metric("parallel_walk_methods", stats.tasks);
+  set_metric("parallel_walk_method_ms", ms(stats.total_seconds));
+  set_metric("parallel_walk_slowest_method_ms",
+             ms(stats.slowest.front().seconds));
+  for (const auto& task : stats.slowest) {
+    TRACE(PM, 1, "  %8.1f ms  %s\n", task.seconds * 1000,
+          SHOW(task.method));
+  }
+}
+
+void PassManager::record_analysis_stats(size_t hits_before,
+                                        size_t builds_before) {
+  const auto& after = m_analyses->stats();
+  if (after.hits != hits_before) {
+    set_metric("analysis_cache_hits", after.hits - hits_before);
+  }
+  if (after.builds != builds_before) {
+    set_metric("analysis_builds", after.builds - builds_before);
+  }
+}
+
 void PassManager::incr_metric(const std::string& key, int value) {
   always_assert_log(m_current_pass_info != nullptr, "No current pass!");
   (m_current_pass_info->metrics)[key] += value;
@@ -13,11 +13,18 @@
 #include "ProguardConfiguration.h"
 
 #include <json/json.h>
+#include <memory>
 #include <string>
 #include <unordered_map>
 #include <utility>
 #include <vector>
 
+class AnalysisManager;
+
+namespace parallel_walkers {
+struct Stats;
+}
+
 class PassManager {
  public:
   PassManager(const std::vector<Pass*>& passes,
@@ -29,6 +36,8 @@ class PassManager {
               const Json::Value& config = Json::Value(Json::objectValue),
               bool verify_none_mode = false);
 
+  ~PassManager();
+
   struct PassInfo {
     const Pass* pass;
     size_t order; // zero-based
@@ -62,14 +71,26 @@ class PassManager {
 
   const PassInfo* get_current_pass_info() const { return m_current_pass_info; }
 
+  // Analyses shared between passes; see AnalysisManager.h.
+  AnalysisManager& analyses() { return *m_analyses; }
+
  private:
   void activate_pass(const char* name, const Json::Value& cfg);
 
   void init(const Json::Value& config);
 
-  static void run_type_checker(const Scope& scope,
-                               bool polymorphic_constants,
-                               bool verify_moves);
+  // Returns the number of methods actually checked.
+  static size_t run_type_checker(const Scope& scope,
+                                 bool polymorphic_constants,
+                                 bool verify_moves);
+
+  // Surface the per-method timings of the current pass's
+  // WalkOrder::LargestMethodFirst walks in its metrics.
+  void record_parallel_walk_stats(const parallel_walkers::Stats& stats);
+
+  // Record the current pass's use of the analysis cache in its metrics, given
+  // the cache's totals before the pass ran.
+  void record_analysis_stats(size_t hits_before, size_t builds_before);
 
   Json::Value m_config;
   std::vector<Pass*> m_registered_passes;
@@ -79,6 +100,8 @@ class PassManager {
   std::vector<PassManager::PassInfo> m_pass_info;
   PassInfo* m_current_pass_info;
 
+  std::unique_ptr<AnalysisManager> m_analyses;
+
   redex::ProguardConfiguration m_pg_config;
   bool m_testing_mode;
   bool m_verify_none_mode;
@@ -0,0 +1,189 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "PassProfiler.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+#ifndef _MSC_VER
+#include <sys/resource.h>
+#endif
+
+#include "IRCode.h"
+#include "Walkers.h"
+
+#ifndef _MSC_VER
+// Defined by util/MallocDebug.cpp in builds that replace malloc.
+extern "C" void redex_malloc_stats(uint64_t* count, uint64_t* bytes)
+    __attribute__((weak));
+#endif
+
+namespace {
+
+// Resets the kernel's resident set high-water mark (VmHWM), Linux >= 4.0.
+bool reset_peak_rss() {
+  FILE* f = fopen("/proc/self/clear_refs", "w");
+  if (f == nullptr) {
+    return false;
+  }
+  bool ok = fputs("5", f) >= 0;
+  ok = fclose(f) == 0 && ok;
+  return ok;
+}
+
+uint64_t read_peak_rss_kb() {
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line)) {
+    if (line.compare(0, 6, "VmHWM:") == 0) {
+      return std::stoull(line.substr(6));
+    }
+  }
+#ifndef _MSC_VER
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0) {
+    // Kilobytes on Linux, bytes on macOS.
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+  }
+#endif
+  return 0;
+}
+
+void count_ir(const Scope& scope, size_t* methods, size_t* instructions) {
+  *methods = 0;
+  *instructions = 0;
+  walk_methods(scope, [&](DexMethod* method) {
+    ++*methods;
+    auto code = method->get_code();
+    if (code != nullptr) {
+      *instructions += code->count_opcodes();
+    }
+  });
+}
+
+Json::Value profile_args(const PassProfile& p) {
+  Json::Value args(Json::objectValue);
+  args["user_cpu_s"] = p.user_cpu;
+  args["sys_cpu_s"] = p.sys_cpu;
+  args["peak_rss_kb"] = Json::UInt64(p.peak_rss_kb);
+  args["peak_rss_is_per_pass"] = p.peak_rss_is_per_pass;
+  if (p.has_alloc_stats) {
+    args["allocations"] = Json::UInt64(p.allocations);
+    args["allocated_bytes"] = Json::UInt64(p.allocated_bytes);
+  } else {
+    args["allocations"] = Json::nullValue;
+    args["allocated_bytes"] = Json::nullValue;
+  }
+  args["methods_before"] = Json::UInt64(p.methods_before);
+  args["methods_after"] = Json::UInt64(p.methods_after);
+  args["instructions_before"] = Json::UInt64(p.instructions_before);
+  args["instructions_after"] = Json::UInt64(p.instructions_after);
+  return args;
+}
+
+} // namespace
+
+PassProfiler::PassProfiler() : m_origin(std::chrono::steady_clock::now()) {}
+
+PassProfiler::Sample PassProfiler::sample() {
+  Sample s;
+  s.time = std::chrono::steady_clock::now();
+  s.user_cpu = s.sys_cpu = 0;
+#ifndef _MSC_VER
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0) {
+    s.user_cpu = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6;
+    s.sys_cpu = usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+  }
+#endif
+  s.allocations = s.allocated_bytes = 0;
+#ifndef _MSC_VER
+  if (redex_malloc_stats != nullptr) {
+    redex_malloc_stats(&s.allocations, &s.allocated_bytes);
+  }
+#endif
+  return s;
+}
+
+void PassProfiler::begin(const std::string& name, const Scope& scope) {
+  PassProfile profile;
+  profile.name = name;
+  count_ir(scope, &profile.methods_before, &profile.instructions_before);
+  profile.peak_rss_is_per_pass = reset_peak_rss();
+  m_profiles.push_back(std::move(profile));
+  // Sample last so that the bookkeeping above is not charged to the pass.
+  m_begin = sample();
+}
+
+void PassProfiler::end(const Scope& scope) {
+  auto s = sample();
+  auto& profile = m_profiles.back();
+  profile.start = std::chrono::duration<double>(m_begin.time - m_origin).count();
+  profile.wall = std::chrono::duration<double>(s.time - m_begin.time).count();
+  profile.user_cpu = s.user_cpu - m_begin.user_cpu;
+  profile.sys_cpu = s.sys_cpu - m_begin.sys_cpu;
+  profile.peak_rss_kb = read_peak_rss_kb();
+#ifndef _MSC_VER
+  profile.has_alloc_stats = redex_malloc_stats != nullptr;
+#endif
+  profile.allocations = s.allocations - m_begin.allocations;
+  profile.allocated_bytes = s.allocated_bytes - m_begin.allocated_bytes;
+  count_ir(scope, &profile.methods_after, &profile.instructions_after);
+}
+
+Json::Value PassProfiler::to_json() const {
+  Json::Value passes(Json::arrayValue);
+  for (const auto& p : m_profiles) {
+    auto obj = profile_args(p);
+    obj["name"] = p.name;
+    obj["start_s"] = p.start;
+    obj["wall_s"] = p.wall;
+    passes.append(obj);
+  }
+  Json::Value root(Json::objectValue);
+  root["passes"] = passes;
+  return root;
+}
+
+Json::Value PassProfiler::to_chrome_trace() const {
+  Json::Value events(Json::arrayValue);
+  for (const auto& p : m_profiles) {
+    Json::Value event(Json::objectValue);
+    event["name"] = p.name;
+    event["cat"] = "pass";
+    event["ph"] = "X";
+    event["pid"] = 1;
+    event["tid"] = 1;
+    event["ts"] = Json::UInt64(p.start * 1e6);
+    event["dur"] = Json::UInt64(p.wall * 1e6);
+    event["args"] = profile_args(p);
+    events.append(event);
+
+    // Counter tracks, sampled at the end of each pass.
+    Json::Value counter(Json::objectValue);
+    counter["name"] = "resources";
+    counter["ph"] = "C";
+    counter["pid"] = 1;
+    counter["ts"] = Json::UInt64((p.start + p.wall) * 1e6);
+    counter["args"]["peak_rss_kb"] = Json::UInt64(p.peak_rss_kb);
+    counter["args"]["instructions"] = Json::UInt64(p.instructions_after);
+    events.append(counter);
+  }
+  Json::Value root(Json::objectValue);
+  root["traceEvents"] = events;
+  root["displayTimeUnit"] = "ms";
+  return root;
+}
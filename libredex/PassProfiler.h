@@ -0,0 +1,80 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <json/json.h>
+
+#include "DexClass.h"
+
+/*
+ * Records what each pass costs: wall and CPU time, peak memory, allocations
+ * and how much IR it leaves behind. The PassManager uses it when the config
+ * has a "pass_profile_output" (structured JSON) or a
+ * "pass_profile_trace_output" (Chrome trace-event format, for
+ * chrome://tracing or Perfetto).
+ *
+ * CPU time is for the whole process, so a pass whose CPU time is close to
+ * its wall time is serial, and one with a much larger CPU time is using
+ * several threads.
+ *
+ * Allocation counts are only available in builds that link
+ * util/MallocDebug.cpp; elsewhere they are reported as null.
+ */
+struct PassProfile {
+  std::string name;
+  // Seconds since the profiler was created.
+  double start{0};
+  double wall{0};
+  double user_cpu{0};
+  double sys_cpu{0};
+  // High-water mark of the resident set while the pass ran, in KB. When the
+  // kernel does not let us reset the mark, this is the process-wide peak.
+  uint64_t peak_rss_kb{0};
+  bool peak_rss_is_per_pass{false};
+  bool has_alloc_stats{false};
+  uint64_t allocations{0};
+  uint64_t allocated_bytes{0};
+  size_t methods_before{0};
+  size_t methods_after{0};
+  size_t instructions_before{0};
+  size_t instructions_after{0};
+};
+
+class PassProfiler {
+ public:
+  PassProfiler();
+
+  void begin(const std::string& name, const Scope& scope);
+  void end(const Scope& scope);
+
+  const std::vector<PassProfile>& get_profiles() const { return m_profiles; }
+
+  Json::Value to_json() const;
+  Json::Value to_chrome_trace() const;
+
+ private:
+  struct Sample {
+    std::chrono::steady_clock::time_point time;
+    double user_cpu;
+    double sys_cpu;
+    uint64_t allocations;
+    uint64_t allocated_bytes;
+  };
+  static Sample sample();
+
+  std::chrono::steady_clock::time_point m_origin;
+  Sample m_begin;
+  std::vector<PassProfile> m_profiles;
+};
@@ -7,12 +7,16 @@
  * of patent rights can be found in the PATENTS file in the same directory.
  */
 
+#include <algorithm>
 #include <boost/regex.hpp>
+#include <cctype>
 #include <cstring>
 #include <iostream>
 #include <memory>
+#include <mutex>
 #include <set>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "ClassHierarchy.h"
@@ -25,24 +29,216 @@
 #include "ProguardRegex.h"
 #include "ProguardReporting.h"
 #include "ReachableClasses.h"
+#include "WorkQueue.h"
 
 namespace redex {
 
 namespace {
 
-std::unique_ptr<boost::regex> make_rx(const std::string& s,
-                                      bool convert = true) {
-  if (s.empty()) return nullptr;
-  auto wc = convert ? proguard_parser::convert_wildcard_type(s) : s;
-  auto rx = proguard_parser::form_type_regex(wc);
-  return std::make_unique<boost::regex>(rx);
-}
+/*
+ * A class-level type pattern of a rule, e.g. the converted className or
+ * annotationType. Patterns made only of literal characters, '*', '**' and
+ * '?' are matched directly, with the same meaning as the regex that
+ * form_type_regex produces for them; the others go through that regex.
+ */
+class TypePattern {
+ public:
+  TypePattern(const std::string& pattern, bool use_globs) {
+    if (use_globs && parse_glob(pattern)) {
+      return;
+    }
+    m_tokens.clear();
+    m_rx = std::make_unique<boost::regex>(
+        proguard_parser::form_type_regex(pattern));
+  }
+
+  bool match(const char* s) const {
+    if (m_rx) {
+      return boost::regex_match(s, *m_rx);
+    }
+    // Most names are rejected by not containing the pattern's longest
+    // literal run.
+    if (!m_required.empty() && strstr(s, m_required.c_str()) == nullptr) {
+      return false;
+    }
+    return match_glob(s);
+  }
+
+  bool match(const std::string& s) const { return match(s.c_str()); }
+
+  // The characters every match starts with.
+  const std::string& literal_prefix() const { return m_prefix; }
+
+  bool is_literal() const {
+    return !m_rx && m_prefix.size() == m_tokens.size();
+  }
+
+ private:
+  enum Kind : uint8_t {
+    CHAR,
+    // '?': any character but '/'.
+    ONE,
+    // '*': any number of characters but '/'.
+    STAR,
+    // '**': one or more '/'-separated parts, each not empty.
+    PARTS,
+  };
+
+  struct Token {
+    Kind kind;
+    char ch;
+  };
 
-bool match_annotation_rx(const DexClass* cls, const boost::regex& annorx) {
+  bool parse_glob(std::string pattern) {
+    if (pattern.empty()) {
+      return false;
+    }
+    if (pattern == "L*;") {
+      pattern = "L**;";
+    }
+    for (size_t i = 0; i < pattern.size(); ++i) {
+      char ch = pattern[i];
+      if (ch == '*') {
+        if (i + 1 < pattern.size() && pattern[i + 1] == '*') {
+          if (i + 2 < pattern.size() && pattern[i + 2] == '*') {
+            return false;
+          }
+          m_tokens.push_back({PARTS, 0});
+          ++i;
+        } else {
+          m_tokens.push_back({STAR, 0});
+        }
+      } else if (ch == '?') {
+        m_tokens.push_back({ONE, 0});
+      } else if (isalnum(static_cast<unsigned char>(ch)) || ch == '_' ||
+                 ch == '$' || ch == '/' || ch == ';' || ch == '[') {
+        m_tokens.push_back({CHAR, ch});
+      } else {
+        return false;
+      }
+    }
+    for (const auto& token : m_tokens) {
+      if (token.kind != CHAR) {
+        break;
+      }
+      m_prefix += token.ch;
+    }
+    std::string run;
+    for (const auto& token : m_tokens) {
+      if (token.kind == CHAR) {
+        run += token.ch;
+      } else {
+        run.clear();
+      }
+      if (run.size() > m_required.size()) {
+        m_required = run;
+      }
+    }
+    return true;
+  }
+
+  /*
+   * Runs the pattern as an NFA over s. state[i] holds where we may be in
+   * token i: bit 0 at its start, and, for PARTS, bit 1 after a character
+   * other than '/' (where it may end) and bit 2 right after a '/'.
+   */
+  bool match_glob(const char* s) const {
+    auto n = m_tokens.size();
+    std::vector<uint8_t> state(n + 1, 0);
+    std::vector<uint8_t> next(n + 1);
+    auto close = [&](std::vector<uint8_t>& st) {
+      for (size_t i = 0; i < n; ++i) {
+        auto kind = m_tokens[i].kind;
+        if ((kind == STAR && (st[i] & 1)) || (kind == PARTS && (st[i] & 2))) {
+          st[i + 1] |= 1;
+        }
+      }
+    };
+    state[0] = 1;
+    close(state);
+    for (; *s != '\0'; ++s) {
+      char c = *s;
+      bool any = false;
+      std::fill(next.begin(), next.end(), 0);
+      for (size_t i = 0; i < n; ++i) {
+        if (state[i] == 0) {
+          continue;
+        }
+        const auto& token = m_tokens[i];
+        switch (token.kind) {
+        case CHAR:
+          if (c == token.ch) {
+            next[i + 1] |= 1;
+          }
+          break;
+        case ONE:
+          if (c != '/') {
+            next[i + 1] |= 1;
+          }
+          break;
+        case STAR:
+          if (c != '/') {
+            next[i] |= 1;
+          }
+          break;
+        case PARTS:
+          if (c != '/') {
+            next[i] |= 2;
+          } else if (state[i] & 2) {
+            next[i] |= 4;
+          }
+          break;
+        }
+      }
+      close(next);
+      for (auto bits : next) {
+        any |= bits != 0;
+      }
+      if (!any) {
+        return false;
+      }
+      state.swap(next);
+    }
+    return (state[n] & 1) != 0;
+  }
+
+  std::vector<Token> m_tokens;
+  std::string m_prefix;
+  std::string m_required;
+  std::unique_ptr<boost::regex> m_rx;
+};
+
+/*
+ * The compiled class-level patterns, shared by all the rules. Safe to use
+ * from several threads.
+ */
+class TypePatterns {
+ public:
+  explicit TypePatterns(bool use_globs) : m_use_globs(use_globs) {}
+
+  const TypePattern* get(const std::string& s, bool convert = true) {
+    if (s.empty()) return nullptr;
+    auto wc = convert ? proguard_parser::convert_wildcard_type(s) : s;
+    std::lock_guard<std::mutex> lock(m_lock);
+    auto& pattern = m_patterns[wc];
+    if (!pattern) {
+      pattern = std::make_unique<TypePattern>(wc, m_use_globs);
+    }
+    return pattern.get();
+  }
+
+ private:
+  bool m_use_globs;
+  std::mutex m_lock;
+  std::unordered_map<std::string, std::unique_ptr<TypePattern>> m_patterns;
+};
+
+bool match_annotation_pattern(const DexClass* cls,
+                              const TypePattern& pattern) {
   const auto* annos = cls->get_anno_set();
   if (!annos) return false;
   for (const auto& anno : annos->get_annotations()) {
-    if (boost::regex_match(anno->type()->c_str(), annorx)) {
+    if (pattern.match(anno->type()->c_str())) {
       return true;
     }
   }
@@ -54,14 +250,15 @@ bool match_annotation_rx(const DexClass* cls, const boost::regex& annorx) {
  * rule.
  */
 struct ClassMatcher {
-  explicit ClassMatcher(const KeepSpec& ks)
+  ClassMatcher(const KeepSpec& ks, TypePatterns& patterns)
       : setFlags_(ks.class_spec.setAccessFlags),
         unsetFlags_(ks.class_spec.unsetAccessFlags),
         m_class_name(ks.class_spec.className),
-        m_cls(make_rx(ks.class_spec.className)),
-        m_anno(make_rx(ks.class_spec.annotationType, false)),
-        m_extends(make_rx(ks.class_spec.extendsClassName)),
-        m_extends_anno(make_rx(ks.class_spec.extendsAnnotationType, false)) {}
+        m_cls(patterns.get(ks.class_spec.className)),
+        m_anno(patterns.get(ks.class_spec.annotationType, false)),
+        m_extends(patterns.get(ks.class_spec.extendsClassName)),
+        m_extends_anno(
+            patterns.get(ks.class_spec.extendsAnnotationType, false)) {}
 
   bool match(const DexClass* cls) {
     // Check for class name match
@@ -84,8 +281,7 @@ struct ClassMatcher {
 
  private:
   bool match_name(const DexClass* cls) const {
-    const auto& deob_name = cls->get_deobfuscated_name();
-    return boost::regex_match(deob_name, *m_cls);
+    return m_cls->match(cls->get_deobfuscated_name());
   }
 
   bool match_access(const DexClass* cls) const {
@@ -94,7 +290,7 @@ struct ClassMatcher {
 
   bool match_annotation(const DexClass* cls) const {
     if (!m_anno) return true;
-    return match_annotation_rx(cls, *m_anno);
+    return match_annotation_pattern(cls, *m_anno);
   }
 
   bool match_extends(const DexClass* cls) {
@@ -107,12 +303,11 @@ struct ClassMatcher {
     if (cls->get_type() == get_object_type()) return false;
     // First check to see if an annotation type needs to be matched.
     if (m_extends_anno) {
-      if (!match_annotation_rx(cls, *m_extends_anno)) {
+      if (!match_annotation_pattern(cls, *m_extends_anno)) {
         return false;
       }
     }
-    const auto& deob_name = cls->get_deobfuscated_name();
-    return boost::regex_match(deob_name, *m_extends);
+    return m_extends->match(cls->get_deobfuscated_name());
   }
 
   bool search_interfaces(const DexClass* cls) {
@@ -162,10 +357,10 @@ struct ClassMatcher {
   DexAccessFlags setFlags_;
   DexAccessFlags unsetFlags_;
   std::string m_class_name;
-  std::unique_ptr<boost::regex> m_cls;
-  std::unique_ptr<boost::regex> m_anno;
-  std::unique_ptr<boost::regex> m_extends;
-  std::unique_ptr<boost::regex> m_extends_anno;
+  const TypePattern* m_cls;
+  const TypePattern* m_anno;
+  const TypePattern* m_extends;
+  const TypePattern* m_extends_anno;
 
   std::unordered_map<const DexClass*, bool> m_extends_result_cache;
 };
@@ -732,56 +927,190 @@ void build_extends_or_implements_hierarchy(const Scope& scope,
   }
 }
 
+/*
+ * The classes of the scope, by deobfuscated name and by the annotations they
+ * have, to find the candidates for a rule without trying every class.
+ */
+class ClassIndex {
+ public:
+  explicit ClassIndex(const Scope& classes) : m_classes(classes) {
+    m_by_name.reserve(classes.size());
+    for (size_t i = 0; i < classes.size(); ++i) {
+      m_by_name.emplace_back(classes[i]->get_deobfuscated_name(), i);
+      const auto* annos = classes[i]->get_anno_set();
+      if (annos) {
+        for (const auto& anno : annos->get_annotations()) {
+          auto& indices = m_by_annotation[anno->type()];
+          if (indices.empty() || indices.back() != i) {
+            indices.push_back(i);
+          }
+        }
+      }
+    }
+    std::sort(m_by_name.begin(), m_by_name.end());
+  }
+
+  /*
+   * The classes that may match a rule with the given className and
+   * annotationType patterns, in scope order. Returns false if there is
+   * nothing to narrow them down with.
+   */
+  bool candidates(const TypePattern* name,
+                  const TypePattern* annotation,
+                  std::vector<size_t>* out) const {
+    const std::vector<size_t>* by_annotation = nullptr;
+    if (annotation != nullptr && annotation->is_literal()) {
+      auto type = DexType::get_type(annotation->literal_prefix().c_str());
+      auto it = m_by_annotation.find(type);
+      by_annotation = it == m_by_annotation.end() ? &m_empty : &it->second;
+    }
+    // Every class name starts with 'L'.
+    const std::string* prefix = nullptr;
+    if (name != nullptr && name->literal_prefix().size() > 1) {
+      prefix = &name->literal_prefix();
+    }
+    if (prefix == nullptr && by_annotation == nullptr) {
+      return false;
+    }
+    auto lo = m_by_name.begin();
+    auto hi = m_by_name.end();
+    if (prefix != nullptr) {
+      lo = std::lower_bound(
+          m_by_name.begin(),
+          m_by_name.end(),
+          *prefix,
+          [](const std::pair<std::string, size_t>& entry,
+             const std::string& p) { return entry.first < p; });
+      hi = lo;
+      while (hi != m_by_name.end() &&
+             hi->first.compare(0, prefix->size(), *prefix) == 0) {
+        ++hi;
+      }
+    }
+    if (by_annotation != nullptr &&
+        (prefix == nullptr ||
+         by_annotation->size() < static_cast<size_t>(hi - lo))) {
+      *out = *by_annotation;
+      return true;
+    }
+    out->clear();
+    for (auto it = lo; it != hi; ++it) {
+      out->push_back(it->second);
+    }
+    std::sort(out->begin(), out->end());
+    return true;
+  }
+
+  DexClass* get(size_t i) const { return m_classes[i]; }
+
+ private:
+  const Scope& m_classes;
+  std::vector<std::pair<std::string, size_t>> m_by_name;
+  std::unordered_map<const DexType*, std::vector<size_t>> m_by_annotation;
+  std::vector<size_t> m_empty;
+};
+
+/*
+ * The classes the class-level part of a keep rule matches, in the order the
+ * rule is to be applied to them.
+ */
+std::vector<DexClass*> match_classes(const ProguardMap& pg_map,
+                                     const KeepSpec& keep_rule,
+                                     const ClassHierarchy& hierarchy,
+                                     const Scope& classes,
+                                     const ClassIndex* index,
+                                     TypePatterns& patterns) {
+  ClassMatcher class_match(keep_rule, patterns);
+  std::vector<DexClass*> matches;
+  auto match_single = [&](DexClass* cls) {
+    // Skip external classes.
+    if (cls == nullptr || cls->is_external()) {
+      return;
+    }
+    if (class_match.match(cls)) {
+      matches.push_back(cls);
+    }
+  };
+
+  auto const& className = keep_rule.class_spec.className;
+  if (!classname_contains_wildcard(className)) {
+    match_single(find_single_class(pg_map, className));
+    return matches;
+  }
+  auto const& extendsClassName = keep_rule.class_spec.extendsClassName;
+  if (extendsClassName != "" &&
+      !classname_contains_wildcard(extendsClassName)) {
+    DexClass* super = find_single_class(pg_map, extendsClassName);
+    if (super != nullptr) {
+      TypeSet children;
+      get_all_children(hierarchy, super->get_type(), children);
+      match_single(super);
+      for (auto const* type : children) {
+        match_single(type_class(type));
+      }
+    }
+    return matches;
+  }
+  std::vector<size_t> candidates;
+  if (index != nullptr &&
+      index->candidates(
+          patterns.get(className),
+          patterns.get(keep_rule.class_spec.annotationType, false),
+          &candidates)) {
+    for (auto i : candidates) {
+      match_single(index->get(i));
+    }
+    return matches;
+  }
+  for (const auto& cls : classes) {
+    match_single(cls);
+  }
+  return matches;
+}
+
 void process_keep(const ProguardMap& pg_map,
                   std::vector<KeepSpec>& keep_rules,
                   std::unordered_map<std::string, boost::regex*>& regex_map,
+                  const ClassHierarchy& hierarchy,
                   const Scope& classes,
-                  const Scope& external_classes,
+                  const ClassIndex* index,
+                  const ProguardMatcherOptions& options,
                   std::function<void(
                       std::unordered_map<std::string, boost::regex*>& regex_map,
                       KeepSpec&,
                       DexClass*)> keep_processor) {
-  ClassHierarchy hierarchy;
-  build_extends_or_implements_hierarchy(classes, &hierarchy);
-  // We need to include external classes in the hierarchy because keep rules
-  // may, for instance, forbid renaming of all classes that inherit from a
-  // given external class.
-  build_extends_or_implements_hierarchy(external_classes, &hierarchy);
-  auto process_single_keep = [&](
-      ClassMatcher& class_match, KeepSpec& keep_rule, DexClass* cls) {
-    // Skip external classes.
-    if (cls == nullptr || cls->is_external()) {
-      return;
-    }
-    if (class_match.match(cls)) {
-      keep_processor(regex_map, keep_rule, cls);
-    }
-  };
-  for (auto& keep_rule : keep_rules) {
-    ClassMatcher class_match(keep_rule);
-
-    auto const& className = keep_rule.class_spec.className;
-    if (!classname_contains_wildcard(className)) {
-      DexClass* cls = find_single_class(pg_map, className);
-      process_single_keep(class_match, keep_rule, cls);
-      continue;
-    }
-    auto const& extendsClassName = keep_rule.class_spec.extendsClassName;
-    if (extendsClassName != "" &&
-        !classname_contains_wildcard(extendsClassName)) {
-      DexClass* super = find_single_class(pg_map, extendsClassName);
-      if (super != nullptr) {
-        TypeSet children;
-        get_all_children(hierarchy, super->get_type(), children);
-        process_single_keep(class_match, keep_rule, super);
-        for (auto const* type : children) {
-          process_single_keep(class_match, keep_rule, type_class(type));
-        }
+  if (!options.indexed) {
+    for (auto& keep_rule : keep_rules) {
+      TypePatterns patterns(/* use_globs */ false);
+      for (auto cls : match_classes(
+               pg_map, keep_rule, hierarchy, classes, nullptr, patterns)) {
+        keep_processor(regex_map, keep_rule, cls);
       }
-      continue;
     }
-    for (const auto& cls : classes) {
-      process_single_keep(class_match, keep_rule, cls);
+    return;
+  }
+  // Matching the classes only reads them, so the rules can be matched in
+  // parallel. Applying them is order-dependent (see apply_keep_modifiers),
+  // so that is done afterwards, in rule order.
+  TypePatterns patterns(/* use_globs */ true);
+  std::vector<std::vector<DexClass*>> matches(keep_rules.size());
+  auto num_threads = options.num_threads;
+  if (num_threads == 0) {
+    num_threads = std::max(1u, std::thread::hardware_concurrency() / 2);
+  }
+  auto wq = workqueue_foreach<size_t>(
+      [&](size_t i) {
+        matches[i] = match_classes(
+            pg_map, keep_rules[i], hierarchy, classes, index, patterns);
+      },
+      num_threads);
+  for (size_t i = 0; i < keep_rules.size(); ++i) {
+    wq.add_item(i);
+  }
+  wq.run_all();
+  for (size_t i = 0; i < keep_rules.size(); ++i) {
+    for (auto cls : matches[i]) {
+      keep_processor(regex_map, keep_rules[i], cls);
     }
   }
 }
@@ -832,7 +1161,8 @@ void filter_duplicate_rules(std::vector<KeepSpec>* keep_rules) {
 void process_proguard_rules(const ProguardMap& pg_map,
                             const Scope& classes,
                             const Scope& external_classes,
-                            ProguardConfiguration* pg_config) {
+                            ProguardConfiguration* pg_config,
+                            const ProguardMatcherOptions& options) {
   size_t field_count = 0;
   size_t method_count = 0;
   for (const auto& cls : classes) {
@@ -843,25 +1173,41 @@ void process_proguard_rules(const ProguardMap& pg_map,
   // Filter out duplicate rules to speed up processing.
   filter_duplicate_rules(&pg_config->keep_rules);
   filter_duplicate_rules(&pg_config->assumenosideeffects_rules);
+  ClassHierarchy hierarchy;
+  build_extends_or_implements_hierarchy(classes, &hierarchy);
+  // We need to include external classes in the hierarchy because keep rules
+  // may, for instance, forbid renaming of all classes that inherit from a
+  // given external class.
+  build_extends_or_implements_hierarchy(external_classes, &hierarchy);
+  std::unique_ptr<ClassIndex> index;
+  if (options.indexed) {
+    index = std::make_unique<ClassIndex>(classes);
+  }
   // Now process each of the different kinds of rules as well
   // as -assumenosideeffects and -whyareyoukeeping.
   process_keep(pg_map,
                pg_config->whyareyoukeeping_rules,
                regex_map,
+               hierarchy,
                classes,
-               external_classes,
+               index.get(),
+               options,
                process_whyareyoukeeping);
   process_keep(pg_map,
                pg_config->keep_rules,
                regex_map,
+               hierarchy,
                classes,
-               external_classes,
+               index.get(),
+               options,
                mark_class_and_members_for_keep);
   process_keep(pg_map,
                pg_config->assumenosideeffects_rules,
                regex_map,
+               hierarchy,
                classes,
-               external_classes,
+               index.get(),
+               options,
                process_assumenosideeffects);
   for (auto& e : regex_map) {
     delete (e.second);
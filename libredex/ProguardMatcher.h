@@ -17,10 +17,24 @@ namespace redex {
 
 using Scope = std::vector<DexClass*>;
 
-void process_proguard_rules(const ProguardMap& pg_map,
-                            const Scope& classes,
-                            const Scope& external_classes,
-                            ProguardConfiguration* pg_config);
+struct ProguardMatcherOptions {
+  // Match the class-level part of the rules through an index of the classes
+  // by name prefix and annotation, with the wildcard patterns compiled once
+  // and shared by all the rules. Otherwise, every rule compiles its own
+  // regexes and is tried against every class.
+  bool indexed{true};
+  // Threads to match the rules on, when indexed; 0 picks a number from the
+  // hardware. The keep bits are always applied on a single thread, in rule
+  // order, so the result does not depend on it.
+  unsigned num_threads{0};
+};
+
+void process_proguard_rules(
+    const ProguardMap& pg_map,
+    const Scope& classes,
+    const Scope& external_classes,
+    ProguardConfiguration* pg_config,
+    const ProguardMatcherOptions& options = ProguardMatcherOptions());
 }
 
 // namespace redex
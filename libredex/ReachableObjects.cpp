@@ -9,10 +9,16 @@
 
 #include "ReachableObjects.h"
 
+#include <atomic>
+#include <mutex>
+#include <thread>
+
 #include "DexUtil.h"
+#include "InternTable.h"
 #include "Pass.h"
 #include "ReachableClasses.h"
 #include "Resolver.h"
+#include "WorkQueue.h"
 
 using namespace reachable_objects;
 
@@ -30,6 +36,15 @@ using namespace reachable_objects;
  * retain (or not) implementations of interface methods. These elements are
  * placed in the cond_marked_* sets; care must be taken to promote
  * conditionally marked elements to fully marked.
+ *
+ * With more than one thread, the DFS becomes a parallel traversal: every
+ * newly marked element is a task on a work-stealing WorkQueue, and the seeds
+ * are found by one task per class. Marking is a test-and-set on concurrent
+ * sets, so each element is still visited once. A conditional mark and the
+ * marking of its class are serialized by a lock striped over the classes;
+ * either the member sees its class marked, or the visit of the class sees the
+ * member. The marked sets are the same for any number of threads, since
+ * marking computes the least fixpoint of the rules below whatever the order.
  */
 
 namespace {
@@ -112,6 +127,70 @@ struct InheritanceGraph {
       m_inheritors;
 };
 
+/*
+ * A set that any number of threads can test and mark.
+ */
+template <class T>
+class MarkSet {
+ public:
+  // Returns whether x was not marked before.
+  bool mark(const T* x) { return m_table.insert(x, true); }
+
+  bool marked(const T* x) const { return m_table.get(x); }
+
+  std::unordered_set<const T*> to_set() const {
+    std::unordered_set<const T*> result;
+    result.reserve(m_table.size());
+    m_table.for_each([&](const T* x, bool) { result.emplace(x); });
+    return result;
+  }
+
+ private:
+  InternTable<const T*, bool> m_table;
+};
+
+/*
+ * For a type, the classes whose virtual methods may implement the type's
+ * virtual methods: those on the superclass chain of any of its descendants,
+ * up to the first external class. Many methods of the same type get kept, so
+ * each list is computed once and shared between threads.
+ */
+class ImplementorIndex {
+ public:
+  explicit ImplementorIndex(const InheritanceGraph& graph) : m_graph(graph) {}
+
+  ~ImplementorIndex() {
+    m_index.for_each(
+        [](const DexType*, const std::vector<const DexClass*>* classes) {
+          delete classes;
+        });
+  }
+
+  const std::vector<const DexClass*>& get(const DexType* type) {
+    return *m_index.get_or_create(type, [&] {
+      auto classes = new std::vector<const DexClass*>();
+      std::unordered_set<const DexClass*> seen;
+      for (auto child : m_graph.get_descendants(type)) {
+        while (true) {
+          auto child_cls = type_class(child);
+          if (!child_cls || child_cls->is_external() ||
+              !seen.emplace(child_cls).second) {
+            // A class already seen has had its superclasses added too.
+            break;
+          }
+          classes->push_back(child_cls);
+          child = child_cls->get_super_class();
+        }
+      }
+      return std::make_pair(type, classes);
+    });
+  }
+
+ private:
+  const InheritanceGraph& m_graph;
+  InternTable<const DexType*, std::vector<const DexClass*>*> m_index;
+};
+
 bool implements_library_method(const DexMethod* to_check, const DexClass* cls) {
   if (!cls) return false;
   if (cls->is_external()) {
@@ -144,22 +223,43 @@ bool implements_library_method(InheritanceGraph& graph,
   return false;
 }
 
+struct MarkTask {
+  enum Kind : uint8_t {
+    // Look for seeds in a class.
+    SEEDS,
+    CLASS,
+    FIELD,
+    METHOD,
+  };
+  Kind kind;
+  const void* object;
+};
+
 class Reachable {
+  static constexpr size_t kClassLockStripes = 64;
+
   DexStoresVector& m_stores;
   const std::unordered_set<const DexType*>& m_ignore_string_literals;
   const std::unordered_set<const DexType*>& m_ignore_string_literal_annos;
   std::unordered_set<const DexType*> m_ignore_system_annos;
   bool m_record_reachability;
   InheritanceGraph m_inheritance_graph;
-  int m_num_ignore_check_strings = 0;
-  std::unordered_set<const DexClass*> m_marked_classes;
-  std::unordered_set<const DexFieldRef*> m_marked_fields;
-  std::unordered_set<const DexMethodRef*> m_marked_methods;
-  std::unordered_set<const DexField*> m_cond_marked_fields;
-  std::unordered_set<const DexMethod*> m_cond_marked_methods;
+  ImplementorIndex m_implementors;
+  std::atomic<int> m_num_ignore_check_strings{0};
+  MarkSet<DexClass> m_marked_classes;
+  MarkSet<DexFieldRef> m_marked_fields;
+  MarkSet<DexMethodRef> m_marked_methods;
+  MarkSet<DexField> m_cond_marked_fields;
+  MarkSet<DexMethod> m_cond_marked_methods;
+  // Held while marking a class, and while conditionally marking a member of
+  // it.
+  std::mutex m_class_locks[kClassLockStripes];
+  // The worklist: the stacks when marking on one thread, the queue otherwise.
   std::vector<const DexClass*> m_class_stack;
   std::vector<const DexFieldRef*> m_field_stack;
   std::vector<const DexMethodRef*> m_method_stack;
+  WorkQueue<MarkTask, std::nullptr_t, std::nullptr_t>* m_queue{nullptr};
+  // Only recorded when marking on one thread.
   ReachableObjectGraph m_retainers_of;
 
  public:
@@ -174,7 +274,8 @@ class Reachable {
         m_ignore_string_literal_annos(ignore_string_literal_annos),
         m_ignore_system_annos(ignore_system_annos),
         m_record_reachability(record_reachability),
-        m_inheritance_graph(stores) {
+        m_inheritance_graph(stores),
+        m_implementors(m_inheritance_graph) {
     // To keep the backward compatability of this code, ensure that the
     // "MemberClasses" annotation is always in m_ignore_system_annos.
     m_ignore_system_annos.emplace(
@@ -182,27 +283,55 @@ class Reachable {
   }
 
  private:
-  void mark(const DexClass* cls) {
-    if (!cls) return;
-    m_marked_classes.emplace(cls);
+  std::mutex& class_lock(const DexClass* cls) {
+    return m_class_locks[(reinterpret_cast<uintptr_t>(cls) >> 4) %
+                         kClassLockStripes];
   }
 
-  void mark(const DexFieldRef* field) {
-    if (!field) return;
-    m_marked_fields.emplace(field);
+  // The mark() functions return whether the object was not marked before.
+  bool mark(const DexClass* cls) {
+    std::lock_guard<std::mutex> guard(class_lock(cls));
+    return m_marked_classes.mark(cls);
   }
 
-  void mark(const DexMethodRef* method) {
-    if (!method) return;
-    m_marked_methods.emplace(method);
+  bool mark(const DexFieldRef* field) { return m_marked_fields.mark(field); }
+
+  bool mark(const DexMethodRef* method) {
+    return m_marked_methods.mark(method);
   }
 
-  bool marked(const DexClass* cls) { return m_marked_classes.count(cls); }
+  bool marked(const DexClass* cls) { return m_marked_classes.marked(cls); }
 
-  bool marked(const DexFieldRef* field) { return m_marked_fields.count(field); }
+  bool marked(const DexFieldRef* field) {
+    return m_marked_fields.marked(field);
+  }
 
   bool marked(const DexMethodRef* method) {
-    return m_marked_methods.count(method);
+    return m_marked_methods.marked(method);
+  }
+
+  void enqueue(const DexClass* cls) {
+    if (m_queue) {
+      m_queue->add_item(MarkTask{MarkTask::CLASS, cls});
+    } else {
+      m_class_stack.emplace_back(cls);
+    }
+  }
+
+  void enqueue(const DexFieldRef* field) {
+    if (m_queue) {
+      m_queue->add_item(MarkTask{MarkTask::FIELD, field});
+    } else {
+      m_field_stack.emplace_back(field);
+    }
+  }
+
+  void enqueue(const DexMethodRef* method) {
+    if (m_queue) {
+      m_queue->add_item(MarkTask{MarkTask::METHOD, method});
+    } else {
+      m_method_stack.emplace_back(method);
+    }
   }
 
   void push_seed(const DexType* type) {
@@ -217,76 +346,75 @@ class Reachable {
   }
 
   void push_seed(const DexClass* cls) {
-    if (!cls || marked(cls)) return;
+    if (!cls || marked(cls) || !mark(cls)) return;
     record_is_seed(cls);
-    mark(cls);
-    m_class_stack.emplace_back(cls);
+    enqueue(cls);
   }
 
   template <class Parent>
   void push(const Parent* parent, const DexClass* cls) {
     // FIXME: Bug! Even if cls is already marked, we need to record its
     // reachability from parent to cls.
-    if (!cls || marked(cls)) return;
+    if (!cls || marked(cls) || !mark(cls)) return;
     record_reachability(parent, cls);
-    mark(cls);
-    m_class_stack.emplace_back(cls);
+    enqueue(cls);
   }
 
   void push_seed(const DexField* field) {
-    if (!field || marked(field)) return;
+    if (!field || marked(field) || !mark(field)) return;
     record_is_seed(field);
-    mark(field);
-    m_field_stack.emplace_back(field);
+    enqueue(field);
   }
 
   void push_cond(const DexField* field) {
     if (!field || marked(field)) return;
     TRACE(REACH, 4, "Conditionally marking field: %s\n", SHOW(field));
     auto clazz = type_class(field->get_class());
-
-    if (marked(clazz)) {
-      push(clazz, field);
-    } else {
-      m_cond_marked_fields.emplace(field);
+    {
+      std::lock_guard<std::mutex> guard(class_lock(clazz));
+      if (!marked(clazz)) {
+        m_cond_marked_fields.mark(field);
+        return;
+      }
     }
+    push(clazz, field);
   }
 
   template <class Parent>
   void push(const Parent* parent, const DexFieldRef* field) {
-    if (!field || marked(field)) return;
+    if (!field || marked(field) || !mark(field)) return;
     if (field->is_def()) {
       gather_and_push(static_cast<const DexField*>(field));
     }
     record_reachability(parent, field);
-    mark(field);
-    m_field_stack.emplace_back(field);
+    enqueue(field);
   }
 
   void push_seed(const DexMethod* method) {
-    if (!method || marked(method)) return;
+    if (!method || marked(method) || !mark(method)) return;
     record_is_seed(method);
-    mark(method);
-    m_method_stack.emplace_back(method);
+    enqueue(method);
   }
 
   template <class Parent>
   void push(const Parent* parent, const DexMethodRef* method) {
-    if (!method || marked(method)) return;
+    if (!method || marked(method) || !mark(method)) return;
     record_reachability(parent, method);
-    mark(method);
-    m_method_stack.emplace_back(method);
+    enqueue(method);
   }
 
   void push_cond(const DexMethod* method) {
     if (!method || marked(method)) return;
     TRACE(REACH, 4, "Conditionally marking method: %s\n", SHOW(method));
     auto clazz = type_class(method->get_class());
-    if (marked(clazz)) {
-      push(clazz, method);
-    } else {
-      m_cond_marked_methods.emplace(method);
+    {
+      std::lock_guard<std::mutex> guard(class_lock(clazz));
+      if (!marked(clazz)) {
+        m_cond_marked_methods.mark(method);
+        return;
+      }
     }
+    push(clazz, method);
   }
 
   void gather_and_push(DexMethod* meth) {
@@ -373,22 +501,22 @@ class Reachable {
       }
     }
     for (auto const& m : cls->get_ifields()) {
-      if (m_cond_marked_fields.count(m)) {
+      if (m_cond_marked_fields.marked(m)) {
         push(cls, m);
       }
     }
     for (auto const& m : cls->get_sfields()) {
-      if (m_cond_marked_fields.count(m)) {
+      if (m_cond_marked_fields.marked(m)) {
         push(cls, m);
       }
     }
     for (auto const& m : cls->get_dmethods()) {
-      if (m_cond_marked_methods.count(m)) {
+      if (m_cond_marked_methods.marked(m)) {
         push(cls, m);
       }
     }
     for (auto const& m : cls->get_vmethods()) {
-      if (m_cond_marked_methods.count(m)) {
+      if (m_cond_marked_methods.marked(m)) {
         push(cls, m);
       }
     }
@@ -423,20 +551,11 @@ class Reachable {
       // If we're keeping an interface method, we have to keep its
       // implementations.  Annoyingly, the implementation might be defined on a
       // super class of the class that implements the interface.
-      auto const& cls = method->get_class();
-      auto const& children = m_inheritance_graph.get_descendants(cls);
-      for (auto child : children) {
-        while (true) {
-          auto child_cls = type_class(child);
-          if (!child_cls || child_cls->is_external()) {
-            break;
-          }
-          for (auto const& m : child_cls->get_vmethods()) {
-            if (signatures_match(method, m)) {
-              push_cond(m);
-            }
+      for (auto child_cls : m_implementors.get(method->get_class())) {
+        for (auto const& m : child_cls->get_vmethods()) {
+          if (signatures_match(method, m)) {
+            push_cond(m);
           }
-          child = child_cls->get_super_class();
         }
       }
     }
@@ -481,39 +600,73 @@ class Reachable {
     }
   }
 
- public:
-  ReachableObjects mark(int* num_ignore_check_strings) {
+  void push_seeds(const DexClass* cls) {
+    if (root(cls) || is_canary(cls)) {
+      TRACE(REACH, 3, "Visiting seed: %s\n", SHOW(cls));
+      push_seed(cls);
+    }
+    for (auto const& f : cls->get_ifields()) {
+      if (root(f) || is_volatile(f)) {
+        TRACE(REACH, 3, "Visiting seed: %s\n", SHOW(f));
+        push_cond(f);
+      }
+    }
+    for (auto const& f : cls->get_sfields()) {
+      if (root(f)) {
+        TRACE(REACH, 3, "Visiting seed: %s\n", SHOW(f));
+        push_cond(f);
+      }
+    }
+    for (auto const& m : cls->get_dmethods()) {
+      if (root(m)) {
+        TRACE(REACH, 3, "Visiting seed: %s\n", SHOW(m));
+        push_cond(m);
+      }
+    }
+    for (auto const& m : cls->get_vmethods()) {
+      if (root(m) || implements_library_method(m_inheritance_graph, m, cls)) {
+        TRACE(REACH, 3, "Visiting seed: %s\n", SHOW(m));
+        push_cond(m);
+      }
+    }
+  }
+
+  void run(const MarkTask& task) {
+    switch (task.kind) {
+    case MarkTask::SEEDS:
+      push_seeds(static_cast<const DexClass*>(task.object));
+      break;
+    case MarkTask::CLASS:
+      visit(static_cast<const DexClass*>(task.object));
+      break;
+    case MarkTask::FIELD:
+      visit(const_cast<DexFieldRef*>(
+          static_cast<const DexFieldRef*>(task.object)));
+      break;
+    case MarkTask::METHOD:
+      visit(const_cast<DexMethodRef*>(
+          static_cast<const DexMethodRef*>(task.object)));
+      break;
+    }
+  }
+
+  void mark_parallel(unsigned num_threads) {
+    auto wq = workqueue_foreach<MarkTask>(
+        [this](MarkTask task) { run(task); }, num_threads);
     for (auto const& dex : DexStoreClassesIterator(m_stores)) {
       for (auto const& cls : dex) {
-        if (root(cls) || is_canary(cls)) {
-          TRACE(REACH, 3, "Visiting seed: %s\n", SHOW(cls));
-          push_seed(cls);
-        }
-        for (auto const& f : cls->get_ifields()) {
-          if (root(f) || is_volatile(f)) {
-            TRACE(REACH, 3, "Visiting seed: %s\n", SHOW(f));
-            push_cond(f);
-          }
-        }
-        for (auto const& f : cls->get_sfields()) {
-          if (root(f)) {
-            TRACE(REACH, 3, "Visiting seed: %s\n", SHOW(f));
-            push_cond(f);
-          }
-        }
-        for (auto const& m : cls->get_dmethods()) {
-          if (root(m)) {
-            TRACE(REACH, 3, "Visiting seed: %s\n", SHOW(m));
-            push_cond(m);
-          }
-        }
-        for (auto const& m : cls->get_vmethods()) {
-          if (root(m) ||
-              implements_library_method(m_inheritance_graph, m, cls)) {
-            TRACE(REACH, 3, "Visiting seed: %s\n", SHOW(m));
-            push_cond(m);
-          }
-        }
+        wq.add_item(MarkTask{MarkTask::SEEDS, cls});
+      }
+    }
+    m_queue = &wq;
+    wq.run_all();
+    m_queue = nullptr;
+  }
+
+  void mark_serial() {
+    for (auto const& dex : DexStoreClassesIterator(m_stores)) {
+      for (auto const& cls : dex) {
+        push_seeds(cls);
       }
     }
     while (true) {
@@ -537,15 +690,25 @@ class Reachable {
       }
       break;
     }
+  }
+
+ public:
+  ReachableObjects mark(int* num_ignore_check_strings, unsigned num_threads) {
+    if (num_threads > 1) {
+      always_assert(!m_record_reachability);
+      mark_parallel(num_threads);
+    } else {
+      mark_serial();
+    }
 
     if (num_ignore_check_strings) {
       *num_ignore_check_strings = m_num_ignore_check_strings;
     }
 
     ReachableObjects ret;
-    ret.marked_fields = std::move(m_marked_fields);
-    ret.marked_classes = std::move(m_marked_classes);
-    ret.marked_methods = std::move(m_marked_methods);
+    ret.marked_fields = m_marked_fields.to_set();
+    ret.marked_classes = m_marked_classes.to_set();
+    ret.marked_methods = m_marked_methods.to_set();
     ret.retainers_of = std::move(m_retainers_of);
     return ret;
   }
@@ -645,13 +808,20 @@ ReachableObjects compute_reachable_objects(
     const std::unordered_set<const DexType*>& ignore_string_literal_annos,
     const std::unordered_set<const DexType*>& ignore_system_annos,
     int* num_ignore_check_strings,
-    bool record_reachability) {
+    bool record_reachability,
+    unsigned num_threads) {
+  if (record_reachability) {
+    // Which retainer gets recorded depends on the order of the traversal.
+    num_threads = 1;
+  } else if (num_threads == 0) {
+    num_threads = std::max(1u, std::thread::hardware_concurrency() / 2);
+  }
   return Reachable(stores,
                    ignore_string_literals,
                    ignore_string_literal_annos,
                    ignore_system_annos,
                    record_reachability)
-      .mark(num_ignore_check_strings);
+      .mark(num_ignore_check_strings, num_threads);
 }
 
 void dump_reachability(DexStoresVector& stores,
@@ -157,13 +157,20 @@ struct ReachableObjects {
   reachable_objects::ReachableObjectGraph retainers_of;
 };
 
+/*
+ * Mark what is reachable from the roots of the stores. With num_threads > 1,
+ * marking runs in parallel and yields the same marked sets; 0 picks a number
+ * of threads from the hardware. Recording the retainers always marks on a
+ * single thread.
+ */
 ReachableObjects compute_reachable_objects(
     DexStoresVector& stores,
     const std::unordered_set<const DexType*>& ignore_string_literals,
     const std::unordered_set<const DexType*>& ignore_string_literal_annos,
     const std::unordered_set<const DexType*>& ignore_system_annos,
     int* num_ignore_check_strings,
-    bool record_reachability = false);
+    bool record_reachability = false,
+    unsigned num_threads = 0);
 
 // Dump reachability information to TRACE(REACH_DUMP, 5).
 void dump_reachability(DexStoresVector& stores,
@@ -21,121 +21,86 @@ RedexContext::RedexContext() {}
 
 RedexContext::~RedexContext() {
   // Delete DexStrings.
-  for (auto const& p : s_string_map) {
-    delete p.second;
-  }
+  s_string_map.for_each(
+      [](const char*, DexString* str) { delete str; });
   // Delete DexTypes.  NB: This table intentionally contains aliases (multiple
   // DexStrings map to the same DexType), so we have to dedup the set of types
   // before deleting to avoid double-frees.
   std::unordered_set<DexType*> delete_types;
-  for (auto const& p : s_type_map) {
-    delete_types.emplace(p.second);
-  }
+  s_type_map.for_each(
+      [&](DexString*, DexType* type) { delete_types.emplace(type); });
   for (auto const& t : delete_types) {
     delete t;
   }
   // Delete DexFields.
-  for (auto const& it : s_field_map) {
-    delete static_cast<DexField*>(it.second);
-  }
+  s_field_map.for_each([](const DexFieldSpec&, DexFieldRef* field) {
+    delete static_cast<DexField*>(field);
+  });
   // Delete DexTypeLists.
-  for (auto const& p : s_typelist_map) {
-    delete p.second;
-  }
+  s_typelist_map.for_each(
+      [](const std::deque<DexType*>*, DexTypeList* list) { delete list; });
   // Delete DexProtos.
-  for (auto const& p1 : s_proto_map) {
-    for (auto const& p2 : p1.second) {
-      delete p2.second;
-    }
-  }
+  s_proto_map.for_each(
+      [](const ProtoKey&, DexProto* proto) { delete proto; });
   // Delete DexMethods.
-  for (auto const& it : s_method_map) {
-    delete it.second;
-  }
+  s_method_map.for_each(
+      [](const DexMethodSpec&, DexMethodRef* method) { delete method; });
 }
 
 DexString* RedexContext::make_string(const char* nstr, uint32_t utfsize) {
   always_assert(nstr != nullptr);
-  std::lock_guard<std::mutex> lock(s_string_lock);
-  auto it = s_string_map.find(nstr);
-  if (it == s_string_map.end()) {
+  return s_string_map.get_or_create(nstr, [&] {
     // note DexStrings are keyed by the c_str() of the underlying std::string
     // The c_str is valid until a the string is destroyed, or until a non-const
     // function is called on the string (but note the std::string itself is
     // const)
     auto rv = new DexString(nstr, utfsize);
-    s_string_map.emplace(rv->c_str(), rv);
-    return rv;
-  } else {
-    return it->second;
-  }
+    return std::make_pair(rv->c_str(), rv);
+  });
 }
 
 DexString* RedexContext::get_string(const char* nstr, uint32_t utfsize) {
   if (nstr == nullptr) {
     return nullptr;
   }
-  // We need to use the lock to prevent undefined behavior if this method is
-  // called while the map is being modified.
-  std::lock_guard<std::mutex> lock(s_string_lock);
-  auto find = s_string_map.find(nstr);
-  auto result = find != s_string_map.end() ? find->second : nullptr;
-  return result;
+  return s_string_map.get(nstr);
 }
 
 DexType* RedexContext::make_type(DexString* dstring) {
   always_assert(dstring != nullptr);
-  std::lock_guard<std::mutex> lock(s_type_lock);
-  auto it = s_type_map.find(dstring);
-  if (it == s_type_map.end()) {
-    auto rv = new DexType(dstring);
-    s_type_map.emplace(dstring, rv);
-    return rv;
-  } else {
-    return it->second;
-  }
+  return s_type_map.get_or_create(dstring, [&] {
+    return std::make_pair(dstring, new DexType(dstring));
+  });
 }
 
 DexType* RedexContext::get_type(DexString* dstring) {
   if (dstring == nullptr) {
     return nullptr;
   }
-  // We need to use the lock to prevent undefined behavior if this method is
-  // called while the map is being modified.
-  std::lock_guard<std::mutex> lock(s_type_lock);
-  auto find = s_type_map.find(dstring);
-  auto result = find != s_type_map.end() ? find->second : nullptr;
-  return result;
+  return s_type_map.get(dstring);
 }
 
 void RedexContext::alias_type_name(DexType* type, DexString* new_name) {
-  std::lock_guard<std::mutex> lock(s_type_lock);
   always_assert_log(
-      !s_type_map.count(new_name),
+      s_type_map.insert(new_name, type),
       "Bailing, attempting to alias a symbol that already exists! '%s'\n",
       new_name->c_str());
   type->m_name = new_name;
-  s_type_map.emplace(new_name, type);
 }
 
 DexFieldRef* RedexContext::make_field(const DexType* container,
                                       const DexString* name,
                                       const DexType* type) {
   always_assert(container != nullptr && name != nullptr && type != nullptr);
-  std::lock_guard<std::mutex> lock(s_field_lock);
   DexFieldSpec r(const_cast<DexType*>(container),
                 const_cast<DexString*>(name),
                 const_cast<DexType*>(type));
-  auto it = s_field_map.find(r);
-  if (it == s_field_map.end()) {
-    auto rv = new DexField(const_cast<DexType*>(container),
-                           const_cast<DexString*>(name),
-                           const_cast<DexType*>(type));
-    s_field_map.emplace(r, rv);
-    return rv;
-  } else {
-    return it->second;
-  }
+  return s_field_map.get_or_create(r, [&] {
+    DexFieldRef* rv = new DexField(const_cast<DexType*>(container),
+                                   const_cast<DexString*>(name),
+                                   const_cast<DexType*>(type));
+    return std::make_pair(r, rv);
+  });
 }
 
 DexFieldRef* RedexContext::get_field(const DexType* container,
@@ -147,71 +112,48 @@ DexFieldRef* RedexContext::get_field(const DexType* container,
   DexFieldSpec r(const_cast<DexType*>(container),
                 const_cast<DexString*>(name),
                 const_cast<DexType*>(type));
-  // Still need to perform the locking in case a make_method call on another
-  // thread is modifying the map.
-  std::lock_guard<std::mutex> lock(s_field_lock);
-  auto it = s_field_map.find(r);
-  if (it == s_field_map.end()) {
-    return nullptr;
-  } else {
-    return it->second;
-  }
+  return s_field_map.get(r);
 }
 
 void RedexContext::mutate_field(DexFieldRef* field, const DexFieldSpec& ref) {
-  std::lock_guard<std::mutex> lock(s_field_lock);
-  DexFieldSpec& r = field->m_spec;
-  s_field_map.erase(r);
+  std::lock_guard<std::mutex> lock(m_mutate_lock);
+  DexFieldSpec r = field->m_spec;
   r.cls = ref.cls != nullptr ? ref.cls : field->m_spec.cls;
   r.name = ref.name != nullptr ? ref.name : field->m_spec.name;
   r.type = ref.type != nullptr ? ref.type : field->m_spec.type;
+  // Renaming a field onto an existing one is tolerated: the existing field
+  // stays interned under the new spec, and the renamed one is no longer
+  // interned at all.
+  s_field_map.rekey_or_drop(field->m_spec, r, field);
   field->m_spec = r;
-  s_field_map.emplace(r, field);
 }
 
 DexTypeList* RedexContext::make_type_list(std::deque<DexType*>&& p) {
-  std::lock_guard<std::mutex> lock(s_typelist_lock);
-  auto it = s_typelist_map.find(p);
-  if (it == s_typelist_map.end()) {
+  return s_typelist_map.get_or_create(&p, [&] {
     auto rv = new DexTypeList(std::move(p));
-    s_typelist_map[rv->m_list] = rv;
-    return rv;
-  } else {
-    return it->second;
-  }
+    return std::make_pair(&rv->m_list, rv);
+  });
 }
 
 DexTypeList* RedexContext::get_type_list(std::deque<DexType*>&& p) {
-  // We need to use the lock to prevent undefined behavior if this method is
-  // called while the map is being modified.
-  std::lock_guard<std::mutex> lock(s_typelist_lock);
-  auto find = s_typelist_map.find(p);
-  auto result = find != s_typelist_map.end() ? find->second : nullptr;
-  return result;
+  return s_typelist_map.get(&p);
 }
 
 DexProto* RedexContext::make_proto(DexType* rtype,
                                    DexTypeList* args,
                                    DexString* shorty) {
   always_assert(rtype != nullptr && args != nullptr && shorty != nullptr);
-  std::lock_guard<std::mutex> lock(s_proto_lock);
-  if (s_proto_map[rtype].count(args) == 0) {
-    auto rv = new DexProto(rtype, args, shorty);
-    s_proto_map[rtype][args] = rv;
-    return rv;
-  }
-  return s_proto_map[rtype][args];
+  ProtoKey key(rtype, args);
+  return s_proto_map.get_or_create(key, [&] {
+    return std::make_pair(key, new DexProto(rtype, args, shorty));
+  });
 }
 
 DexProto* RedexContext::get_proto(DexType* rtype, DexTypeList* args) {
   if (rtype == nullptr || args == nullptr) {
     return nullptr;
   }
-  std::lock_guard<std::mutex> lock(s_proto_lock);
-  if (s_proto_map[rtype].count(args) == 0) {
-    return nullptr;
-  }
-  return s_proto_map[rtype][args];
+  return s_proto_map.get(ProtoKey(rtype, args));
 }
 
 DexMethodRef* RedexContext::make_method(DexType* type,
@@ -219,15 +161,10 @@ DexMethodRef* RedexContext::make_method(DexType* type,
                                         DexProto* proto) {
   always_assert(type != nullptr && name != nullptr && proto != nullptr);
   DexMethodSpec r(type, name, proto);
-  std::lock_guard<std::mutex> lock(s_method_lock);
-  auto it = s_method_map.find(r);
-  if (it == s_method_map.end()) {
-    auto rv = new DexMethod(type, name, proto);
-    s_method_map.emplace(r, rv);
-    return rv;
-  } else {
-    return it->second;
-  }
+  return s_method_map.get_or_create(r, [&] {
+    DexMethodRef* rv = new DexMethod(type, name, proto);
+    return std::make_pair(r, rv);
+  });
 }
 
 DexMethodRef* RedexContext::get_method(DexType* type,
@@ -236,47 +173,30 @@ DexMethodRef* RedexContext::get_method(DexType* type,
   if (type == nullptr || name == nullptr || proto == nullptr) {
     return nullptr;
   }
-  DexMethodSpec r(type, name, proto);
-  // Still need to perform the locking in case a make_method call on another
-  // thread is modifying the map.
-  std::lock_guard<std::mutex> lock(s_method_lock);
-  auto it = s_method_map.find(r);
-  if (it == s_method_map.end()) {
-    return nullptr;
-  } else {
-    return it->second;
-  }
+  return s_method_map.get(DexMethodSpec(type, name, proto));
 }
 
 void RedexContext::erase_method(DexMethodRef* method) {
-  std::lock_guard<std::mutex> lock(s_method_lock);
   s_method_map.erase(method->m_spec);
 }
 
 void RedexContext::mutate_method(DexMethodRef* method,
                                  const DexMethodSpec& ref,
                                  bool rename_on_collision /* = false */) {
-  std::lock_guard<std::mutex> lock(s_method_lock);
-  DexMethodSpec& r = method->m_spec;
-  s_method_map.erase(r);
-
+  std::lock_guard<std::mutex> lock(m_mutate_lock);
+  DexMethodSpec r = method->m_spec;
   r.cls = ref.cls != nullptr ? ref.cls : method->m_spec.cls;
   r.name = ref.name != nullptr ? ref.name : method->m_spec.name;
   r.proto = ref.proto != nullptr ? ref.proto : method->m_spec.proto;
-  if (s_method_map.find(r) != s_method_map.end() && rename_on_collision) {
-    std::string original_name(r.name->c_str());
+  if (!s_method_map.rekey(method->m_spec, r, method)) {
+    always_assert_log(rename_on_collision,
+                      "Another method of the same signature already exists");
     uint32_t i = 0;
-    while (true) {
-      r.name = DexString::make_string(
-          ("r$" + std::to_string(i++)).c_str());
-      if (s_method_map.find(r) == s_method_map.end()) {
-        break;
-      }
-    }
+    do {
+      r.name = DexString::make_string(("r$" + std::to_string(i++)).c_str());
+    } while (!s_method_map.rekey(method->m_spec, r, method));
   }
-  always_assert_log(s_method_map.find(r) == s_method_map.end(),
-                    "Another method of the same signature already exists");
-  s_method_map.emplace(r, method);
+  method->m_spec = r;
 }
 
 void RedexContext::publish_class(DexClass* cls) {
@@ -19,7 +19,10 @@
 #include <unordered_map>
 #include <vector>
 
+#include <boost/functional/hash.hpp>
+
 #include "DexMemberRefs.h"
+#include "InternTable.h"
 
 class DexDebugInstruction;
 class DexString;
@@ -97,36 +100,57 @@ struct RedexContext {
   }
 
  private:
-  struct carray_cmp {
+  struct carray_hash {
+    size_t operator()(const char* s) const {
+      return boost::hash_range(s, s + strlen(s));
+    }
+  };
+  struct carray_eq {
     bool operator()(const char* a, const char* b) const {
-      return (strcmp(a, b) < 0);
+      return strcmp(a, b) == 0;
+    }
+  };
+  // DexTypeLists are keyed by a pointer to their own list.
+  struct type_list_hash {
+    size_t operator()(const std::deque<DexType*>* l) const {
+      return boost::hash_range(l->begin(), l->end());
     }
   };
+  struct type_list_eq {
+    bool operator()(const std::deque<DexType*>* a,
+                    const std::deque<DexType*>* b) const {
+      return *a == *b;
+    }
+  };
+  using ProtoKey = std::pair<DexType*, DexTypeList*>;
+
+  // The interning tables are sharded; lookups of existing entries take no
+  // lock.
 
   // DexString
-  std::map<const char*, DexString*, carray_cmp> s_string_map;
-  std::mutex s_string_lock;
+  InternTable<const char*, DexString*, carray_hash, carray_eq> s_string_map;
 
   // DexType
-  std::unordered_map<DexString*, DexType*> s_type_map;
-  std::mutex s_type_lock;
+  InternTable<DexString*, DexType*> s_type_map;
 
   // DexFieldRef
-  std::unordered_map<DexFieldSpec, DexFieldRef*> s_field_map;
-  std::mutex s_field_lock;
+  InternTable<DexFieldSpec, DexFieldRef*> s_field_map;
 
   // DexTypeList
-  std::map<std::deque<DexType*>, DexTypeList*> s_typelist_map;
-  std::mutex s_typelist_lock;
+  InternTable<const std::deque<DexType*>*,
+              DexTypeList*,
+              type_list_hash,
+              type_list_eq>
+      s_typelist_map;
 
   // DexProto
-  std::unordered_map<DexType*, std::unordered_map<DexTypeList*, DexProto*>>
-      s_proto_map;
-  std::mutex s_proto_lock;
+  InternTable<ProtoKey, DexProto*, boost::hash<ProtoKey>> s_proto_map;
 
   // DexMethod
-  std::unordered_map<DexMethodSpec, DexMethodRef*> s_method_map;
-  std::mutex s_method_lock;
+  InternTable<DexMethodSpec, DexMethodRef*> s_method_map;
+
+  // Serializes renaming of fields and methods.
+  std::mutex m_mutate_lock;
 
   // Type-to-class map and class hierarchy
   std::mutex m_type_system_mutex;
@@ -10,6 +10,9 @@
 #include "Trace.h"
 
 #include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <cstdarg>
 #include <cstdio>
 #include <cstdlib>
@@ -17,11 +20,221 @@
 #include <ctime>
 #include <mutex>
 #include <string>
+#include <thread>
 #include <unordered_map>
+#include <unordered_set>
 #include <utility>
+#include <vector>
+
+#include "BinaryTrace.h"
 
 namespace {
 
+/*
+ * A single-producer single-consumer byte ring. The thread that owns it
+ * appends whole records; the flusher thread copies out everything appended
+ * so far. Neither ever blocks the other.
+ */
+class TraceRing {
+ public:
+  static constexpr size_t kCapacity = 1 << 20;
+
+  explicit TraceRing(uint32_t thread)
+      : m_thread(thread), m_data(new char[kCapacity]) {}
+
+  uint32_t thread() const { return m_thread; }
+
+  size_t used() const {
+    return m_head.load(std::memory_order_relaxed) -
+           m_tail.load(std::memory_order_relaxed);
+  }
+
+  bool try_push(const char* data, size_t size) {
+    auto head = m_head.load(std::memory_order_relaxed);
+    auto tail = m_tail.load(std::memory_order_acquire);
+    if (kCapacity - (head - tail) < size) {
+      return false;
+    }
+    auto at = head % kCapacity;
+    auto first = std::min(size, kCapacity - at);
+    memcpy(m_data.get() + at, data, first);
+    memcpy(m_data.get(), data + first, size - first);
+    m_head.store(head + size, std::memory_order_release);
+    return true;
+  }
+
+  // Called by the flusher only.
+  void drain(std::vector<char>& out) {
+    auto tail = m_tail.load(std::memory_order_relaxed);
+    auto head = m_head.load(std::memory_order_acquire);
+    auto size = head - tail;
+    auto at = tail % kCapacity;
+    auto first = std::min(size, kCapacity - at);
+    out.insert(out.end(), m_data.get() + at, m_data.get() + at + first);
+    out.insert(out.end(), m_data.get(), m_data.get() + (size - first));
+    m_tail.store(head, std::memory_order_release);
+  }
+
+ private:
+  const uint32_t m_thread;
+  std::unique_ptr<char[]> m_data;
+  std::atomic<uint64_t> m_head{0};
+  std::atomic<uint64_t> m_tail{0};
+};
+
+/*
+ * The binary backend, enabled by TRACE_BINARY=<file>. See BinaryTrace.h for
+ * the format and tools/trace-decode for turning the file into text.
+ */
+class BinaryTracer {
+ public:
+  explicit BinaryTracer(FILE* file)
+      : m_file(file), m_start(std::chrono::steady_clock::now()) {
+    fwrite(binary_trace::kMagic, sizeof(binary_trace::kMagic), 1, m_file);
+    write_u32(binary_trace::kBinaryTraceVersion);
+    write_u32(N_TRACE_MODULES);
+    const char* names[] = {
+#define TM(x) #x,
+        TMS
+#undef TM
+    };
+    for (auto name : names) {
+      write_u32(strlen(name));
+      fwrite(name, strlen(name), 1, m_file);
+    }
+    m_flusher = std::thread([this] { flush_loop(); });
+  }
+
+  ~BinaryTracer() {
+    {
+      std::lock_guard<std::mutex> lock(m_wakeup_mutex);
+      m_stop = true;
+    }
+    m_wakeup.notify_one();
+    m_flusher.join();
+    fclose(m_file);
+  }
+
+  void trace(TraceModule module, int level, const char* fmt, va_list ap) {
+    thread_local std::vector<char> record;
+    thread_local std::unordered_set<const char*> known_formats;
+    record.clear();
+    if (known_formats.insert(fmt).second) {
+      auto len = strlen(fmt);
+      put_u32(record, binary_trace::kFormatHeaderSize + len);
+      record.push_back(binary_trace::kFormatRecord);
+      put_u64(record, reinterpret_cast<uintptr_t>(fmt));
+      record.insert(record.end(), fmt, fmt + len);
+    }
+    auto event = record.size();
+    put_u32(record, 0);
+    record.push_back(binary_trace::kEventRecord);
+    record.push_back(static_cast<char>(module));
+    record.push_back(static_cast<char>(level));
+    record.push_back(0);
+    put_u64(record,
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - m_start)
+                .count());
+    put_u64(record, reinterpret_cast<uintptr_t>(fmt));
+    binary_trace::encode_args(record, fmt, ap);
+    uint32_t size = record.size() - event;
+    memcpy(record.data() + event, &size, sizeof(size));
+
+    auto ring = thread_ring();
+    if (record.size() > TraceRing::kCapacity / 4) {
+      // Too big to go through the ring; huge messages are rare.
+      std::lock_guard<std::mutex> lock(m_file_mutex);
+      write_chunk(ring->thread(), record);
+      return;
+    }
+    while (!ring->try_push(record.data(), record.size())) {
+      m_wakeup.notify_one();
+      std::this_thread::yield();
+    }
+    if (ring->used() > TraceRing::kCapacity / 2) {
+      m_wakeup.notify_one();
+    }
+  }
+
+ private:
+  static void put_u32(std::vector<char>& out, uint32_t v) {
+    out.insert(out.end(), (char*)&v, (char*)&v + sizeof(v));
+  }
+
+  static void put_u64(std::vector<char>& out, uint64_t v) {
+    out.insert(out.end(), (char*)&v, (char*)&v + sizeof(v));
+  }
+
+  TraceRing* thread_ring() {
+    thread_local TraceRing* ring = nullptr;
+    if (ring == nullptr) {
+      std::lock_guard<std::mutex> lock(m_rings_mutex);
+      // Rings outlive their threads, so that what a thread traced just
+      // before exiting still gets written.
+      m_rings.emplace_back(std::make_unique<TraceRing>(m_rings.size()));
+      ring = m_rings.back().get();
+    }
+    return ring;
+  }
+
+  void flush_loop() {
+    for (;;) {
+      bool stop;
+      {
+        std::unique_lock<std::mutex> lock(m_wakeup_mutex);
+        m_wakeup.wait_for(
+            lock, std::chrono::milliseconds(20), [this] { return m_stop; });
+        stop = m_stop;
+      }
+      flush();
+      if (stop) {
+        return;
+      }
+    }
+  }
+
+  void flush() {
+    std::vector<TraceRing*> rings;
+    {
+      std::lock_guard<std::mutex> lock(m_rings_mutex);
+      for (auto& ring : m_rings) {
+        rings.push_back(ring.get());
+      }
+    }
+    std::lock_guard<std::mutex> lock(m_file_mutex);
+    for (auto ring : rings) {
+      m_chunk.clear();
+      ring->drain(m_chunk);
+      if (!m_chunk.empty()) {
+        write_chunk(ring->thread(), m_chunk);
+      }
+    }
+    fflush(m_file);
+  }
+
+  void write_chunk(uint32_t thread, const std::vector<char>& records) {
+    write_u32(thread);
+    write_u32(records.size());
+    fwrite(records.data(), records.size(), 1, m_file);
+  }
+
+  void write_u32(uint32_t v) { fwrite(&v, sizeof(v), 1, m_file); }
+
+  FILE* m_file;
+  const std::chrono::steady_clock::time_point m_start;
+  std::mutex m_file_mutex;
+  std::vector<char> m_chunk;
+
+  std::mutex m_rings_mutex;
+  std::vector<std::unique_ptr<TraceRing>> m_rings;
+
+  std::thread m_flusher;
+  std::mutex m_wakeup_mutex;
+  std::condition_variable m_wakeup;
+  bool m_stop{false};
+};
+
 struct Tracer {
 
   bool m_show_timestamps{false};
@@ -34,11 +247,21 @@ struct Tracer {
     const char* envfile = getenv("TRACEFILE");
     const char* show_timestamps = getenv("SHOW_TIMESTAMPS");
     const char* show_tracemodule = getenv("SHOW_TRACEMODULE");
+    const char* binary_file = getenv("TRACE_BINARY");
     m_method_filter = getenv("TRACE_METHOD_FILTER");
     if (!traceenv) {
       return;
     }
     init_trace_modules(traceenv);
+    if (binary_file) {
+      auto file = fopen(binary_file, "wb");
+      if (!file) {
+        fprintf(stderr, "Unable to open %s\n", binary_file);
+        abort();
+      }
+      m_binary = std::make_unique<BinaryTracer>(file);
+      return;
+    }
     init_trace_file(envfile);
 
     if (show_timestamps) {
@@ -64,11 +287,12 @@ struct Tracer {
   }
 
   void trace(TraceModule module, int level, const char* fmt, va_list ap) {
-    if (m_method_filter && !TraceContext::s_current_method.empty()) {
-      if (strstr(TraceContext::s_current_method.c_str(), m_method_filter) ==
-          nullptr) {
-        return;
-      }
+    if (m_method_filter && !matches_method_filter()) {
+      return;
+    }
+    if (m_binary) {
+      m_binary->trace(module, level, fmt, ap);
+      return;
     }
     std::lock_guard<std::mutex> guard(TraceContext::s_trace_mutex);
     if (m_show_timestamps) {
@@ -94,6 +318,27 @@ struct Tracer {
   }
 
  private:
+  bool matches_method_filter() {
+    if (TraceContext::s_current_name != nullptr) {
+      return strstr(TraceContext::s_current_name->c_str(), m_method_filter) !=
+             nullptr;
+    }
+    auto method = TraceContext::s_current_method;
+    if (method == nullptr) {
+      return true;
+    }
+    // Consecutive traces mostly come from the same method.
+    thread_local const void* last_method = nullptr;
+    thread_local bool last_matched = false;
+    if (method != last_method) {
+      last_method = method;
+      last_matched =
+          strstr(TraceContext::s_method_name(method).c_str(),
+                 m_method_filter) != nullptr;
+    }
+    return last_matched;
+  }
+
   void init_trace_modules(const char* traceenv) {
     std::unordered_map<std::string, int> module_id_map;
 #define TM(x) module_id_map[ #x ] = x;
@@ -146,6 +391,7 @@ struct Tracer {
 
  private:
   FILE* m_file{nullptr};
+  std::unique_ptr<BinaryTracer> m_binary;
   long m_level{0};
   std::array<long, N_TRACE_MODULES> m_traces;
 };
@@ -170,5 +416,7 @@ void trace(TraceModule module, int level, const char* fmt, ...) {
   va_end(ap);
 }
 
-thread_local std::string TraceContext::s_current_method;
+thread_local const void* TraceContext::s_current_method{nullptr};
+thread_local TraceContext::NameFn TraceContext::s_method_name{nullptr};
+thread_local const std::string* TraceContext::s_current_name{nullptr};
 std::mutex TraceContext::s_trace_mutex;
@@ -107,12 +107,39 @@ void trace(TraceModule module, int level, const char* fmt, ...);
   } while (0)
 #endif // NDEBUG
 
+/*
+ * Names the method the current thread is working on, for
+ * TRACE_METHOD_FILTER. Setting it is just two pointer stores; the name is
+ * only computed when a filter is set, by the caller-provided accessor, so
+ * that tracing does not depend on the IR classes.
+ */
 struct TraceContext {
-  explicit TraceContext(const std::string& current_method) {
+  using NameFn = std::string (*)(const void*);
+
+  template <class Method>
+  explicit TraceContext(const Method* current_method) {
     s_current_method = current_method;
+    s_method_name = [](const void* method) -> std::string {
+      return static_cast<const Method*>(method)->get_deobfuscated_name();
+    };
+  }
+  explicit TraceContext(const std::string& current_name)
+      : m_current_name(current_name) {
+    s_current_name = &m_current_name;
+  }
+  explicit TraceContext(const char* current_name)
+      : TraceContext(std::string(current_name)) {}
+  ~TraceContext() {
+    s_current_method = nullptr;
+    s_current_name = nullptr;
   }
-  ~TraceContext() { s_current_method.clear(); }
 
-  thread_local static std::string s_current_method;
+  thread_local static const void* s_current_method;
+  thread_local static NameFn s_method_name;
+  thread_local static const std::string* s_current_name;
+  // Serializes the text backend's writes.
   static std::mutex s_trace_mutex;
+
+ private:
+  std::string m_current_name;
 };
@@ -9,6 +9,7 @@
 
 #include "Warning.h"
 
+#include <atomic>
 #include <cstdarg>
 #include <cstdio>
 
@@ -20,8 +21,9 @@ const char* s_warning_text[] = {
 #undef OPT_WARN
 };
 
-size_t s_warning_counts[] = {
-#define OPT_WARN(...) 0,
+// Warnings may be raised concurrently, e.g. by dexes written in parallel.
+std::atomic<size_t> s_warning_counts[] = {
+#define OPT_WARN(...) {0},
     OPT_WARNINGS
 #undef OPT_WARN
 };
@@ -12,70 +12,389 @@
 #include "Debug.h"
 
 #include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <memory>
 #include <mutex>
-#include <numeric>
 #include <queue>
-#include <random>
 #include <thread>
+#include <vector>
 
 namespace workqueue_impl {
 
 /**
- * Creates a random ordering of which threads to visit.  This prevents threads
- * from being prematurely emptied (if everyone targets thread 0, for example)
+ * A Chase-Lev work-stealing deque, following "Correct and Efficient
+ * Work-Stealing for Weak Memory Models" (Le et al., PPoPP'13).
  *
- * Each thread should empty its own queue first, so we explicitly set the
- * thread's index as the first element of the list.
+ * Only the owning thread may push() and pop() at the bottom; any thread may
+ * steal() from the top. T must be trivially copyable (we store pointers).
+ * Arrays replaced by grow() are kept alive until the deque is destroyed, as
+ * a concurrent thief may still be reading from them.
  */
-inline std::vector<int> create_permutation(int num, unsigned int thread_idx) {
-  std::vector<int> attempts(num);
-  std::iota(attempts.begin(), attempts.end(), 0);
-  auto seed = std::chrono::system_clock::now().time_since_epoch().count();
-  std::shuffle(
-      attempts.begin(), attempts.end(), std::default_random_engine(seed));
-  std::iter_swap(attempts.begin(),
-                 std::find(attempts.begin(), attempts.end(), thread_idx));
-  return attempts;
+template <class T>
+class WorkStealingDeque {
+  struct Array {
+    const int64_t capacity;
+    const int64_t mask;
+    std::unique_ptr<std::atomic<T>[]> slots;
+
+    explicit Array(int64_t cap)
+        : capacity(cap), mask(cap - 1), slots(new std::atomic<T>[cap]) {}
+
+    T get(int64_t i) const {
+      return slots[i & mask].load(std::memory_order_relaxed);
+    }
+    void put(int64_t i, T x) {
+      slots[i & mask].store(x, std::memory_order_relaxed);
+    }
+  };
+
+  std::atomic<int64_t> m_top{0};
+  std::atomic<int64_t> m_bottom{0};
+  std::atomic<Array*> m_array;
+  std::vector<std::unique_ptr<Array>> m_arrays;
+
+  Array* grow(Array* a, int64_t bottom, int64_t top) {
+    m_arrays.emplace_back(std::make_unique<Array>(a->capacity * 2));
+    Array* bigger = m_arrays.back().get();
+    for (int64_t i = top; i < bottom; ++i) {
+      bigger->put(i, a->get(i));
+    }
+    m_array.store(bigger, std::memory_order_release);
+    return bigger;
+  }
+
+ public:
+  explicit WorkStealingDeque(int64_t capacity = 256) {
+    always_assert((capacity & (capacity - 1)) == 0);
+    m_arrays.emplace_back(std::make_unique<Array>(capacity));
+    m_array.store(m_arrays.back().get(), std::memory_order_relaxed);
+  }
+
+  /*
+   * Owner only.
+   */
+  void push(T x) {
+    int64_t b = m_bottom.load(std::memory_order_relaxed);
+    int64_t t = m_top.load(std::memory_order_acquire);
+    Array* a = m_array.load(std::memory_order_relaxed);
+    if (b - t > a->capacity - 1) {
+      a = grow(a, b, t);
+    }
+    a->put(b, x);
+    std::atomic_thread_fence(std::memory_order_release);
+    m_bottom.store(b + 1, std::memory_order_relaxed);
+  }
+
+  /*
+   * Owner only. Takes the most recently pushed element.
+   */
+  bool pop(T& x) {
+    int64_t b = m_bottom.load(std::memory_order_relaxed) - 1;
+    Array* a = m_array.load(std::memory_order_relaxed);
+    m_bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = m_top.load(std::memory_order_relaxed);
+    if (t > b) {
+      // Empty.
+      m_bottom.store(b + 1, std::memory_order_relaxed);
+      return false;
+    }
+    x = a->get(b);
+    if (t == b) {
+      // Last element: race against thieves for it.
+      bool won = m_top.compare_exchange_strong(
+          t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+      m_bottom.store(b + 1, std::memory_order_relaxed);
+      return won;
+    }
+    return true;
+  }
+
+  /*
+   * Any thread. Takes the oldest element. A false return may also mean that
+   * we lost a race to another thief, so it does not imply emptiness.
+   */
+  bool steal(T& x) {
+    int64_t t = m_top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t b = m_bottom.load(std::memory_order_acquire);
+    if (t >= b) {
+      return false;
+    }
+    Array* a = m_array.load(std::memory_order_acquire);
+    x = a->get(t);
+    return m_top.compare_exchange_strong(
+        t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+  }
+
+  bool empty() const {
+    return m_bottom.load(std::memory_order_relaxed) <=
+           m_top.load(std::memory_order_relaxed);
+  }
+
+  /*
+   * Not thread-safe; only call this while no other thread uses the deque.
+   */
+  void clear() {
+    m_top.store(0, std::memory_order_relaxed);
+    m_bottom.store(0, std::memory_order_relaxed);
+  }
+};
+
+/**
+ * Anything that wants help from the pool. Pool workers call help() on the
+ * jobs offered to them and return to the pool once it comes back.
+ */
+class Job {
+ public:
+  virtual ~Job() {}
+  virtual void help() = 0;
+
+  bool is_nested_in(const Job* ancestor) const {
+    for (auto job = m_parent; job != nullptr; job = job->m_parent) {
+      if (job == ancestor) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+ protected:
+  // The job whose task started the current run of this one, if any.
+  const Job* m_parent{nullptr};
+
+ private:
+  friend class ThreadPool;
+  // Number of pool workers currently inside help(); guarded by the pool lock.
+  size_t m_active_helpers{0};
+};
+
+/**
+ * A process-wide set of worker threads that is created on first use and
+ * reused by every WorkQueue, so running a queue no longer spawns threads.
+ */
+class ThreadPool {
+  struct Offer {
+    Job* job;
+    size_t helpers;
+  };
+
+  std::mutex m_mtx;
+  std::condition_variable m_work_cv;
+  std::condition_variable m_done_cv;
+  std::deque<Offer> m_offers;
+  std::vector<std::thread> m_threads;
+  bool m_stop{false};
+
+  void worker_loop() {
+    std::unique_lock<std::mutex> lock(m_mtx);
+    while (true) {
+      m_work_cv.wait(lock, [this] { return m_stop || !m_offers.empty(); });
+      if (m_stop) {
+        return;
+      }
+      join(lock, m_offers.begin());
+    }
+  }
+
+  /*
+   * Takes one helper from the offer and runs its job, with m_mtx held by
+   * `lock` on entry and on return.
+   */
+  void join(std::unique_lock<std::mutex>& lock,
+            std::deque<Offer>::iterator offer) {
+    Job* job = offer->job;
+    if (--offer->helpers == 0) {
+      m_offers.erase(offer);
+    }
+    ++job->m_active_helpers;
+    lock.unlock();
+    job->help();
+    lock.lock();
+    --job->m_active_helpers;
+    m_done_cv.notify_all();
+  }
+
+ public:
+  explicit ThreadPool(size_t num_threads) {
+    for (size_t i = 0; i < num_threads; ++i) {
+      m_threads.emplace_back([this] { worker_loop(); });
+    }
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> guard(m_mtx);
+      m_stop = true;
+    }
+    m_work_cv.notify_all();
+    for (auto& thread : m_threads) {
+      thread.join();
+    }
+  }
+
+  static ThreadPool& get() {
+    static ThreadPool s_pool(
+        std::max(1u, std::thread::hardware_concurrency()));
+    return s_pool;
+  }
+
+  size_t size() const { return m_threads.size(); }
+
+  /*
+   * Let up to `helpers` idle workers join `job`.
+   */
+  void submit(Job* job, size_t helpers) {
+    if (helpers == 0) {
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> guard(m_mtx);
+      m_offers.push_back(Offer{job, helpers});
+    }
+    if (helpers == 1) {
+      m_work_cv.notify_one();
+    } else {
+      m_work_cv.notify_all();
+    }
+  }
+
+  /*
+   * Called by a participant of `within` that has run out of tasks while
+   * others are still running: joins a job that one of those tasks started, if
+   * any is on offer, and returns true once it comes back. Other jobs are left
+   * alone, since they may be waiting for the very task that `within` is
+   * waiting for.
+   */
+  bool try_help(const Job* within) {
+    std::unique_lock<std::mutex> lock(m_mtx);
+    auto offer = std::find_if(
+        m_offers.begin(), m_offers.end(), [within](const Offer& o) {
+          return o.job->is_nested_in(within);
+        });
+    if (offer == m_offers.end()) {
+      return false;
+    }
+    join(lock, offer);
+    return true;
+  }
+
+  /*
+   * Withdraw whatever is left of the offer for `job` and wait until every
+   * worker that joined it has returned.
+   */
+  void retract(Job* job) {
+    std::unique_lock<std::mutex> lock(m_mtx);
+    m_offers.erase(std::remove_if(m_offers.begin(),
+                                  m_offers.end(),
+                                  [job](const Offer& o) { return o.job == job; }),
+                   m_offers.end());
+    m_done_cv.wait(lock, [job] { return job->m_active_helpers == 0; });
+  }
+};
+
+/*
+ * The queue (and its slot) that the current thread is working for, if any.
+ * add_item() uses this to push onto the caller's own deque without locking.
+ */
+struct Participant {
+  const Job* queue{nullptr};
+  size_t slot{0};
+};
+
+inline Participant& current_participant() {
+  thread_local Participant s_participant;
+  return s_participant;
+}
+
+/*
+ * A cheap per-thread generator for picking steal victims; rand() is not
+ * thread-safe.
+ */
+inline uint32_t next_random() {
+  thread_local uint32_t s_state = static_cast<uint32_t>(
+      std::hash<std::thread::id>()(std::this_thread::get_id()) | 1);
+  s_state ^= s_state << 13;
+  s_state ^= s_state >> 17;
+  s_state ^= s_state << 5;
+  return s_state;
+}
+
+inline void backoff(unsigned attempt) {
+  if (attempt < 64) {
+    std::this_thread::yield();
+  } else {
+    std::this_thread::sleep_for(std::chrono::microseconds(50));
+  }
 }
 
+/*
+ * Tasks added during run_all() by threads that are not working on the queue
+ * go here, since they cannot touch any worker's deque.
+ */
+template <class Input>
+struct SharedState {
+  std::atomic<size_t> pending{0};
+  std::atomic<size_t> next_slot{0};
+  std::atomic<bool> running{false};
+  std::atomic<bool> aborted{false};
+  std::mutex injection_mtx;
+  std::queue<Input> injection;
+  std::atomic<size_t> injection_size{0};
+  // Tasks added with add_ordered_items(), taken front to back.
+  std::vector<Input> ordered;
+  std::atomic<size_t> next_ordered{0};
+};
+
 } // namespace workqueue_impl
 
 template <class Input, class Data, class Output>
 struct WorkerState {
-  std::queue<Input> queue;
-  std::mutex queue_mtx;
+  workqueue_impl::WorkStealingDeque<Input*> deque;
+  // Backing store for the tasks in `deque`. Only the thread owning this slot
+  // appends to it, and std::deque never moves existing elements, so thieves
+  // can safely move out of the element they took.
+  std::deque<Input> storage;
   Data data;
   Output result;
 
   WorkerState(const Data& initial) : data(initial) {}
 
-  bool pop_task(Input& task) {
-    std::lock_guard<std::mutex> guard(queue_mtx);
-    if (!queue.empty()) {
-      task = std::move(queue.front());
-      queue.pop();
-      return true;
-    }
-    return false;
+  void push_task(Input task) {
+    storage.push_back(std::move(task));
+    deque.push(&storage.back());
   }
 };
 
+/*
+ * Each WorkQueue has num_threads slots, each with its own work-stealing deque,
+ * Data and partial result. run_all() runs on the calling thread plus up to
+ * num_threads - 1 workers of the shared ThreadPool; each of them owns one
+ * slot, drains its own deque first and then steals from the others. A queue
+ * run from one of the tasks is nested in this one: participants that run out
+ * of tasks join it instead of waiting for the task to return.
+ */
 template <class Input, class Data, class Output>
-class WorkQueue {
+class WorkQueue : public workqueue_impl::Job {
  private:
-  bool m_currently_running{false};
   std::function<Output(Data&, Input)> m_mapper;
   std::function<Output(Output, Output)> m_reducer;
 
   std::vector<std::unique_ptr<WorkerState<Input, Data, Output>>> m_states;
+  std::unique_ptr<workqueue_impl::SharedState<Input>> m_shared;
 
   const size_t m_num_threads{1};
   size_t m_insert_idx{0};
 
-  void consume(WorkerState<Input, Data, Output>* state, Input task) {
-    state->result = m_reducer(state->result, m_mapper(state->data, task));
-  }
+  bool find_task(size_t slot, Input& task);
+  void run_slot(size_t slot);
+  void help() override;
 
  public:
   WorkQueue(
@@ -86,6 +405,14 @@ class WorkQueue {
 
   void add_item(Input task);
 
+  /**
+   * Add tasks that are started in exactly the given order, e.g. the most
+   * expensive first so that none of them ends up running alone once all the
+   * others are done. A thread takes the next of them whenever its own deque
+   * is empty, before stealing from the others. Only before run_all().
+   */
+  void add_ordered_items(std::vector<Input> tasks);
+
   void set_mapper(std::function<Output(Data&, Input)> mapper) {
     m_mapper = mapper;
   }
@@ -95,7 +422,8 @@ class WorkQueue {
   }
 
   /**
-   * Spawn threads and evaluate function.  This method blocks.
+   * Evaluate the mapper over all items on the shared thread pool, with the
+   * calling thread taking part. This method blocks.
    */
   Output run_all(const Output& init_output = Output());
 };
@@ -106,7 +434,10 @@ WorkQueue<Input, Data, Output>::WorkQueue(
     std::function<Output(Output, Output)> reducer,
     std::function<Data(unsigned int /* thread index */)> data_initializer,
     unsigned int num_threads)
-    : m_mapper(mapper), m_reducer(reducer), m_num_threads(num_threads) {
+    : m_mapper(mapper),
+      m_reducer(reducer),
+      m_shared(std::make_unique<workqueue_impl::SharedState<Input>>()),
+      m_num_threads(num_threads) {
   always_assert(num_threads >= 1);
   for (unsigned int i = 0; i < m_num_threads; ++i) {
     m_states.emplace_back(std::make_unique<WorkerState<Input, Data, Output>>(
@@ -154,57 +485,164 @@ WorkQueue<Input, std::nullptr_t /*Data*/, Output> workqueue_mapreduce(
 
 template <class Input, class Data, class Output>
 void WorkQueue<Input, Data, Output>::add_item(Input task) {
-  if (m_currently_running) {
-    auto insert_idx = rand() % m_num_threads;
-    std::lock_guard<std::mutex> guard(m_states[insert_idx]->queue_mtx);
-    m_states[insert_idx]->queue.push(task);
-  } else {
+  auto& shared = *m_shared;
+  shared.pending.fetch_add(1, std::memory_order_relaxed);
+  if (!shared.running.load(std::memory_order_acquire)) {
     m_insert_idx = (m_insert_idx + 1) % m_num_threads;
-    m_states[m_insert_idx]->queue.push(task);
+    m_states[m_insert_idx]->push_task(std::move(task));
+    return;
+  }
+  const auto& self = workqueue_impl::current_participant();
+  if (self.queue == this) {
+    // Called from one of our own tasks: the slot's deque is ours to push to.
+    m_states[self.slot]->push_task(std::move(task));
+  } else {
+    std::lock_guard<std::mutex> guard(shared.injection_mtx);
+    shared.injection.push(std::move(task));
+    shared.injection_size.fetch_add(1, std::memory_order_release);
   }
 }
 
-/*
- * Each worker thread pulls from its own queue first, and then once finished
- * looks randomly at other queues to try and steal work.
- */
 template <class Input, class Data, class Output>
-Output WorkQueue<Input, Data, Output>::run_all(const Output& init_output) {
-  m_currently_running = true;
-  std::vector<std::thread> all_threads;
-  auto worker = [&](WorkerState<Input, Data, Output>* state, size_t state_idx) {
-    state->result = init_output;
-    auto attempts =
-        workqueue_impl::create_permutation(m_num_threads, state_idx);
-    while (true) {
-      auto have_task = false;
-      for (auto idx : attempts) {
-        auto other_state = m_states[idx].get();
-        Input task;
-        have_task = other_state->pop_task(task);
-        if (have_task) {
-          consume(state, task);
-          break;
-        }
-      }
-      if (!have_task) {
-        return;
-      }
-    }
-  };
+void WorkQueue<Input, Data, Output>::add_ordered_items(
+    std::vector<Input> tasks) {
+  auto& shared = *m_shared;
+  always_assert(!shared.running.load(std::memory_order_acquire));
+  shared.pending.fetch_add(tasks.size(), std::memory_order_relaxed);
+  shared.ordered.insert(shared.ordered.end(),
+                        std::make_move_iterator(tasks.begin()),
+                        std::make_move_iterator(tasks.end()));
+}
 
+template <class Input, class Data, class Output>
+bool WorkQueue<Input, Data, Output>::find_task(size_t slot, Input& task) {
+  Input* item;
+  if (m_states[slot]->deque.pop(item)) {
+    task = std::move(*item);
+    return true;
+  }
+  auto& shared = *m_shared;
+  if (shared.next_ordered.load(std::memory_order_relaxed) <
+      shared.ordered.size()) {
+    auto i = shared.next_ordered.fetch_add(1, std::memory_order_relaxed);
+    if (i < shared.ordered.size()) {
+      task = std::move(shared.ordered[i]);
+      return true;
+    }
+  }
+  auto start = workqueue_impl::next_random();
   for (size_t i = 0; i < m_num_threads; ++i) {
-    all_threads.emplace_back(worker, m_states[i].get(), i);
+    auto victim = (start + i) % m_num_threads;
+    if (victim != slot && m_states[victim]->deque.steal(item)) {
+      task = std::move(*item);
+      return true;
+    }
+  }
+  if (shared.injection_size.load(std::memory_order_acquire) > 0) {
+    std::lock_guard<std::mutex> guard(shared.injection_mtx);
+    if (!shared.injection.empty()) {
+      task = std::move(shared.injection.front());
+      shared.injection.pop();
+      shared.injection_size.fetch_sub(1, std::memory_order_relaxed);
+      return true;
+    }
+  }
+  return false;
+}
+
+template <class Input, class Data, class Output>
+void WorkQueue<Input, Data, Output>::run_slot(size_t slot) {
+  auto& self = workqueue_impl::current_participant();
+  auto saved = self;
+  self.queue = this;
+  self.slot = slot;
+  auto* state = m_states[slot].get();
+  auto& shared = *m_shared;
+  unsigned attempt = 0;
+  while (!shared.aborted.load(std::memory_order_relaxed)) {
+    Input task;
+    if (find_task(slot, task)) {
+      state->result = m_reducer(state->result, m_mapper(state->data, task));
+      shared.pending.fetch_sub(1, std::memory_order_acq_rel);
+      attempt = 0;
+      continue;
+    }
+    // Some task may still be running and about to add more work.
+    if (shared.pending.load(std::memory_order_acquire) == 0) {
+      break;
+    }
+    // Rather than wait for it, help with any queue it runs.
+    if (workqueue_impl::ThreadPool::get().try_help(this)) {
+      attempt = 0;
+      continue;
+    }
+    workqueue_impl::backoff(attempt++);
+  }
+  self = saved;
+}
+
+template <class Input, class Data, class Output>
+void WorkQueue<Input, Data, Output>::help() {
+  auto slot = m_shared->next_slot.fetch_add(1, std::memory_order_relaxed);
+  if (slot < m_num_threads) {
+    run_slot(slot);
+  }
+}
+
+template <class Input, class Data, class Output>
+Output WorkQueue<Input, Data, Output>::run_all(const Output& init_output) {
+  auto& shared = *m_shared;
+  for (auto& state : m_states) {
+    state->result = init_output;
   }
+  // Slot 0 belongs to the calling thread.
+  shared.next_slot.store(1, std::memory_order_relaxed);
+  shared.aborted.store(false, std::memory_order_relaxed);
+  shared.running.store(true, std::memory_order_release);
+  m_parent = workqueue_impl::current_participant().queue;
 
-  for (auto& thread : all_threads) {
-    thread.join();
+  auto& pool = workqueue_impl::ThreadPool::get();
+  pool.submit(this, std::min(m_num_threads - 1, pool.size()));
+  auto finish = [&] {
+    pool.retract(this);
+    shared.running.store(false, std::memory_order_release);
+    for (auto& state : m_states) {
+      state->deque.clear();
+      state->storage.clear();
+    }
+    std::queue<Input>().swap(shared.injection);
+    shared.injection_size.store(0, std::memory_order_relaxed);
+    shared.ordered.clear();
+    shared.next_ordered.store(0, std::memory_order_relaxed);
+    shared.pending.store(0, std::memory_order_relaxed);
+  };
+  try {
+    run_slot(0);
+  } catch (...) {
+    shared.aborted.store(true, std::memory_order_relaxed);
+    finish();
+    throw;
   }
+  finish();
 
   Output result = init_output;
   for (auto& thread_state : m_states) {
     result = m_reducer(result, thread_state->result);
   }
-  m_currently_running = false;
   return result;
 }
+
+/**
+ * Calls f(i) for every i in [0, n) on the shared thread pool, and returns
+ * once all of them have.
+ */
+inline void workqueue_parallel_for(
+    size_t n,
+    const std::function<void(size_t)>& f,
+    unsigned int num_threads = std::thread::hardware_concurrency()) {
+  auto wq = workqueue_foreach<size_t>(f, std::max(1u, num_threads));
+  for (size_t i = 0; i < n; ++i) {
+    wq.add_item(i);
+  }
+  wq.run_all();
+}
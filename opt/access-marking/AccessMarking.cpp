@@ -11,6 +11,7 @@
 
 #include <unordered_map>
 
+#include "AnalysisManager.h"
 #include "ClassHierarchy.h"
 #include "DexUtil.h"
 #include "IRCode.h"
@@ -142,8 +143,8 @@ void AccessMarkingPass::run_pass(
   PassManager& pm
 ) {
   auto scope = build_class_scope(stores);
-  ClassHierarchy ch = build_type_hierarchy(scope);
-  SignatureMap sm = build_signature_map(ch);
+  const auto& ch = pm.analyses().get_class_hierarchy(scope);
+  const auto& sm = pm.analyses().get_signature_map(scope);
   if (m_finalize_classes) {
     auto n_classes_final = mark_classes_final(scope, ch);
     pm.incr_metric("finalized_classes", n_classes_final);
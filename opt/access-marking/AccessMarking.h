@@ -23,6 +23,14 @@ class AccessMarkingPass : public Pass {
 
   virtual void run_pass(DexStoresVector&, ConfigFiles&, PassManager&) override;
 
+  /*
+   * Finalizing only changes access flags; privatizing turns virtual methods
+   * into direct ones.
+   */
+  virtual AnalysisSet preserved_analyses() const override {
+    return m_privatize_methods ? ANALYSIS_CLASS_HIERARCHY : ALL_ANALYSES;
+  }
+
  private:
   bool m_finalize_classes;
   bool m_finalize_methods;
@@ -211,7 +211,7 @@ void ConstantPropagationPass::run_pass(DexStoresVector& stores,
       m_branches_removed += rcp.branches_removed();
       m_materialized_consts += rcp.materialized_consts();
     }
-  });
+  }, WalkOrder::LargestMethodFirst);
 
   mgr.incr_metric("num_branch_propagated", m_branches_removed);
   mgr.incr_metric("num_materialized_consts", m_materialized_consts);
@@ -76,6 +76,10 @@ class ConstantPropagationPass : public Pass {
                         ConfigFiles& cfg,
                         PassManager& mgr) override;
 
+  virtual AnalysisSet preserved_analyses() const override {
+    return ALL_ANALYSES;
+  }
+
 
  private:
   ConstPropConfig m_config;
@@ -17,6 +17,10 @@ class CopyPropagationPass : public Pass {
 
   virtual void run_pass(DexStoresVector&, ConfigFiles&, PassManager&) override;
 
+  virtual AnalysisSet preserved_analyses() const override {
+    return ALL_ANALYSES;
+  }
+
   virtual void configure_pass(const PassConfig& pc) override {
 
     // This option can only be safely enabled in verify-none. `run_pass` will
@@ -122,7 +122,7 @@ class DedupBlocksImpl {
         record_stats(dups);
         deduplicate(dups, method);
       }
-    });
+    }, WalkOrder::LargestMethodFirst);
     report_stats();
   }
 
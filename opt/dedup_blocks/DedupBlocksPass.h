@@ -17,6 +17,10 @@ class DedupBlocksPass : public Pass {
 
   virtual void run_pass(DexStoresVector&, ConfigFiles&, PassManager&) override;
 
+  virtual AnalysisSet preserved_analyses() const override {
+    return ALL_ANALYSES;
+  }
+
   virtual void configure_pass(const PassConfig& pc) override {
     std::vector<std::string> method_black_list_names;
     pc.get("method_black_list", {}, method_black_list_names);
@@ -11,8 +11,10 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <set>
 #include <string>
 #include <vector>
+#include <unordered_map>
 #include <unordered_set>
 
 #include "ConfigFiles.h"
@@ -317,6 +319,109 @@ static void emit_class(InterDexPass* pass,
   emit_class(pass, det, outdex, clazz, false);
 }
 
+/*
+ * Emits the classes in an order that keeps classes sharing many refs in the
+ * same dex, so that fewer refs are duplicated across dexes and fewer dexes
+ * are needed.
+ *
+ * This grows each dex from its current contents over the graph of classes
+ * and the method and field refs they use: the next class is the one that
+ * adds the fewest refs the dex does not have yet, ties going to the earlier
+ * class in the scope. emit_class still decides where a dex ends, and when it
+ * does, the next dex grows from the class that did not fit.
+ */
+static void emit_classes_partitioned(InterDexPass* pass,
+                                     dex_emit_tracker& det,
+                                     DexClassesVector& outdex,
+                                     const Scope& classes) {
+  std::vector<DexClass*> nodes;
+  for (auto clazz : classes) {
+    if (det.emitted.count(clazz) == 0 && !is_canary(clazz)) {
+      nodes.push_back(clazz);
+    }
+  }
+  // The refs of each class, and the classes using each ref.
+  std::vector<std::vector<DexMethodRef*>> node_mrefs(nodes.size());
+  std::vector<std::vector<DexFieldRef*>> node_frefs(nodes.size());
+  std::unordered_map<DexMethodRef*, std::vector<uint32_t>> mref_users;
+  std::unordered_map<DexFieldRef*, std::vector<uint32_t>> fref_users;
+  for (uint32_t i = 0; i < nodes.size(); ++i) {
+    mrefs_t mrefs;
+    frefs_t frefs;
+    gather_mrefs(pass, nodes[i], mrefs, frefs);
+    node_mrefs[i].assign(mrefs.begin(), mrefs.end());
+    node_frefs[i].assign(frefs.begin(), frefs.end());
+    for (auto mref : node_mrefs[i]) {
+      mref_users[mref].push_back(i);
+    }
+    for (auto fref : node_frefs[i]) {
+      fref_users[fref].push_back(i);
+    }
+  }
+
+  // Candidates by (refs the dex is missing, position in scope).
+  std::vector<uint32_t> cost(nodes.size());
+  std::vector<bool> placed(nodes.size(), false);
+  std::set<std::pair<uint32_t, uint32_t>> queue;
+  auto add_to_dex = [&](const std::vector<uint32_t>& users) {
+    for (auto u : users) {
+      if (!placed[u]) {
+        queue.erase(std::make_pair(cost[u], u));
+        queue.emplace(--cost[u], u);
+      }
+    }
+  };
+  // Start over from what the open dex holds.
+  auto reset = [&]() {
+    queue.clear();
+    for (uint32_t i = 0; i < nodes.size(); ++i) {
+      if (placed[i]) {
+        continue;
+      }
+      cost[i] = node_mrefs[i].size() + node_frefs[i].size();
+      for (auto mref : node_mrefs[i]) {
+        cost[i] -= det.mrefs.count(mref);
+      }
+      for (auto fref : node_frefs[i]) {
+        cost[i] -= det.frefs.count(fref);
+      }
+      queue.emplace(cost[i], i);
+    }
+  };
+
+  reset();
+  while (!queue.empty()) {
+    auto i = queue.begin()->second;
+    queue.erase(queue.begin());
+    placed[i] = true;
+    std::vector<DexMethodRef*> new_mrefs;
+    std::vector<DexFieldRef*> new_frefs;
+    for (auto mref : node_mrefs[i]) {
+      if (det.mrefs.count(mref) == 0) {
+        new_mrefs.push_back(mref);
+      }
+    }
+    for (auto fref : node_frefs[i]) {
+      if (det.frefs.count(fref) == 0) {
+        new_frefs.push_back(fref);
+      }
+    }
+    auto num_dexes = outdex.size();
+    emit_class(pass, det, outdex, nodes[i]);
+    if (outdex.size() != num_dexes) {
+      // The class did not fit, and opened a new dex.
+      reset();
+    } else if (det.emitted.count(nodes[i])) {
+      for (auto mref : new_mrefs) {
+        add_to_dex(mref_users[mref]);
+      }
+      for (auto fref : new_frefs) {
+        add_to_dex(fref_users[fref]);
+      }
+    }
+  }
+}
+
 static std::unordered_set<const DexClass*> find_unrefenced_coldstart_classes(
   const Scope& scope,
   dex_emit_tracker& det,
@@ -412,7 +517,8 @@ static DexClassesVector run_interdex(InterDexPass* pass,
                                      ConfigFiles& cfg,
                                      bool allow_cutting_off_dex,
                                      bool static_prune_classes,
-                                     bool normal_primary_dex) {
+                                     bool normal_primary_dex,
+                                     bool partition_kerf) {
 
   global_dmeth_cnt = 0;
   global_smeth_cnt = 0;
@@ -542,8 +648,12 @@ static DexClassesVector run_interdex(InterDexPass* pass,
   /* Now emit the kerf that wasn't specified in the head
    * or primary list.
    */
-  for (auto clazz : scope) {
-    emit_class(pass, det, outdex, clazz);
+  if (partition_kerf) {
+    emit_classes_partitioned(pass, det, outdex, scope);
+  } else {
+    for (auto clazz : scope) {
+      emit_class(pass, det, outdex, clazz);
+    }
   }
   for (const auto& plugin : pass->m_plugins) {
     auto add_classes = plugin->leftover_classes();
@@ -593,8 +703,13 @@ void InterDexPass::run_pass(DexClassesVector& dexen,
   }
   emit_canaries = m_emit_canaries;
   linear_alloc_limit = m_linear_alloc_limit;
-  dexen = run_interdex(
-      this, dexen, cfg, true, m_static_prune, m_normal_primary_dex);
+  dexen = run_interdex(this,
+                       dexen,
+                       cfg,
+                       true,
+                       m_static_prune,
+                       m_normal_primary_dex,
+                       m_partition_kerf);
   for (const auto& plugin : m_plugins) {
     plugin->cleanup(original_scope);
   }
@@ -66,6 +66,7 @@ class InterDexPass : public Pass {
     pc.get("emit_canaries", true, m_emit_canaries);
     pc.get("normal_primary_dex", false, m_normal_primary_dex);
     pc.get("linear_alloc_limit", 11600 * 1024, m_linear_alloc_limit);
+    pc.get("partition_kerf", false, m_partition_kerf);
   }
 
   virtual void run_pass(DexClassesVector&, Scope&, ConfigFiles&, PassManager&);
@@ -78,4 +79,7 @@ class InterDexPass : public Pass {
   bool m_emit_canaries;
   bool m_normal_primary_dex;
   int64_t m_linear_alloc_limit;
+  // Group the classes outside of the cold-start set by the refs they share,
+  // instead of emitting them in scope order.
+  bool m_partition_kerf;
 };
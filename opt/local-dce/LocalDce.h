@@ -78,4 +78,8 @@ class LocalDcePass : public Pass {
   static void run(DexMethod* method);
 
   virtual void run_pass(DexStoresVector&, ConfigFiles&, PassManager&) override;
+
+  virtual AnalysisSet preserved_analyses() const override {
+    return ALL_ANALYSES;
+  }
 };
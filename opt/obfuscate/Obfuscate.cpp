@@ -15,12 +15,12 @@
 #include "IRCode.h"
 #include "Obfuscate.h"
 #include "ObfuscateUtils.h"
+#include "ParallelWalkers.h"
 #include "ProguardMap.h"
 #include "ReachableClasses.h"
 #include "Resolver.h"
 #include "Trace.h"
 #include "VirtualRenamer.h"
-#include "Walkers.h"
 
 namespace {
 
@@ -74,50 +74,58 @@ void debug_logging(std::vector<DexClass*>& classes) {
   TRACE(OBFUSCATE, 3, "Finished applying new names to defs\n");
 }
 
-template<typename DexMember, typename DexMemberRef, typename DexMemberSpec, typename K>
-DexMember* find_renamable_ref(DexMemberRef* ref,
-    std::unordered_map<DexMemberRef*, DexMember*>& ref_def_cache,
-    DexElemManager<DexMember*, DexMemberRef*, DexMemberSpec, K>& name_mapping) {
-  TRACE(OBFUSCATE, 4, "Found a ref opcode\n");
-  DexMember* def = nullptr;
-  auto member_itr = ref_def_cache.find(ref);
-  if (member_itr != ref_def_cache.end()) {
-    def = member_itr->second;
-  } else {
-    def = name_mapping.def_of_ref(ref);
+/*
+ * Finds the defs that we are going to rename of the given refs. This looks
+ * up the name managers, which isn't thread-safe, but there are far fewer
+ * distinct refs than instructions.
+ */
+template <typename DexMember,
+          typename DexMemberRef,
+          typename DexMemberSpec,
+          typename K>
+std::unordered_map<DexMemberRef*, DexMember*> find_renamable_refs(
+    const std::unordered_set<DexMemberRef*>& refs,
+    DexElemManager<DexMember*, DexMemberRef*, DexMemberSpec, K>&
+        name_mapping) {
+  std::unordered_map<DexMemberRef*, DexMember*> ref_defs;
+  for (auto ref : refs) {
+    DexMember* def = name_mapping.def_of_ref(ref);
+    if (def != nullptr) {
+      ref_defs.emplace(ref, def);
+    }
   }
-  ref_def_cache[ref] = def;
-  return def;
+  return ref_defs;
 }
 
 void update_refs(Scope& scope, DexFieldManager& field_name_mapping,
     DexMethodManager& method_name_mapping) {
-  std::unordered_map<DexFieldRef*, DexField*> f_ref_def_cache;
-  std::unordered_map<DexMethodRef*, DexMethod*> m_ref_def_cache;
-  walk_opcodes(scope,
-    [](DexMethod*) { return true; },
-    [&](DexMethod*, IRInstruction* instr) {
+  auto refs =
+      collect_member_refs(scope, parallel_walkers::default_num_threads());
+  const auto f_ref_defs = find_renamable_refs(refs.fields, field_name_mapping);
+  const auto m_ref_defs =
+      find_renamable_refs(refs.methods, method_name_mapping);
+  walk_methods_parallel_simple(scope, [&](DexMethod* m) {
+    auto code = m->get_code();
+    if (code == nullptr) {
+      return;
+    }
+    for (auto& mie : InstructionIterable(code)) {
+      auto instr = mie.insn;
       if (instr->has_field()) {
-        DexFieldRef* field_ref = instr->get_field();
-        if (field_ref->is_def()) return;
-        DexField* field_def =
-            find_renamable_ref(field_ref, f_ref_def_cache, field_name_mapping);
-        if (field_def != nullptr) {
-          TRACE(OBFUSCATE, 4, "Found a ref to fixup %s", SHOW(field_ref));
-          instr->set_field(field_def);
+        auto it = f_ref_defs.find(instr->get_field());
+        if (it != f_ref_defs.end()) {
+          TRACE(OBFUSCATE, 4, "Found a ref to fixup %s", SHOW(it->first));
+          instr->set_field(it->second);
         }
       } else if (instr->has_method()) {
-        DexMethodRef* method_ref = instr->get_method();
-        if (method_ref->is_def()) return;
-        DexMethod* method_def =
-            find_renamable_ref(method_ref, m_ref_def_cache,
-                method_name_mapping);
-        if (method_def != nullptr) {
-          TRACE(OBFUSCATE, 4, "Found a ref to fixup %s", SHOW(method_ref));
-          instr->set_method(method_def);
+        auto it = m_ref_defs.find(instr->get_method());
+        if (it != m_ref_defs.end()) {
+          TRACE(OBFUSCATE, 4, "Found a ref to fixup %s", SHOW(it->first));
+          instr->set_method(it->second);
         }
       }
-    });
+    }
+  });
 }
 
 void get_totals(Scope& scope, RenameStats& stats) {
@@ -131,6 +139,44 @@ void get_totals(Scope& scope, RenameStats& stats) {
 
 } // end namespace
 
+MemberRefs collect_member_refs(const Scope& scope, size_t num_threads) {
+  // Each thread collects into its own MemberRefs, merged once at the end;
+  // merging the refs of every method into a running result would copy the
+  // result over and over.
+  std::vector<MemberRefs> thread_refs(num_threads);
+  walk_methods_parallel<MemberRefs*, std::nullptr_t>(
+      scope,
+      [](MemberRefs* refs, DexMethod* m) {
+        auto code = m->get_code();
+        if (code == nullptr) {
+          return nullptr;
+        }
+        for (auto& mie : InstructionIterable(code)) {
+          auto instr = mie.insn;
+          if (instr->has_field()) {
+            if (!instr->get_field()->is_def()) {
+              refs->fields.insert(instr->get_field());
+            }
+          } else if (instr->has_method()) {
+            if (!instr->get_method()->is_def()) {
+              refs->methods.insert(instr->get_method());
+            }
+          }
+        }
+        return nullptr;
+      },
+      [](std::nullptr_t, std::nullptr_t) { return nullptr; },
+      [&](int thread) { return &thread_refs[thread]; },
+      nullptr,
+      num_threads);
+  MemberRefs refs;
+  for (const auto& t : thread_refs) {
+    refs.fields.insert(t.fields.begin(), t.fields.end());
+    refs.methods.insert(t.methods.begin(), t.methods.end());
+  }
+  return refs;
+}
+
 void obfuscate(Scope& scope, RenameStats& stats) {
   get_totals(scope, stats);
   ClassHierarchy ch = build_type_hierarchy(scope);
@@ -242,7 +288,8 @@ void obfuscate(Scope& scope, RenameStats& stats) {
 
   // Update any instructions with a member that is a ref to the corresponding
   // def for any field that we are going to rename. This allows us to in-place
-  // rename the field def and have that change seen everywhere.
+  // rename the field def and have that change seen everywhere. The refs are
+  // collected and rewritten in parallel; only resolving them is serial.
   update_refs(scope, field_name_manager, method_name_manager);
 
   TRACE(OBFUSCATE, 3, "Finished transforming refs\n");
@@ -9,6 +9,8 @@
 
 #pragma once
 
+#include <unordered_set>
+
 #include "PassManager.h"
 
 class ObfuscatePass : public Pass {
@@ -28,3 +30,11 @@ struct RenameStats {
 };
 
 void obfuscate(Scope& classes, RenameStats& stats);
+
+// The member refs that instructions use and that aren't defs themselves.
+struct MemberRefs {
+  std::unordered_set<DexFieldRef*> fields;
+  std::unordered_set<DexMethodRef*> methods;
+};
+
+MemberRefs collect_member_refs(const Scope& scope, size_t num_threads);
@@ -12,9 +12,10 @@
 #include "VirtualScope.h"
 #include "DexUtil.h"
 #include "DexAccess.h"
+#include "IRCode.h"
+#include "ParallelWalkers.h"
 #include "Resolver.h"
 #include "Trace.h"
-#include "Walkers.h"
 
 #include <map>
 #include <set>
@@ -105,11 +106,6 @@ DexMethod* find_method(
   return (DexMethod*)nullptr;
 };
 
-// keep a map from defs to all refs resolving to that def
-using RefsMap =
-    std::unordered_map<DexMethod*,
-                       std::set<DexMethodRef*, dexmethods_comparator>>;
-
 /**
  * Rename a given method with the given name.
  */
@@ -376,31 +372,55 @@ int VirtualRenamer::rename_virtual_scopes(
   return renamed;
 }
 
+}
+
 /**
  * Collect all method refs to concrete methods (definitions).
+ * Resolving the refs only reads the class hierarchy, so the methods are
+ * walked in parallel, each thread into its own map, and the maps merged at
+ * the end; the refs of a def are kept ordered, so the result doesn't depend
+ * on the order of the merges.
  */
-void collect_refs(Scope& scope, RefsMap& def_refs) {
-  walk_opcodes(scope, [](DexMethod*) { return true; },
-    [&](DexMethod*, IRInstruction* insn) {
-      if (!insn->has_method()) return;
-      auto callee = insn->get_method();
-      if (callee->is_concrete()) return;
-      auto cls = type_class(callee->get_class());
-      if (cls == nullptr || cls->is_external()) return;
-      DexMethod* top = nullptr;
-      if (is_interface(cls)) {
-        top = resolve_method(callee, MethodSearch::Interface);
-      } else {
-        top = find_top_impl(cls, callee->get_name(), callee->get_proto());
-      }
-      if (top == nullptr || top == callee) return;
-      assert(type_class(top->get_class()) != nullptr);
-      if (type_class(top->get_class())->is_external()) return;
-      // it's a top definition on an internal class, save it
-      def_refs[top].insert(callee);
-    });
-}
-
+void collect_refs(const Scope& scope, RefsMap& def_refs, size_t num_threads) {
+  std::vector<RefsMap> thread_refs(num_threads);
+  walk_methods_parallel<RefsMap*, std::nullptr_t>(
+      scope,
+      [](RefsMap* refs, DexMethod* m) {
+        auto code = m->get_code();
+        if (code == nullptr) {
+          return nullptr;
+        }
+        for (auto& mie : InstructionIterable(code)) {
+          auto insn = mie.insn;
+          if (!insn->has_method()) continue;
+          auto callee = insn->get_method();
+          if (callee->is_concrete()) continue;
+          auto cls = type_class(callee->get_class());
+          if (cls == nullptr || cls->is_external()) continue;
+          DexMethod* top = nullptr;
+          if (is_interface(cls)) {
+            top = resolve_method(callee, MethodSearch::Interface);
+          } else {
+            top = find_top_impl(cls, callee->get_name(), callee->get_proto());
+          }
+          if (top == nullptr || top == callee) continue;
+          assert(type_class(top->get_class()) != nullptr);
+          if (type_class(top->get_class())->is_external()) continue;
+          // it's a top definition on an internal class, save it
+          (*refs)[top].insert(callee);
+        }
+        return nullptr;
+      },
+      [](std::nullptr_t, std::nullptr_t) { return nullptr; },
+      [&](int thread) { return &thread_refs[thread]; },
+      nullptr,
+      num_threads);
+  def_refs.clear();
+  for (auto& refs : thread_refs) {
+    for (auto& pair : refs) {
+      def_refs[pair.first].insert(pair.second.begin(), pair.second.end());
+    }
+  }
 }
 
 /**
@@ -411,7 +431,7 @@ size_t rename_virtuals(Scope& classes) {
   ClassScopes class_scopes(classes);
   scope_info(class_scopes);
   RefsMap def_refs;
-  collect_refs(classes, def_refs);
+  collect_refs(classes, def_refs, parallel_walkers::default_num_threads());
   VirtualRenamer vr(class_scopes, def_refs);
 
   // rename virtual only first
@@ -9,6 +9,16 @@
 
 #pragma once
 
+#include <set>
+#include <unordered_map>
+
 #include "Obfuscate.h"
 
 size_t rename_virtuals(Scope& scope);
+
+// keep a map from defs to all refs resolving to that def
+using RefsMap =
+    std::unordered_map<DexMethod*,
+                       std::set<DexMethodRef*, dexmethods_comparator>>;
+
+void collect_refs(const Scope& scope, RefsMap& def_refs, size_t num_threads);
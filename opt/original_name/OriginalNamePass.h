@@ -24,6 +24,11 @@ class OriginalNamePass : public Pass {
                         ConfigFiles& cfg,
                         PassManager& mgr) override;
 
+  // Only adds static fields.
+  virtual AnalysisSet preserved_analyses() const override {
+    return ALL_ANALYSES;
+  }
+
  private:
   void build_hierarchies(
       PassManager& mgr,
@@ -18,6 +18,10 @@ class PeepholePass : public Pass {
 
   virtual void run_pass(DexStoresVector&, ConfigFiles&, PassManager&) override;
 
+  virtual AnalysisSet preserved_analyses() const override {
+    return ALL_ANALYSES;
+  }
+
   virtual void configure_pass(const PassConfig& pc) override {
     pc.get("disabled_peepholes", {}, config.disabled_peepholes);
   }
@@ -300,6 +300,7 @@ std::string show(const RegisterTransform& reg_transform) {
 
 void Allocator::Stats::accumulate(const Allocator::Stats& that) {
   reiteration_count += that.reiteration_count;
+  liveness_reused += that.liveness_reused;
   param_spill_moves += that.param_spill_moves;
   range_spill_moves += that.range_spill_moves;
   global_spill_moves += that.global_spill_moves;
@@ -609,8 +610,9 @@ void Allocator::select_ranges(const IRCode* code,
       vreg_files.emplace(src, vreg_file);
     }
 
+    std::vector<reg_t> range_regs(insn->srcs().begin(), insn->srcs().end());
     reg_t range_base = find_best_range_fit(ig,
-                                           insn->srcs(),
+                                           range_regs,
                                            0,
                                            reg_transform->size,
                                            vreg_files,
@@ -1058,6 +1060,9 @@ void Allocator::allocate(bool use_splitting, IRCode* code) {
   auto range_set = init_range_set(code);
 
   bool first{true};
+  // Block-boundary liveness carried over from the previous iteration, when
+  // it only spilled.
+  std::unique_ptr<BlockLiveness> carried_liveness;
   while (true) {
     SplitCosts split_costs;
     SpillPlan spill_plan;
@@ -1067,7 +1072,14 @@ void Allocator::allocate(bool use_splitting, IRCode* code) {
     auto& cfg = code->cfg();
     cfg.calculate_exit_block();
     LivenessFixpointIterator fixpoint_iter(cfg);
-    fixpoint_iter.run(LivenessDomain(code->get_registers_size()));
+    if (carried_liveness != nullptr &&
+        fixpoint_iter.reuse(
+            *carried_liveness, cfg, code->get_registers_size())) {
+      ++m_stats.liveness_reused;
+    } else {
+      fixpoint_iter.run(LivenessDomain(code->get_registers_size()));
+    }
+    carried_liveness.reset();
 
     TRACE(REG, 5, "Allocating:\n%s\n", SHOW(code->cfg()));
     auto ig =
@@ -1117,6 +1129,7 @@ void Allocator::allocate(bool use_splitting, IRCode* code) {
         find_split(ig, split_costs, &reg_transform, &spill_plan, &split_plan);
       }
       std::unordered_set<reg_t> new_temps;
+      auto old_param_spill_moves = m_stats.param_spill_moves;
       split_params(ig, spill_plan.param_spills, code, &new_temps);
       spill(ig, spill_plan, range_set, code, &new_temps);
 
@@ -1124,6 +1137,12 @@ void Allocator::allocate(bool use_splitting, IRCode* code) {
         TRACE(REG, 5, "Split plan:\n%s\n", SHOW(split_plan));
         m_stats.split_moves +=
             split(fixpoint_iter, split_plan, split_costs, ig, code);
+      } else if (m_stats.param_spill_moves == old_param_spill_moves) {
+        // The spill moves and their temps all sit within a block, so liveness
+        // at the block boundaries is unchanged, and the next iteration only
+        // needs it for the instructions.
+        carried_liveness = std::make_unique<BlockLiveness>(
+            fixpoint_iter.get_block_liveness(cfg));
       }
 
       // Since we have inserted instructions, we need to rebuild the CFG to
@@ -1137,6 +1156,7 @@ void Allocator::allocate(bool use_splitting, IRCode* code) {
   }
 
   TRACE(REG, 3, "Reiteration count: %lu\n", m_stats.reiteration_count);
+  TRACE(REG, 3, "Liveness reused: %lu\n", m_stats.liveness_reused);
   TRACE(REG, 3, "Spill count: %lu\n", m_stats.moves_inserted());
   TRACE(REG, 3, "  Param spills: %lu\n", m_stats.param_spill_moves);
   TRACE(REG, 3, "  Range spills: %lu\n", m_stats.range_spill_moves);
@@ -77,6 +77,9 @@ class Allocator {
  public:
   struct Stats {
     size_t reiteration_count{0};
+    // Reiterations that reused the previous liveness instead of rerunning
+    // the analysis.
+    size_t liveness_reused{0};
     size_t param_spill_moves{0};
     size_t range_spill_moves{0};
     size_t global_spill_moves{0};
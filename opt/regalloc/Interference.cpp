@@ -20,6 +20,8 @@ namespace interference {
 
 namespace impl {
 
+constexpr size_t RegPairSet::kMaxDenseRegs;
+
 /*
  * We determine a node's colorability using equation E.3 in [Smith00] for
  * registers of varying width in an unaligned architecture.
@@ -75,6 +77,7 @@ void Graph::add_edge(reg_t u, reg_t v, bool can_coalesce) {
   if (!is_adjacent(u, v)) {
     auto& u_node = m_nodes.at(u);
     auto& v_node = m_nodes.at(v);
+    m_adj_matrix.insert(u, v);
     u_node.m_adjacent.push_back(v);
     v_node.m_adjacent.push_back(u);
     u_node.m_weight += edge_weight(u_node, v_node);
@@ -89,7 +92,9 @@ void Graph::add_edge(reg_t u, reg_t v, bool can_coalesce) {
   //
   // then the final state of the edge between s0 and s1 must be
   // non-coalesceable.
-  m_adj_matrix[Edge(u, v)] = m_adj_matrix[Edge(u, v)] || !can_coalesce;
+  if (!can_coalesce) {
+    m_not_coalesceable.insert(u, v);
+  }
 }
 
 uint32_t Node::colorable_limit() const {
@@ -241,7 +246,7 @@ Graph GraphBuilder::build(const LivenessFixpointIterator& fixpoint_iter,
                           IRCode* code,
                           reg_t initial_regs,
                           const RangeSet& range_set) {
-  Graph graph;
+  Graph graph(code->get_registers_size());
   auto ii = InstructionIterable(code);
   for (auto it = ii.begin(); it != ii.end(); ++it) {
     GraphBuilder::update_node_constraints(it.unwrap(), range_set, &graph);
@@ -337,11 +342,9 @@ std::ostream& Graph::write_dot_format(std::ostream& o) const {
   o << "}\n";
 
   o << "containment graph {\n";
-  for (const auto& pair : m_containment_graph) {
-    auto reg1 = pair.first;
-    auto reg2 = pair.second;
+  m_containment_graph.for_each([&](reg_t reg1, reg_t reg2) {
     o << reg1 << " -- " << reg2 << "\n";
-  }
+  });
   o << "}\n";
   return o;
 }
@@ -9,6 +9,7 @@
 
 #pragma once
 
+#include <algorithm>
 #include <boost/functional/hash.hpp>
 #include <boost/range/adaptor/filtered.hpp>
 #include <unordered_map>
@@ -64,26 +65,79 @@ namespace impl {
 
 class GraphBuilder;
 
-template <typename T>
-struct OrderedPair {
-  T first;
-  T second;
+/*
+ * A set of pairs of registers, either ordered (u, v) or unordered {u, v}.
+ *
+ * Registers are small dense integers, so the pairs of registers below
+ * `dense_regs` are kept in a bit matrix -- a triangular one for unordered
+ * pairs. This is much faster to build and query than hashing each pair, which
+ * matters for the large methods whose interference graphs have millions of
+ * edges. Pairs involving higher registers go to a hash set, so that we don't
+ * allocate huge matrices for the rare methods with that many registers.
+ */
+class RegPairSet {
+ public:
+  // Keeps the dense part at a few megabytes.
+  static constexpr size_t kMaxDenseRegs = 8192;
+
+  RegPairSet(bool ordered, size_t dense_regs)
+      : m_ordered(ordered),
+        m_dense_regs(std::min(dense_regs, kMaxDenseRegs)),
+        m_bits(ordered ? m_dense_regs * m_dense_regs
+                       : m_dense_regs * (m_dense_regs + 1) / 2) {}
+
+  bool contains(reg_t u, reg_t v) const {
+    if (!m_ordered && u > v) {
+      std::swap(u, v);
+    }
+    if (std::max(u, v) < m_dense_regs) {
+      return m_bits[index(u, v)];
+    }
+    return m_sparse.count(key(u, v)) != 0;
+  }
 
-  OrderedPair(T u, T v)
-      : first(std::min(u, v)), second(std::max(u, v)) {}
+  void insert(reg_t u, reg_t v) {
+    if (!m_ordered && u > v) {
+      std::swap(u, v);
+    }
+    if (std::max(u, v) < m_dense_regs) {
+      m_bits[index(u, v)] = true;
+    } else {
+      m_sparse.insert(key(u, v));
+    }
+  }
 
-  bool operator==(const OrderedPair& that) const {
-    return first == that.first && second == that.second;
+  /*
+   * Calls f(u, v) for every pair in the set, with u <= v if the pairs are
+   * unordered.
+   */
+  template <typename F>
+  void for_each(F f) const {
+    for (size_t u = 0; u < m_dense_regs; ++u) {
+      for (size_t v = m_ordered ? 0 : u; v < m_dense_regs; ++v) {
+        if (m_bits[index(u, v)]) {
+          f(reg_t(u), reg_t(v));
+        }
+      }
+    }
+    for (auto k : m_sparse) {
+      f(reg_t(k >> 16), reg_t(k & 0xffff));
+    }
   }
-};
 
-template <typename T>
-inline size_t hash_value(const OrderedPair<T>& pair) {
-  size_t seed{0};
-  boost::hash_combine(seed, pair.first);
-  boost::hash_combine(seed, pair.second);
-  return seed;
-}
+ private:
+  // For unordered pairs, u <= v.
+  size_t index(size_t u, size_t v) const {
+    return m_ordered ? u * m_dense_regs + v : v * (v + 1) / 2 + u;
+  }
+
+  static uint32_t key(reg_t u, reg_t v) { return (uint32_t(u) << 16) | v; }
+
+  bool m_ordered;
+  size_t m_dense_regs;
+  std::vector<bool> m_bits;
+  std::unordered_set<uint32_t> m_sparse;
+};
 
 } // namespace impl
 
@@ -187,16 +241,15 @@ class Graph {
   }
 
   bool is_adjacent(reg_t u, reg_t v) const {
-    return m_adj_matrix.find(Edge(u, v)) != m_adj_matrix.end();
+    return m_adj_matrix.contains(u, v);
   }
 
   bool is_coalesceable(reg_t u, reg_t v) const {
-    return !is_adjacent(u, v) || !m_adj_matrix.at(Edge(u, v));
+    return !m_not_coalesceable.contains(u, v);
   }
 
   bool has_containment_edge(reg_t u, reg_t v) const {
-    return m_containment_graph.find(ContainmentEdge(u, v)) !=
-           m_containment_graph.end();
+    return m_containment_graph.contains(u, v);
   }
 
   /*
@@ -223,26 +276,28 @@ class Graph {
  private:
   uint32_t edge_weight(const Node&, const Node&) const;
 
-  using ContainmentEdge = std::pair<reg_t, reg_t>;
-  Graph() = default;
+  // The registers below dense_regs get bit matrices; see RegPairSet.
+  explicit Graph(size_t dense_regs = 0)
+      : m_adj_matrix(/* ordered */ false, dense_regs),
+        m_not_coalesceable(/* ordered */ false, dense_regs),
+        m_containment_graph(/* ordered */ true, dense_regs) {}
   void add_edge(reg_t, reg_t, bool can_coalesce = false);
   void add_coalesceable_edge(reg_t u, reg_t v) { add_edge(u, v, true); }
   void add_containment_edge(reg_t u, reg_t v) {
     if (u == v) {
       return;
     }
-    m_containment_graph.emplace(ContainmentEdge(u, v));
+    m_containment_graph.insert(u, v);
   }
 
   // Boolean of whether we should separate symregs requiring less than 16 bits
   // from those without this constraint,
   bool m_separate_node{false};
   std::unordered_map<reg_t, Node> m_nodes;
-  using Edge = impl::OrderedPair<reg_t>;
-  std::unordered_map<Edge, bool /* not_coalesceable */, boost::hash<Edge>>
-      m_adj_matrix;
-  std::unordered_set<ContainmentEdge, boost::hash<ContainmentEdge>>
-      m_containment_graph;
+  impl::RegPairSet m_adj_matrix;
+  // The subset of the edges that coalescing must respect.
+  impl::RegPairSet m_not_coalesceable;
+  impl::RegPairSet m_containment_graph;
   // This map contains the LivenessDomains for all instructions which could
   // potentialy take on the /range format.
   std::unordered_map<IRInstruction*, LivenessDomain> m_range_liveness;
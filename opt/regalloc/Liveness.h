@@ -18,6 +18,21 @@ namespace regalloc {
 using namespace std::placeholders;
 using LivenessDomain = SparseSetAbstractDomain;
 
+/*
+ * The live-in and live-out sets at the boundaries of the blocks of a CFG,
+ * with enough of the CFG's shape to tell whether they still line up with the
+ * blocks of a CFG rebuilt from the same code.
+ */
+struct BlockLiveness {
+  struct Entry {
+    size_t id;
+    std::vector<size_t> succs;
+    LivenessDomain live_in;
+    LivenessDomain live_out;
+  };
+  std::vector<Entry> blocks;
+};
+
 class LivenessFixpointIterator final
     : public MonotonicFixpointIterator<
           BackwardsFixpointIterationAdaptor<cfg::GraphInterface>,
@@ -55,12 +70,79 @@ class LivenessFixpointIterator final
   }
 
   LivenessDomain get_live_in_vars_at(const NodeId& block) const {
+    if (!m_reused.empty()) {
+      return m_reused.at(block).live_in;
+    }
     return get_exit_state_at(block);
   }
 
   LivenessDomain get_live_out_vars_at(const NodeId& block) const {
+    if (!m_reused.empty()) {
+      return m_reused.at(block).live_out;
+    }
     return get_entry_state_at(block);
   }
+
+  BlockLiveness get_block_liveness(const ControlFlowGraph& cfg) const {
+    BlockLiveness result;
+    for (Block* block : cfg.blocks()) {
+      BlockLiveness::Entry entry{block->id(),
+                                 {},
+                                 get_live_in_vars_at(block),
+                                 get_live_out_vars_at(block)};
+      for (const auto& succ : block->succs()) {
+        entry.succs.push_back(succ->target()->id());
+      }
+      result.blocks.push_back(std::move(entry));
+    }
+    return result;
+  }
+
+  /*
+   * Instead of running the analysis, take the liveness at block boundaries
+   * from that of an earlier CFG of the same code. That is only valid if the
+   * code has since been changed in ways that keep liveness at the block
+   * boundaries, e.g. by spilling, which only adds registers that are live
+   * within a block. Returns false if the blocks don't line up, in which case
+   * the analysis needs to run.
+   */
+  bool reuse(const BlockLiveness& liveness,
+             const ControlFlowGraph& cfg,
+             size_t registers_size) {
+    const auto& blocks = cfg.blocks();
+    if (blocks.size() != liveness.blocks.size()) {
+      return false;
+    }
+    for (size_t i = 0; i < blocks.size(); ++i) {
+      const auto& entry = liveness.blocks[i];
+      const auto& succs = blocks[i]->succs();
+      if (blocks[i]->id() != entry.id || succs.size() != entry.succs.size()) {
+        return false;
+      }
+      for (size_t j = 0; j < succs.size(); ++j) {
+        if (succs[j]->target()->id() != entry.succs[j]) {
+          return false;
+        }
+      }
+    }
+    for (size_t i = 0; i < blocks.size(); ++i) {
+      const auto& entry = liveness.blocks[i];
+      // The sets need room for the registers added since.
+      auto& reused = m_reused[blocks[i]];
+      reused.live_in = LivenessDomain(registers_size);
+      reused.live_in.join_with(entry.live_in);
+      reused.live_out = LivenessDomain(registers_size);
+      reused.live_out.join_with(entry.live_out);
+    }
+    return true;
+  }
+
+ private:
+  struct Reused {
+    LivenessDomain live_in;
+    LivenessDomain live_out;
+  };
+  std::unordered_map<Block*, Reused> m_reused;
 };
 
 } // namespace regalloc
@@ -109,9 +109,14 @@ void RegAllocPass::run_pass(DexStoresVector& stores,
       },
       [&](unsigned int) { // data initializer
         return nullptr;
-      });
+      },
+      Output(),
+      parallel_walkers::default_num_threads(),
+      // Allocation time grows much faster than linearly with method size.
+      WalkOrder::LargestMethodFirst);
 
   TRACE(REG, 1, "Total reiteration count: %lu\n", stats.reiteration_count);
+  TRACE(REG, 1, "Total liveness reused: %lu\n", stats.liveness_reused);
   TRACE(REG, 1, "Total Params spilled early: %lu\n", stats.params_spill_early);
   TRACE(REG, 1, "Total spill count: %lu\n", stats.moves_inserted());
   TRACE(REG, 1, "  Total param spills: %lu\n", stats.param_spill_moves);
@@ -123,6 +128,7 @@ void RegAllocPass::run_pass(DexStoresVector& stores,
 
   mgr.incr_metric("param spilled too early", stats.params_spill_early);
   mgr.incr_metric("reiteration_count", stats.reiteration_count);
+  mgr.incr_metric("liveness_reused", stats.liveness_reused);
   mgr.incr_metric("spill_count", stats.moves_inserted());
   mgr.incr_metric("coalesce_count", stats.moves_coalesced);
   mgr.incr_metric("net_moves", stats.net_moves());
@@ -23,6 +23,10 @@ class RegAllocPass : public Pass {
   }
   virtual void run_pass(DexStoresVector&, ConfigFiles&, PassManager&) override;
 
+  virtual AnalysisSet preserved_analyses() const override {
+    return ALL_ANALYSES;
+  }
+
  private:
   bool m_use_splitting = false;
   bool m_spill_param_properly = false;
@@ -17,5 +17,9 @@ class RemoveGotosPass : public Pass {
 
   virtual void run_pass(DexStoresVector&, ConfigFiles&, PassManager&) override;
 
+  virtual AnalysisSet preserved_analyses() const override {
+    return ALL_ANALYSES;
+  }
+
   size_t run(DexMethod*);
 };
@@ -23,6 +23,7 @@
 #include "SingleImplDefs.h"
 #include "SingleImplUtil.h"
 #include "Trace.h"
+#include "AnalysisManager.h"
 #include "ClassHierarchy.h"
 #include "Walkers.h"
 
@@ -101,7 +102,7 @@ const int MAX_PASSES = 8;
 
 void SingleImplPass::run_pass(DexStoresVector& stores, ConfigFiles& cfg, PassManager& mgr) {
   auto scope = build_class_scope(stores);
-  ClassHierarchy ch = build_type_hierarchy(scope);
+  const auto& ch = mgr.analyses().get_class_hierarchy(scope);
   int max_steps = 0;
   size_t previous_invoke_intf_count = s_invoke_intf_count;
   removed_count = 0;
@@ -24,6 +24,7 @@
 #include "ReachableClasses.h"
 #include "Walkers.h"
 #include "Warning.h"
+#include "AnalysisManager.h"
 #include "ClassHierarchy.h"
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -378,7 +379,8 @@ void StaticSinkPass::run_pass(DexStoresVector& stores, ConfigFiles& cfg, PassMan
     TRACE(SINK, 1, "StaticSinkPass not run because no ProGuard configuration was provided.");
     return;
   }
-  ClassHierarchy ch = build_type_hierarchy(build_class_scope(stores));
+  const auto& ch =
+      mgr.analyses().get_class_hierarchy(build_class_scope(stores));
   DexClassesVector& root_store = stores[0].get_dexen();
   auto method_list = cfg.get_coldstart_methods();
   auto methods = strings_to_dexmethods(method_list);
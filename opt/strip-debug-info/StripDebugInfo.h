@@ -23,6 +23,10 @@ class StripDebugInfoPass : public Pass {
 
   virtual void run_pass(DexStoresVector&, ConfigFiles&, PassManager&) override;
 
+  virtual AnalysisSet preserved_analyses() const override {
+    return ALL_ANALYSES;
+  }
+
   void set_drop_prologue_end(bool b) { m_drop_prologue_end = b; }
   void set_drop_local_variables(bool b) { m_drop_local_variables = b; }
   void set_drop_epilogue_begin(bool b) { m_drop_epilogue_begin = b; }
@@ -18,6 +18,7 @@
 #include <utility>
 #include <vector>
 
+#include "AnalysisManager.h"
 #include "ClassHierarchy.h"
 #include "Debug.h"
 #include "DexClass.h"
@@ -912,7 +913,7 @@ void SynthPass::run_pass(DexStoresVector& stores, ConfigFiles& cfg, PassManager&
     return;
   }
   Scope scope = build_class_scope(stores);
-  ClassHierarchy ch = build_type_hierarchy(scope);
+  const auto& ch = mgr.analyses().get_class_hierarchy(scope);
   SynthMetrics metrics;
   int passes = 0;
   do {
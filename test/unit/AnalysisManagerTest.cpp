@@ -0,0 +1,168 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <gtest/gtest.h>
+
+#include "AccessMarking.h"
+#include "AnalysisManager.h"
+#include "Creators.h"
+#include "DexUtil.h"
+#include "OriginalNamePass.h"
+#include "PassManager.h"
+#include "RedexContext.h"
+#include "ScopeHelper.h"
+
+namespace {
+
+class AnalysisManagerTest : public ::testing::Test {
+ public:
+  AnalysisManagerTest() {
+    g_redex = new RedexContext();
+    m_scope = create_empty_scope();
+    auto void_void = DexProto::make_proto(get_void_type(),
+                                          DexTypeList::make_type_list({}));
+    auto a = create_internal_class(
+        DexType::make_type("LA;"), get_object_type(), {});
+    create_empty_method(a, "foo", void_void);
+    auto b = create_internal_class(DexType::make_type("LB;"), a->get_type(), {});
+    create_empty_method(b, "foo", void_void);
+    m_scope.push_back(a);
+    m_scope.push_back(b);
+  }
+
+  ~AnalysisManagerTest() { delete g_redex; }
+
+ protected:
+  Scope m_scope;
+};
+
+/*
+ * Records the class hierarchy it is given, and preserves what it is told to.
+ */
+class UsesHierarchyPass : public Pass {
+ public:
+  UsesHierarchyPass(const std::string& name, AnalysisSet preserved)
+      : Pass(name), m_preserved(preserved) {}
+
+  virtual void run_pass(DexStoresVector& stores,
+                        ConfigFiles&,
+                        PassManager& mgr) override {
+    hierarchy = &mgr.analyses().get_class_hierarchy(build_class_scope(stores));
+  }
+
+  virtual AnalysisSet preserved_analyses() const override {
+    return m_preserved;
+  }
+
+  const ClassHierarchy* hierarchy{nullptr};
+
+ private:
+  AnalysisSet m_preserved;
+};
+
+} // namespace
+
+TEST_F(AnalysisManagerTest, reusesUntilInvalidated) {
+  AnalysisManager am;
+  auto& ch = am.get_class_hierarchy(m_scope);
+  EXPECT_EQ(get_children(ch, m_scope[0]->get_type()),
+            TypeSet{m_scope[1]->get_type()});
+  EXPECT_EQ(&am.get_class_hierarchy(m_scope), &ch);
+  EXPECT_EQ(am.stats().builds, 1);
+  EXPECT_EQ(am.stats().hits, 1);
+
+  // The signature map is built from the cached hierarchy, which only counts
+  // as its build.
+  am.get_signature_map(m_scope);
+  EXPECT_EQ(am.stats().builds, 2);
+  EXPECT_EQ(am.stats().hits, 1);
+  EXPECT_EQ(am.cached(), ANALYSIS_CLASS_HIERARCHY | ANALYSIS_SIGNATURE_MAP);
+
+  // Dropping the hierarchy drops what was built from it.
+  am.invalidate(ANALYSIS_CLASS_HIERARCHY);
+  EXPECT_EQ(am.cached(), NO_ANALYSES);
+  am.get_class_scopes(m_scope);
+  am.invalidate(ANALYSIS_SIGNATURE_MAP);
+  EXPECT_EQ(am.cached(), NO_ANALYSES);
+}
+
+TEST_F(AnalysisManagerTest, classScopesProvideTheOthers) {
+  AnalysisManager am;
+  auto& scopes = am.get_class_scopes(m_scope);
+  EXPECT_EQ(&am.get_class_hierarchy(m_scope), &scopes.get_class_hierarchy());
+  EXPECT_EQ(&am.get_signature_map(m_scope), &scopes.get_signature_map());
+  EXPECT_EQ(am.stats().builds, 1);
+  EXPECT_EQ(am.stats().hits, 2);
+}
+
+TEST_F(AnalysisManagerTest, rebuildsForADifferentScope) {
+  AnalysisManager am;
+  am.get_class_hierarchy(m_scope);
+  auto smaller = m_scope;
+  smaller.pop_back();
+  auto& ch = am.get_class_hierarchy(smaller);
+  EXPECT_EQ(am.stats().builds, 2);
+  EXPECT_TRUE(get_children(ch, m_scope[0]->get_type()).empty());
+}
+
+TEST_F(AnalysisManagerTest, passManagerInvalidatesAfterPasses) {
+  DexStoresVector stores;
+  DexMetadata dm;
+  dm.set_id("classes");
+  DexStore store(dm);
+  store.add_classes(m_scope);
+  stores.emplace_back(std::move(store));
+
+  UsesHierarchyPass first("FirstPass", ALL_ANALYSES);
+  UsesHierarchyPass second("SecondPass", NO_ANALYSES);
+  UsesHierarchyPass third("ThirdPass", NO_ANALYSES);
+  PassManager manager({&first, &second, &third});
+  manager.set_testing_mode();
+  Json::Value conf_obj = Json::nullValue;
+  ConfigFiles dummy_cfg(conf_obj);
+  manager.run_passes(stores, Scope(), dummy_cfg);
+
+  EXPECT_EQ(manager.analyses().stats().builds, 2);
+  EXPECT_EQ(manager.analyses().stats().hits, 1);
+  const auto& info = manager.get_pass_info();
+  EXPECT_EQ(info[0].metrics.at("analysis_builds"), 1);
+  EXPECT_EQ(info[1].metrics.at("analysis_cache_hits"), 1);
+  EXPECT_EQ(info[1].metrics.count("analysis_builds"), 0);
+  EXPECT_EQ(info[2].metrics.at("analysis_builds"), 1);
+  EXPECT_EQ(manager.analyses().cached(), NO_ANALYSES);
+}
+
+TEST_F(AnalysisManagerTest, consecutivePassesShareTheHierarchy) {
+  DexStoresVector stores;
+  DexMetadata dm;
+  dm.set_id("classes");
+  DexStore store(dm);
+  store.add_classes(m_scope);
+  stores.emplace_back(std::move(store));
+
+  OriginalNamePass original_name;
+  AccessMarkingPass access_marking;
+  Json::Value config(Json::objectValue);
+  config["redex"]["passes"].append("OriginalNamePass");
+  config["redex"]["passes"].append("AccessMarkingPass");
+  PassManager manager({&original_name, &access_marking}, config);
+  manager.set_testing_mode();
+  ConfigFiles dummy_cfg(config);
+  manager.run_passes(stores, Scope(), dummy_cfg);
+
+  const auto& info = manager.get_pass_info();
+  ASSERT_EQ(info.size(), 2);
+  EXPECT_EQ(info[0].metrics.at("analysis_builds"), 1);
+  // AccessMarking gets the hierarchy OriginalName built, and builds the
+  // signature map from it.
+  EXPECT_EQ(info[1].metrics.at("analysis_cache_hits"), 1);
+  EXPECT_EQ(info[1].metrics.at("analysis_builds"), 1);
+  // It privatizes methods, so only the hierarchy survives it.
+  EXPECT_EQ(manager.analyses().cached(), ANALYSIS_CLASS_HIERARCHY);
+}
@@ -0,0 +1,102 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <gtest/gtest.h>
+
+#include <cstdarg>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "BinaryTrace.h"
+
+namespace {
+
+std::vector<char> encode(const char* fmt, ...) {
+  std::vector<char> out;
+  va_list ap;
+  va_start(ap, fmt);
+  binary_trace::encode_args(out, fmt, ap);
+  va_end(ap);
+  return out;
+}
+
+std::string format(const char* fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  char buf[1024];
+  vsnprintf(buf, sizeof(buf), fmt, ap);
+  va_end(ap);
+  return buf;
+}
+
+std::string decode(const char* fmt, const std::vector<char>& args) {
+  std::string out;
+  EXPECT_TRUE(binary_trace::render(fmt, args.data(), args.size(), &out));
+  return out;
+}
+
+} // namespace
+
+// Each format is encoded as the tracer does and decoded as trace-decode does,
+// and must come out as printf would have printed it.
+#define EXPECT_ROUND_TRIP(fmt, ...) \
+  EXPECT_EQ(format(fmt, __VA_ARGS__), decode(fmt, encode(fmt, __VA_ARGS__)))
+
+TEST(BinaryTraceTest, mixedArguments) {
+  int x = 0;
+  EXPECT_ROUND_TRIP("%d %u %x %c\n", -42, 42u, 0xbeef, 'r');
+  EXPECT_ROUND_TRIP("%ld %lld %zu %llx\n",
+                    -1L << 40,
+                    1LL << 62,
+                    size_t(1) << 35,
+                    0xdeadbeefcafeULL);
+  EXPECT_ROUND_TRIP("%hd %hhu\n", -3, 200);
+  EXPECT_ROUND_TRIP("%f %.3e %g %8.2f\n", 3.25, -1e-9, 1e20, 2.5);
+  EXPECT_ROUND_TRIP("%Lf\n", 1.5L);
+  EXPECT_ROUND_TRIP("%s|%-8s|%.2s\n", "method", "pad", "truncated");
+  EXPECT_ROUND_TRIP("%*d|%-*.*f|%.*s\n", 6, 7, 9, 2, 1.125, 3, "abcdef");
+  EXPECT_ROUND_TRIP("%p %s\n", &x, "after a pointer");
+  EXPECT_ROUND_TRIP("100%% of %d%%\n", 5);
+  EXPECT_ROUND_TRIP("%s %d %s %f %lu %s\n",
+                    "a",
+                    1,
+                    "",
+                    2.0,
+                    3UL,
+                    std::string(300, 'z').c_str());
+}
+
+TEST(BinaryTraceTest, nullString) {
+  auto args = encode("<%s>\n", static_cast<const char*>(nullptr));
+  EXPECT_EQ("<(null)>\n", decode("<%s>\n", args));
+}
+
+TEST(BinaryTraceTest, noArguments) {
+  auto args = encode("plain text\n");
+  EXPECT_TRUE(args.empty());
+  EXPECT_EQ("plain text\n", decode("plain text\n", args));
+}
+
+TEST(BinaryTraceTest, unknownConversionKeepsRestOfFormat) {
+  auto args = encode("%d %Q %d\n", 1, 2);
+  EXPECT_EQ("1 %Q %d\n", decode("%d %Q %d\n", args));
+}
+
+TEST(BinaryTraceTest, mismatchedArgumentsAreRejected) {
+  auto args = encode("%s\n", "a string");
+  std::string out;
+  // Truncated mid-string.
+  EXPECT_FALSE(binary_trace::render(
+      "%s\n", args.data(), args.size() - 2, &out));
+  // A star where the encoding has the string.
+  out.clear();
+  EXPECT_FALSE(
+      binary_trace::render("%*s\n", args.data(), args.size(), &out));
+}
@@ -0,0 +1,110 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "Creators.h"
+#include "DexLoader.h"
+#include "DexOutput.h"
+#include "IRCode.h"
+#include "InstructionLowering.h"
+#include "RedexContext.h"
+
+namespace fs = boost::filesystem;
+
+//==========
+// Test for performance
+//==========
+
+DexMethod* make_method(DexType* cls, size_t n, size_t size) {
+  auto method = static_cast<DexMethod*>(DexMethod::make_method(
+      cls,
+      DexString::make_string("m" + std::to_string(n)),
+      DexProto::make_proto(
+          DexType::make_type("I"),
+          DexTypeList::make_type_list({DexType::make_type("I")}))));
+  method->make_concrete(ACC_PUBLIC | ACC_STATIC, false);
+  auto code = std::make_unique<IRCode>(method, 1);
+  code->set_debug_item(std::make_unique<DexDebugItem>());
+  for (size_t i = 0; i < size; ++i) {
+    if (i % 8 == 0) {
+      auto pos = std::make_unique<DexPosition>(n + i);
+      pos->bind(method, DexString::make_string("CachePerfTest.java"));
+      code->push_back(std::move(pos));
+    }
+    code->push_back((new IRInstruction(OPCODE_ADD_INT))
+                        ->set_dest(0)
+                        ->set_src(0, 0)
+                        ->set_src(1, 1));
+  }
+  code->push_back((new IRInstruction(OPCODE_RETURN))->set_src(0, 0));
+  method->set_code(std::move(code));
+  return method;
+}
+
+void write_dex(const std::string& path, size_t num_methods, size_t size) {
+  g_redex = new RedexContext();
+  auto cls_type = DexType::make_type("LCachePerfTest;");
+  ClassCreator creator(cls_type);
+  creator.set_super(DexType::make_type("Ljava/lang/Object;"));
+  for (size_t i = 0; i < num_methods; ++i) {
+    creator.add_method(make_method(cls_type, i, size));
+  }
+  DexClasses classes{creator.create()};
+  for (auto m : classes[0]->get_dmethods()) {
+    instruction_lowering::lower(m);
+  }
+  Json::Value json(Json::objectValue);
+  ConfigFiles cfg(json);
+  std::unique_ptr<PositionMapper> pos_mapper(PositionMapper::make("", ""));
+  write_classes_to_dex(
+      path, &classes, nullptr, 0, cfg, json, pos_mapper.get());
+  delete g_redex;
+}
+
+// Loads a dex without the cache, on a cache miss (which also writes the
+// entry) and on a hit.
+void coldVsWarm() {
+  auto dir = fs::temp_directory_path() / fs::unique_path();
+  fs::create_directories(dir);
+  auto dex = (dir / "classes.dex").string();
+  auto cache_dir = (dir / "cache").string();
+  write_dex(dex, 20000, 40);
+
+  auto time_load = [&](const std::string& cache) {
+    g_redex = new RedexContext();
+    std::vector<dex_stats_t> stats;
+    auto start = std::chrono::steady_clock::now();
+    load_classes_from_dexes({dex}, &stats, true, cache);
+    auto elapsed = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+    delete g_redex;
+    return elapsed;
+  };
+  auto uncached = time_load("");
+  auto miss = time_load(cache_dir);
+  auto hit = time_load(cache_dir);
+  printf("no cache: %7.1f ms\n", uncached * 1000);
+  printf("miss:     %7.1f ms\n", miss * 1000);
+  printf("hit:      %7.1f ms (%.2fx faster than no cache)\n",
+         hit * 1000,
+         uncached / hit);
+  fs::remove_all(dir);
+}
+
+int main() {
+  coldVsWarm();
+  return 0;
+}
@@ -0,0 +1,270 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <ctime>
+#include <fstream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/regex.hpp>
+
+#include "Creators.h"
+#include "DexCache.h"
+#include "DexLoader.h"
+#include "DexOutput.h"
+#include "IRCode.h"
+#include "InstructionLowering.h"
+#include "RedexContext.h"
+
+namespace fs = boost::filesystem;
+
+namespace {
+
+DexPosition* add_position(IRCode* code, DexMethod* method, uint32_t line) {
+  auto pos = std::make_unique<DexPosition>(line);
+  pos->bind(method, DexString::make_string("CacheTest.java"));
+  auto ptr = pos.get();
+  code->push_back(std::move(pos));
+  return ptr;
+}
+
+/*
+ * A method that exercises every kind of MethodItemEntry the loader produces:
+ * positions, a switch, a try region with its catch, and array data.
+ */
+DexMethod* make_rich_method(DexType* cls) {
+  auto method = static_cast<DexMethod*>(DexMethod::make_method(
+      cls,
+      DexString::make_string("rich"),
+      DexProto::make_proto(
+          DexType::make_type("Ljava/lang/Object;"),
+          DexTypeList::make_type_list({DexType::make_type("I")}))));
+  method->make_concrete(ACC_PUBLIC | ACC_STATIC, false);
+  auto code = std::make_unique<IRCode>(method, 2);
+  code->set_debug_item(std::make_unique<DexDebugItem>());
+  auto param = 2;
+
+  add_position(code.get(), method, 10);
+  code->push_back((new IRInstruction(OPCODE_CONST_STRING))
+                      ->set_string(DexString::make_string("hello")));
+  code->push_back(
+      (new IRInstruction(IOPCODE_MOVE_RESULT_PSEUDO_OBJECT))->set_dest(0));
+  auto switch_insn = new IRInstruction(OPCODE_PACKED_SWITCH);
+  switch_insn->set_src(0, param);
+  code->push_back(switch_insn);
+  auto switch_mie = &*std::prev(code->end());
+  add_position(code.get(), method, 11);
+  code->push_back(new IRInstruction(OPCODE_RETURN_OBJECT));
+  std::prev(code->end())->insn->set_src(0, 0);
+
+  // case 0: a call inside a try region.
+  auto catch_mie = new MethodItemEntry(DexType::make_type("Ljava/lang/Exception;"));
+  auto bt0 = new BranchTarget();
+  bt0->type = BRANCH_MULTI;
+  bt0->src = switch_mie;
+  bt0->index = 0;
+  code->push_back(bt0);
+  code->push_back(TRY_START, catch_mie);
+  auto invoke = new IRInstruction(OPCODE_INVOKE_STATIC);
+  invoke->set_method(DexMethod::make_method("LCacheTest;", "helper", "V", {"I"}))
+      ->set_arg_word_count(1)
+      ->set_src(0, param);
+  code->push_back(invoke);
+  code->push_back(TRY_END, catch_mie);
+  code->push_back((new IRInstruction(OPCODE_RETURN_OBJECT))->set_src(0, 0));
+
+  // case 1: an array filled from a payload.
+  auto bt1 = new BranchTarget();
+  bt1->type = BRANCH_MULTI;
+  bt1->src = switch_mie;
+  bt1->index = 1;
+  code->push_back(bt1);
+  add_position(code.get(), method, 12);
+  code->push_back((new IRInstruction(OPCODE_CONST))->set_dest(1)->set_literal(2));
+  code->push_back((new IRInstruction(OPCODE_NEW_ARRAY))
+                      ->set_type(DexType::make_type("[I"))
+                      ->set_src(0, 1));
+  code->push_back(
+      (new IRInstruction(IOPCODE_MOVE_RESULT_PSEUDO_OBJECT))->set_dest(0));
+  // fill-array-data-payload: ident, element width, size (2 words), data.
+  const uint16_t payload[] = {FOPCODE_FILLED_ARRAY, 4, 2, 0, 7, 0, 9, 0};
+  code->push_back((new IRInstruction(OPCODE_FILL_ARRAY_DATA))
+                      ->set_data(new DexOpcodeData(payload, 7))
+                      ->set_src(0, 0));
+  code->push_back((new IRInstruction(OPCODE_RETURN_OBJECT))->set_src(0, 0));
+
+  code->push_back(*catch_mie);
+  code->push_back((new IRInstruction(OPCODE_MOVE_EXCEPTION))->set_dest(0));
+  code->push_back((new IRInstruction(OPCODE_RETURN_OBJECT))->set_src(0, 0));
+
+  method->set_code(std::move(code));
+  return method;
+}
+
+DexMethod* make_simple_method(DexType* cls, size_t n, size_t size) {
+  auto method = static_cast<DexMethod*>(DexMethod::make_method(
+      cls,
+      DexString::make_string("m" + std::to_string(n)),
+      DexProto::make_proto(
+          DexType::make_type("I"),
+          DexTypeList::make_type_list({DexType::make_type("I")}))));
+  method->make_concrete(ACC_PUBLIC | ACC_STATIC, false);
+  auto code = std::make_unique<IRCode>(method, 1);
+  code->set_debug_item(std::make_unique<DexDebugItem>());
+  add_position(code.get(), method, n);
+  code->push_back((new IRInstruction(OPCODE_CONST))->set_dest(0)->set_literal(n));
+  for (size_t i = 0; i < size; ++i) {
+    if (i % 8 == 0) {
+      add_position(code.get(), method, n + i);
+    }
+    code->push_back((new IRInstruction(OPCODE_ADD_INT))
+                        ->set_dest(0)
+                        ->set_src(0, 0)
+                        ->set_src(1, 1));
+  }
+  code->push_back((new IRInstruction(OPCODE_RETURN))->set_src(0, 0));
+  method->set_code(std::move(code));
+  return method;
+}
+
+void write_test_dex(const std::string& path, size_t num_methods, size_t size) {
+  g_redex = new RedexContext();
+  auto cls_type = DexType::make_type("LCacheTest;");
+  ClassCreator creator(cls_type);
+  creator.set_super(DexType::make_type("Ljava/lang/Object;"));
+  creator.add_method(make_rich_method(cls_type));
+  for (size_t i = 0; i < num_methods; ++i) {
+    creator.add_method(make_simple_method(cls_type, i, size));
+  }
+  DexClasses classes{creator.create()};
+  for (auto m : classes[0]->get_dmethods()) {
+    instruction_lowering::lower(m);
+  }
+
+  Json::Value json(Json::objectValue);
+  ConfigFiles cfg(json);
+  std::unique_ptr<PositionMapper> pos_mapper(PositionMapper::make("", ""));
+  write_classes_to_dex(
+      path, &classes, nullptr, 0, cfg, json, pos_mapper.get());
+  delete g_redex;
+}
+
+using ShownCode = std::map<std::string, std::string>;
+
+ShownCode load_and_show(const std::string& dex, const std::string& cache_dir) {
+  g_redex = new RedexContext();
+  std::vector<dex_stats_t> stats;
+  auto dexen = load_classes_from_dexes(
+      {dex}, &stats, /* balloon */ true, cache_dir);
+  ShownCode shown;
+  // Cached methods never parse their code_item, but still count in the stats.
+  shown["num_instructions"] = std::to_string(stats.at(0).num_instructions);
+  for (auto cls : dexen.at(0)) {
+    for (auto m : cls->get_dmethods()) {
+      // Entries are shown with their addresses, which differ between runs.
+      static const boost::regex address("0x[0-9a-f]+");
+      shown[show(m)] = boost::regex_replace(show(m->get_code()), address, "");
+    }
+  }
+  delete g_redex;
+  return shown;
+}
+
+struct TempDir {
+  fs::path path;
+  TempDir() : path(fs::temp_directory_path() / fs::unique_path()) {
+    fs::create_directories(path);
+  }
+  ~TempDir() { fs::remove_all(path); }
+};
+
+} // namespace
+
+TEST(DexCacheTest, warmLoadMatchesCold) {
+  TempDir tmp;
+  auto dex = (tmp.path / "classes.dex").string();
+  auto cache_dir = (tmp.path / "cache").string();
+  write_test_dex(dex, 20, 10);
+
+  auto uncached = load_and_show(dex, "");
+  auto cold = load_and_show(dex, cache_dir);
+  EXPECT_EQ(cold, uncached);
+  ASSERT_EQ(std::distance(fs::directory_iterator(cache_dir),
+                          fs::directory_iterator()),
+            1);
+  auto entry = fs::directory_iterator(cache_dir)->path();
+
+  // A hit must not rewrite the entry.
+  std::time_t past = std::time(nullptr) - 3600;
+  fs::last_write_time(entry, past);
+  auto warm = load_and_show(dex, cache_dir);
+  EXPECT_EQ(warm, uncached);
+  EXPECT_EQ(fs::last_write_time(entry), past);
+  EXPECT_NE(warm.at("LCacheTest;.rich:(I)Ljava/lang/Object;").find("TRY_START"),
+            std::string::npos);
+
+  // A damaged entry is ignored and replaced.
+  auto size = fs::file_size(entry);
+  fs::resize_file(entry, size - 3);
+  EXPECT_EQ(load_and_show(dex, cache_dir), uncached);
+  EXPECT_EQ(fs::file_size(entry), size);
+}
+
+TEST(DexCacheTest, entryOfAnotherVersionIsReplaced) {
+  TempDir tmp;
+  auto dex = (tmp.path / "classes.dex").string();
+  auto cache_dir = (tmp.path / "cache").string();
+  write_test_dex(dex, 5, 4);
+
+  auto uncached = load_and_show(dex, "");
+  load_and_show(dex, cache_dir);
+  auto entry = fs::directory_iterator(cache_dir)->path().string();
+  auto read_version = [&] {
+    std::ifstream in(entry, std::ios::binary);
+    in.seekg(8);
+    uint32_t version;
+    in.read(reinterpret_cast<char*>(&version), sizeof(version));
+    return version;
+  };
+  auto version = read_version();
+  {
+    std::fstream out(entry, std::ios::binary | std::ios::in | std::ios::out);
+    out.seekp(8);
+    uint32_t other = version + 1;
+    out.write(reinterpret_cast<const char*>(&other), sizeof(other));
+  }
+  EXPECT_EQ(load_and_show(dex, cache_dir), uncached);
+  EXPECT_EQ(read_version(), kDexCacheVersion);
+}
+
+TEST(DexCacheTest, sharedEntryIsTakenOnce) {
+  for (int round = 0; round < 50; ++round) {
+    CachedCode cached;
+    cached.code = std::make_unique<IRCode>();
+    std::atomic<int> winners{0};
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i) {
+      threads.emplace_back([&] {
+        if (cached.take()) {
+          ++winners;
+        }
+      });
+    }
+    for (auto& t : threads) {
+      t.join();
+    }
+    EXPECT_EQ(winners, 1);
+  }
+}
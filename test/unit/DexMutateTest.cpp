@@ -65,3 +65,24 @@ TEST(RenameMembers, rename) {
   std::string name_after = field->get_name()->c_str();
   ASSERT_EQ("numbat", name_after);
 }
+
+TEST(RenameMembers, renameOntoExistingField) {
+  g_redex = new RedexContext();
+  auto obj_t = DexType::make_type("Ljava/lang/Object;");
+  auto int_t = DexType::make_type("I");
+  auto a = DexType::make_type("A");
+  auto wombat = make_field_def(a, "wombat", int_t, ACC_PUBLIC, true);
+  auto numbat = make_field_def(a, "numbat", int_t, ACC_PUBLIC, true);
+  create_class(a, obj_t, {wombat, numbat}, ACC_PUBLIC, true);
+  DexFieldSpec spec;
+  spec.name = DexString::make_string("numbat");
+  wombat->change(spec);
+  // The rename goes through, but the existing field keeps the name in the
+  // intern table.
+  EXPECT_STREQ(wombat->get_name()->c_str(), "numbat");
+  EXPECT_EQ(DexField::get_field(a, DexString::make_string("numbat"), int_t),
+            numbat);
+  EXPECT_EQ(DexField::get_field(a, DexString::make_string("wombat"), int_t),
+            nullptr);
+  delete g_redex;
+}
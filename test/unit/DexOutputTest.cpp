@@ -0,0 +1,174 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
+
+#include "Creators.h"
+#include "DexOutput.h"
+#include "DexOutputBuffer.h"
+#include "IRCode.h"
+#include "InstructionLowering.h"
+#include "RedexContext.h"
+#include "Show.h"
+
+namespace fs = boost::filesystem;
+
+namespace {
+
+constexpr size_t k_num_dexes = 5;
+
+DexMethod* make_method(DexType* cls, size_t n) {
+  auto method = static_cast<DexMethod*>(DexMethod::make_method(
+      cls,
+      DexString::make_string("m" + std::to_string(n)),
+      DexProto::make_proto(
+          DexType::make_type("Ljava/lang/String;"),
+          DexTypeList::make_type_list({DexType::make_type("I")}))));
+  method->make_concrete(ACC_PUBLIC | ACC_STATIC, false);
+  // The symbol files are keyed by the names the loader would have recorded.
+  method->set_deobfuscated_name(show(method));
+  auto code = std::make_unique<IRCode>(method, 1);
+  code->set_debug_item(std::make_unique<DexDebugItem>());
+  for (size_t i = 0; i <= n % 4; ++i) {
+    auto pos = std::make_unique<DexPosition>(n * 10 + i);
+    pos->bind(method, DexString::make_string("OutputTest.java"));
+    code->push_back(std::move(pos));
+    code->push_back((new IRInstruction(OPCODE_ADD_INT_LIT8))
+                        ->set_dest(0)
+                        ->set_src(0, 1)
+                        ->set_literal(i));
+  }
+  code->push_back(
+      (new IRInstruction(OPCODE_CONST_STRING))
+          ->set_string(DexString::make_string("s" + std::to_string(n))));
+  code->push_back(
+      (new IRInstruction(IOPCODE_MOVE_RESULT_PSEUDO_OBJECT))->set_dest(0));
+  code->push_back((new IRInstruction(OPCODE_RETURN_OBJECT))->set_src(0, 0));
+  method->set_code(std::move(code));
+  return method;
+}
+
+std::string read_file(const fs::path& path) {
+  std::ifstream in(path.string(), std::ios::binary);
+  return std::string(std::istreambuf_iterator<char>(in),
+                     std::istreambuf_iterator<char>());
+}
+
+// The method mapping is written in the hash order of the method index, which
+// varies from run to run even when writing serially.
+std::string sorted_lines(const std::string& text) {
+  std::vector<std::string> lines;
+  boost::split(lines, text, boost::is_any_of("\n"));
+  std::sort(lines.begin(), lines.end());
+  return boost::join(lines, "\n");
+}
+
+using Outputs = std::map<std::string, std::string>;
+
+/*
+ * Writes the same synthetic dexes, along with a line map and the symbol
+ * files, and returns the contents of every file produced.
+ */
+Outputs write_dexes(const fs::path& dir, size_t num_threads) {
+  g_redex = new RedexContext();
+  std::vector<DexClasses> dexen(k_num_dexes);
+  for (size_t d = 0; d < k_num_dexes; ++d) {
+    // Dexes of different sizes, so that their jobs finish out of order.
+    for (size_t c = 0; c <= d * 2; ++c) {
+      auto type = DexType::make_type(DexString::make_string(
+          "LOutputTest" + std::to_string(d) + "_" + std::to_string(c) + ";"));
+      ClassCreator creator(type);
+      creator.set_super(DexType::make_type("Ljava/lang/Object;"));
+      for (size_t m = 0; m < 3 + c; ++m) {
+        auto method = make_method(type, d * 100 + c * 10 + m);
+        instruction_lowering::lower(method);
+        creator.add_method(method);
+      }
+      auto cls = creator.create();
+      cls->set_deobfuscated_name(type->c_str());
+      dexen[d].push_back(cls);
+    }
+  }
+
+  Json::Value json(Json::objectValue);
+  json["method_mapping"] = "method_mapping.txt";
+  json["class_mapping"] = "class_mapping.txt";
+  json["bytecode_offset_map"] = "bytecode_offset_map.txt";
+  ConfigFiles cfg(json);
+  cfg.outdir = dir.string();
+  std::unique_ptr<PositionMapper> pos_mapper(
+      PositionMapper::make("", (dir / "line_map_v2").string()));
+
+  std::vector<DexOutputJob> jobs;
+  for (size_t d = 0; d < k_num_dexes; ++d) {
+    auto name = "classes" + std::to_string(d) + ".dex";
+    jobs.push_back(DexOutputJob{(dir / name).string(), &dexen[d], d});
+  }
+  write_classes_to_dexes(
+      jobs, nullptr, cfg, json, pos_mapper.get(), num_threads);
+  pos_mapper->write_map();
+  delete g_redex;
+
+  Outputs outputs;
+  for (auto it = fs::directory_iterator(dir); it != fs::directory_iterator();
+       ++it) {
+    auto name = it->path().filename().string();
+    auto contents = read_file(it->path());
+    outputs[name] =
+        name == "method_mapping.txt" ? sorted_lines(contents) : contents;
+  }
+  return outputs;
+}
+
+struct TempDir {
+  fs::path path;
+  TempDir() : path(fs::temp_directory_path() / fs::unique_path()) {
+    fs::create_directories(path);
+  }
+  ~TempDir() { fs::remove_all(path); }
+};
+
+} // namespace
+
+TEST(DexOutputTest, parallelOutputMatchesSerial) {
+  TempDir serial_dir;
+  TempDir parallel_dir;
+  auto serial = write_dexes(serial_dir.path, 1);
+  auto parallel = write_dexes(parallel_dir.path, 3);
+
+  // Every dex, the line map and the symbol files.
+  EXPECT_EQ(serial.size(), k_num_dexes + 4);
+  ASSERT_EQ(serial.size(), parallel.size());
+  for (const auto& pair : serial) {
+    auto it = parallel.find(pair.first);
+    ASSERT_NE(it, parallel.end()) << pair.first;
+    EXPECT_FALSE(pair.second.empty()) << pair.first;
+    EXPECT_TRUE(pair.second == it->second) << pair.first << " differs";
+  }
+}
+
+TEST(DexOutputTest, bufferRejectsWritesPastItsReservation) {
+  DexOutputBuffer buffer;
+  EXPECT_EQ(buffer.at(0, 16), buffer.data());
+  uint8_t* last = buffer.at(buffer.capacity() - 1, 1);
+  *last = 1;
+  EXPECT_EQ(*last, 1);
+  EXPECT_ANY_THROW(buffer.at(buffer.capacity() - 1, 2));
+  EXPECT_ANY_THROW(buffer.ensure(buffer.capacity() + 1));
+}
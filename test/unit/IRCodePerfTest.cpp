@@ -0,0 +1,69 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <sstream>
+#include <string>
+
+#include "IRAssembler.h"
+#include "IRCode.h"
+#include "InstructionLowering.h"
+#include "RedexContext.h"
+
+//==========
+// Test for performance
+//==========
+
+DexMethod* lowered_method(const std::string& body) {
+  auto method = static_cast<DexMethod*>(
+      DexMethod::make_method("Lfoo;", "sync", "V", {}));
+  method->make_concrete(ACC_PUBLIC | ACC_STATIC, false);
+  auto code = assembler::ircode_from_string(body);
+  code->set_registers_size(1);
+  method->set_code(std::move(code));
+  instruction_lowering::lower(method);
+  return method;
+}
+
+void syncLargeMethod() {
+  // Short forward branches interleaved with straight-line code, each of
+  // which also has a backward goto spanning an ever larger part of the
+  // method, so that many gotos have to grow during relaxation.
+  const size_t kBlocks = 10000;
+  std::ostringstream ss;
+  ss << "(\n";
+  for (size_t i = 0; i < kBlocks; ++i) {
+    ss << ":b" << i << "\n";
+    ss << "(if-eqz v0 :c" << i << ")\n";
+    ss << "(goto :b" << i / 2 << ")\n";
+    ss << ":c" << i << "\n";
+    for (size_t j = 0; j < 4; ++j) {
+      ss << "(const/4 v0 0)\n";
+    }
+  }
+  ss << "(return-void))";
+  auto method = lowered_method(ss.str());
+
+  auto start = std::chrono::high_resolution_clock::now();
+  method->sync();
+  auto end = std::chrono::high_resolution_clock::now();
+  auto& insns = method->get_dex_code()->get_instructions();
+  assert(insns.back()->opcode() == OPCODE_RETURN_VOID);
+  printf("synced %zu instructions in %fs\n",
+         insns.size(),
+         std::chrono::duration<double>(end - start).count());
+}
+
+int main() {
+  printf("Begin!\n");
+  g_redex = new RedexContext();
+  syncLargeMethod();
+  delete g_redex;
+}
@@ -8,14 +8,52 @@
  */
 
 #include <gtest/gtest.h>
+#include <sstream>
 
 #include "DexAsm.h"
+#include "IRAssembler.h"
 #include "IRCode.h"
+#include "InstructionLowering.h"
+#include "Show.h"
 
 std::ostream& operator<<(std::ostream& os, const IRInstruction& to_show) {
   return os << show(&to_show);
 }
 
+namespace {
+
+/*
+ * Assemble and lower the given code into a fresh static method, leaving it
+ * ready to be synced.
+ */
+DexMethod* lowered_method(const std::string& body) {
+  static size_t count = 0;
+  auto method = static_cast<DexMethod*>(DexMethod::make_method(
+      "Lfoo;", ("sync" + std::to_string(count++)).c_str(), "V", {}));
+  method->make_concrete(ACC_PUBLIC | ACC_STATIC, false);
+  auto code = assembler::ircode_from_string(body);
+  code->set_registers_size(1);
+  method->set_code(std::move(code));
+  instruction_lowering::lower(method);
+  return method;
+}
+
+std::vector<DexInstruction*>& sync_code(const std::string& body) {
+  auto method = lowered_method(body);
+  method->sync();
+  return method->get_dex_code()->get_instructions();
+}
+
+std::string repeat_const(size_t n) {
+  std::ostringstream ss;
+  for (size_t i = 0; i < n; ++i) {
+    ss << "(const/4 v0 0)\n";
+  }
+  return ss.str();
+}
+
+} // namespace
+
 TEST(IRCode, LoadParamInstructionsDirect) {
   using namespace dex_asm;
 
@@ -51,3 +89,65 @@ TEST(IRCode, LoadParamInstructionsVirtual) {
 
   delete g_redex;
 }
+
+TEST(IRCode, SyncDropsGotoToNextInstruction) {
+  g_redex = new RedexContext();
+
+  auto& insns = sync_code(R"(
+    (
+     (const/4 v0 0)
+     (goto :a)
+     :a
+     (goto :b)
+     :b
+     (return-void)
+    )
+  )");
+  ASSERT_EQ(insns.size(), 2);
+  EXPECT_EQ(insns[0]->opcode(), OPCODE_CONST_4);
+  EXPECT_EQ(insns[1]->opcode(), OPCODE_RETURN_VOID);
+
+  delete g_redex;
+}
+
+TEST(IRCode, SyncSizesGotos) {
+  g_redex = new RedexContext();
+
+  auto goto_over = [](size_t n) {
+    auto& insns = sync_code("((goto :end)\n" + repeat_const(n) +
+                            ":end\n(return-void))");
+    EXPECT_EQ(insns.size(), n + 2);
+    return insns.front();
+  };
+
+  auto insn = goto_over(100);
+  EXPECT_EQ(insn->opcode(), OPCODE_GOTO);
+  EXPECT_EQ(insn->offset(), 101);
+
+  insn = goto_over(200);
+  EXPECT_EQ(insn->opcode(), OPCODE_GOTO_16);
+  EXPECT_EQ(insn->offset(), 202);
+
+  insn = goto_over(40000);
+  EXPECT_EQ(insn->opcode(), OPCODE_GOTO_32);
+  EXPECT_EQ(insn->offset(), 40003);
+
+  delete g_redex;
+}
+
+TEST(IRCode, SyncRewritesFarConditionalBranch) {
+  g_redex = new RedexContext();
+
+  auto& insns = sync_code("((if-eqz v0 :end)\n" + repeat_const(40000) +
+                          ":end\n(return-void))");
+  // The if-eqz can't reach its target, so it gets inverted to jump over a
+  // goto/32 that does.
+  ASSERT_EQ(insns.size(), 40003);
+  EXPECT_EQ(insns[0]->opcode(), OPCODE_IF_NEZ);
+  EXPECT_EQ(insns[0]->offset(), 5);
+  EXPECT_EQ(insns[1]->opcode(), OPCODE_GOTO_32);
+  EXPECT_EQ(insns[1]->offset(), 40003);
+  EXPECT_EQ(insns.back()->opcode(), OPCODE_RETURN_VOID);
+
+  delete g_redex;
+}
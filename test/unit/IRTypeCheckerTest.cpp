@@ -539,3 +539,49 @@ TEST_F(IRTypeCheckerTest, polymorphicConstants3) {
       "v0' for register v0: expected type INT, but found REFERENCE instead",
       regular_checker.what());
 }
+
+TEST_F(IRTypeCheckerTest, runIfChanged) {
+  using namespace dex_asm;
+  std::vector<IRInstruction*> insns = {
+      dasm(OPCODE_ADD_INT, {2_v, 5_v, 5_v}),
+      dasm(OPCODE_RETURN, {9_v}),
+  };
+  add_code(insns);
+  auto run_if_changed = [&](bool* good) {
+    IRTypeChecker checker(m_method);
+    auto checked = checker.run_if_changed();
+    *good = checker.good();
+    return checked;
+  };
+  bool good;
+  EXPECT_TRUE(run_if_changed(&good));
+  EXPECT_TRUE(good);
+  EXPECT_FALSE(run_if_changed(&good));
+  EXPECT_TRUE(good);
+
+  // Edits made directly on an instruction are not tracked by IRCode.
+  auto generation = m_method->get_code()->generation();
+  insns[0]->set_src(1, 14);
+  EXPECT_EQ(generation, m_method->get_code()->generation());
+  EXPECT_TRUE(run_if_changed(&good));
+  EXPECT_FALSE(good);
+  // Failures are not remembered.
+  EXPECT_TRUE(run_if_changed(&good));
+  EXPECT_FALSE(good);
+  // Back to the code that passed.
+  insns[0]->set_src(1, 5);
+  EXPECT_FALSE(run_if_changed(&good));
+  EXPECT_TRUE(good);
+
+  m_method->get_code()->insert_after(insns[0],
+                                     {dasm(OPCODE_ADD_INT, {3_v, 2_v, 5_v})});
+  EXPECT_NE(generation, m_method->get_code()->generation());
+  EXPECT_TRUE(run_if_changed(&good));
+  EXPECT_TRUE(good);
+  EXPECT_FALSE(run_if_changed(&good));
+
+  // A stricter check than the one that passed must run again.
+  IRTypeChecker checker(m_method);
+  checker.verify_moves();
+  EXPECT_TRUE(checker.run_if_changed());
+}
@@ -0,0 +1,151 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "ConfigFiles.h"
+#include "Creators.h"
+#include "DexClass.h"
+#include "DexStore.h"
+#include "IRAssembler.h"
+#include "IRCode.h"
+#include "InterDex.h"
+#include "PassManager.h"
+#include "PassRegistry.h"
+#include "RedexContext.h"
+
+namespace {
+
+constexpr size_t k_num_clusters = 6;
+constexpr size_t k_cluster_size = 8;
+constexpr size_t k_callees_per_cluster = 10;
+// What InterDex estimates for a class with a single direct method: the
+// default vtable plus the method.
+constexpr int64_t k_class_linear_alloc = 48 + 52;
+// Room for exactly one cluster per dex.
+constexpr int64_t k_linear_alloc_limit = k_cluster_size * k_class_linear_alloc;
+
+/*
+ * Classes whose only method calls the callees of its cluster. Consecutive
+ * classes belong to different clusters, so scope order spreads each cluster
+ * over every dex.
+ */
+DexClasses make_classes() {
+  DexClasses classes;
+  for (size_t i = 0; i < k_num_clusters * k_cluster_size; ++i) {
+    auto name = "LKerf" + std::to_string(i) + ";";
+    auto type = DexType::make_type(name.c_str());
+    ClassCreator creator(type);
+    creator.set_super(get_object_type());
+    std::ostringstream body;
+    body << "(\n";
+    for (size_t j = 0; j < k_callees_per_cluster; ++j) {
+      body << "(invoke-static () \"LCallee" << i % k_num_clusters << ";.m"
+           << j << ":()V\")\n";
+    }
+    body << "(return-void))";
+    auto method =
+        static_cast<DexMethod*>(DexMethod::make_method(name + ".run:()V"));
+    method->make_concrete(
+        ACC_PUBLIC | ACC_STATIC, assembler::ircode_from_string(body.str()),
+        false);
+    creator.add_method(method);
+    classes.push_back(creator.create());
+  }
+  return classes;
+}
+
+struct Result {
+  std::vector<std::vector<std::string>> dexes;
+  // The method refs of each dex, summed over the dexes; a ref used by
+  // classes in several dexes counts once per dex.
+  size_t method_refs{0};
+};
+
+Result run_interdex(bool partition_kerf) {
+  g_redex = new RedexContext();
+  DexStoresVector stores;
+  DexMetadata dm;
+  dm.set_id("classes");
+  DexStore store(dm);
+  store.add_classes(make_classes());
+  stores.emplace_back(std::move(store));
+
+  Pass* pass = nullptr;
+  for (auto p : PassRegistry::get().get_passes()) {
+    if (p->name() == INTERDEX_PASS_NAME) {
+      pass = p;
+    }
+  }
+  EXPECT_NE(pass, nullptr);
+  Json::Value config(Json::objectValue);
+  config["redex"]["passes"].append(INTERDEX_PASS_NAME);
+  auto& pass_config = config[INTERDEX_PASS_NAME];
+  pass_config["emit_canaries"] = false;
+  pass_config["normal_primary_dex"] = true;
+  pass_config["linear_alloc_limit"] = Json::Int64(k_linear_alloc_limit);
+  pass_config["partition_kerf"] = partition_kerf;
+  PassManager manager({pass}, config);
+  manager.set_testing_mode();
+  ConfigFiles cfg(config);
+  manager.run_passes(stores, Scope(), cfg);
+
+  const auto& dexen = stores[0].get_dexen();
+  Result result;
+  for (const auto& dex : dexen) {
+    std::vector<std::string> names;
+    std::vector<DexMethodRef*> refs;
+    for (auto cls : dex) {
+      names.push_back(cls->get_name()->str());
+      cls->gather_methods(refs);
+    }
+    result.dexes.push_back(names);
+    result.method_refs +=
+        std::unordered_set<DexMethodRef*>(refs.begin(), refs.end()).size();
+  }
+  delete g_redex;
+  return result;
+}
+
+void expect_valid(const Result& result) {
+  std::vector<std::string> emitted;
+  for (const auto& dex : result.dexes) {
+    EXPECT_FALSE(dex.empty());
+    EXPECT_LE(dex.size() * k_class_linear_alloc, k_linear_alloc_limit);
+    emitted.insert(emitted.end(), dex.begin(), dex.end());
+  }
+  std::vector<std::string> expected;
+  for (size_t i = 0; i < k_num_clusters * k_cluster_size; ++i) {
+    expected.push_back("LKerf" + std::to_string(i) + ";");
+  }
+  std::sort(emitted.begin(), emitted.end());
+  std::sort(expected.begin(), expected.end());
+  // Every class, exactly once.
+  EXPECT_EQ(emitted, expected);
+}
+
+} // namespace
+
+TEST(InterDexTest, partitionedKerfSharesRefs) {
+  auto baseline = run_interdex(false);
+  auto partitioned = run_interdex(true);
+  expect_valid(baseline);
+  expect_valid(partitioned);
+  EXPECT_EQ(partitioned.dexes.size(), k_num_clusters);
+  EXPECT_LE(partitioned.method_refs, baseline.method_refs);
+  // Each dex holds one cluster: its own methods and the cluster's callees.
+  EXPECT_EQ(partitioned.method_refs,
+            k_num_clusters * (k_cluster_size + k_callees_per_cluster));
+}
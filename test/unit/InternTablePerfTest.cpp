@@ -0,0 +1,67 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "DexClass.h"
+#include "RedexContext.h"
+
+//==========
+// Test for performance
+//==========
+
+// Every thread interns the same names, as happens when several dexes
+// reference the same classes and methods.
+void redexContextScaling() {
+  const size_t kNames = 50000;
+  std::vector<std::string> names;
+  for (size_t i = 0; i < kNames; ++i) {
+    names.push_back("Lcom/example/pkg" + std::to_string(i % 97) + "/Cls" +
+                    std::to_string(i) + ";");
+  }
+  auto max_threads = std::max(8u, std::thread::hardware_concurrency());
+  for (size_t num_threads = 1; num_threads <= max_threads; num_threads *= 2) {
+    g_redex = new RedexContext();
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < num_threads; ++t) {
+      threads.emplace_back([&, t] {
+        auto ret = DexType::make_type("V");
+        auto args = DexTypeList::make_type_list({});
+        auto proto = DexProto::make_proto(ret, args);
+        auto method_name = DexString::make_string("run");
+        for (size_t i = 0; i < kNames; ++i) {
+          auto& name = names[(i + t * 7919) % kNames];
+          auto type = DexType::make_type(name.c_str());
+          DexMethod::make_method(type, method_name, proto);
+        }
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    auto elapsed = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+    printf("%2zu threads: %8.1f ms, %6.2f M interned entries/s\n",
+           num_threads,
+           elapsed * 1000,
+           num_threads * kNames * 3 / elapsed / 1e6);
+    delete g_redex;
+  }
+}
+
+int main() {
+  redexContextScaling();
+}
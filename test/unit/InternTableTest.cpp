@@ -0,0 +1,150 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <vector>
+
+#include "InternTable.h"
+
+TEST(InternTableTest, insertGetErase) {
+  InternTable<int, int*> table;
+  std::vector<int> values(10000);
+  for (int i = 0; i < values.size(); ++i) {
+    EXPECT_TRUE(table.insert(i, &values[i]));
+  }
+  EXPECT_FALSE(table.insert(42, &values[0]));
+  EXPECT_EQ(table.size(), values.size());
+  for (int i = 0; i < values.size(); ++i) {
+    EXPECT_EQ(table.get(i), &values[i]);
+  }
+  EXPECT_EQ(table.get(-1), nullptr);
+
+  for (int i = 0; i < values.size(); i += 2) {
+    EXPECT_TRUE(table.erase(i));
+  }
+  EXPECT_FALSE(table.erase(0));
+  EXPECT_EQ(table.size(), values.size() / 2);
+  for (int i = 0; i < values.size(); ++i) {
+    EXPECT_EQ(table.get(i), i % 2 ? &values[i] : nullptr);
+  }
+
+  size_t visited = 0;
+  table.for_each([&](int key, int* value) {
+    EXPECT_EQ(value, &values[key]);
+    ++visited;
+  });
+  EXPECT_EQ(visited, values.size() / 2);
+}
+
+TEST(InternTableTest, concurrentGetOrCreate) {
+  InternTable<int, int*> table;
+  const int kKeys = 20000;
+  const size_t kThreads = 8;
+  std::vector<std::vector<int*>> seen(kThreads);
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < kThreads; ++t) {
+    threads.emplace_back([&, t] {
+      for (int i = 0; i < kKeys; ++i) {
+        // Walk the keys in different orders to provoke races.
+        int key = t % 2 ? i : kKeys - 1 - i;
+        seen[t].push_back(table.get_or_create(
+            key, [&] { return std::make_pair(key, new int(key)); }));
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(table.size(), kKeys);
+  for (int i = 0; i < kKeys; ++i) {
+    auto value = table.get(i);
+    ASSERT_NE(value, nullptr);
+    EXPECT_EQ(*value, i);
+    for (size_t t = 0; t < kThreads; ++t) {
+      EXPECT_EQ(seen[t][t % 2 ? i : kKeys - 1 - i], value);
+    }
+  }
+  table.for_each([](int, int* value) { delete value; });
+}
+
+TEST(InternTableTest, rekey) {
+  InternTable<int, int*> table;
+  int a = 0;
+  int b = 1;
+  EXPECT_TRUE(table.insert(0, &a));
+  EXPECT_TRUE(table.insert(1, &b));
+  EXPECT_FALSE(table.rekey(0, 1, &a));
+  EXPECT_EQ(table.get(0), &a);
+  EXPECT_EQ(table.get(1), &b);
+  EXPECT_TRUE(table.rekey(0, 0, &a));
+  EXPECT_TRUE(table.rekey(0, 2, &a));
+  EXPECT_EQ(table.get(0), nullptr);
+  EXPECT_EQ(table.get(2), &a);
+  EXPECT_EQ(table.size(), 2);
+}
+
+TEST(InternTableTest, rekeyOrDrop) {
+  InternTable<int, int*> table;
+  int a = 0;
+  int b = 1;
+  EXPECT_TRUE(table.insert(0, &a));
+  EXPECT_TRUE(table.insert(1, &b));
+  // The entry already under the new key wins.
+  EXPECT_FALSE(table.rekey_or_drop(0, 1, &a));
+  EXPECT_EQ(table.get(0), nullptr);
+  EXPECT_EQ(table.get(1), &b);
+  EXPECT_EQ(table.size(), 1);
+  EXPECT_TRUE(table.rekey_or_drop(1, 1, &b));
+  EXPECT_TRUE(table.rekey_or_drop(1, 2, &b));
+  EXPECT_EQ(table.get(1), nullptr);
+  EXPECT_EQ(table.get(2), &b);
+}
+
+// A writer racing with a rekey must see the entry under exactly one key.
+TEST(InternTableTest, concurrentRekeyAndGetOrCreate) {
+  InternTable<int, int*> table;
+  const int kKeys = 20000;
+  std::vector<int> values(kKeys);
+  for (int i = 0; i < kKeys; ++i) {
+    table.insert(i, &values[i]);
+  }
+  std::vector<char> moved(kKeys);
+  std::vector<int*> created(kKeys);
+  std::thread mover([&] {
+    for (int i = 0; i < kKeys; ++i) {
+      moved[i] = table.rekey(i, i + kKeys, &values[i]);
+    }
+  });
+  std::thread creator([&] {
+    for (int i = 0; i < kKeys; ++i) {
+      created[i] = table.get_or_create(
+          i + kKeys, [&] { return std::make_pair(i + kKeys, new int(i)); });
+    }
+  });
+  mover.join();
+  creator.join();
+
+  size_t num_moved = 0;
+  for (int i = 0; i < kKeys; ++i) {
+    auto value = table.get(i + kKeys);
+    EXPECT_EQ(value, created[i]);
+    if (moved[i]) {
+      ++num_moved;
+      EXPECT_EQ(value, &values[i]);
+      EXPECT_EQ(table.get(i), nullptr);
+    } else {
+      EXPECT_NE(value, &values[i]);
+      EXPECT_EQ(table.get(i), &values[i]);
+      delete value;
+    }
+  }
+  EXPECT_EQ(table.size(), 2 * kKeys - num_moved);
+}
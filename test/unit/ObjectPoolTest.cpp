@@ -0,0 +1,219 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <gtest/gtest.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include "DexAsm.h"
+#include "IRCode.h"
+#include "IRInstruction.h"
+#include "ObjectPool.h"
+#include "RedexContext.h"
+
+namespace {
+
+struct Item {
+  REDEX_POOL_ALLOCATED(Item)
+
+  explicit Item(uint64_t v) : value(v) {}
+  uint64_t value;
+  char padding[40];
+};
+
+} // namespace
+
+TEST(ObjectPoolTest, reusesFreedBlocks) {
+  std::vector<Item*> items;
+  for (uint64_t i = 0; i < 1000; ++i) {
+    items.push_back(new Item(i));
+  }
+  std::unordered_set<Item*> addresses(items.begin(), items.end());
+  EXPECT_EQ(addresses.size(), items.size());
+  for (uint64_t i = 0; i < items.size(); ++i) {
+    EXPECT_EQ(items[i]->value, i);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(items[i]) % alignof(Item), 0);
+  }
+  auto peak = Item::pool_stats().carved_blocks;
+  EXPECT_GE(peak, items.size());
+
+  for (auto item : items) {
+    delete item;
+  }
+  for (uint64_t i = 0; i < 1000; ++i) {
+    auto item = new Item(i);
+    EXPECT_EQ(addresses.count(item), 1);
+    items[i] = item;
+  }
+  // Nothing new was carved out of the slabs.
+  EXPECT_EQ(Item::pool_stats().carved_blocks, peak);
+  EXPECT_GT(Item::pool_stats().malloc_overhead_saved(), 0);
+  for (auto item : items) {
+    delete item;
+  }
+}
+
+TEST(ObjectPoolTest, freeOnOtherThread) {
+  std::vector<Item*> items;
+  std::thread allocator([&items] {
+    for (uint64_t i = 0; i < 10000; ++i) {
+      items.push_back(new Item(i));
+    }
+  });
+  allocator.join();
+
+  std::thread deleter([&items] {
+    for (auto item : items) {
+      delete item;
+    }
+  });
+  deleter.join();
+
+  // The blocks freed away from their slab went to the overflow list, which
+  // the next thread that runs out adopts.
+  auto peak = Item::pool_stats().carved_blocks;
+  std::thread reuser([&items] {
+    for (size_t i = 0; i < items.size(); ++i) {
+      items[i] = new Item(i);
+    }
+    for (auto item : items) {
+      delete item;
+    }
+  });
+  reuser.join();
+  EXPECT_EQ(Item::pool_stats().carved_blocks, peak);
+}
+
+// Blocks freed by a thread that stays alive but never allocates again must
+// still be reused by the thread that allocated them.
+TEST(ObjectPoolTest, freeOnLiveThread) {
+  std::vector<Item*> items;
+  for (uint64_t i = 0; i < 10000; ++i) {
+    items.push_back(new Item(i));
+  }
+  EXPECT_GE(Item::pool_stats().live_objects, items.size());
+
+  std::mutex mtx;
+  std::condition_variable cv;
+  bool freed = false;
+  bool done = false;
+  std::thread deleter([&] {
+    for (auto item : items) {
+      delete item;
+    }
+    std::unique_lock<std::mutex> lock(mtx);
+    freed = true;
+    cv.notify_all();
+    cv.wait(lock, [&] { return done; });
+  });
+  {
+    std::unique_lock<std::mutex> lock(mtx);
+    cv.wait(lock, [&] { return freed; });
+  }
+
+  auto peak = Item::pool_stats().carved_blocks;
+  for (uint64_t i = 0; i < items.size(); ++i) {
+    items[i] = new Item(i);
+  }
+  EXPECT_EQ(Item::pool_stats().carved_blocks, peak);
+  for (auto item : items) {
+    delete item;
+  }
+  {
+    std::lock_guard<std::mutex> guard(mtx);
+    done = true;
+    cv.notify_all();
+  }
+  deleter.join();
+}
+
+namespace {
+
+// A size no other test uses, so that it gets a pool of its own.
+struct ClearedItem {
+  REDEX_POOL_ALLOCATED(ClearedItem)
+
+  explicit ClearedItem(uint64_t v) : value(v) {}
+  uint64_t value;
+  char padding[88];
+};
+
+} // namespace
+
+TEST(ObjectPoolTest, clearReleasesSlabs) {
+  std::vector<ClearedItem*> items;
+  for (uint64_t i = 0; i < 10000; ++i) {
+    items.push_back(new ClearedItem(i));
+  }
+  auto stats = ClearedItem::pool_stats();
+  EXPECT_EQ(stats.live_objects, items.size());
+  EXPECT_GT(stats.slab_bytes, 0);
+
+  // Not while anything is alive.
+  EXPECT_FALSE(ClearedItem::pool_clear());
+  std::thread deleter([&items] {
+    for (auto item : items) {
+      delete item;
+    }
+  });
+  deleter.join();
+  EXPECT_EQ(ClearedItem::pool_stats().live_objects, 0);
+
+  EXPECT_TRUE(ClearedItem::pool_clear());
+  stats = ClearedItem::pool_stats();
+  EXPECT_EQ(stats.slab_bytes, 0);
+  EXPECT_EQ(stats.carved_blocks, 0);
+
+  // The pool starts over from new slabs.
+  for (uint64_t i = 0; i < items.size(); ++i) {
+    items[i] = new ClearedItem(i);
+  }
+  for (uint64_t i = 0; i < items.size(); ++i) {
+    EXPECT_EQ(items[i]->value, i);
+  }
+  EXPECT_EQ(ClearedItem::pool_stats().live_objects, items.size());
+  for (auto item : items) {
+    delete item;
+  }
+}
+
+TEST(ObjectPoolTest, inlineSources) {
+  g_redex = new RedexContext();
+
+  using namespace dex_asm;
+  auto insn = dasm(OPCODE_ADD_INT, {0_v, 1_v, 2_v});
+  EXPECT_EQ(insn->srcs_size(), 2);
+  EXPECT_EQ(insn->src(0), 1);
+  EXPECT_EQ(insn->src(1), 2);
+
+  auto invoke = new IRInstruction(OPCODE_INVOKE_STATIC);
+  invoke->set_arg_word_count(7);
+  for (size_t i = 0; i < 7; ++i) {
+    invoke->set_src(i, i + 10);
+  }
+  EXPECT_EQ(invoke->srcs_size(), 7);
+  EXPECT_EQ(invoke->src(6), 16);
+  invoke->set_arg_word_count(2);
+  EXPECT_EQ(invoke->srcs_size(), 2);
+  EXPECT_EQ(invoke->src(1), 11);
+
+  auto mie = new MethodItemEntry(insn);
+  EXPECT_EQ(mie->insn, insn);
+  delete mie;
+  delete insn;
+  delete invoke;
+  EXPECT_GT(MethodItemEntry::pool_stats().carved_blocks, 0);
+  EXPECT_GT(IRInstruction::pool_stats().carved_blocks, 0);
+
+  delete g_redex;
+}
@@ -0,0 +1,118 @@
+/**
+ * Copyright (c) 2017-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <gtest/gtest.h>
+
+#include <mutex>
+#include <vector>
+
+#include "Creators.h"
+#include "DexClass.h"
+#include "IRCode.h"
+#include "ParallelWalkers.h"
+#include "RedexContext.h"
+
+namespace {
+
+DexMethod* make_method(DexType* cls, size_t n, size_t size) {
+  auto method = static_cast<DexMethod*>(DexMethod::make_method(
+      cls,
+      DexString::make_string("m" + std::to_string(n)),
+      DexProto::make_proto(DexType::make_type("V"),
+                           DexTypeList::make_type_list({}))));
+  method->make_concrete(ACC_PUBLIC | ACC_STATIC, false);
+  auto code = std::make_unique<IRCode>(method, 1);
+  for (size_t i = 0; i < size; ++i) {
+    code->push_back((new IRInstruction(OPCODE_CONST))->set_dest(0));
+  }
+  code->push_back(new IRInstruction(OPCODE_RETURN_VOID));
+  method->set_code(std::move(code));
+  return method;
+}
+
+Scope make_scope() {
+  Scope scope;
+  size_t n = 0;
+  for (size_t c = 0; c < 4; ++c) {
+    auto type = DexType::make_type(("LWalk" + std::to_string(c) + ";").c_str());
+    ClassCreator creator(type);
+    creator.set_super(get_object_type());
+    for (size_t i = 0; i < 5; ++i, ++n) {
+      // Sizes that interleave across classes.
+      creator.add_method(make_method(type, n, (n * 7) % 20));
+    }
+    scope.push_back(creator.create());
+  }
+  return scope;
+}
+
+} // namespace
+
+TEST(ParallelWalkersTest, largestMethodFirstVisitsEachMethodOnce) {
+  g_redex = new RedexContext();
+  auto scope = make_scope();
+  parallel_walkers::take_stats();
+
+  // A single worker runs the tasks in exactly the order they were scheduled.
+  std::vector<DexMethod*> visited;
+  auto count = walk_methods_parallel<std::nullptr_t, size_t>(
+      scope,
+      [&](std::nullptr_t, DexMethod* m) -> size_t {
+        visited.push_back(m);
+        return 1;
+      },
+      [](size_t a, size_t b) { return a + b; },
+      [](int) { return nullptr; },
+      0,
+      1,
+      WalkOrder::LargestMethodFirst);
+  EXPECT_EQ(count, 20);
+  ASSERT_EQ(visited.size(), 20);
+  for (size_t i = 1; i < visited.size(); ++i) {
+    EXPECT_GE(visited[i - 1]->get_code()->count_opcodes(),
+              visited[i]->get_code()->count_opcodes());
+  }
+  std::sort(visited.begin(), visited.end());
+  EXPECT_EQ(std::unique(visited.begin(), visited.end()), visited.end());
+
+  auto stats = parallel_walkers::take_stats();
+  EXPECT_EQ(stats.tasks, 20);
+  EXPECT_EQ(stats.slowest.size(), parallel_walkers::kSlowestKept);
+  for (size_t i = 1; i < stats.slowest.size(); ++i) {
+    EXPECT_GE(stats.slowest[i - 1].seconds, stats.slowest[i].seconds);
+  }
+  EXPECT_EQ(parallel_walkers::take_stats().tasks, 0);
+
+  delete g_redex;
+}
+
+TEST(ParallelWalkersTest, largestMethodFirstMultipleThreads) {
+  g_redex = new RedexContext();
+  auto scope = make_scope();
+  parallel_walkers::take_stats();
+
+  std::mutex lock;
+  std::vector<DexMethod*> visited;
+  walk_methods_parallel_simple(scope,
+                               [&](DexMethod* m) {
+                                 std::lock_guard<std::mutex> guard(lock);
+                                 visited.push_back(m);
+                               },
+                               WalkOrder::LargestMethodFirst);
+  std::sort(visited.begin(), visited.end());
+  EXPECT_EQ(visited.size(), 20);
+  EXPECT_EQ(std::unique(visited.begin(), visited.end()), visited.end());
+  EXPECT_EQ(parallel_walkers::take_stats().tasks, 20);
+
+  // The default mode does not time its tasks.
+  walk_methods_parallel_simple(scope, [](DexMethod*) {});
+  EXPECT_EQ(parallel_walkers::take_stats().tasks, 0);
+
+  delete g_redex;
+}
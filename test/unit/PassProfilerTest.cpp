@@ -0,0 +1,62 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <gtest/gtest.h>
+
+#include "Creators.h"
+#include "DexAsm.h"
+#include "IRCode.h"
+#include "PassProfiler.h"
+#include "RedexContext.h"
+
+TEST(PassProfilerTest, recordsIrSizeAndEmitsJson) {
+  g_redex = new RedexContext();
+  using namespace dex_asm;
+
+  auto method = static_cast<DexMethod*>(
+      DexMethod::make_method("LFoo;", "bar", "V", {}));
+  method->make_concrete(ACC_PUBLIC | ACC_STATIC, false);
+  method->set_code(std::make_unique<IRCode>(method, 1));
+  method->get_code()->push_back(dasm(OPCODE_RETURN_VOID));
+  ClassCreator creator(DexType::make_type("LFoo;"));
+  creator.set_super(DexType::make_type("Ljava/lang/Object;"));
+  creator.add_method(method);
+  Scope scope{creator.create()};
+
+  PassProfiler profiler;
+  profiler.begin("AddConstPass#1", scope);
+  auto code = method->get_code();
+  code->insert_before(code->begin(), dasm(OPCODE_CONST_4, {0_v, 1_L}));
+  profiler.end(scope);
+
+  ASSERT_EQ(profiler.get_profiles().size(), 1);
+  const auto& profile = profiler.get_profiles()[0];
+  EXPECT_EQ(profile.name, "AddConstPass#1");
+  EXPECT_EQ(profile.methods_before, 1);
+  EXPECT_EQ(profile.methods_after, 1);
+  EXPECT_EQ(profile.instructions_before, 1);
+  EXPECT_EQ(profile.instructions_after, 2);
+  EXPECT_GE(profile.wall, 0);
+  EXPECT_GT(profile.peak_rss_kb, 0);
+
+  auto json = profiler.to_json();
+  ASSERT_EQ(json["passes"].size(), 1);
+  EXPECT_EQ(json["passes"][0]["name"].asString(), "AddConstPass#1");
+  EXPECT_EQ(json["passes"][0]["instructions_after"].asUInt64(), 2);
+  EXPECT_TRUE(json["passes"][0].isMember("user_cpu_s"));
+  EXPECT_TRUE(json["passes"][0].isMember("allocations"));
+
+  auto trace = profiler.to_chrome_trace();
+  ASSERT_EQ(trace["traceEvents"].size(), 2);
+  EXPECT_EQ(trace["traceEvents"][0]["ph"].asString(), "X");
+  EXPECT_EQ(trace["traceEvents"][0]["name"].asString(), "AddConstPass#1");
+  EXPECT_EQ(trace["traceEvents"][1]["ph"].asString(), "C");
+
+  delete g_redex;
+}
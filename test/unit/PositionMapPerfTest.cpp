@@ -0,0 +1,132 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/regex.hpp>
+
+#include "DexClass.h"
+#include "DexPosition.h"
+#include "PositionMap.h"
+#include "RedexContext.h"
+
+namespace fs = boost::filesystem;
+
+//==========
+// Test for performance
+//==========
+
+/*
+ * Writes a v2 map in which each of the given number of methods has been
+ * inlined into a caller, and returns the map lines of the inlined positions.
+ */
+std::vector<uint32_t> write_v2_map(const std::string& filename,
+                                   size_t num_methods) {
+  g_redex = new RedexContext();
+  std::vector<std::unique_ptr<DexPosition>> positions;
+  std::vector<uint32_t> lines;
+  RealPositionMapper mapper("", filename);
+  auto file = DexString::make_string("Foo.java");
+  for (size_t i = 0; i < num_methods; ++i) {
+    auto make_position = [&](const std::string& name, uint32_t line) {
+      auto method = static_cast<DexMethod*>(
+          DexMethod::make_method("LFoo;", name.c_str(), "V", {}));
+      method->set_deobfuscated_name("LFoo;." + name + ":()V");
+      positions.emplace_back(new DexPosition(line));
+      positions.back()->bind(method, file);
+      mapper.register_position(positions.back().get());
+      return positions.back().get();
+    };
+    auto caller = make_position("caller" + std::to_string(i), 10 + i);
+    auto callee = make_position("callee" + std::to_string(i), 20 + i);
+    callee->parent = caller;
+    lines.push_back(mapper.position_to_line(callee));
+  }
+  mapper.write_map();
+  delete g_redex;
+  return lines;
+}
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+/*
+ * Compares loading a map and symbolicating frames the way symbolicate-trace
+ * used to (parsing the v2 map, matching each line with a regex) against the
+ * indexed map and frame parser.
+ */
+void symbolicate(const fs::path& dir) {
+  auto v2 = (dir / "map_v2").string();
+  auto v3 = (dir / "map_v3").string();
+  auto lines = write_v2_map(v2, 200000);
+  write_indexed_map(*read_map(v2.c_str()), v3.c_str());
+
+  std::vector<std::string> frames;
+  for (size_t i = 0; i < 500000; ++i) {
+    frames.push_back("\tat com.foo.Bar.baz(:" +
+                     std::to_string(lines[(i * 7919) % lines.size()]) + ")");
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  auto unindexed = read_map(v2.c_str());
+  auto load_v2 = seconds_since(start);
+  start = std::chrono::steady_clock::now();
+  std::ostringstream regex_out;
+  boost::regex trace_regex(R"/((\s+at\s+[^(]*)\(:(\d+)\)\s?)/");
+  for (const auto& frame : frames) {
+    boost::smatch matches;
+    if (boost::regex_match(frame, matches, trace_regex)) {
+      for (const auto& pos :
+           get_stack(*unindexed, std::stoi(matches[2]) - 1)) {
+        regex_out << matches[1] << "(" << pos.filename << ":" << pos.line
+                  << ")\n";
+      }
+    }
+  }
+  auto symbolicate_regex = seconds_since(start);
+
+  start = std::chrono::steady_clock::now();
+  auto indexed = IndexedPositionMap::open(v3.c_str());
+  auto load_v3 = seconds_since(start);
+  start = std::chrono::steady_clock::now();
+  std::ostringstream indexed_out;
+  for (const auto& frame : frames) {
+    boost::string_ref prefix;
+    uint32_t line;
+    if (parse_frame(frame, &prefix, &line)) {
+      write_stack(indexed_out, prefix, *indexed, line);
+    }
+  }
+  auto symbolicate_indexed = seconds_since(start);
+  assert(regex_out.str() == indexed_out.str());
+
+  printf("load v2 map:       %8.3f ms\n", load_v2 * 1000);
+  printf("load v3 map:       %8.3f ms\n", load_v3 * 1000);
+  printf("regex frames/s:    %8.0f\n", frames.size() / symbolicate_regex);
+  printf("indexed frames/s:  %8.0f (%.2fx)\n",
+         frames.size() / symbolicate_indexed,
+         symbolicate_regex / symbolicate_indexed);
+}
+
+int main() {
+  printf("Begin!\n");
+  auto dir = fs::temp_directory_path() / fs::unique_path();
+  fs::create_directories(dir);
+  symbolicate(dir);
+  fs::remove_all(dir);
+}
@@ -0,0 +1,142 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "DexClass.h"
+#include "DexPosition.h"
+#include "PositionMap.h"
+#include "RedexContext.h"
+
+namespace fs = boost::filesystem;
+
+namespace {
+
+struct TempDir {
+  fs::path path;
+  TempDir() : path(fs::temp_directory_path() / fs::unique_path()) {
+    fs::create_directories(path);
+  }
+  ~TempDir() { fs::remove_all(path); }
+};
+
+/*
+ * Writes a v2 map in which each of the given number of methods has been
+ * inlined into a caller, and returns the map lines of the inlined positions.
+ */
+std::vector<uint32_t> write_v2_map(const std::string& filename,
+                                   size_t num_methods) {
+  g_redex = new RedexContext();
+  std::vector<std::unique_ptr<DexPosition>> positions;
+  std::vector<uint32_t> lines;
+  RealPositionMapper mapper("", filename);
+  auto file = DexString::make_string("Foo.java");
+  for (size_t i = 0; i < num_methods; ++i) {
+    auto make_position = [&](const std::string& name, uint32_t line) {
+      auto method = static_cast<DexMethod*>(
+          DexMethod::make_method("LFoo;", name.c_str(), "V", {}));
+      method->set_deobfuscated_name("LFoo;." + name + ":()V");
+      positions.emplace_back(new DexPosition(line));
+      positions.back()->bind(method, file);
+      mapper.register_position(positions.back().get());
+      return positions.back().get();
+    };
+    auto caller = make_position("caller" + std::to_string(i), 10 + i);
+    auto callee = make_position("callee" + std::to_string(i), 20 + i);
+    callee->parent = caller;
+    lines.push_back(mapper.position_to_line(callee));
+  }
+  mapper.write_map();
+  delete g_redex;
+  return lines;
+}
+
+std::string symbolicate(const IndexedPositionMap& map,
+                        const std::string& frame) {
+  std::ostringstream os;
+  boost::string_ref prefix;
+  uint32_t line;
+  if (parse_frame(frame, &prefix, &line)) {
+    write_stack(os, prefix, map, line);
+  }
+  return os.str();
+}
+
+} // namespace
+
+TEST(PositionMapTest, parseFrame) {
+  boost::string_ref prefix;
+  uint32_t line;
+  EXPECT_TRUE(parse_frame("\tat com.foo.Bar.baz(:12)", &prefix, &line));
+  EXPECT_EQ(prefix, "\tat com.foo.Bar.baz");
+  EXPECT_EQ(line, 12);
+  EXPECT_TRUE(parse_frame("  at  Bar.baz(:3) ", &prefix, &line));
+  EXPECT_EQ(prefix, "  at  Bar.baz");
+  EXPECT_EQ(line, 3);
+
+  EXPECT_FALSE(parse_frame("at Bar.baz(:3)", &prefix, &line));
+  EXPECT_FALSE(parse_frame("\tat Bar.baz(Bar.java:3)", &prefix, &line));
+  EXPECT_FALSE(parse_frame("\tat Bar.baz(:)", &prefix, &line));
+  EXPECT_FALSE(parse_frame("\tat Bar.baz(:3)x", &prefix, &line));
+  EXPECT_FALSE(parse_frame("\tat Bar.baz(:3)  ", &prefix, &line));
+  EXPECT_FALSE(parse_frame("\tat Bar.baz(:99999999999)", &prefix, &line));
+  EXPECT_FALSE(parse_frame("\tatBar.baz(:3)", &prefix, &line));
+}
+
+TEST(PositionMapTest, indexedMatchesUnindexed) {
+  TempDir tmp;
+  auto v2 = (tmp.path / "map_v2").string();
+  auto v3 = (tmp.path / "map_v3").string();
+  auto lines = write_v2_map(v2, 10);
+  auto unindexed = read_map(v2.c_str());
+  ASSERT_NE(unindexed, nullptr);
+  ASSERT_TRUE(write_indexed_map(*unindexed, v3.c_str()));
+
+  auto from_v2 = IndexedPositionMap::open(v2.c_str());
+  auto from_v3 = IndexedPositionMap::open(v3.c_str());
+  ASSERT_NE(from_v2, nullptr);
+  ASSERT_NE(from_v3, nullptr);
+  ASSERT_EQ(from_v3->size(), unindexed->positions_size);
+  for (size_t i = 0; i < unindexed->positions_size; ++i) {
+    auto expected = unindexed->positions[i];
+    auto actual = from_v3->position(i);
+    EXPECT_EQ(from_v3->string(actual.class_id),
+              unindexed->string_pool[expected.class_id]);
+    EXPECT_EQ(from_v3->string(actual.method_id),
+              unindexed->string_pool[expected.method_id]);
+    EXPECT_EQ(from_v3->string(actual.file_id),
+              unindexed->string_pool[expected.file_id]);
+    EXPECT_EQ(actual.line, expected.line);
+    EXPECT_EQ(actual.parent, expected.parent);
+  }
+
+  auto frame = "\tat Foo.callee3(:" + std::to_string(lines[3]) + ")";
+  EXPECT_EQ(symbolicate(*from_v3, frame),
+            "\tat Foo.callee3(Foo.java:23)\n\tat Foo.callee3(Foo.java:13)\n");
+  EXPECT_EQ(symbolicate(*from_v2, frame), symbolicate(*from_v3, frame));
+  EXPECT_EQ(symbolicate(*from_v3, "\tat Foo.callee3(:0)"), "");
+  EXPECT_EQ(symbolicate(*from_v3, "\tat Foo.callee3(:100000)"), "");
+}
+
+TEST(PositionMapTest, rejectsTruncatedIndex) {
+  TempDir tmp;
+  auto v2 = (tmp.path / "map_v2").string();
+  auto v3 = (tmp.path / "map_v3").string();
+  write_v2_map(v2, 10);
+  ASSERT_TRUE(write_indexed_map(*read_map(v2.c_str()), v3.c_str()));
+  fs::resize_file(v3, 64);
+  EXPECT_EQ(IndexedPositionMap::open(v3.c_str()), nullptr);
+}
@@ -0,0 +1,40 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <cstdio>
+#include <string>
+
+#include "ProguardMatcherTestHelper.h"
+
+using namespace proguard_matcher_test;
+
+//==========
+// Test for performance
+//==========
+
+void keepRules() {
+  const size_t kClasses = 20000;
+  auto rules = std::string(kRules) + generated_rules(500);
+  double legacy_seconds;
+  double indexed_seconds;
+  auto expected = run(kClasses, rules, legacy(), &legacy_seconds);
+  auto actual = run(kClasses, rules, indexed(0), &indexed_seconds);
+  always_assert(expected.rstates == actual.rstates);
+  printf("matching %zu rules over %zu classes: per-rule regexes %fs, "
+         "indexed %fs\n",
+         expected.rule_counts.size(),
+         kClasses,
+         legacy_seconds,
+         indexed_seconds);
+}
+
+int main() {
+  printf("Begin!\n");
+  keepRules();
+}
@@ -0,0 +1,35 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <gtest/gtest.h>
+
+#include "ProguardMatcherTestHelper.h"
+
+using namespace proguard_matcher_test;
+
+TEST(ProguardMatcherTest, indexedMatchesLegacy) {
+  auto expected = run(500, kRules, legacy());
+  for (size_t i = 0; i < expected.rule_counts.size(); ++i) {
+    EXPECT_GT(expected.rule_counts[i], 0) << i;
+  }
+  for (unsigned num_threads : {1, 4}) {
+    auto actual = run(500, kRules, indexed(num_threads));
+    EXPECT_EQ(expected.rstates, actual.rstates);
+    EXPECT_EQ(expected.rule_counts, actual.rule_counts);
+  }
+}
+
+TEST(ProguardMatcherTest, generatedRulesMatchLegacy) {
+  auto rules = generated_rules(100);
+  auto expected = run(1000, rules, legacy());
+  auto actual = run(1000, rules, indexed(4));
+  EXPECT_EQ(expected.rstates, actual.rstates);
+  EXPECT_EQ(expected.rule_counts, actual.rule_counts);
+}
+
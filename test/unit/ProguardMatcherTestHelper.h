@@ -0,0 +1,204 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "Creators.h"
+#include "Debug.h"
+#include "DexAnnotation.h"
+#include "DexClass.h"
+#include "ProguardConfiguration.h"
+#include "ProguardMap.h"
+#include "ProguardMatcher.h"
+#include "ProguardParser.h"
+#include "RedexContext.h"
+#include "Show.h"
+
+/*
+ * Synthetic classes and keep rules shared by the matcher's correctness tests
+ * and its benchmark.
+ */
+namespace proguard_matcher_test {
+
+using namespace redex;
+
+inline void set_annotation(DexClass* cls, const char* type) {
+  auto annos = new DexAnnotationSet();
+  annos->add_annotation(
+      new DexAnnotation(DexType::make_type(type), DAV_RUNTIME));
+  cls->attach_annotation_set(annos);
+}
+
+/*
+ * Classes com.pN.sM.CK in a few packages, with supers, interfaces,
+ * annotations, fields and methods that the rules below pick from.
+ */
+inline Scope make_classes(size_t num_classes) {
+  Scope scope;
+  auto intf_type = DexType::make_type("Lcom/p0/I0;");
+  ClassCreator intf_creator(intf_type);
+  intf_creator.set_access(ACC_PUBLIC | ACC_INTERFACE | ACC_ABSTRACT);
+  intf_creator.set_super(get_object_type());
+  auto intf = intf_creator.create();
+  intf->set_deobfuscated_name("Lcom/p0/I0;");
+  scope.push_back(intf);
+  for (size_t i = 0; i < num_classes; ++i) {
+    auto name = "Lcom/p" + std::to_string(i % 10) + "/s" +
+                std::to_string(i / 10 % 7) + "/C" + std::to_string(i) +
+                (i % 13 == 0 ? "$Inner" : "") + ";";
+    auto type = DexType::make_type(name.c_str());
+    ClassCreator creator(type);
+    creator.set_access(i % 4 == 0 ? ACC_PUBLIC : DexAccessFlags(0));
+    creator.set_super(i > 10 && i % 3 == 0 ? scope[i / 3]->get_type()
+                                           : get_object_type());
+    if (i % 11 == 0) {
+      creator.add_interface(intf_type);
+    }
+    auto cls = creator.create();
+    cls->set_deobfuscated_name(name);
+    if (i % 5 == 0) {
+      set_annotation(cls, "Lcom/ann/Keep;");
+    } else if (i % 7 == 0) {
+      set_annotation(cls, "Lcom/ann/Other;");
+    }
+    auto field = static_cast<DexField*>(DexField::make_field(
+        type, DexString::make_string("field" + std::to_string(i % 3)),
+        get_int_type()));
+    field->make_concrete(ACC_PUBLIC);
+    field->set_deobfuscated_name(show(field));
+    cls->add_field(field);
+    for (auto method_name : {"f", "g"}) {
+      auto method = static_cast<DexMethod*>(DexMethod::make_method(
+          name + "." + method_name + std::to_string(i % 2) + ":()V"));
+      method->make_concrete(ACC_PUBLIC, false);
+      method->set_deobfuscated_name(show(method));
+      cls->add_method(method);
+    }
+    scope.push_back(cls);
+  }
+  return scope;
+}
+
+constexpr const char* kRules = R"(
+-keep class com.p1.** { *; }
+-keep @com.ann.Keep class *
+-keep @com.ann.Other class com.p2.** { int field*; }
+-keep class com.p2.s1.C1?
+-keep,allowobfuscation class * extends com.p5.s0.C5 { void f*(); }
+-keepclasseswithmembers class com.p3.*.* { int field1; }
+-keepclasseswithmembers class com.p3.** { int field1; }
+-keep public class **$Inner { <methods>; }
+-keep class * implements com.p0.I0
+-keep,allowshrinking class * extends com.p*.s2.** { void g0(); }
+-keep class com.**.C1*
+-keep class com.p4.s3.C34
+-keep,allowshrinking class *
+-keep class **.C2? { *; }
+-keep class *** { void g1(); }
+-keepnames class com.p6.s?.C*
+-whyareyoukeeping class com.p5.s2.**
+-assumenosideeffects class com.p7.** { void g*(); }
+)";
+
+inline std::string generated_rules(size_t num_rules) {
+  std::ostringstream rules;
+  for (size_t i = 0; i < num_rules; ++i) {
+    switch (i % 5) {
+    case 0:
+      rules << "-keep class com.p" << i % 10 << ".s" << i % 7 << ".C" << i
+            << "* { *; }\n";
+      break;
+    case 1:
+      rules << "-keep @com.ann.Keep class com.p" << i % 10 << ".** { void f"
+            << i % 2 << "(); }\n";
+      break;
+    case 2:
+      rules << "-keep class * extends com.p" << i % 10 << ".s" << i % 7
+            << ".C" << i << "\n";
+      break;
+    case 3:
+      rules << "-keepclasseswithmembers class **.C" << i << "? { int field"
+            << i % 3 << "; }\n";
+      break;
+    case 4:
+      rules << "-keep class com.p" << i % 10 << ".*.C" << i << "\n";
+      break;
+    }
+  }
+  return rules.str();
+}
+
+struct Result {
+  std::vector<std::string> rstates;
+  std::vector<unsigned> rule_counts;
+};
+
+/*
+ * Process the rules over a fresh set of classes, and snapshot the keep bits
+ * of every class and member.
+ */
+inline Result run(size_t num_classes,
+                  const std::string& rules,
+                  const ProguardMatcherOptions& options,
+                  double* seconds = nullptr) {
+  g_redex = new RedexContext();
+  auto scope = make_classes(num_classes);
+  ProguardConfiguration config;
+  std::istringstream rules_stream(rules);
+  proguard_parser::parse(rules_stream, &config);
+  always_assert(config.ok);
+  std::istringstream map_stream("");
+  ProguardMap pg_map(map_stream);
+
+  auto start = std::chrono::steady_clock::now();
+  process_proguard_rules(pg_map, scope, {}, &config, options);
+  if (seconds != nullptr) {
+    *seconds = std::chrono::duration<double>(
+                   std::chrono::steady_clock::now() - start)
+                   .count();
+  }
+
+  Result result;
+  for (auto cls : scope) {
+    result.rstates.push_back(show(cls) + " " + cls->rstate.str());
+    for (auto field : cls->get_ifields()) {
+      result.rstates.push_back(show(field) + " " + field->rstate.str());
+    }
+    for (auto method : cls->get_vmethods()) {
+      result.rstates.push_back(show(method) + " " + method->rstate.str());
+    }
+    for (auto method : cls->get_dmethods()) {
+      result.rstates.push_back(show(method) + " " + method->rstate.str());
+    }
+  }
+  for (const auto& rule : config.keep_rules) {
+    result.rule_counts.push_back(rule.count);
+  }
+  delete g_redex;
+  return result;
+}
+
+inline ProguardMatcherOptions legacy() {
+  ProguardMatcherOptions options;
+  options.indexed = false;
+  return options;
+}
+
+inline ProguardMatcherOptions indexed(unsigned num_threads) {
+  ProguardMatcherOptions options;
+  options.num_threads = num_threads;
+  return options;
+}
+
+} // namespace proguard_matcher_test
@@ -0,0 +1,164 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <gtest/gtest.h>
+
+#include "Creators.h"
+#include "DexClass.h"
+#include "IRAssembler.h"
+#include "IRCode.h"
+#include "ReachableObjects.h"
+#include "RedexContext.h"
+
+namespace {
+
+DexClass* make_class(const std::string& name,
+                     DexType* super,
+                     DexAccessFlags access = ACC_PUBLIC) {
+  ClassCreator creator(DexType::make_type(name.c_str()));
+  creator.set_access(access);
+  creator.set_super(super);
+  return creator.create();
+}
+
+DexMethod* add_method(DexClass* cls,
+                      const std::string& name,
+                      const std::string& code,
+                      bool is_virtual = true) {
+  auto method = static_cast<DexMethod*>(
+      DexMethod::make_method(show(cls) + "." + name + ":()V"));
+  method->make_concrete(ACC_PUBLIC | (is_virtual ? DexAccessFlags(0)
+                                                  : ACC_STATIC),
+                        assembler::ircode_from_string(code),
+                        is_virtual);
+  method->get_code()->set_registers_size(1);
+  cls->add_method(method);
+  return method;
+}
+
+DexStoresVector make_stores(const Scope& scope) {
+  DexStoresVector stores;
+  DexMetadata dm;
+  dm.set_id("classes");
+  DexStore store(dm);
+  store.add_classes(scope);
+  stores.emplace_back(std::move(store));
+  return stores;
+}
+
+ReachableObjects mark(DexStoresVector& stores, unsigned num_threads) {
+  int num_ignore_check_strings = 0;
+  return compute_reachable_objects(stores,
+                                   {},
+                                   {},
+                                   {},
+                                   &num_ignore_check_strings,
+                                   /* record_reachability */ false,
+                                   num_threads);
+}
+
+void expect_same_marks(const ReachableObjects& a, const ReachableObjects& b) {
+  EXPECT_EQ(a.marked_classes, b.marked_classes);
+  EXPECT_EQ(a.marked_fields, b.marked_fields);
+  EXPECT_EQ(a.marked_methods, b.marked_methods);
+}
+
+} // namespace
+
+TEST(ReachableObjectsTest, interfaceImplementationOnSuperclass) {
+  g_redex = new RedexContext();
+
+  auto intf = make_class("LI;", get_object_type(),
+                         ACC_PUBLIC | ACC_INTERFACE | ACC_ABSTRACT);
+  auto intf_run = static_cast<DexMethod*>(DexMethod::make_method("LI;.run:()V"));
+  intf_run->make_concrete(ACC_PUBLIC | ACC_ABSTRACT, true);
+  intf->add_method(intf_run);
+
+  auto base = make_class("LBase;", get_object_type());
+  auto base_run = add_method(base, "run", "((return-void))");
+  auto base_other = add_method(base, "other", "((return-void))");
+
+  // LImpl; implements LI; with the run() it inherits from LBase;.
+  ClassCreator impl_creator(DexType::make_type("LImpl;"));
+  impl_creator.set_super(base->get_type());
+  impl_creator.add_interface(intf->get_type());
+  auto impl = impl_creator.create();
+
+  auto user = make_class("LUser;", get_object_type());
+  user->rstate.set_keep();
+  auto use = add_method(user, "use", R"((
+    (new-instance "LImpl;")
+    (move-result-pseudo-object v0)
+    (invoke-interface (v0) "LI;.run:()V")
+    (return-void)
+  ))", false);
+  use->rstate.set_keep();
+
+  auto dead = make_class("LDead;", get_object_type());
+  auto dead_run = add_method(dead, "run", "((return-void))");
+  // Kept, but only if its class is.
+  dead_run->rstate.set_keep();
+
+  auto stores = make_stores({intf, base, impl, user, dead});
+  auto serial = mark(stores, 1);
+  EXPECT_TRUE(serial.marked_classes.count(impl));
+  EXPECT_TRUE(serial.marked_classes.count(base));
+  EXPECT_TRUE(serial.marked_methods.count(intf_run));
+  EXPECT_TRUE(serial.marked_methods.count(base_run));
+  EXPECT_FALSE(serial.marked_methods.count(base_other));
+  EXPECT_FALSE(serial.marked_classes.count(dead));
+  EXPECT_FALSE(serial.marked_methods.count(dead_run));
+
+  for (size_t i = 0; i < 10; ++i) {
+    expect_same_marks(serial, mark(stores, 4));
+  }
+
+  delete g_redex;
+}
+
+TEST(ReachableObjectsTest, parallelMatchesSerial) {
+  g_redex = new RedexContext();
+
+  // A web of classes that instantiate each other and call each other's
+  // virtual methods, from a few roots.
+  const size_t kClasses = 300;
+  Scope scope;
+  for (size_t i = 0; i < kClasses; ++i) {
+    auto super = i % 3 == 0 ? get_object_type()
+                            : scope[(i * 13) % i]->get_type();
+    scope.push_back(make_class("LC" + std::to_string(i) + ";", super));
+  }
+  for (size_t i = 0; i < kClasses; ++i) {
+    auto target = "LC" + std::to_string((i * 7 + 3) % kClasses) + ";";
+    auto callee = "LC" + std::to_string((i * 11 + 5) % kClasses) + ";";
+    add_method(scope[i], "f", R"((
+      (new-instance ")" + target + R"(")
+      (move-result-pseudo-object v0)
+      (invoke-virtual (v0) ")" + callee + R"(.f:()V")
+      (return-void)
+    ))");
+    add_method(scope[i], "g", "((return-void))");
+    if (i % 17 == 0) {
+      scope[i]->get_vmethods().front()->rstate.set_keep();
+    }
+    if (i % 50 == 0) {
+      scope[i]->rstate.set_keep();
+    }
+  }
+
+  auto stores = make_stores(scope);
+  auto serial = mark(stores, 1);
+  EXPECT_LT(serial.marked_classes.size(), kClasses);
+  EXPECT_GT(serial.marked_classes.size(), 0);
+  for (size_t i = 0; i < 10; ++i) {
+    expect_same_marks(serial, mark(stores, 4));
+  }
+
+  delete g_redex;
+}
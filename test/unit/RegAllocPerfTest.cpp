@@ -0,0 +1,83 @@
+/**
+ * Copyright (c) 2017-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <sstream>
+#include <vector>
+
+#include "GraphColoring.h"
+#include "IRAssembler.h"
+#include "IRCode.h"
+#include "RedexContext.h"
+
+using namespace regalloc;
+
+//==========
+// Test for performance
+//==========
+
+/*
+ * Allocates a method large enough, and with enough values live at once, to
+ * spill repeatedly, like the largest methods of an app.
+ */
+void largeMethod() {
+  const size_t kValues = 200;
+  const size_t kRounds = 8;
+  std::ostringstream ss;
+  ss << "((load-param v0)\n";
+  reg_t next = 1;
+  std::vector<reg_t> values;
+  for (size_t i = 0; i < kValues; ++i) {
+    ss << "(const v" << next << " " << i << ")\n";
+    values.push_back(next++);
+  }
+  for (size_t round = 0; round < kRounds; ++round) {
+    ss << "(if-eqz v0 :skip" << round << ")\n";
+    for (size_t i = 0; i < kValues; ++i) {
+      auto a = values[i];
+      auto b = values[(i * 7 + round) % kValues];
+      ss << "(add-int v" << next << " v" << a << " v" << b << ")\n";
+      values[i] = next++;
+    }
+    ss << ":skip" << round << "\n";
+    // Merge the values of both paths.
+    for (size_t i = 0; i < kValues; i += 3) {
+      ss << "(add-int v" << next << " v" << values[i] << " v"
+         << values[(i + 1) % kValues] << ")\n";
+      values[i] = next++;
+    }
+  }
+  ss << "(add-int v" << next << " v" << values[0] << " v" << values[1]
+     << ")\n(return v" << next << "))";
+  auto code = assembler::ircode_from_string(ss.str());
+  code->set_registers_size(next + 1);
+  code->build_cfg();
+
+  graph_coloring::Allocator allocator;
+  auto start = std::chrono::steady_clock::now();
+  allocator.allocate(/* use_splitting */ false, code.get());
+  auto seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+          .count();
+  const auto& stats = allocator.get_stats();
+  printf("allocated %zu instructions in %fs, %zu reiterations, %zu reusing "
+         "liveness\n",
+         code->count_opcodes(),
+         seconds,
+         static_cast<size_t>(stats.reiteration_count),
+         static_cast<size_t>(stats.liveness_reused));
+}
+
+int main() {
+  printf("Begin!\n");
+  g_redex = new RedexContext();
+  largeMethod();
+  delete g_redex;
+}
@@ -10,6 +10,7 @@
 #include <cmath>
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
+#include <sstream>
 
 #include "DexAsm.h"
 #include "DexUtil.h"
@@ -843,3 +844,94 @@ TEST_F(RegAllocTest, ParamFirstUse) {
   EXPECT_EQ(assembler::to_s_expr(code.get()),
             assembler::to_s_expr(expected_code.get()));
 }
+
+TEST_F(RegAllocTest, RegPairSet) {
+  using namespace interference::impl;
+  // Registers from 4 up go to the hash set.
+  RegPairSet unordered(/* ordered */ false, 4);
+  unordered.insert(1, 2);
+  unordered.insert(3, 3);
+  unordered.insert(5, 1);
+  EXPECT_TRUE(unordered.contains(2, 1));
+  EXPECT_TRUE(unordered.contains(3, 3));
+  EXPECT_TRUE(unordered.contains(1, 5));
+  EXPECT_FALSE(unordered.contains(1, 3));
+  EXPECT_FALSE(unordered.contains(5, 5));
+
+  RegPairSet ordered(/* ordered */ true, 4);
+  ordered.insert(2, 1);
+  ordered.insert(1, 7);
+  EXPECT_TRUE(ordered.contains(2, 1));
+  EXPECT_FALSE(ordered.contains(1, 2));
+  EXPECT_TRUE(ordered.contains(1, 7));
+  EXPECT_FALSE(ordered.contains(7, 1));
+
+  std::vector<std::pair<reg_t, reg_t>> pairs;
+  ordered.for_each([&](reg_t u, reg_t v) { pairs.emplace_back(u, v); });
+  EXPECT_THAT(pairs,
+              ::testing::UnorderedElementsAre(std::make_pair(reg_t(2), reg_t(1)),
+                                              std::make_pair(reg_t(1), reg_t(7))));
+}
+
+TEST_F(RegAllocTest, ReuseLivenessAfterSpill) {
+  auto code = assembler::ircode_from_string(R"(
+    (
+     (load-param v0)
+     (const/4 v1 1)
+     (const/4 v2 2)
+     (if-eqz v0 :else)
+     (add-int v3 v1 v2)
+     (goto :end)
+     :else
+     (mul-int v3 v1 v2)
+     :end
+     (add-int v4 v3 v1)
+     (return v4)
+    )
+)");
+  code->set_registers_size(5);
+  code->build_cfg();
+  code->cfg().calculate_exit_block();
+  LivenessFixpointIterator fixpoint_iter(code->cfg());
+  fixpoint_iter.run(LivenessDomain(code->get_registers_size()));
+  RangeSet range_set;
+  interference::Graph ig = interference::build_graph(
+      fixpoint_iter, code.get(), code->get_registers_size(), range_set);
+
+  graph_coloring::SpillPlan spill_plan;
+  spill_plan.global_spills =
+      std::unordered_map<reg_t, reg_t>{{1, 16}, {2, 16}, {3, 256}};
+  std::unordered_set<reg_t> new_temps;
+  graph_coloring::Allocator allocator;
+  allocator.spill(ig, spill_plan, range_set, code.get(), &new_temps);
+  auto liveness = fixpoint_iter.get_block_liveness(code->cfg());
+
+  code->build_cfg();
+  auto& cfg = code->cfg();
+  cfg.calculate_exit_block();
+  LivenessFixpointIterator reused(cfg);
+  ASSERT_TRUE(reused.reuse(liveness, cfg, code->get_registers_size()));
+  LivenessFixpointIterator recomputed(cfg);
+  recomputed.run(LivenessDomain(code->get_registers_size()));
+  for (Block* block : cfg.blocks()) {
+    EXPECT_TRUE(reused.get_live_in_vars_at(block).equals(
+        recomputed.get_live_in_vars_at(block)));
+    EXPECT_TRUE(reused.get_live_out_vars_at(block).equals(
+        recomputed.get_live_out_vars_at(block)));
+  }
+  auto reused_ig = interference::build_graph(
+      reused, code.get(), code->get_registers_size(), range_set);
+  auto recomputed_ig = interference::build_graph(
+      recomputed, code.get(), code->get_registers_size(), range_set);
+  for (const auto& pair : recomputed_ig.nodes()) {
+    EXPECT_THAT(reused_ig.get_node(pair.first).adjacent(),
+                ::testing::UnorderedElementsAreArray(pair.second.adjacent()));
+  }
+
+  // A CFG of a different shape can't reuse it.
+  auto other = assembler::ircode_from_string("((return-void))");
+  other->build_cfg();
+  other->cfg().calculate_exit_block();
+  LivenessFixpointIterator other_iter(other->cfg());
+  EXPECT_FALSE(other_iter.reuse(liveness, other->cfg(), 1));
+}
@@ -13,6 +13,7 @@
 #include "DexClass.h"
 #include "Creators.h"
 #include "DexUtil.h"
+#include "IRAssembler.h"
 #include "Walkers.h"
 #include "VirtualRenamer.h"
 #include "ScopeHelper.h"
@@ -625,3 +626,73 @@ TEST(Interface3IntfOverEscape, empty) {
 
   delete g_redex;
 }
+
+/**
+ * Classes A0..An with a method f and a field x, subclasses B0..Bn that
+ * inherit them, and callers that reach them through the subclasses, so that
+ * every call and field access uses a ref that isn't a def.
+ */
+std::vector<DexClass*> create_scope_refs(size_t n) {
+  std::vector<DexClass*> scope = create_empty_scope();
+  auto obj_t = get_object_type();
+  auto void_void = DexProto::make_proto(get_void_type(),
+      DexTypeList::make_type_list({}));
+  std::ostringstream body;
+  body << "(\n";
+  for (size_t i = 0; i < n; ++i) {
+    auto a_name = "LA" + std::to_string(i) + ";";
+    auto b_name = "LB" + std::to_string(i) + ";";
+    auto a_t = DexType::make_type(a_name.c_str());
+    auto a_cls = create_internal_class(a_t, obj_t, {});
+    create_empty_method(a_cls, "f", void_void);
+    auto x = static_cast<DexField*>(
+        DexField::make_field(a_name + ".x:I"));
+    x->make_concrete(ACC_PUBLIC);
+    a_cls->add_field(x);
+    scope.push_back(a_cls);
+    auto b_t = DexType::make_type(b_name.c_str());
+    scope.push_back(create_internal_class(b_t, a_t, {}));
+    body << "(invoke-virtual (v0) \"" << b_name << ".f:()V\")\n";
+    body << "(iget v0 \"" << b_name << ".x:I\")\n";
+    body << "(move-result-pseudo v1)\n";
+  }
+  body << "(return-void))";
+  for (size_t i = 0; i < n; ++i) {
+    auto c_name = "LC" + std::to_string(i) + ";";
+    auto c_cls =
+        create_internal_class(DexType::make_type(c_name.c_str()), obj_t, {});
+    auto m = static_cast<DexMethod*>(
+        DexMethod::make_method(c_name + ".g:()V"));
+    m->make_concrete(ACC_PUBLIC | ACC_STATIC,
+                     assembler::ircode_from_string(body.str()),
+                     false);
+    c_cls->add_method(m);
+    scope.push_back(c_cls);
+  }
+  return scope;
+}
+
+TEST(CollectRefs, parallelMatchesSerial) {
+  g_redex = new RedexContext();
+  const size_t n = 20;
+  std::vector<DexClass*> scope = create_scope_refs(n);
+
+  RefsMap serial;
+  collect_refs(scope, serial, 1);
+  RefsMap parallel;
+  collect_refs(scope, parallel, 4);
+  EXPECT_EQ(serial.size(), n);
+  EXPECT_EQ(serial, parallel);
+  for (const auto& pair : serial) {
+    EXPECT_EQ(pair.second.size(), 1);
+  }
+
+  auto serial_members = collect_member_refs(scope, 1);
+  auto parallel_members = collect_member_refs(scope, 4);
+  EXPECT_EQ(serial_members.methods.size(), n);
+  EXPECT_EQ(serial_members.fields.size(), n);
+  EXPECT_EQ(serial_members.methods, parallel_members.methods);
+  EXPECT_EQ(serial_members.fields, parallel_members.fields);
+
+  delete g_redex;
+}
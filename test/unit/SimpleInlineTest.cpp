@@ -9,10 +9,13 @@
 
 #include <gtest/gtest.h>
 
+#include "Creators.h"
 #include "DexAsm.h"
+#include "DexStore.h"
 #include "DexUtil.h"
 #include "Inliner.h"
 #include "IRCode.h"
+#include "Resolver.h"
 
 std::ostream& operator<<(std::ostream& os, const IRInstruction& to_show) {
   return os << show(&to_show);
@@ -71,3 +74,108 @@ TEST(SimpleInlineTest, insertMoves) {
   EXPECT_EQ(caller_code->get_registers_size(), 5);
   delete g_redex;
 }
+
+namespace {
+
+/*
+ * The call graph used to compare serial and parallel inlining: method i
+ * calls every method listed in kCallGraph[i]. Leaves are shared by several
+ * callers so that inlining steps depend on each other.
+ */
+const std::vector<std::vector<size_t>> kCallGraph = {
+    {4, 5, 6}, {5, 6, 7}, {6, 7, 8}, {8, 9},
+    {10, 11}, {10, 12}, {11, 12}, {12, 13}, {10, 13}, {11},
+    {}, {}, {}, {}};
+
+std::vector<DexMethod*> make_call_graph(const char* cls_name,
+                                       Scope& scope) {
+  using namespace dex_asm;
+  auto type = DexType::make_type(cls_name);
+  std::vector<DexMethod*> methods;
+  for (size_t i = 0; i < kCallGraph.size(); ++i) {
+    auto method = static_cast<DexMethod*>(DexMethod::make_method(
+        cls_name, ("m" + std::to_string(i)).c_str(), "V", {}));
+    method->make_concrete(ACC_PUBLIC | ACC_STATIC, false);
+    method->set_code(std::make_unique<IRCode>(method, 0));
+    methods.push_back(method);
+  }
+  // emit callees before callers so that all invoked methods have code
+  for (size_t i = kCallGraph.size(); i-- > 0;) {
+    auto code = methods[i]->get_code();
+    code->push_back(dasm(OPCODE_CONST_4, {0_v, Operand{LITERAL, i % 8}}));
+    for (auto callee : kCallGraph[i]) {
+      code->push_back(dasm(OPCODE_INVOKE_STATIC, methods[callee], {}));
+    }
+    code->push_back(dasm(OPCODE_RETURN_VOID));
+    code->set_registers_size(1);
+  }
+
+  ClassCreator creator(type);
+  creator.set_super(DexType::make_type("Ljava/lang/Object;"));
+  for (auto method : methods) {
+    creator.add_method(method);
+  }
+  scope.push_back(creator.create());
+  return methods;
+}
+
+std::string code_string(DexMethod* method, const std::string& cls_name) {
+  std::string result;
+  for (const auto& mie : InstructionIterable(method->get_code())) {
+    auto str = show(mie.insn);
+    for (auto pos = str.find(cls_name); pos != std::string::npos;
+         pos = str.find(cls_name, pos)) {
+      str.replace(pos, cls_name.size(), "LCls;");
+    }
+    result += str + "\n";
+  }
+  return result;
+}
+
+} // namespace
+
+/*
+ * Test that the parallel inliner produces the same code as the serial one.
+ */
+TEST(SimpleInlineTest, parallelMatchesSerial) {
+  g_redex = new RedexContext();
+
+  auto run = [](const char* cls_name, bool parallel,
+                size_t* calls_inlined) {
+    Scope scope;
+    auto methods = make_call_graph(cls_name, scope);
+    std::unordered_set<DexMethod*> candidates(methods.begin() + 4,
+                                              methods.end());
+    DexStore store("classes");
+    store.add_classes(scope);
+    DexStoresVector stores;
+    stores.emplace_back(std::move(store));
+    MethodRefCache resolved_refs;
+    auto resolver = [&resolved_refs](DexMethodRef* method,
+                                     MethodSearch search) {
+      return resolve_method(method, search, resolved_refs);
+    };
+    MultiMethodInliner::Config config;
+    config.parallel = parallel;
+    {
+      MultiMethodInliner inliner(scope, stores, candidates, resolver, config);
+      inliner.inline_methods();
+      *calls_inlined = inliner.get_info().calls_inlined;
+    }
+    std::vector<std::string> codes;
+    for (auto method : methods) {
+      codes.push_back(code_string(method, cls_name));
+    }
+    return codes;
+  };
+
+  size_t serial_inlined;
+  size_t parallel_inlined;
+  auto serial = run("LSerial;", false, &serial_inlined);
+  auto parallel = run("LParallel;", true, &parallel_inlined);
+  EXPECT_GT(serial_inlined, 0);
+  EXPECT_EQ(serial_inlined, parallel_inlined);
+  EXPECT_EQ(serial, parallel);
+
+  delete g_redex;
+}
@@ -9,9 +9,14 @@
 
 #include "WorkQueue.h"
 
+#include <atomic>
 #include <chrono>
 #include <gtest/gtest.h>
+#include <mutex>
 #include <random>
+#include <set>
+#include <thread>
+#include <vector>
 
 constexpr unsigned int NUM_STRINGS = 100'000;
 constexpr unsigned int NUM_INTS = 1000;
@@ -103,3 +108,148 @@ TEST(WorkQueueTest, checkDynamicallyAddingTasks) {
   // 10 + 9 + ... + 1 + 0 = 55
   EXPECT_EQ(55, result);
 }
+
+// A task may itself run a WorkQueue; the calling pool worker takes part in the
+// inner run, so this must not deadlock even when every worker is busy.
+TEST(WorkQueueTest, checkNestedRunAll) {
+  auto wq = workqueue_mapreduce<int, int>(
+      [](int a) {
+        auto inner = workqueue_mapreduce<int, int>(
+            [](int b) { return b; }, [](int x, int y) { return x + y; });
+        for (int idx = 0; idx <= a; ++idx) {
+          inner.add_item(idx);
+        }
+        return inner.run_all();
+      },
+      [](int a, int b) { return a + b; });
+  for (int idx = 0; idx < 100; ++idx) {
+    wq.add_item(10);
+  }
+  EXPECT_EQ(55 * 100, wq.run_all());
+}
+
+// Participants of the outer queue that have nothing left to do help with the
+// inner one rather than wait for the task running it.
+TEST(WorkQueueTest, checkIdleParticipantsHelpNestedRun) {
+  std::mutex mtx;
+  std::set<std::thread::id> inner_threads;
+  auto wq = workqueue_foreach<int>(
+      [&](int) {
+        auto inner = workqueue_foreach<int>(
+            [&](int) {
+              std::this_thread::sleep_for(std::chrono::milliseconds(5));
+              std::lock_guard<std::mutex> guard(mtx);
+              inner_threads.insert(std::this_thread::get_id());
+            },
+            2);
+        for (int idx = 0; idx < 20; ++idx) {
+          inner.add_item(idx);
+        }
+        inner.run_all();
+      },
+      2);
+  wq.add_item(0);
+  wq.run_all();
+  EXPECT_EQ(2, inner_threads.size());
+}
+
+// Items added during a run by a thread that is not working on the queue go
+// through the shared injection queue.
+TEST(WorkQueueTest, checkAddingTasksFromOtherThread) {
+  std::atomic<int> sum{0};
+  auto wq = workqueue_foreach<int>([&](int a) { sum += a; });
+  wq.set_mapper([&](std::nullptr_t&, int a) {
+    if (a == 0) {
+      std::thread other([&wq] {
+        for (int idx = 0; idx < 100; ++idx) {
+          wq.add_item(1);
+        }
+      });
+      other.join();
+    }
+    sum += a;
+    return nullptr;
+  });
+  wq.add_item(0);
+  wq.run_all();
+  EXPECT_EQ(100, sum.load());
+}
+
+TEST(WorkQueueTest, checkRunningTwice) {
+  auto wq = workqueue_mapreduce<int, int>([](int a) { return a; },
+                                          [](int a, int b) { return a + b; });
+  for (int idx = 0; idx < NUM_INTS; ++idx) {
+    wq.add_item(1);
+  }
+  EXPECT_EQ(NUM_INTS, wq.run_all());
+  wq.add_item(5);
+  EXPECT_EQ(5, wq.run_all());
+}
+
+TEST(WorkQueueTest, checkOrderedItems) {
+  std::vector<int> order;
+  auto wq = workqueue_foreach<int>([&](int a) { order.push_back(a); }, 1);
+  std::vector<int> items;
+  for (int idx = 0; idx < NUM_INTS; ++idx) {
+    items.push_back(NUM_INTS - idx);
+  }
+  wq.add_ordered_items(items);
+  wq.run_all();
+  EXPECT_EQ(items, order);
+
+  // Every ordered item runs exactly once alongside the others, and the queue
+  // starts from scratch on the next run.
+  std::atomic<int> sum{0};
+  auto mt_wq = workqueue_foreach<int>([&](int a) { sum += a; }, 4);
+  for (int run = 0; run < 2; ++run) {
+    sum = 0;
+    mt_wq.add_ordered_items(items);
+    mt_wq.add_item(1);
+    mt_wq.run_all();
+    EXPECT_EQ(NUM_INTS * (NUM_INTS + 1) / 2 + 1, sum.load());
+  }
+}
+
+// The owner pushes and pops while thieves steal; every element must be taken
+// exactly once.
+TEST(WorkQueueTest, checkWorkStealingDeque) {
+  constexpr int num_items = 100'000;
+  constexpr int num_thieves = 3;
+  std::vector<int> items(num_items);
+  std::vector<std::atomic<int>> taken(num_items);
+  for (auto& t : taken) {
+    t = 0;
+  }
+  workqueue_impl::WorkStealingDeque<int*> deque(2);
+  std::atomic<bool> done{false};
+  std::vector<std::thread> thieves;
+  for (int i = 0; i < num_thieves; ++i) {
+    thieves.emplace_back([&] {
+      int* item;
+      while (!done) {
+        if (deque.steal(item)) {
+          taken[item - items.data()]++;
+        }
+      }
+    });
+  }
+  int* item;
+  for (int idx = 0; idx < num_items; ++idx) {
+    deque.push(&items[idx]);
+    if (idx % 3 == 0 && deque.pop(item)) {
+      taken[item - items.data()]++;
+    }
+  }
+  while (!deque.empty()) {
+    if (deque.pop(item)) {
+      taken[item - items.data()]++;
+    }
+  }
+  done = true;
+  for (auto& thief : thieves) {
+    thief.join();
+  }
+  for (int idx = 0; idx < num_items; ++idx) {
+    ASSERT_EQ(1, taken[idx]);
+  }
+}
@@ -8,12 +8,16 @@
  */
 
 #include <boost/scope_exit.hpp>
+#include <cctype>
+#include <cstring>
 #include <fcntl.h>
+#include <fstream>
 #include <iostream>
 #include <memory>
 #include <string>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
 #include "PositionMap.h"
 
@@ -28,20 +32,23 @@ std::unique_ptr<PositionMap> read_map(const char* filename) {
   if (fstat(fd, &buf)) {
     std::cerr << "Cannot fstat file (" << filename
               << ") with error: " << strerror(errno) << std::endl;
+    close(fd);
     return nullptr;
   }
-  uint8_t* mapping = (uint8_t*)mmap(
+  uint8_t* base = (uint8_t*)mmap(
       nullptr, buf.st_size, PROT_READ, MAP_FILE | MAP_SHARED, fd, 0);
-  uint32_t magic = *(uint32_t*)mapping;
-  mapping += sizeof(uint32_t);
-  if (mapping == MAP_FAILED) {
+  close(fd);
+  if (base == MAP_FAILED) {
     std::cerr << "mmap failed for file (" << filename
               << ") with error: " << strerror(errno) << std::endl;
     return nullptr;
   }
   BOOST_SCOPE_EXIT_ALL(=, &buf) {
-    munmap(mapping, buf.st_size);
+    munmap(base, buf.st_size);
   };
+  uint8_t* mapping = base;
+  uint32_t magic = *(uint32_t*)mapping;
+  mapping += sizeof(uint32_t);
   if (magic != 0xfaceb000) {
     std::cerr << "Magic number mismatch\n";
     return nullptr;
@@ -83,3 +90,213 @@ std::vector<Position> get_stack(const PositionMap& map, int64_t idx) {
   }
   return stack;
 }
+
+namespace {
+
+constexpr uint32_t k_magic = 0xfaceb000;
+constexpr uint32_t k_indexed_version = 3;
+constexpr size_t k_header_size = 4 * sizeof(uint32_t);
+
+void append_u32(std::vector<uint8_t>& out, uint32_t value) {
+  auto bytes = (const uint8_t*)&value;
+  out.insert(out.end(), bytes, bytes + sizeof(value));
+}
+
+} // namespace
+
+std::unique_ptr<IndexedPositionMap> IndexedPositionMap::open(
+    const char* filename) {
+  int fd = ::open(filename, O_RDONLY);
+  if (fd == -1) {
+    std::cerr << "open failed for file (" << filename
+              << ") with error: " << strerror(errno) << std::endl;
+    return nullptr;
+  }
+  struct stat buf;
+  if (fstat(fd, &buf)) {
+    std::cerr << "Cannot fstat file (" << filename
+              << ") with error: " << strerror(errno) << std::endl;
+    close(fd);
+    return nullptr;
+  }
+  size_t size = buf.st_size;
+  if (size < 2 * sizeof(uint32_t)) {
+    std::cerr << "Truncated map file (" << filename << ")\n";
+    close(fd);
+    return nullptr;
+  }
+  void* mapping =
+      mmap(nullptr, size, PROT_READ, MAP_FILE | MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    std::cerr << "mmap failed for file (" << filename
+              << ") with error: " << strerror(errno) << std::endl;
+    return nullptr;
+  }
+  auto header = (const uint32_t*)mapping;
+  if (header[0] != k_magic) {
+    std::cerr << "Magic number mismatch\n";
+    munmap(mapping, size);
+    return nullptr;
+  }
+  uint32_t version = header[1];
+  std::unique_ptr<IndexedPositionMap> map(new IndexedPositionMap());
+  if (version == k_indexed_version) {
+    map->m_mapping = (uint8_t*)mapping;
+    map->m_mapping_size = size;
+  } else {
+    munmap(mapping, size);
+    if (version != 2) {
+      std::cerr << "Version mismatch\n";
+      return nullptr;
+    }
+    auto unindexed = read_map(filename);
+    if (unindexed == nullptr) {
+      return nullptr;
+    }
+    map->m_owned = index_map(*unindexed);
+  }
+  bool ok = map->m_mapping != nullptr
+                ? map->init(map->m_mapping, map->m_mapping_size)
+                : map->init(map->m_owned.data(), map->m_owned.size());
+  if (!ok) {
+    std::cerr << "Malformed map file (" << filename << ")\n";
+    return nullptr;
+  }
+  return map;
+}
+
+IndexedPositionMap::~IndexedPositionMap() {
+  if (m_mapping != nullptr) {
+    munmap(m_mapping, m_mapping_size);
+  }
+}
+
+bool IndexedPositionMap::init(const uint8_t* data, size_t size) {
+  if (size < k_header_size) {
+    return false;
+  }
+  auto header = (const uint32_t*)data;
+  uint64_t string_count = header[2];
+  uint64_t positions_size = header[3];
+  uint64_t offsets_off =
+      k_header_size + positions_size * sizeof(PositionItem);
+  uint64_t data_off = offsets_off + (string_count + 1) * sizeof(uint32_t);
+  if (data_off > size) {
+    return false;
+  }
+  m_positions = (const PositionItem*)(data + k_header_size);
+  m_positions_size = positions_size;
+  m_string_offsets = (const uint32_t*)(data + offsets_off);
+  m_string_count = string_count;
+  m_string_data = (const char*)(data + data_off);
+  m_string_data_size = size - data_off;
+  return true;
+}
+
+boost::string_ref IndexedPositionMap::string(uint32_t id) const {
+  // Offsets are only checked as they are used, so that opening stays O(1).
+  if (id >= m_string_count) {
+    return boost::string_ref();
+  }
+  uint32_t begin = m_string_offsets[id];
+  uint32_t end = m_string_offsets[id + 1];
+  if (begin > end || end > m_string_data_size) {
+    return boost::string_ref();
+  }
+  return boost::string_ref(m_string_data + begin, end - begin);
+}
+
+std::vector<uint8_t> index_map(const PositionMap& map) {
+  std::vector<uint8_t> out;
+  append_u32(out, k_magic);
+  append_u32(out, k_indexed_version);
+  append_u32(out, map.string_pool.size());
+  append_u32(out, map.positions_size);
+  auto positions = (const uint8_t*)map.positions.get();
+  out.insert(out.end(),
+             positions,
+             positions + map.positions_size * sizeof(PositionItem));
+  uint32_t offset = 0;
+  append_u32(out, offset);
+  for (const auto& s : map.string_pool) {
+    offset += s.size();
+    append_u32(out, offset);
+  }
+  for (const auto& s : map.string_pool) {
+    out.insert(out.end(), s.begin(), s.end());
+  }
+  return out;
+}
+
+bool write_indexed_map(const PositionMap& map, const char* filename) {
+  auto bytes = index_map(map);
+  std::ofstream ofs(filename,
+                    std::ofstream::out | std::ofstream::trunc |
+                        std::ofstream::binary);
+  ofs.write((const char*)bytes.data(), bytes.size());
+  return ofs.good();
+}
+
+bool parse_frame(boost::string_ref frame,
+                 boost::string_ref* prefix,
+                 uint32_t* line) {
+  size_t i = 0;
+  auto skip_spaces = [&]() {
+    size_t start = i;
+    while (i < frame.size() && std::isspace((unsigned char)frame[i])) {
+      ++i;
+    }
+    return i > start;
+  };
+  if (!skip_spaces() || frame.substr(i, 2) != "at") {
+    return false;
+  }
+  i += 2;
+  if (!skip_spaces()) {
+    return false;
+  }
+  size_t paren = frame.substr(i).find('(');
+  if (paren == boost::string_ref::npos) {
+    return false;
+  }
+  paren += i;
+  i = paren + 1;
+  if (i == frame.size() || frame[i] != ':') {
+    return false;
+  }
+  size_t digits = ++i;
+  uint64_t value = 0;
+  while (i < frame.size() && std::isdigit((unsigned char)frame[i])) {
+    value = value * 10 + (frame[i] - '0');
+    if (value > UINT32_MAX) {
+      return false;
+    }
+    ++i;
+  }
+  if (i == digits || i == frame.size() || frame[i] != ')') {
+    return false;
+  }
+  ++i;
+  if (i < frame.size() && std::isspace((unsigned char)frame[i])) {
+    ++i;
+  }
+  if (i != frame.size()) {
+    return false;
+  }
+  *prefix = frame.substr(0, paren);
+  *line = value;
+  return true;
+}
+
+void write_stack(std::ostream& os,
+                 boost::string_ref prefix,
+                 const IndexedPositionMap& map,
+                 uint32_t line) {
+  int64_t idx = (int64_t)line - 1;
+  while (idx >= 0 && (size_t)idx < map.size()) {
+    const auto& pi = map.position(idx);
+    os << prefix << "(" << map.string(pi.file_id) << ":" << pi.line << ")\n";
+    idx = (int64_t)pi.parent - 1;
+  }
+}
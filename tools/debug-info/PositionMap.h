@@ -7,7 +7,12 @@
  * of patent rights can be found in the PATENTS file in the same directory.
  */
 
+#pragma once
+
+#include <boost/utility/string_ref.hpp>
+#include <cstdint>
 #include <memory>
+#include <ostream>
 #include <string>
 #include <vector>
 
@@ -39,3 +44,67 @@ struct PositionMap {
 
 std::unique_ptr<PositionMap> read_map(const char* filename);
 std::vector<Position> get_stack(const PositionMap& map, int64_t idx);
+
+/*
+ * Version 3 of the map holds the same data as version 2, laid out so that it
+ * can be used straight from an mmap without parsing:
+ *
+ * 0xfaceb000 (magic number)
+ * version (4 bytes)
+ * string_pool_size (4 bytes)
+ * positions_size (4 bytes)
+ * positions[positions_size]
+ * string_offsets[string_pool_size + 1]
+ * string_data
+ *
+ * String i occupies string_data[string_offsets[i], string_offsets[i + 1]).
+ */
+class IndexedPositionMap {
+ public:
+  /*
+   * Maps a version 3 file directly. A version 2 file is read and indexed in
+   * memory instead, so callers don't need to care which one they were given.
+   */
+  static std::unique_ptr<IndexedPositionMap> open(const char* filename);
+  ~IndexedPositionMap();
+
+  size_t size() const { return m_positions_size; }
+  const PositionItem& position(size_t idx) const { return m_positions[idx]; }
+  boost::string_ref string(uint32_t id) const;
+
+ private:
+  IndexedPositionMap() = default;
+  bool init(const uint8_t* data, size_t size);
+
+  // Either an mmap of a version 3 file or an owned, indexed version 2 map.
+  uint8_t* m_mapping{nullptr};
+  size_t m_mapping_size{0};
+  std::vector<uint8_t> m_owned;
+
+  const PositionItem* m_positions{nullptr};
+  size_t m_positions_size{0};
+  const uint32_t* m_string_offsets{nullptr};
+  size_t m_string_count{0};
+  const char* m_string_data{nullptr};
+  size_t m_string_data_size{0};
+};
+
+std::vector<uint8_t> index_map(const PositionMap& map);
+bool write_indexed_map(const PositionMap& map, const char* filename);
+
+/*
+ * Recognizes a stack frame whose line number was remapped by redex, i.e. one
+ * of the form "<ws>at<ws>com.foo.Bar.baz(:123)". On success, `prefix` is the
+ * part of the line preceding the parenthesis and `line` the number in it.
+ */
+bool parse_frame(boost::string_ref frame, boost::string_ref* prefix,
+                 uint32_t* line);
+
+/*
+ * Writes one frame per position in the inline stack of the given map line,
+ * innermost first.
+ */
+void write_stack(std::ostream& os,
+                 boost::string_ref prefix,
+                 const IndexedPositionMap& map,
+                 uint32_t line);
@@ -0,0 +1,27 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <iostream>
+
+#include "PositionMap.h"
+
+int main(int argc, char** argv) {
+  if (argc < 3) {
+    std::cerr << "Usage: linemapindex mapping_file indexed_mapping_file\n";
+    abort();
+  }
+  auto map = read_map(argv[1]);
+  if (map == nullptr) {
+    return 1;
+  }
+  if (!write_indexed_map(*map, argv[2])) {
+    std::cerr << "Failed to write " << argv[2] << std::endl;
+    return 1;
+  }
+}
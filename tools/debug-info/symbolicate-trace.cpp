@@ -7,31 +7,87 @@
  * of patent rights can be found in the PATENTS file in the same directory.
  */
 
-#include <boost/regex.hpp>
 #include <iostream>
 #include <string>
+#include <unordered_map>
 
 #include "PositionMap.h"
 
-boost::regex trace_regex(R"/((\s+at\s+[^(]*)\(:(\d+)\)\s?)/");
+namespace {
+
+void symbolicate(std::ostream& os,
+                 const IndexedPositionMap& map,
+                 boost::string_ref line) {
+  boost::string_ref prefix;
+  uint32_t map_line;
+  if (parse_frame(line, &prefix, &map_line)) {
+    write_stack(os, prefix, map, map_line);
+  } else {
+    os << line << "\n";
+  }
+}
+
+/*
+ * Serves traces against any number of maps from one long-lived process. Each
+ * request is a line of the form "<mapping file>\t<trace line>". Maps are
+ * loaded on first use and kept for the lifetime of the process. Every
+ * response is terminated by an empty line and flushed, so that a client can
+ * drive this over a pipe.
+ */
+int serve_batch(int argc, char** argv) {
+  std::unordered_map<std::string, std::unique_ptr<IndexedPositionMap>> maps;
+  auto get_map = [&](const std::string& filename) -> IndexedPositionMap* {
+    auto it = maps.find(filename);
+    if (it != maps.end()) {
+      return it->second.get();
+    }
+    auto map = IndexedPositionMap::open(filename.c_str());
+    if (map == nullptr) {
+      // Don't remember the failure; the map may show up later.
+      return nullptr;
+    }
+    return (maps[filename] = std::move(map)).get();
+  };
+  for (int i = 0; i < argc; ++i) {
+    if (get_map(argv[i]) == nullptr) {
+      return 1;
+    }
+  }
+  for (std::string request; std::getline(std::cin, request);) {
+    auto tab = request.find('\t');
+    if (tab == std::string::npos) {
+      std::cerr << "Malformed request: " << request << std::endl;
+    } else {
+      boost::string_ref line(request);
+      auto map = get_map(request.substr(0, tab));
+      if (map != nullptr) {
+        symbolicate(std::cout, *map, line.substr(tab + 1));
+      } else {
+        std::cout << line.substr(tab + 1) << "\n";
+      }
+    }
+    std::cout << std::endl;
+  }
+  return 0;
+}
+
+} // namespace
 
 int main(int argc, char** argv) {
   if (argc < 2) {
-    std::cerr << "Usage: cat trace | remap mapping_file\n";
+    std::cerr << "Usage: cat trace | remap mapping_file\n"
+              << "       cat requests | remap --batch [mapping_file...]\n";
     abort();
   }
-  auto map = read_map(argv[1]);
+  std::ios::sync_with_stdio(false);
+  if (std::string(argv[1]) == "--batch") {
+    return serve_batch(argc - 2, argv + 2);
+  }
+  auto map = IndexedPositionMap::open(argv[1]);
+  if (map == nullptr) {
+    return 1;
+  }
   for (std::string line; std::getline(std::cin, line);) {
-    boost::smatch matches;
-    if (boost::regex_match(line, matches, trace_regex)) {
-      auto idx = std::stoi(matches[2]) - 1;
-      auto stack = get_stack(*map, idx);
-      for (auto pos : stack) {
-        std::cout << matches[1] << "(" << pos.filename << ":" << pos.line
-                  << ")" << std::endl;
-      }
-    } else {
-      std::cout << line << std::endl;
-    }
+    symbolicate(std::cout, *map, line);
   }
 }
@@ -15,14 +15,19 @@
 #include "memory-accounter.h"
 #include "util.h"
 
+#include <fcntl.h>
+#include <unistd.h>
+
 #include <cerrno>
 #include <cstdint>
 #include <cstdio>
 #include <cstring>
 
 #include <algorithm>
+#include <atomic>
 #include <memory>
 #include <string>
+#include <thread>
 #include <vector>
 
 #define PACKED __attribute__((packed))
@@ -1647,7 +1652,6 @@ class LookupTables {
     CHECK(dex_fh.fread(&header, sizeof(DexFileHeader), 1) == 1);
 
     const auto num_classes = header.class_defs_size;
-    const auto mask = lookup_table_size - 1;
 
     // TODO: This is probably the most memory hungry part of the whole building
     // process, but total usage should still be <1MB for all the class strings.
@@ -1678,6 +1682,92 @@ class LookupTables {
 
     char class_name_buf[kClassNameBufSize] = {};
 
+    fill_lookup_table(table_buf.get(), lookup_table_size, num_classes,
+      [&](uint32_t i, uint32_t* string_offset) {
+        const auto class_idx = class_defs_buf[i].class_idx;
+        CHECK(class_idx < num_type_ids);
+        const auto string_id = typeid_buf[class_idx];
+        CHECK(string_id < num_string_ids);
+        *string_offset = stringid_buf[string_id];
+
+        dex_fh.seek_set(*string_offset);
+        auto read_size = dex_fh.fread(class_name_buf, sizeof(char), kClassNameBufSize);
+        CHECK(read_size > 0);
+
+        auto ptr = class_name_buf;
+        const auto str_size = read_uleb128(&ptr) + 1;
+        const auto str_start = ptr - class_name_buf;
+
+        if (str_start + str_size >= kClassNameBufSize) {
+          std::unique_ptr<char[]> large_class_name_buf(new char[str_size]);
+          dex_fh.seek_set(*string_offset + str_start);
+          CHECK(dex_fh.fread(large_class_name_buf.get(), sizeof(char), str_size)
+              == str_size);
+          return std::string(large_class_name_buf.get(), str_size);
+        }
+        return std::string(ptr, str_size);
+      });
+
+    return table_buf;
+  }
+
+ public:
+  // Like build_lookup_table(filename, ...), for a dex file that is already
+  // in memory, e.g. mapped. Only reads the buffer, so several of these can
+  // run at once.
+  static std::unique_ptr<LookupTableEntry[]>
+  build_lookup_table(ConstBuffer dex_buf, uint32_t lookup_table_size) {
+
+    std::unique_ptr<LookupTableEntry[]>
+      table_buf(new LookupTableEntry[lookup_table_size]);
+    memset(table_buf.get(), 0, lookup_table_size * sizeof(LookupTableEntry));
+
+    CHECK(dex_buf.len >= sizeof(DexFileHeader));
+    const auto& header = *reinterpret_cast<const DexFileHeader*>(dex_buf.ptr);
+
+    const auto num_type_ids = header.type_ids_size;
+    const auto num_string_ids = header.string_ids_size;
+    const auto num_classes = header.class_defs_size;
+    CHECK(header.type_ids_off + num_type_ids * sizeof(uint32_t) <= dex_buf.len);
+    CHECK(header.string_ids_off + num_string_ids * sizeof(uint32_t) <= dex_buf.len);
+    CHECK(header.class_defs_off + num_classes * sizeof(DexClassDef) <= dex_buf.len);
+
+    const auto typeids =
+      reinterpret_cast<const uint32_t*>(dex_buf.ptr + header.type_ids_off);
+    const auto stringids =
+      reinterpret_cast<const uint32_t*>(dex_buf.ptr + header.string_ids_off);
+    const auto class_defs =
+      reinterpret_cast<const DexClassDef*>(dex_buf.ptr + header.class_defs_off);
+
+    fill_lookup_table(table_buf.get(), lookup_table_size, num_classes,
+      [&](uint32_t i, uint32_t* string_offset) {
+        const auto class_idx = class_defs[i].class_idx;
+        CHECK(class_idx < num_type_ids);
+        const auto string_id = typeids[class_idx];
+        CHECK(string_id < num_string_ids);
+        *string_offset = stringids[string_id];
+        CHECK(*string_offset < dex_buf.len);
+
+        auto ptr = const_cast<char*>(dex_buf.ptr + *string_offset);
+        const auto str_size = read_uleb128(&ptr) + 1;
+        CHECK(ptr + str_size <= dex_buf.ptr + dex_buf.len);
+        return std::string(ptr, str_size);
+      });
+
+    return table_buf;
+  }
+
+ private:
+  // Inserts the classes of a dex file into an empty table. class_name(i,
+  // &string_offset) returns the name of the i-th class def, including the
+  // terminating null, and sets where that name is in the dex file.
+  template <typename ClassNameFn>
+  static void fill_lookup_table(LookupTableEntry* table,
+                                uint32_t lookup_table_size,
+                                uint32_t num_classes,
+                                ClassNameFn class_name) {
+    const auto mask = lookup_table_size - 1;
+
     struct Retry {
       uint32_t string_offset;
       uint16_t data;
@@ -1687,48 +1777,21 @@ class LookupTables {
     std::vector<Retry> retry_indices;
 
     for (unsigned int i = 0; i < num_classes; i++) {
-      const auto class_idx = class_defs_buf[i].class_idx;
-      CHECK(class_idx < num_type_ids);
-      const auto string_id = typeid_buf[class_idx];
-      CHECK(string_id < num_string_ids);
-      const auto string_offset = stringid_buf[string_id];
-
-      dex_fh.seek_set(string_offset);
-      auto read_size = dex_fh.fread(class_name_buf, sizeof(char), kClassNameBufSize);
-      CHECK(read_size > 0);
-
-      auto ptr = class_name_buf;
-      const auto str_size = read_uleb128(&ptr) + 1;
-      const auto str_start = ptr - class_name_buf;
-
-      std::string class_name;
-
-      if (str_start + str_size >= kClassNameBufSize) {
-        std::unique_ptr<char[]> large_class_name_buf(new char[str_size]);
-        dex_fh.seek_set(string_offset + str_start);
-        CHECK(dex_fh.fread(large_class_name_buf.get(), sizeof(char), str_size)
-            == str_size);
-        class_name = std::string(large_class_name_buf.get(), str_size);
-      } else {
-        class_name = std::string(ptr, str_size);
-      }
-
-      const auto hash = hash_str(class_name);
+      uint32_t string_offset = 0;
+      const auto hash = hash_str(class_name(i, &string_offset));
       const auto data = make_lt_data(i, hash, mask);
 
-      if (!insert_no_probe(table_buf.get(),
+      if (!insert_no_probe(table,
             LookupTableEntry { string_offset, data, 0 }, hash, mask)) {
         retry_indices.emplace_back(Retry { string_offset, data, hash });
       }
     }
 
     for (const auto& retry : retry_indices) {
-      insert(table_buf.get(),
+      insert(table,
              LookupTableEntry { retry.string_offset, retry.data, 0 },
              retry.hash, mask);
     }
-
-    return table_buf;
   }
 
   static bool supportedSize(uint32_t num_class_defs) {
@@ -2611,16 +2674,9 @@ std::unique_ptr<ImageInfo_064> read_image_info_064(const std::string& art_image_
   );
 }
 
-template <typename DexFileListingType, typename OatClassesType, typename LookupTablesType, typename SamsungLookupTablesType>
-OatFile::Status build_oatfile(const std::string& oat_file_name,
-                              const std::vector<DexInput>& dex_input,
-                              const OatVersion oat_version,
-                              InstructionSet isa,
-                              bool write_elf,
-                              const std::string& art_image_location,
-                              bool samsung_mode) {
-
-  const std::vector<KeyValueStore::KeyValue> key_value = {
+std::vector<KeyValueStore::KeyValue> build_key_value(
+    const std::string& art_image_location) {
+  return {
     { "classpath", "" },
     { "compiler-filter", "verify-none" },
     { "debuggable", "false" },
@@ -2633,6 +2689,37 @@ OatFile::Status build_oatfile(const std::string& oat_file_name,
     { "pic", "false" },
     { kCreatedByOatmeal, "true" }
   };
+}
+
+// Calls fn(i) for every i in [0, n), on as many threads as there are cores.
+template <typename Fn>
+void parallel_for(size_t n, const Fn& fn) {
+  const size_t num_threads = std::min<size_t>(
+      n, std::max(1u, std::thread::hardware_concurrency()));
+  std::atomic<size_t> next{0};
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < num_threads; t++) {
+    threads.emplace_back([&]() {
+      for (size_t i = next++; i < n; i = next++) {
+        fn(i);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+template <typename DexFileListingType, typename OatClassesType, typename LookupTablesType, typename SamsungLookupTablesType>
+OatFile::Status build_oatfile(const std::string& oat_file_name,
+                              const std::vector<DexInput>& dex_input,
+                              const OatVersion oat_version,
+                              InstructionSet isa,
+                              bool write_elf,
+                              const std::string& art_image_location,
+                              bool samsung_mode) {
+
+  const auto key_value = build_key_value(art_image_location);
 
   ////////// Gather image info from boot.art and boot.oat
   std::unique_ptr<ImageInfo_064> image_info;
@@ -2723,6 +2810,105 @@ OatFile::Status build_oatfile(const std::string& oat_file_name,
   return OatFile::Status::BUILD_SUCCESS;
 }
 
+// Builds the same file as build_oatfile<DexFileListing_079, OatClasses_079,
+// LookupTables, SamsungLookupTablesNil>, but instead of streaming it front to
+// back, lays out the whole file first and then writes each part at its
+// offset. The input dex files are mapped rather than read, and each one is
+// copied and gets its lookup table built on its own thread. Everything else
+// is small, and is rendered in memory up front.
+OatFile::Status build_oatfile_mapped(const std::string& oat_file_name,
+                                     const std::vector<DexInput>& dex_input,
+                                     const OatVersion oat_version,
+                                     InstructionSet isa,
+                                     bool write_elf,
+                                     const std::string& art_image_location) {
+  CHECK(!dex_input.empty());
+  const auto key_value = build_key_value(art_image_location);
+
+  ////////// Compute sizes and offsets.
+
+  const auto keyvalue_size = KeyValueStore::compute_size(key_value);
+  const auto dex_file_listing_size =
+    DexFileListing_079::compute_size(dex_input, false);
+
+  uint32_t next_offset = align<4>(OatHeader::size(oat_version) +
+                                 + keyvalue_size
+                                 + dex_file_listing_size);
+
+  auto dex_files = DexFileListing_079::build(dex_input, next_offset, false);
+
+  auto oat_size = align<0x1000>(next_offset);
+
+  // The checksum is left as a marker, as in build_oatfile.
+  auto header = build_header(oat_version, dex_input, isa, keyvalue_size, oat_size, nullptr);
+
+  ////////// Render the small sections.
+
+  BufferFileHandle prefix_fh;
+  header.write(prefix_fh);
+  KeyValueStore::write(prefix_fh, key_value);
+  DexFileListing_079::write(prefix_fh, dex_files, false);
+  CHECK(align<4>(prefix_fh.bytes_written()) == dex_files.front().file_offset);
+
+  BufferFileHandle classes_fh(dex_files.front().classes_offset);
+  OatClasses_079::write(dex_files, classes_fh);
+
+  ////////// Write the file.
+
+  const size_t oat_start = write_elf ? 0x1000 : 0;
+
+  auto fd = open(oat_file_name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return OatFile::Status::BUILD_IO_ERROR;
+  }
+  // Sizing the file up front leaves all the padding zeroed.
+  CHECK(ftruncate(fd, oat_start + oat_size) == 0,
+        "ftruncate failed: %s", std::strerror(errno));
+
+  pwrite_buf(fd, prefix_fh.buffer(), oat_start);
+  pwrite_buf(fd, classes_fh.buffer(), oat_start + dex_files.front().classes_offset);
+
+  std::atomic<bool> mapped_all{true};
+  parallel_for(dex_input.size(), [&](size_t i) {
+    const auto& dex_file = dex_files[i];
+    MappedFile dex(dex_input[i].filename);
+    auto dex_buf = dex.buffer();
+    if (dex_buf.ptr == nullptr) {
+      fprintf(stderr, "failed to map %s\n", dex_input[i].filename.c_str());
+      mapped_all = false;
+      return;
+    }
+    pwrite_buf(fd, dex_buf, oat_start + dex_file.file_offset);
+
+    const auto num_entries = LookupTables::numEntries(dex_file.num_classes);
+    if (num_entries == 0) {
+      return;
+    }
+    auto table = LookupTables::build_lookup_table(dex_buf, num_entries);
+    pwrite_buf(fd,
+               ConstBuffer { reinterpret_cast<const char*>(table.get()),
+                             num_entries * sizeof(LookupTables::LookupTableEntry) },
+               oat_start + dex_file.lookup_table_offset);
+  });
+
+  close(fd);
+  if (!mapped_all) {
+    return OatFile::Status::BUILD_IO_ERROR;
+  }
+
+  if (write_elf) {
+    auto oat_fh = FileHandle(fopen(oat_file_name.c_str(), "r+"));
+    if (oat_fh.get() == nullptr) {
+      return OatFile::Status::BUILD_IO_ERROR;
+    }
+    ElfWriter section_headers(oat_version);
+    section_headers.build(isa, oat_size, compute_bss_size_079(dex_input));
+    section_headers.write(oat_fh);
+  }
+
+  return OatFile::Status::BUILD_SUCCESS;
+}
+
 void write_vdex_header(FileHandle& fh,
 		       uint32_t num_dex_files,
 		       uint32_t dex_size,
@@ -2748,19 +2934,7 @@ OatFile::Status build_v124_vdex_odex(
 				     bool write_elf,
 				     const std::string& art_image_location,
 				     bool samsung_mode) {
-  const std::vector<KeyValueStore::KeyValue> key_value = {
-    { "classpath", "" },
-    { "compiler-filter", "verify-none" },
-    { "debuggable", "false" },
-    // What ever will happen if art tries to use this?
-    { "dex2oat-cmdline", "--oat-file=/dev/null --dex-file=/dev/null" },
-    { "dex2oat-host", "X86" },
-    { "has-patch-info", "false" },
-    { "native-debuggable", "false" },
-    { "image-location", art_image_location.c_str() },
-    { "pic", "false" },
-    { kCreatedByOatmeal, "true" }
-  };
+  const auto key_value = build_key_value(art_image_location);
 
   std::vector<DexInput> single_dex_input;
   single_dex_input.push_back(dex_input);
@@ -2874,24 +3048,23 @@ OatFile::Status build_v124_vdex_odex(
 }
 
 
-template <>
-OatFile::Status build_oatfile<
-  DexFileListing_124,
-  OatClasses_124,
-  LookupTables,
-  SamsungLookupTablesNil>(
+// Builds an odex/vdex pair for each of the dex files, in the directory
+// oat_file_name. The pairs don't depend on each other, so if `parallel`
+// they are built at the same time.
+OatFile::Status build_v124_vdex_odex_pairs(
     const std::string& oat_file_name,
     const std::vector<DexInput>& dex_input,
-    const OatVersion,
     InstructionSet isa,
     bool write_elf,
     const std::string& art_image_location,
-    bool samsung_mode) {
+    bool samsung_mode,
+    bool parallel) {
   // Make sure the output is a directory where we will place ODEX and VDEX files
   CHECK(oat_file_name[oat_file_name.size() - 1] == '/');
-  OatFile::Status result = OatFile::Status::BUILD_SUCCESS;
+  std::atomic<OatFile::Status> result{OatFile::Status::BUILD_SUCCESS};
 
-  for (const auto& dex : dex_input) {
+  auto build_pair = [&](size_t i) {
+    const auto& dex = dex_input[i];
     size_t found = dex.filename.find_last_of("/") + 1;
     CHECK(found >= 0);
     auto odex_file_name = dex.filename.substr(found);
@@ -2904,10 +3077,34 @@ OatFile::Status build_oatfile<
 	      dex.filename.c_str(), static_cast<int>(partial_result));
       result = partial_result;
     }
+  };
+  if (parallel) {
+    parallel_for(dex_input.size(), build_pair);
+  } else {
+    for (size_t i = 0; i < dex_input.size(); i++) {
+      build_pair(i);
+    }
   }
   return result;
 }
 
+template <>
+OatFile::Status build_oatfile<
+  DexFileListing_124,
+  OatClasses_124,
+  LookupTables,
+  SamsungLookupTablesNil>(
+    const std::string& oat_file_name,
+    const std::vector<DexInput>& dex_input,
+    const OatVersion,
+    InstructionSet isa,
+    bool write_elf,
+    const std::string& art_image_location,
+    bool samsung_mode) {
+  return build_v124_vdex_odex_pairs(oat_file_name, dex_input, isa, write_elf,
+                                    art_image_location, samsung_mode, false);
+}
+
 OatFile::Status OatFile_064::build(const std::string& oat_file_name,
                                    const std::vector<DexInput>& dex_input,
                                    const OatVersion oat_version,
@@ -2950,12 +3147,17 @@ OatFile::Status OatFile::build(const std::string& oat_file_name,
                                const std::string& arch,
                                bool write_elf,
                                const std::string& art_image_location,
-                               bool samsung_mode) {
+                               bool samsung_mode,
+                               bool mapped_build) {
   auto version = versionInt(oat_version);
   auto isa = instruction_set(arch);
   switch (version) {
     case OatVersion::V_079:
     case OatVersion::V_088:
+      if (mapped_build && !samsung_mode) {
+        return build_oatfile_mapped(oat_file_name, dex_files, version, isa,
+                                    write_elf, art_image_location);
+      }
       return OatFile_079::build(oat_file_name, dex_files, version, isa, write_elf,
                                 art_image_location, samsung_mode);
 
@@ -2965,6 +3167,11 @@ OatFile::Status OatFile::build(const std::string& oat_file_name,
       return OatFile_064::build(oat_file_name, dex_files, version, isa, write_elf,
                                 art_image_location, samsung_mode);
     case OatVersion::V_124:
+      if (mapped_build) {
+        return build_v124_vdex_odex_pairs(oat_file_name, dex_files, isa,
+                                          write_elf, art_image_location,
+                                          samsung_mode, true);
+      }
       return OatFile_124::build(oat_file_name, dex_files, version, isa, write_elf,
                                 art_image_location, samsung_mode);
     default:
@@ -88,13 +88,18 @@ class OatFile {
   // Return the location of the art boot image, or null if there is none.
   virtual std::unique_ptr<std::string> get_art_image_loc() const = 0;
 
+  // If mapped_build, the input dex files are mapped and processed in
+  // parallel, and each part of the output is written at its precomputed
+  // offset. Versions 079, 088 and 124 support it; the others, and samsung
+  // mode before 124, ignore it.
   static Status build(const std::string& oat_file,
                       const std::vector<DexInput>& dex_files,
                       const std::string& oat_version,
                       const std::string& arch,
                       bool write_elf,
                       const std::string& art_image_location,
-                      bool samsung_mode);
+                      bool samsung_mode,
+                      bool mapped_build = false);
 };
 
 enum class InstructionSet {
@@ -12,12 +12,14 @@
 #include "util.h"
 
 #include <getopt.h>
+#include <sys/stat.h>
 
 #ifndef ANDROID
 #include <wordexp.h>
 #endif
 
 #include <cerrno>
+#include <chrono>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
@@ -58,6 +60,12 @@ struct Arguments {
 
   // generate samsung compatible oat file.
   bool samsung_mode = false;
+
+  // map the input dex files and build from them in parallel.
+  bool mapped_build = false;
+
+  // report build throughput on stderr.
+  bool verbose = false;
 };
 
 #ifndef ANDROID
@@ -96,6 +104,8 @@ Arguments parse_args(int argc, char* argv[]) {
                              {"art-image-location", required_argument, nullptr, 0},
                              {"test-is-oatmeal", no_argument, nullptr, 1},
                              {"samsung-oatformat", no_argument, nullptr, 2},
+                             {"mapped-build", no_argument, nullptr, 3},
+                             {"verbose", no_argument, nullptr, 4},
                              {nullptr, 0, nullptr, 0}};
 
   Arguments ret;
@@ -178,6 +188,14 @@ Arguments parse_args(int argc, char* argv[]) {
       ret.samsung_mode = true;
       break;
 
+    case 3:
+      ret.mapped_build = true;
+      break;
+
+    case 4:
+      ret.verbose = true;
+      break;
+
     case ':':
       fprintf(stderr, "ERROR: %s requires an argument\n", argv[optind - 1]);
       exit(1);
@@ -284,8 +302,26 @@ int build(const Arguments& args) {
     return 1;
   }
 
-  OatFile::build(args.oat_file, args.dex_files, args.oat_version, args.arch,
-      args.write_elf, args.art_image_location, args.samsung_mode);
+  auto start = std::chrono::steady_clock::now();
+  auto status = OatFile::build(args.oat_file, args.dex_files, args.oat_version,
+      args.arch, args.write_elf, args.art_image_location, args.samsung_mode,
+      args.mapped_build);
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+
+  if (args.verbose && status == OatFile::Status::BUILD_SUCCESS) {
+    size_t dex_bytes = 0;
+    for (const auto& dex : args.dex_files) {
+      struct stat dex_stat;
+      if (stat(dex.filename.c_str(), &dex_stat) == 0) {
+        dex_bytes += dex_stat.st_size;
+      }
+    }
+    const double dex_mb = dex_bytes / (1024.0 * 1024.0);
+    fprintf(stderr, "Built from %zu dex files (%.1f MB) in %.3f s: %.1f MB/s\n",
+            args.dex_files.size(), dex_mb, elapsed.count(),
+            elapsed.count() > 0 ? dex_mb / elapsed.count() : 0.0);
+  }
 
   return 0;
 }
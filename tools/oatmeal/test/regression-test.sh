@@ -117,6 +117,20 @@ for d in $dex_dirs; do
         diff $actual $expected | head -50
         exit 1
       fi
+      # The mapped build writes the same file with pwrite from mmap'ed
+      # inputs, so it must match the streaming build byte for byte.
+      if [ "$version" == "079" ] || [ "$version" == "088" ]; then
+        mapped_oat=`mktemp`
+        $oatmeal_binary --mapped-build --verbose -v ${version_arg} -a x86 -b -e -o $mapped_oat $dex_files_arg $dex_locations_args > $mapped_oat.output 2> /dev/null
+        if ! cmp $tmp_oat $mapped_oat; then
+          echo "Mapped build differed from streaming build for $d.$version"
+          exit 1
+        fi
+        if [ -s $mapped_oat.output ]; then
+          echo "--verbose wrote to stdout for $d.$version"
+          exit 1
+        fi
+      fi
     else
       echo "Updating expected output for $f"
 
@@ -8,7 +8,10 @@
  */
 
 #include "util.h"
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <unistd.h>
 #include <cerrno>
 #include <cstring>
 
@@ -27,6 +30,50 @@ size_t FileHandle::fread(void* p, size_t size, size_t count) {
   return ::fread(p, size, count, fh_);
 }
 
+size_t BufferFileHandle::fwrite(const void* p, size_t size, size_t count) {
+  auto bytes = static_cast<const char*>(p);
+  buf_.insert(buf_.end(), bytes, bytes + size * count);
+  bytes_written_ += size * count;
+  return count;
+}
+
+MappedFile::MappedFile(const std::string& filename) {
+  auto fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return;
+  }
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) == 0 && file_stat.st_size > 0) {
+    auto ptr = mmap(nullptr, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (ptr != MAP_FAILED) {
+      ptr_ = static_cast<const char*>(ptr);
+      len_ = file_stat.st_size;
+    }
+  }
+  close(fd);
+}
+
+MappedFile::~MappedFile() {
+  if (ptr_ != nullptr) {
+    munmap(const_cast<char*>(ptr_), len_);
+  }
+}
+
+void pwrite_buf(int fd, ConstBuffer buf, size_t offset) {
+  while (buf.len > 0) {
+    auto written = ::pwrite(fd, buf.ptr, buf.len, offset);
+    if (written < 0 && errno == EINTR) {
+      continue;
+    }
+    CHECK(written > 0, "pwrite failed: %s", std::strerror(errno));
+    if (written <= 0) {
+      return;
+    }
+    buf = buf.slice(written);
+    offset += written;
+  }
+}
+
 bool FileHandle::feof() {
   return ::feof(fh_) != 0;
 }
@@ -175,6 +175,44 @@ private:
   FILE* fh_;
 };
 
+// A FileHandle that collects what is written in memory instead, so that a
+// section of a file can be rendered on its own and written out at its offset
+// later. bytes_written() counts from `offset`, as if the section had been
+// written in place.
+class BufferFileHandle : public FileHandle {
+public:
+  explicit BufferFileHandle(size_t offset = 0) : FileHandle(nullptr) {
+    bytes_written_ = offset;
+  }
+  UNCOPYABLE(BufferFileHandle);
+
+  size_t fwrite(const void* p, size_t size, size_t count) override;
+
+  ConstBuffer buffer() const { return ConstBuffer{buf_.data(), buf_.size()}; }
+
+private:
+  std::vector<char> buf_;
+};
+
+// A read-only mapping of a whole file. buffer().ptr is null if the file
+// could not be opened or mapped.
+class MappedFile {
+public:
+  explicit MappedFile(const std::string& filename);
+  UNCOPYABLE(MappedFile);
+  ~MappedFile();
+
+  ConstBuffer buffer() const { return ConstBuffer{ptr_, len_}; }
+
+private:
+  const char* ptr_ = nullptr;
+  size_t len_ = 0;
+};
+
+// Writes all of buf at offset in the file, without moving the file position,
+// so that several threads can write to different parts of the same file.
+void pwrite_buf(int fd, ConstBuffer buf, size_t offset);
+
 void write_word(FileHandle& fh, uint32_t value);
 
 void write_buf(FileHandle& fh, ConstBuffer buf);
@@ -43,6 +43,7 @@
 #include "DexClass.h"
 #include "DexLoader.h"
 #include "DexOutput.h"
+#include "IRCode.h"
 #include "InstructionLowering.h"
 #include "JarLoader.h"
 #include "PassManager.h"
@@ -376,6 +377,8 @@ Json::Value get_stats(const dex_stats_t& stats) {
   val["num_annotations"] = stats.num_annotations;
   val["num_bytes"] = stats.num_bytes;
   val["num_instructions"] = stats.num_instructions;
+  val["max_buffer_bytes"] = Json::UInt64(stats.max_buffer_bytes);
+  val["write_time_us"] = Json::UInt64(stats.write_time_us);
   return val;
 }
 
@@ -401,6 +404,31 @@ Json::Value get_lowering_stats(const instruction_lowering::Stats& stats) {
   return obj;
 }
 
+Json::Value get_pool_stats(const object_pool::Stats& stats) {
+  Json::Value obj(Json::ValueType::objectValue);
+  obj["slab_bytes"] = Json::UInt64(stats.slab_bytes);
+  obj["carved_objects"] = Json::UInt64(stats.carved_blocks);
+  obj["live_objects"] = Json::UInt64(stats.live_objects);
+  obj["object_size"] = Json::UInt64(stats.block_size);
+  obj["malloc_overhead_saved"] = Json::UInt64(stats.malloc_overhead_saved());
+  return obj;
+}
+
+Json::Value get_ir_memory_stats() {
+  auto mie_stats = MethodItemEntry::pool_stats();
+  auto insn_stats = IRInstruction::pool_stats();
+  TRACE(TIME, 1, "IR pools: %lu entries, %lu instructions in %lu bytes, "
+        "saving %lu bytes of malloc overhead\n",
+        mie_stats.carved_blocks, insn_stats.carved_blocks,
+        mie_stats.slab_bytes + insn_stats.slab_bytes,
+        mie_stats.malloc_overhead_saved() +
+            insn_stats.malloc_overhead_saved());
+  Json::Value obj(Json::ValueType::objectValue);
+  obj["method_item_entries"] = get_pool_stats(mie_stats);
+  obj["instructions"] = get_pool_stats(insn_stats);
+  return obj;
+}
+
 Json::Value get_detailed_stats(const std::vector<dex_stats_t>& dexes_stats) {
   Json::Value dexes;
   int i = 0;
@@ -438,6 +466,7 @@ Json::Value get_output_stats(
   d["dexes_stats"] = get_detailed_stats(dexes_stats);
   d["pass_stats"] = get_pass_stats(mgr);
   d["lowering_stats"] = get_lowering_stats(instruction_lowering_stats);
+  d["ir_memory_stats"] = get_ir_memory_stats();
   return d;
 }
 
@@ -543,30 +572,36 @@ int main(int argc, char* argv[]) {
 
     {
       Timer t("Load classes from dexes");
+      // Gather every input dex first, so that the root store and the
+      // DexMetadata stores are all loaded as a single batch. The loaded
+      // classes are then handed back to their stores in input order.
+      std::vector<std::string> dex_paths;
+      std::vector<size_t> dex_store_idx;
       for (const auto& filename : args.dex_files) {
         if (filename.size() >= 5 &&
             filename.compare(filename.size() - 4, 4, ".dex") == 0) {
-          dex_stats_t dex_stats;
-          DexClasses classes =
-              load_classes_from_dex(filename.c_str(), &dex_stats);
-          input_totals += dex_stats;
-          input_dexes_stats.push_back(dex_stats);
-          stores[0].add_classes(std::move(classes));
+          dex_paths.push_back(filename);
+          dex_store_idx.push_back(0);
         } else {
           DexMetadata store_metadata;
           store_metadata.parse(filename);
-          DexStore store(store_metadata);
           for (auto file_path : store_metadata.get_files()) {
-            dex_stats_t dex_stats;
-            DexClasses classes =
-                load_classes_from_dex(file_path.c_str(), &dex_stats);
-            input_totals += dex_stats;
-            input_dexes_stats.push_back(dex_stats);
-            store.add_classes(std::move(classes));
+            dex_paths.push_back(file_path);
+            dex_store_idx.push_back(stores.size());
           }
-          stores.emplace_back(std::move(store));
+          stores.emplace_back(store_metadata);
         }
       }
+      // "ir_cache_dir" keeps the IR of each input dex across runs.
+      auto dexen = load_classes_from_dexes(
+          dex_paths,
+          &input_dexes_stats,
+          /* balloon */ true,
+          args.config.get("ir_cache_dir", "").asString());
+      for (size_t i = 0; i < dexen.size(); ++i) {
+        input_totals += input_dexes_stats[i];
+        stores[dex_store_idx[i]].add_classes(std::move(dexen[i]));
+      }
     }
 
     Scope external_classes;
@@ -631,32 +666,38 @@ int main(int argc, char* argv[]) {
         cfg.metafile(args.config.get("line_number_map_v2", "").asString());
     std::unique_ptr<PositionMapper> pos_mapper(
         PositionMapper::make(pos_output, pos_output_v2));
-    for (auto& store : stores) {
+    {
       Timer t("Writing optimized dexes");
-      for (size_t i = 0; i < store.get_dexen().size(); i++) {
-        std::stringstream ss;
-        ss << args.out_dir << "/" << store.get_name();
-        if (store.get_name().compare("classes") == 0) {
-          // primary/secondary dex store, primary has no numeral and secondaries
-          // start at 2
-          if (i > 0) {
-            ss << (i + 1);
+      std::vector<DexOutputJob> jobs;
+      for (auto& store : stores) {
+        for (size_t i = 0; i < store.get_dexen().size(); i++) {
+          std::stringstream ss;
+          ss << args.out_dir << "/" << store.get_name();
+          if (store.get_name().compare("classes") == 0) {
+            // primary/secondary dex store, primary has no numeral and
+            // secondaries start at 2
+            if (i > 0) {
+              ss << (i + 1);
+            }
+          } else {
+            // other dex stores do not have a primary,
+            // so it makes sense to start at 2
+            ss << (i + 2);
           }
-        } else {
-          // other dex stores do not have a primary,
-          // so it makes sense to start at 2
-          ss << (i + 2);
+          ss << ".dex";
+          jobs.push_back(DexOutputJob{ss.str(), &store.get_dexen()[i], i});
         }
-        ss << ".dex";
-        auto this_dex_stats = write_classes_to_dex(ss.str(),
-                                                   &store.get_dexen()[i],
-                                                   locator_index,
-                                                   i,
-                                                   cfg,
-                                                   args.config,
-                                                   pos_mapper.get());
+      }
+      auto num_threads =
+          std::max(1u, args.config.get("dex_output_threads", 1).asUInt());
+      output_dexes_stats = write_classes_to_dexes(jobs,
+                                                  locator_index,
+                                                  cfg,
+                                                  args.config,
+                                                  pos_mapper.get(),
+                                                  num_threads);
+      for (const auto& this_dex_stats : output_dexes_stats) {
         output_totals += this_dex_stats;
-        output_dexes_stats.push_back(this_dex_stats);
       }
     }
 
@@ -678,6 +719,9 @@ int main(int argc, char* argv[]) {
     {
       Timer t("Freeing global memory");
       delete g_redex;
+      // The IR went with the context, so its pools can go too.
+      MethodItemEntry::pool_clear();
+      IRInstruction::pool_clear();
     }
     TRACE(MAIN, 1, "Done.\n");
   }
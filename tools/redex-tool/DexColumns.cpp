@@ -0,0 +1,245 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "DexColumns.h"
+
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Debug.h"
+
+namespace {
+
+constexpr char k_magic[8] = "DEXCOLS";
+constexpr uint32_t k_version = 1;
+constexpr size_t k_preamble_size = sizeof(k_magic) + 2 * sizeof(uint32_t);
+
+size_t align8(size_t n) { return (n + 7) & ~size_t(7); }
+
+} // namespace
+
+DexColumnsBuilder::Column& DexColumnsBuilder::column(const std::string& name,
+                                                     bool text) {
+  auto it = m_column_index.find(name);
+  if (it != m_column_index.end()) {
+    return m_columns[it->second];
+  }
+  always_assert(name.size() < sizeof(DexColumnHeader::name));
+  m_column_index.emplace(name, m_columns.size());
+  m_columns.push_back(Column{name, text, {}});
+  return m_columns.back();
+}
+
+DexColumnsBuilder::Column& DexColumnsBuilder::column(const char* name,
+                                                     bool text) {
+  auto it = m_literal_index.find(name);
+  if (it != m_literal_index.end()) {
+    return m_columns[it->second];
+  }
+  auto& col = column(std::string(name), text);
+  m_literal_index.emplace(name, &col - m_columns.data());
+  return col;
+}
+
+uint32_t DexColumnsBuilder::intern(const std::string& text) {
+  auto it = m_string_ids.find(text);
+  if (it != m_string_ids.end()) {
+    return it->second;
+  }
+  uint32_t id = m_strings.size();
+  m_string_ids.emplace(text, id);
+  m_strings.push_back(text);
+  return id;
+}
+
+void DexColumnsBuilder::declare(const char* name, bool text) {
+  column(name, text);
+}
+
+void DexColumnsBuilder::add(const char* name, uint32_t value) {
+  column(name, false).values.push_back(value);
+}
+
+void DexColumnsBuilder::add_text(const char* name, const std::string& text) {
+  auto id = intern(text);
+  column(name, true).values.push_back(id);
+}
+
+void DexColumnsBuilder::append(const DexColumnsBuilder& other) {
+  std::vector<uint32_t> remap;
+  remap.reserve(other.m_strings.size());
+  for (const auto& s : other.m_strings) {
+    remap.push_back(intern(s));
+  }
+  for (const auto& src : other.m_columns) {
+    auto& dest = column(src.name, src.text).values;
+    if (src.text) {
+      for (auto id : src.values) {
+        dest.push_back(remap[id]);
+      }
+    } else {
+      dest.insert(dest.end(), src.values.begin(), src.values.end());
+    }
+  }
+}
+
+bool DexColumnsBuilder::write(const std::string& filename) const {
+  std::vector<uint32_t> dict_offsets;
+  std::string dict_bytes;
+  dict_offsets.push_back(0);
+  for (const auto& s : m_strings) {
+    dict_bytes += s;
+    always_assert(dict_bytes.size() <= UINT32_MAX);
+    dict_offsets.push_back(dict_bytes.size());
+  }
+
+  struct Data {
+    std::string name;
+    const void* data;
+    size_t size;
+    uint32_t width;
+  };
+  std::vector<Data> datas;
+  for (const auto& col : m_columns) {
+    datas.push_back(Data{
+        col.name, col.values.data(), col.values.size(), sizeof(uint32_t)});
+  }
+  datas.push_back(Data{"dict.offsets",
+                       dict_offsets.data(),
+                       dict_offsets.size(),
+                       sizeof(uint32_t)});
+  datas.push_back(Data{"dict.bytes", dict_bytes.data(), dict_bytes.size(), 1});
+
+  std::vector<DexColumnHeader> headers(datas.size());
+  size_t offset =
+      align8(k_preamble_size + headers.size() * sizeof(DexColumnHeader));
+  for (size_t i = 0; i < datas.size(); ++i) {
+    auto& header = headers[i];
+    memset(&header, 0, sizeof(header));
+    strncpy(header.name, datas[i].name.c_str(), sizeof(header.name) - 1);
+    header.offset = offset;
+    header.size = datas[i].size;
+    header.width = datas[i].width;
+    offset = align8(offset + header.size * header.width);
+  }
+
+  std::ofstream ofs(filename,
+                    std::ofstream::out | std::ofstream::trunc |
+                        std::ofstream::binary);
+  uint32_t num_columns = headers.size();
+  ofs.write(k_magic, sizeof(k_magic));
+  ofs.write((const char*)&k_version, sizeof(k_version));
+  ofs.write((const char*)&num_columns, sizeof(num_columns));
+  ofs.write((const char*)headers.data(),
+            headers.size() * sizeof(DexColumnHeader));
+  static const char zeros[8] = {};
+  size_t pos = k_preamble_size + headers.size() * sizeof(DexColumnHeader);
+  for (size_t i = 0; i < datas.size(); ++i) {
+    ofs.write(zeros, headers[i].offset - pos);
+    ofs.write((const char*)datas[i].data, headers[i].size * headers[i].width);
+    pos = headers[i].offset + headers[i].size * headers[i].width;
+  }
+  return ofs.good();
+}
+
+std::unique_ptr<DexColumns> DexColumns::open(const std::string& filename) {
+  int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd == -1) {
+    std::cerr << "open failed for file (" << filename
+              << ") with error: " << strerror(errno) << std::endl;
+    return nullptr;
+  }
+  struct stat buf;
+  if (fstat(fd, &buf)) {
+    std::cerr << "Cannot fstat file (" << filename
+              << ") with error: " << strerror(errno) << std::endl;
+    close(fd);
+    return nullptr;
+  }
+  size_t size = buf.st_size;
+  if (size < k_preamble_size) {
+    std::cerr << "Truncated columns file (" << filename << ")\n";
+    close(fd);
+    return nullptr;
+  }
+  void* mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    std::cerr << "mmap failed for file (" << filename
+              << ") with error: " << strerror(errno) << std::endl;
+    return nullptr;
+  }
+  std::unique_ptr<DexColumns> cols(new DexColumns());
+  cols->m_mapping = (uint8_t*)mapping;
+  cols->m_mapping_size = size;
+
+  auto data = cols->m_mapping;
+  uint32_t version;
+  uint32_t num_columns;
+  memcpy(&version, data + sizeof(k_magic), sizeof(version));
+  memcpy(&num_columns, data + sizeof(k_magic) + sizeof(version),
+         sizeof(num_columns));
+  if (memcmp(data, k_magic, sizeof(k_magic)) || version != k_version) {
+    std::cerr << "Not a dex columns file (" << filename << ")\n";
+    return nullptr;
+  }
+  if ((size - k_preamble_size) / sizeof(DexColumnHeader) < num_columns) {
+    std::cerr << "Truncated columns file (" << filename << ")\n";
+    return nullptr;
+  }
+  auto headers = (const DexColumnHeader*)(data + k_preamble_size);
+  for (uint32_t i = 0; i < num_columns; ++i) {
+    const auto& header = headers[i];
+    if ((header.width != 1 && header.width != sizeof(uint32_t)) ||
+        header.offset % header.width != 0 || header.offset > size ||
+        header.size > (size - header.offset) / header.width ||
+        header.name[sizeof(header.name) - 1] != '\0') {
+      std::cerr << "Malformed columns file (" << filename << ")\n";
+      return nullptr;
+    }
+    cols->m_headers.emplace(header.name, &header);
+  }
+  cols->m_dict_offsets = cols->column("dict.offsets");
+  auto bytes = cols->m_headers.find("dict.bytes");
+  if (bytes != cols->m_headers.end()) {
+    cols->m_dict_bytes = (const char*)(data + bytes->second->offset);
+    cols->m_dict_size = bytes->second->size;
+  }
+  return cols;
+}
+
+DexColumns::~DexColumns() { munmap(m_mapping, m_mapping_size); }
+
+DexColumns::Column DexColumns::column(const std::string& name) const {
+  auto it = m_headers.find(name);
+  if (it == m_headers.end() || it->second->width != sizeof(uint32_t)) {
+    return Column();
+  }
+  Column col;
+  col.data = (const uint32_t*)(m_mapping + it->second->offset);
+  col.size = it->second->size;
+  return col;
+}
+
+boost::string_ref DexColumns::text(uint32_t id) const {
+  if ((size_t)id + 1 >= m_dict_offsets.size) {
+    return boost::string_ref();
+  }
+  auto begin = m_dict_offsets[id];
+  auto end = m_dict_offsets[id + 1];
+  if (begin > end || end > m_dict_size) {
+    return boost::string_ref();
+  }
+  return boost::string_ref(m_dict_bytes + begin, end - begin);
+}
@@ -0,0 +1,106 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include <boost/utility/string_ref.hpp>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * A columnar binary form of the tables dex-sql-dump writes, meant to be
+ * mmapped and queried in place rather than imported into a database.
+ *
+ * File layout:
+ *   "DEXCOLS\0" (magic, 8 bytes)
+ *   version (4 bytes)
+ *   num_columns (4 bytes)
+ *   DexColumnHeader[num_columns]
+ *   column data, each column 8-byte aligned
+ *
+ * A column named "<table>.<column>" holds one uint32_t per row, and a row's
+ * id is its index, as with the sql tables. Text columns hold ids into a
+ * string dictionary shared by the whole file: string i is
+ * dict.bytes[dict.offsets[i], dict.offsets[i + 1]).
+ */
+struct DexColumnHeader {
+  char name[48];
+  uint64_t offset;
+  uint64_t size; // in elements
+  uint32_t width; // bytes per element
+  uint32_t padding;
+};
+
+class DexColumnsBuilder {
+ public:
+  /*
+   * Declares a column up front, so that it exists in the output even if no
+   * rows are ever added to it.
+   */
+  void declare(const char* name, bool text);
+
+  void add(const char* name, uint32_t value);
+  void add_text(const char* name, const std::string& text);
+
+  /*
+   * Appends the rows of each of the other builder's columns to the matching
+   * column of this one, translating its text ids into this dictionary.
+   */
+  void append(const DexColumnsBuilder& other);
+
+  bool write(const std::string& filename) const;
+
+ private:
+  struct Column {
+    std::string name;
+    bool text;
+    std::vector<uint32_t> values;
+  };
+
+  Column& column(const std::string& name, bool text);
+  Column& column(const char* name, bool text);
+  uint32_t intern(const std::string& text);
+
+  std::vector<Column> m_columns;
+  std::unordered_map<std::string, size_t> m_column_index;
+  // Callers pass column names as literals, so we can skip building a string
+  // for each row.
+  std::unordered_map<const char*, size_t> m_literal_index;
+  std::vector<std::string> m_strings;
+  std::unordered_map<std::string, uint32_t> m_string_ids;
+};
+
+class DexColumns {
+ public:
+  struct Column {
+    const uint32_t* data{nullptr};
+    size_t size{0};
+    uint32_t operator[](size_t i) const { return data[i]; }
+  };
+
+  static std::unique_ptr<DexColumns> open(const std::string& filename);
+  ~DexColumns();
+
+  // Columns missing from the file read as empty.
+  Column column(const std::string& name) const;
+  boost::string_ref text(uint32_t id) const;
+
+ private:
+  DexColumns() = default;
+
+  uint8_t* m_mapping{nullptr};
+  size_t m_mapping_size{0};
+  std::unordered_map<std::string, const DexColumnHeader*> m_headers;
+  Column m_dict_offsets;
+  const char* m_dict_bytes{nullptr};
+  size_t m_dict_size{0};
+};
@@ -0,0 +1,230 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "DexColumns.h"
+#include "Tool.h"
+#include "WorkQueue.h"
+
+namespace {
+
+constexpr size_t k_chunk_rows = 64 * 1024;
+
+/*
+ * Calls f(begin, end) over the rows of a column in parallel chunks, and
+ * returns the per-chunk results in row order.
+ */
+template <typename T, typename F>
+std::vector<T> scan(size_t rows, F f) {
+  size_t num_chunks = (rows + k_chunk_rows - 1) / k_chunk_rows;
+  std::vector<T> results(num_chunks);
+  auto wq = workqueue_foreach<size_t>([&](size_t chunk) {
+    auto begin = chunk * k_chunk_rows;
+    results[chunk] = f(begin, std::min(rows, begin + k_chunk_rows));
+  });
+  for (size_t i = 0; i < num_chunks; ++i) {
+    wq.add_item(i);
+  }
+  wq.run_all();
+  return results;
+}
+
+/*
+ * Resolves the fully qualified names the sql schema spreads over two tables:
+ * a member's name is its class name without the trailing ';', followed by
+ * its own name, e.g. "Lcom/foo/Bar" + ";.baz:()V".
+ */
+class Names {
+ public:
+  explicit Names(const DexColumns& cols)
+      : m_cols(cols),
+        m_class_names(cols.column("classes.name")),
+        m_method_classes(cols.column("methods.class_id")),
+        m_method_names(cols.column("methods.name")),
+        m_field_classes(cols.column("fields.class_id")),
+        m_field_names(cols.column("fields.name")),
+        m_strings(cols.column("strings.text")) {}
+
+  size_t num_classes() const { return m_class_names.size; }
+  size_t num_methods() const { return m_method_names.size; }
+  size_t num_fields() const { return m_field_names.size; }
+  size_t num_strings() const { return m_strings.size; }
+
+  std::string cls(uint32_t id) const {
+    if (id >= m_class_names.size) {
+      return "<invalid class>";
+    }
+    return m_cols.text(m_class_names[id]).to_string();
+  }
+
+  std::string method(uint32_t id) const {
+    return member(m_method_classes, m_method_names, id);
+  }
+
+  std::string field(uint32_t id) const {
+    return member(m_field_classes, m_field_names, id);
+  }
+
+  std::string string(uint32_t id) const {
+    if (id >= m_strings.size) {
+      return "<invalid string>";
+    }
+    return m_cols.text(m_strings[id]).to_string();
+  }
+
+ private:
+  std::string member(const DexColumns::Column& classes,
+                     const DexColumns::Column& names,
+                     uint32_t id) const {
+    if (id >= classes.size || id >= names.size) {
+      return "<invalid member>";
+    }
+    auto cls_name = cls(classes[id]);
+    if (!cls_name.empty() && cls_name.back() == ';') {
+      cls_name.pop_back();
+    }
+    return cls_name + m_cols.text(names[id]).to_string();
+  }
+
+  const DexColumns& m_cols;
+  DexColumns::Column m_class_names;
+  DexColumns::Column m_method_classes;
+  DexColumns::Column m_method_names;
+  DexColumns::Column m_field_classes;
+  DexColumns::Column m_field_names;
+  DexColumns::Column m_strings;
+};
+
+class DexColumnsQuery : public Tool {
+ public:
+  DexColumnsQuery()
+      : Tool("dex-columns-query",
+             "answer reference queries from a dex-sql-dump --columns file") {}
+
+  void add_options(po::options_description& options) const override {
+    options.add_options()
+      ("input,i",
+       po::value<std::string>()->value_name("dex.cols")->required(),
+       "path to a columnar dump")
+      ("who-references,r",
+       po::value<std::string>()->value_name("Lcom/foo/Bar;")->required(),
+       "class, method, field or string whose referrers to list")
+      ("prefix",
+       po::bool_switch(),
+       "match every class, member or string starting with the argument")
+    ;
+  }
+
+  void run(const po::variables_map& options) override {
+    auto cols = DexColumns::open(options["input"].as<std::string>());
+    if (cols == nullptr) {
+      exit(EXIT_FAILURE);
+    }
+    who_references(*cols,
+                   options["who-references"].as<std::string>(),
+                   options["prefix"].as<bool>());
+  }
+
+ private:
+  void who_references(const DexColumns& cols,
+                      const std::string& target,
+                      bool prefix) const {
+    Names names(cols);
+    auto matches = [&](const std::string& name) {
+      return prefix ? name.compare(0, target.size(), target) == 0
+                    : name == target;
+    };
+    // Marks the ids of an entity table whose full name matches.
+    auto match_ids = [&](size_t rows,
+                         const std::function<std::string(uint32_t)>& name_of) {
+      auto chunks = scan<std::vector<uint32_t>>(
+          rows, [&](size_t begin, size_t end) {
+            std::vector<uint32_t> ids;
+            for (size_t i = begin; i < end; ++i) {
+              if (matches(name_of(i))) {
+                ids.push_back(i);
+              }
+            }
+            return ids;
+          });
+      std::vector<bool> matched(rows);
+      for (const auto& ids : chunks) {
+        for (auto id : ids) {
+          matched[id] = true;
+        }
+      }
+      return matched;
+    };
+    auto cls = [&](uint32_t id) { return names.cls(id); };
+    auto method = [&](uint32_t id) { return names.method(id); };
+    auto field = [&](uint32_t id) { return names.field(id); };
+    auto string = [&](uint32_t id) { return names.string(id); };
+    auto quoted = [&](uint32_t id) { return "\"" + names.string(id) + "\""; };
+    auto classes = match_ids(names.num_classes(), cls);
+    auto methods = match_ids(names.num_methods(), method);
+    auto fields = match_ids(names.num_fields(), field);
+    auto strings = match_ids(names.num_strings(), string);
+
+    struct RefTable {
+      const char* table;
+      const char* ref_column;
+      const std::vector<bool>& matched;
+      std::function<std::string(uint32_t)> name_of;
+    };
+    RefTable tables[] = {
+        {"method_class_refs", "ref_class_id", classes, cls},
+        {"method_method_refs", "ref_method_id", methods, method},
+        {"method_field_refs", "ref_field_id", fields, field},
+        {"method_string_refs", "ref_string_id", strings, quoted},
+    };
+    for (const auto& t : tables) {
+      auto table = std::string(t.table);
+      auto method_ids = cols.column(table + ".method_id");
+      auto refs = cols.column(table + "." + t.ref_column);
+      auto opcodes = cols.column(table + ".opcode");
+      auto rows = std::min({method_ids.size, refs.size, opcodes.size});
+      auto chunks =
+          scan<std::vector<uint32_t>>(rows, [&](size_t begin, size_t end) {
+            std::vector<uint32_t> hits;
+            for (size_t i = begin; i < end; ++i) {
+              if (refs[i] < t.matched.size() && t.matched[refs[i]]) {
+                hits.push_back(i);
+              }
+            }
+            return hits;
+          });
+      for (const auto& hits : chunks) {
+        for (auto row : hits) {
+          std::cout << t.table << "\t"
+                    << names.method(method_ids[row]) << "\t"
+                    << opcodes[row] << "\t" << t.name_of(refs[row])
+                    << "\n";
+        }
+      }
+    }
+
+    auto field_ids = cols.column("field_string_refs.field_id");
+    auto string_refs = cols.column("field_string_refs.ref_string_id");
+    for (size_t i = 0; i < std::min(field_ids.size, string_refs.size); ++i) {
+      if (string_refs[i] < strings.size() && strings[string_refs[i]]) {
+        std::cout << "field_string_refs\t"
+                  << names.field(field_ids[i]) << "\t\t"
+                  << quoted(string_refs[i]) << "\n";
+      }
+    }
+  }
+};
+
+static DexColumnsQuery s_tool;
+
+}
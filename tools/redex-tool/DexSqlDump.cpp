@@ -21,6 +21,12 @@ $ sqlite3 dex.db "SELECT COUNT(*) FROM dex;"   # verify sane-looking value
 $ ./native/redex/tools/redex-tool/DexSqlQuery.py dex.db
 <..enter queries..>
 
+For a large app, passing --columns dex.cols instead of --output skips the sql
+text and the import entirely. The resulting file can be queried in place:
+
+$ buck run  //native/redex:redex-tool -- dex-columns-query \
+      --input dex.cols --who-references 'Lcom/foo/Bar;' --prefix
+
 */
 
 #include <boost/algorithm/string/replace.hpp>
@@ -30,12 +36,14 @@ $ ./native/redex/tools/redex-tool/DexSqlQuery.py dex.db
 
 #include "ClassHierarchy.h"
 #include "ControlFlow.h"
+#include "DexColumns.h"
 #include "DexOutput.h"
 #include "IRCode.h"
 #include "Resolver.h"
 #include "Show.h"
 #include "Tool.h"
 #include "Walkers.h"
+#include "WorkQueue.h"
 
 namespace {
 
@@ -59,75 +67,69 @@ void dump_field_refs(FILE* fdout, const char* prefix, DexField* field, int field
     string_id);
 }
 
-void dump_method_refs(FILE* fdout, const char* prefix, DexMethod* method, int method_id) {
+enum class RefKind { STRING, CLASS, FIELD, METHOD };
+
+/*
+ * Calls f(kind, ref_id, opcode) for every reference from the method's code to
+ * a string, class, field or method that is part of the dump.
+ */
+template <typename F>
+void for_each_method_ref(DexMethod* method, F f) {
   auto code = method->get_code();
   if (!code) return;
 
-  static int next_string_ref = 0;
-  static int next_class_ref = 0;
-  static int next_field_ref = 0;
-  static int next_method_ref = 0;
-
   for (auto& mie : InstructionIterable(code)) {
     auto insn = mie.insn;
     if (insn->has_string()) {
-      if (string_ids.count(insn->get_string())) {
-        auto string_id = string_ids[insn->get_string()];
-        fprintf(
-          fdout,
-          "INSERT INTO %smethod_string_refs VALUES (%d, %d, %d, %d);\n",
-          prefix,
-          next_string_ref++,
-          method_id,
-          string_id,
-          insn->opcode());
+      auto it = string_ids.find(insn->get_string());
+      if (it != string_ids.end()) {
+        f(RefKind::STRING, it->second, insn->opcode());
       }
     }
     if (insn->has_type()) {
       auto cls = type_class(insn->get_type());
-      if (cls && class_ids.count(cls)) {
-        auto class_id = class_ids[cls];
-        fprintf(
-          fdout,
-          "INSERT INTO %smethod_class_refs VALUES (%d, %d, %d, %d);\n",
-          prefix,
-          next_class_ref++,
-          method_id,
-          class_id,
-          insn->opcode());
+      auto it = class_ids.find(cls);
+      if (cls && it != class_ids.end()) {
+        f(RefKind::CLASS, it->second, insn->opcode());
       }
     }
     if (insn->has_field()) {
       auto field = resolve_field(insn->get_field());
-      if (field != nullptr && field_ids.count(field)) {
-        auto field_id = field_ids[field];
-        fprintf(
-          fdout,
-          "INSERT INTO %smethod_field_refs VALUES (%d, %d, %d, %d);\n",
-          prefix,
-          next_field_ref++,
-          method_id,
-          field_id,
-          insn->opcode());
+      auto it = field_ids.find(field);
+      if (field != nullptr && it != field_ids.end()) {
+        f(RefKind::FIELD, it->second, insn->opcode());
       }
     }
     if (insn->has_method()) {
       auto meth = resolve_method(insn->get_method(), opcode_to_search(insn));
-      if (meth != nullptr && method_ids.count(meth)) {
-        auto method_ref_id = method_ids[meth];
-        fprintf(
-          fdout,
-          "INSERT INTO %smethod_method_refs VALUES (%d, %d, %d, %d);\n",
-          prefix,
-          next_method_ref++,
-          method_id,
-          method_ref_id,
-          insn->opcode());
+      auto it = method_ids.find(meth);
+      if (meth != nullptr && it != method_ids.end()) {
+        f(RefKind::METHOD, it->second, insn->opcode());
       }
     }
   }
 }
 
+void dump_method_refs(FILE* fdout, const char* prefix, DexMethod* method, int method_id) {
+  static int next_ref[4] = {0, 0, 0, 0};
+  static const char* tables[4] = {"method_string_refs",
+                                  "method_class_refs",
+                                  "method_field_refs",
+                                  "method_method_refs"};
+  for_each_method_ref(method, [&](RefKind kind, int ref_id, int opcode) {
+    auto k = static_cast<int>(kind);
+    fprintf(
+      fdout,
+      "INSERT INTO %s%s VALUES (%d, %d, %d, %d);\n",
+      prefix,
+      tables[k],
+      next_ref[k]++,
+      method_id,
+      ref_id,
+      opcode);
+  });
+}
+
 void dump_class(FILE* fdout, const char* prefix, const char* dex_id, DexClass* cls, int class_id) {
   // TODO: annotations?
   // TODO: inheritance?
@@ -375,6 +377,232 @@ CREATE TABLE %1$smethod_string_refs (
   fprintf(fdout, "END TRANSACTION;\n");
 }
 
+// The part of a member's deobfuscated name after its class, as in the sql
+// dump, e.g. ";.foo:()V".
+std::string member_name(const std::string& deobfuscated_name) {
+  auto pos = deobfuscated_name.find(';');
+  return pos == std::string::npos ? deobfuscated_name
+                                  : deobfuscated_name.substr(pos);
+}
+
+/*
+ * Builds the rows one dex contributes to every table but is_a. Only reads the
+ * id maps, so dexes can be dumped in parallel once those are populated.
+ */
+void dump_dex_columns(const std::string& dex_id,
+                      const DexClasses& dex,
+                      const std::vector<DexString*>& strings,
+                      DexColumnsBuilder& out) {
+  for (auto dexstr : strings) {
+    out.add_text("strings.text", dexstr->c_str());
+  }
+  auto add_field = [&](int class_id, DexField* field) {
+    out.add("fields.class_id", class_id);
+    out.add_text("fields.name", member_name(field->get_deobfuscated_name()));
+    out.add_text("fields.obfuscated_name", field->get_name()->c_str());
+    out.add("fields.access", field->get_access());
+  };
+  auto add_method = [&](int class_id, DexMethod* method) {
+    out.add("methods.class_id", class_id);
+    out.add_text("methods.name", member_name(method->get_deobfuscated_name()));
+    out.add_text("methods.obfuscated_name", method->get_name()->c_str());
+    out.add("methods.access", method->get_access());
+    out.add("methods.code_size",
+            method->get_code() ? method->get_code()->sum_opcode_sizes() : 0);
+  };
+  for (const auto& cls : dex) {
+    auto class_id = class_ids.at(cls);
+    out.add_text("classes.dex", dex_id);
+    out.add_text("classes.name", cls->get_deobfuscated_name());
+    out.add_text("classes.obfuscated_name", cls->get_name()->c_str());
+    out.add("classes.access", cls->get_access());
+    for (auto field : cls->get_ifields()) {
+      add_field(class_id, field);
+    }
+    for (auto field : cls->get_sfields()) {
+      add_field(class_id, field);
+    }
+    for (auto meth : cls->get_dmethods()) {
+      add_method(class_id, meth);
+    }
+    for (auto meth : cls->get_vmethods()) {
+      add_method(class_id, meth);
+    }
+  }
+
+  static const char* ref_columns[4][3] = {
+      {"method_string_refs.method_id",
+       "method_string_refs.ref_string_id",
+       "method_string_refs.opcode"},
+      {"method_class_refs.method_id",
+       "method_class_refs.ref_class_id",
+       "method_class_refs.opcode"},
+      {"method_field_refs.method_id",
+       "method_field_refs.ref_field_id",
+       "method_field_refs.opcode"},
+      {"method_method_refs.method_id",
+       "method_method_refs.ref_method_id",
+       "method_method_refs.opcode"}};
+  auto add_method_refs = [&](DexMethod* meth) {
+    auto method_id = method_ids.at(meth);
+    for_each_method_ref(meth, [&](RefKind kind, int ref_id, int opcode) {
+      auto columns = ref_columns[static_cast<int>(kind)];
+      out.add(columns[0], method_id);
+      out.add(columns[1], ref_id);
+      out.add(columns[2], opcode);
+    });
+  };
+  auto add_field_refs = [&](DexField* field) {
+    auto static_value = field->get_static_value();
+    if (!static_value || static_value->evtype() != DEVT_STRING) return;
+    auto str = static_cast<DexEncodedValueString*>(static_value)->string();
+    auto it = string_ids.find(str);
+    if (it == string_ids.end()) return;
+    out.add("field_string_refs.field_id", field_ids.at(field));
+    out.add("field_string_refs.ref_string_id", it->second);
+  };
+  for (const auto& cls : dex) {
+    for (auto meth : cls->get_dmethods()) {
+      add_method_refs(meth);
+    }
+    for (auto meth : cls->get_vmethods()) {
+      add_method_refs(meth);
+    }
+    for (auto field : cls->get_sfields()) {
+      add_field_refs(field);
+    }
+    for (auto field : cls->get_ifields()) {
+      add_field_refs(field);
+    }
+  }
+}
+
+/*
+ * Writes the same tables as dump_sql, with the same ids, as a DexColumns
+ * file. Ids are handed out serially, then each dex's rows are built in
+ * parallel and concatenated in dex order.
+ */
+void dump_columns(const std::string& filename,
+                  DexStoresVector& stores,
+                  ProguardMap& pg_map) {
+  struct Dex {
+    std::string id;
+    DexClasses* classes;
+    std::vector<DexString*> strings;
+    DexColumnsBuilder columns;
+  };
+  std::vector<Dex> dexes;
+  for (auto& store : stores) {
+    auto& dexen = store.get_dexen();
+    apply_deobfuscated_names(dexen, pg_map);
+    for (size_t dex_idx = 0 ; dex_idx < dexen.size() ; ++dex_idx) {
+      dexes.emplace_back();
+      dexes.back().id = store.get_name() + "/" + std::to_string(dex_idx);
+      dexes.back().classes = &dexen[dex_idx];
+    }
+  }
+
+  auto for_each_dex = [&](const std::function<void(size_t)>& f) {
+    auto wq = workqueue_foreach<size_t>(f);
+    for (size_t i = 0; i < dexes.size(); ++i) {
+      wq.add_item(i);
+    }
+    wq.run_all();
+  };
+  for_each_dex([&](size_t i) {
+    GatheredTypes gtypes(dexes[i].classes);
+    dexes[i].strings = gtypes.get_cls_order_dexstring_emitlist();
+  });
+
+  int next_class_id = 0;
+  int next_method_id = 0;
+  int next_field_id = 0;
+  int next_string_id = 0;
+  for (const auto& dex : dexes) {
+    for (auto dexstr : dex.strings) {
+      string_ids[dexstr] = next_string_id++;
+    }
+    for (const auto& cls : *dex.classes) {
+      class_ids[cls] = next_class_id++;
+      for (auto field : cls->get_ifields()) {
+        field_ids[field] = next_field_id++;
+      }
+      for (auto field : cls->get_sfields()) {
+        field_ids[field] = next_field_id++;
+      }
+      for (auto meth : cls->get_dmethods()) {
+        method_ids[meth] = next_method_id++;
+      }
+      for (auto meth : cls->get_vmethods()) {
+        method_ids[meth] = next_method_id++;
+      }
+    }
+  }
+
+  for_each_dex([&](size_t i) {
+    dump_dex_columns(
+        dexes[i].id, *dexes[i].classes, dexes[i].strings, dexes[i].columns);
+  });
+
+  DexColumnsBuilder columns;
+  for (auto text : {"classes.dex",
+                    "classes.name",
+                    "classes.obfuscated_name",
+                    "methods.name",
+                    "methods.obfuscated_name",
+                    "fields.name",
+                    "fields.obfuscated_name",
+                    "strings.text"}) {
+    columns.declare(text, true);
+  }
+  for (auto value : {"classes.access",
+                     "methods.class_id",
+                     "methods.access",
+                     "methods.code_size",
+                     "fields.class_id",
+                     "fields.access",
+                     "is_a.class_id",
+                     "is_a.is_a_class_id",
+                     "field_string_refs.field_id",
+                     "field_string_refs.ref_string_id",
+                     "method_class_refs.method_id",
+                     "method_class_refs.ref_class_id",
+                     "method_class_refs.opcode",
+                     "method_method_refs.method_id",
+                     "method_method_refs.ref_method_id",
+                     "method_method_refs.opcode",
+                     "method_field_refs.method_id",
+                     "method_field_refs.ref_field_id",
+                     "method_field_refs.opcode",
+                     "method_string_refs.method_id",
+                     "method_string_refs.ref_string_id",
+                     "method_string_refs.opcode"}) {
+    columns.declare(value, false);
+  }
+  for (const auto& dex : dexes) {
+    columns.append(dex.columns);
+  }
+
+  auto scope = build_class_scope(stores);
+  ClassHierarchy ch = build_type_hierarchy(scope);
+  for (auto& cls : scope) {
+    TypeSet results;
+    get_all_children_or_implementors(ch, scope, cls, results);
+    for (auto type : results) {
+      auto type_cls = type_class(type);
+      if (type_cls) {
+        columns.add("is_a.class_id", class_ids[type_cls]);
+        columns.add("is_a.is_a_class_id", class_ids[cls]);
+      }
+    }
+  }
+
+  if (!columns.write(filename)) {
+    fprintf(stderr, "Could not write %s; terminating\n", filename.c_str());
+    exit(EXIT_FAILURE);
+  }
+}
+
 class DexSqlDump : public Tool {
  public:
   DexSqlDump() : Tool("dex-sql-dump", "dump an apk to a sql insertion script") {}
@@ -388,6 +616,9 @@ class DexSqlDump : public Tool {
       ("output,o",
        po::value<std::string>()->value_name("dex.sql"),
        "path to output sql dump file (defaults to stdout)")
+      ("columns,c",
+       po::value<std::string>()->value_name("dex.cols"),
+       "write a columnar binary dump to this path instead of sql")
       ("table-prefix,t",
        po::value<std::string>()->value_name("pre_"),
        "prefix to use on all table names")
@@ -401,6 +632,10 @@ class DexSqlDump : public Tool {
       options["dexendir"].as<std::string>());
     ProguardMap pgmap(options.count("proguard-map") ?
       options["proguard-map"].as<std::string>() : "/dev/null");
+    if (options.count("columns")) {
+      dump_columns(options["columns"].as<std::string>(), stores, pgmap);
+      return;
+    }
     const std::string& filename = options["output"].as<std::string>();
     FILE* fdout = options.count("output") ?
       fopen(filename.c_str(), "w") : stdout;
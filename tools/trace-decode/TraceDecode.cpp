@@ -0,0 +1,199 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+/*
+ * Renders the file written by redex with TRACE_BINARY=<file> as the text the
+ * ordinary TRACE backend would have printed, in timestamp order.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "BinaryTrace.h"
+
+namespace {
+
+struct Event {
+  uint64_t time;
+  uint32_t thread;
+  uint8_t module;
+  uint8_t level;
+  uint64_t format;
+  // The encoded arguments, in the file's buffer.
+  const char* args;
+  size_t args_size;
+};
+
+struct Trace {
+  std::vector<char> data;
+  std::vector<std::string> modules;
+  std::unordered_map<uint64_t, std::string> formats;
+  std::vector<Event> events;
+};
+
+[[noreturn]] void fail(const char* msg) {
+  fprintf(stderr, "trace-decode: %s\n", msg);
+  exit(1);
+}
+
+template <class T>
+T read(const char*& p, const char* end) {
+  if (static_cast<size_t>(end - p) < sizeof(T)) {
+    fail("truncated trace");
+  }
+  T v;
+  memcpy(&v, p, sizeof(T));
+  p += sizeof(T);
+  return v;
+}
+
+void read_records(Trace& trace,
+                  uint32_t thread,
+                  const char* p,
+                  const char* end) {
+  using namespace binary_trace;
+  while (p < end) {
+    auto record = p;
+    auto size = read<uint32_t>(p, end);
+    auto kind = read<uint8_t>(p, end);
+    if (size < kRecordHeaderSize ||
+        size > static_cast<size_t>(end - record)) {
+      fail("bad record size");
+    }
+    auto record_end = record + size;
+    if (kind == kFormatRecord) {
+      auto id = read<uint64_t>(p, record_end);
+      trace.formats[id] = std::string(p, record_end);
+    } else if (kind == kEventRecord) {
+      Event event;
+      event.thread = thread;
+      event.module = read<uint8_t>(p, record_end);
+      event.level = read<uint8_t>(p, record_end);
+      read<uint8_t>(p, record_end);
+      event.time = read<uint64_t>(p, record_end);
+      event.format = read<uint64_t>(p, record_end);
+      event.args = p;
+      event.args_size = record_end - p;
+      trace.events.push_back(event);
+    } else {
+      fail("unknown record kind");
+    }
+    p = record_end;
+  }
+}
+
+void load(Trace& trace, const char* path) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in) {
+    fail("cannot open the trace");
+  }
+  trace.data.assign(std::istreambuf_iterator<char>(in),
+                    std::istreambuf_iterator<char>());
+  const char* p = trace.data.data();
+  const char* end = p + trace.data.size();
+  if (trace.data.size() < sizeof(binary_trace::kMagic) ||
+      memcmp(p, binary_trace::kMagic, sizeof(binary_trace::kMagic)) != 0) {
+    fail("not a binary trace");
+  }
+  p += sizeof(binary_trace::kMagic);
+  if (read<uint32_t>(p, end) != binary_trace::kBinaryTraceVersion) {
+    fail("unsupported trace version");
+  }
+  auto num_modules = read<uint32_t>(p, end);
+  for (uint32_t i = 0; i < num_modules; ++i) {
+    auto len = read<uint32_t>(p, end);
+    if (len > static_cast<size_t>(end - p)) {
+      fail("truncated trace");
+    }
+    trace.modules.emplace_back(p, len);
+    p += len;
+  }
+  while (p < end) {
+    auto thread = read<uint32_t>(p, end);
+    auto len = read<uint32_t>(p, end);
+    if (len > static_cast<size_t>(end - p)) {
+      // The process died mid-write; keep what we have.
+      break;
+    }
+    read_records(trace, thread, p, p + len);
+    p += len;
+  }
+  // Each thread's events are in order, but the chunks of different threads
+  // interleave.
+  std::stable_sort(trace.events.begin(),
+                   trace.events.end(),
+                   [](const Event& a, const Event& b) { return a.time < b.time; });
+}
+
+void usage() {
+  fprintf(stderr,
+          "Usage: trace-decode [--show-time] [--show-module] [--show-thread] "
+          "TRACE_FILE\n");
+  exit(1);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  bool show_time = false;
+  bool show_module = false;
+  bool show_thread = false;
+  const char* path = nullptr;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--show-time") == 0) {
+      show_time = true;
+    } else if (strcmp(argv[i], "--show-module") == 0) {
+      show_module = true;
+    } else if (strcmp(argv[i], "--show-thread") == 0) {
+      show_thread = true;
+    } else if (argv[i][0] == '-' || path != nullptr) {
+      usage();
+    } else {
+      path = argv[i];
+    }
+  }
+  if (path == nullptr) {
+    usage();
+  }
+
+  Trace trace;
+  load(trace, path);
+  for (const auto& event : trace.events) {
+    auto it = trace.formats.find(event.format);
+    if (it == trace.formats.end()) {
+      fail("event refers to an unknown format");
+    }
+    if (show_time) {
+      printf("[%12.6f] ", event.time / 1e9);
+    }
+    if (show_thread) {
+      printf("[t%u] ", event.thread);
+    }
+    if (show_module) {
+      auto module = event.module < trace.modules.size()
+                        ? trace.modules[event.module].c_str()
+                        : "?";
+      printf("[%s:%d] ", module, event.level);
+    }
+    std::string text;
+    if (!binary_trace::render(
+            it->second, event.args, event.args_size, &text)) {
+      fail("arguments do not match their format");
+    }
+    fwrite(text.data(), text.size(), 1, stdout);
+  }
+}
@@ -30,6 +30,8 @@
 #include <dlfcn.h>
 #endif
 
+#include <atomic>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
@@ -160,10 +162,23 @@ class MallocDebug {
 
 thread_local MallocDebug malloc_debug;
 
+// Read by the PassManager's profiler through redex_malloc_stats().
+std::atomic<uint64_t> s_malloc_count{0};
+std::atomic<uint64_t> s_malloc_bytes{0};
+
 }
 
 extern "C" {
 
-void* malloc(size_t sz) { return malloc_debug.malloc(sz); }
+void* malloc(size_t sz) {
+  s_malloc_count.fetch_add(1, std::memory_order_relaxed);
+  s_malloc_bytes.fetch_add(sz, std::memory_order_relaxed);
+  return malloc_debug.malloc(sz);
+}
+
+void redex_malloc_stats(uint64_t* count, uint64_t* bytes) {
+  *count = s_malloc_count.load(std::memory_order_relaxed);
+  *bytes = s_malloc_bytes.load(std::memory_order_relaxed);
+}
 
 }